@@ -0,0 +1,314 @@
+/*
+License: GPL-2
+  An electronic filing cabinet: scan, print, stack, arrange
+ Copyright (C) 2009 Simon Glass, chch-kiwi@users.sourceforge.net
+ .
+ This program is free software; you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation; either version 2 of the License, or
+ (at your option) any later version.
+ .
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+ .
+ You should have received a copy of the GNU General Public License
+ along with this program; if not, write to the Free Software
+ Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301 USA
+
+X-Comment: On Debian GNU/Linux systems, the complete text of the GNU General
+ Public License can be found in the /usr/share/common-licenses/GPL file.
+*/
+
+
+#include <stdio.h>
+
+#include <QCryptographicHash>
+#include <QDir>
+#include <QDirIterator>
+#include <QElapsedTimer>
+#include <QFileInfo>
+#include <QMap>
+#include <QtConcurrent>
+
+#include "batch.h"
+#include "err.h"
+#include "op.h"
+#include "thumbcache.h"
+
+
+Batch::Batch (e_op op, int jobs, bool force)
+   {
+   _op = op;
+   _force = force;
+   _done = _skipped = _errors = 0;
+   if (jobs > 0)
+      _pool.setMaxThreadCount (jobs);
+   }
+
+
+Batch::~Batch ()
+   {
+   _pool.waitForDone ();
+   }
+
+
+QString Batch::opName (void) const
+   {
+   switch (_op)
+      {
+      case Op_pdf :
+         return "pdf";
+      case Op_max :
+         return "max";
+      case Op_jpeg :
+         return "jpeg";
+      case Op_info :
+         return "info";
+      case Op_sum :
+         return "sum";
+      case Op_compact :
+         return "compact";
+      case Op_thumbs :
+         return "thumbs";
+      }
+   return QString ();
+   }
+
+
+bool Batch::addPath (const QString &path)
+   {
+   QFileInfo fi (path);
+   job_info job;
+
+   if (fi.isDir ())
+      {
+      QDirIterator it (fi.absoluteFilePath (), QDir::Dirs | QDir::NoDotAndDotDot,
+            QDirIterator::Subdirectories);
+
+      addDir (fi.absoluteFilePath () + "/");
+      while (it.hasNext ())
+         addDir (it.next () + "/");
+      return true;
+      }
+   if (!fi.exists ())
+      return false;
+   job.dir = fi.absolutePath () + "/";
+   job.fnames << fi.fileName ();
+   _jobs << job;
+   return true;
+   }
+
+
+void Batch::addDir (const QString &dir)
+   {
+   QMap<QString, int> bybase;
+   QString base, ext;
+   job_info job;
+   int pagenum;
+
+   job.dir = dir;
+   foreach (const QString &fname, QDir (dir).entryList (QDir::Files,
+         QDir::Name))
+      {
+      File::e_type type = File::typeFromName (fname);
+
+      if (type == File::Type_other)
+         continue;
+
+      // JPEG pages are in separate files, so add them to their first page
+      if (type == File::Type_jpeg
+          && File::decodePageNumber (fname, base, pagenum, ext))
+         {
+         if (bybase.contains (base))
+            {
+            _jobs [bybase [base]].fnames << fname;
+            continue;
+            }
+         bybase.insert (base, _jobs.size ());
+         }
+      job.fnames.clear ();
+      job.fnames << fname;
+      _jobs << job;
+      }
+   }
+
+
+int Batch::run (void)
+   {
+   QElapsedTimer timer;
+
+   timer.start ();
+   foreach (const job_info &job, _jobs)
+      QtConcurrent::run (&_pool, this, &Batch::process, job);
+   _pool.waitForDone ();
+   if (_op == Op_thumbs)
+      Thumbcache::instance ()->save ();
+
+   fprintf (stderr, "%s: %d stacks: %d ok, %d skipped, %d failed, %lld ms\n",
+            qPrintable (opName ()), _jobs.size (), _done, _skipped, _errors,
+            timer.elapsed ());
+   return _errors;
+   }
+
+
+void Batch::process (const job_info &job)
+   {
+   QString base, ext, detail, path = job.dir + job.fnames.first ();
+   QElapsedTimer timer;
+   bool skipped = false;
+   const char *status;
+   err_info *err;
+   int pagenum, pages = 0, i;
+   File *f;
+
+   timer.start ();
+
+   // use our own File object, which is not attached to any desk
+   f = File::createFile (job.dir, job.fnames.first (), 0,
+         File::typeFromName (job.fnames.first ()));
+   err = f->load ();
+   if (!err)
+      {
+      for (i = 1; i < job.fnames.size (); i++)
+         if (File::decodePageNumber (job.fnames [i], base, pagenum, ext))
+            f->claimFileAsNewPage (job.fnames [i], base, pagenum);
+      pages = f->pagecount ();
+      err = operate (f, detail, skipped);
+      }
+   delete f;
+
+   if (err)
+      detail = err->errstr;
+   status = err ? "error" : skipped ? "skip" : "ok";
+
+   // keep the output machine-readable even if the message is not
+   detail.replace ('\t', ' ').replace ('\n', ' ');
+
+   _mutex.lock ();
+   printf ("%s\t%s\t%lld\t%d\t%s\t%s\n", qPrintable (opName ()), status,
+           timer.elapsed (), pages, qPrintable (path), qPrintable (detail));
+   fflush (stdout);
+   if (err)
+      _errors++;
+   else if (skipped)
+      _skipped++;
+   else
+      _done++;
+   _mutex.unlock ();
+   }
+
+
+err_info *Batch::operate (File *f, QString &detail, bool &skipped)
+   {
+   switch (_op)
+      {
+      case Op_pdf :
+         return convert (f, File::Type_pdf, detail, skipped);
+
+      case Op_max :
+         return convert (f, File::Type_max, detail, skipped);
+
+      case Op_jpeg :
+         return convert (f, File::Type_jpeg, detail, skipped);
+
+      case Op_info :
+         detail = QString ("type=%1 bytes=%2").arg (f->typeName ())
+               .arg (QFileInfo (f->pathname ()).size ());
+         return NULL;
+
+      case Op_sum :
+         return checksum (f, detail);
+
+      case Op_compact :
+         // only .max files have space to recover
+         if (f->type () != File::Type_max)
+            {
+            skipped = true;
+            return NULL;
+            }
+         return f->compact ();
+
+      case Op_thumbs :
+         return thumbnail (f, skipped);
+      }
+   return NULL;
+   }
+
+
+err_info *Batch::convert (File *f, File::e_type type, QString &detail,
+      bool &skipped)
+   {
+   QFileInfo fi (f->pathname ());
+   QString fname = fi.completeBaseName () + File::typeExt (type);
+   QString dir = fi.path () + "/";
+   File *fnew;
+   err_info *err;
+
+   detail = dir + fname;
+   if (f->type () == type || (QFile::exists (detail) && !_force))
+      {
+      skipped = true;
+      return NULL;
+      }
+
+   // nothing is watching our progress, but copyTo() needs an operation
+   Operation op ("Converting", f->pagecount (), 0);
+
+   QFile::remove (detail);
+   fnew = File::createFile (dir, fname, 0, type);
+   if (!fnew)
+      return File::not_impl ();
+   err = fnew->create ();
+   if (!err)
+      err = f->copyTo (fnew, 3, op);
+   if (!err)
+      err = fnew->flush ();
+
+   // don't leave a partial file around
+   if (err || !fnew->pagecount ())
+      fnew->remove ();
+   delete fnew;
+   return err;
+   }
+
+
+err_info *Batch::checksum (File *f, QString &detail)
+   {
+   QCryptographicHash hash (QCryptographicHash::Md5);
+   QSize size, trueSize;
+   QImage image;
+   int pagenum, bpp, y;
+
+   for (pagenum = 0; pagenum < f->pagecount (); pagenum++)
+      {
+      CALL (f->getImage (pagenum, false, image, size, trueSize, bpp, false));
+
+      // hash each line separately, to skip any padding at the end
+      for (y = 0; y < image.height (); y++)
+         hash.addData ((const char *)image.constScanLine (y),
+               (image.width () * image.depth () + 7) / 8);
+      }
+   detail = hash.result ().toHex ();
+   return NULL;
+   }
+
+
+err_info *Batch::thumbnail (File *f, bool &skipped)
+   {
+   Thumbcache *cache = Thumbcache::instance ();
+   QString path = QFileInfo (f->pathname ()).path () + "/"
+         + f->pageFilename (0);
+   QImage image;
+
+   // the desktop shows the first page of a new stack
+   if (cache->find (path, 0, image))
+      {
+      skipped = true;
+      return NULL;
+      }
+   CALL (f->getPreviewImage (0, image, false));
+   cache->insert (path, 0, image);
+   return NULL;
+   }
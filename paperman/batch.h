@@ -0,0 +1,157 @@
+/*
+License: GPL-2
+  An electronic filing cabinet: scan, print, stack, arrange
+ Copyright (C) 2009 Simon Glass, chch-kiwi@users.sourceforge.net
+ .
+ This program is free software; you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation; either version 2 of the License, or
+ (at your option) any later version.
+ .
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+ .
+ You should have received a copy of the GNU General Public License
+ along with this program; if not, write to the Free Software
+ Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301 USA
+
+X-Comment: On Debian GNU/Linux systems, the complete text of the GNU General
+ Public License can be found in the /usr/share/common-licenses/GPL file.
+*/
+/*
+   Project:    Maxview
+   File:       batch.h
+
+   This file implements the headless batch mode, used from the command line
+   to convert, check or pre-process a large number of stacks without
+   starting the GUI.
+
+   Each argument is a stack or a directory tree of stacks. The stacks are
+   processed in parallel on a thread pool, each with its own File object.
+   For each stack a single tab-separated line is written to stdout:
+
+      <operation> <status> <ms> <pages> <path> <detail>
+
+   where status is 'ok', 'skip' or 'error' and detail depends on the
+   operation (it holds the message for an error). A summary goes to stderr.
+*/
+
+#ifndef __batch_h
+#define __batch_h
+
+
+#include <QMutex>
+#include <QString>
+#include <QStringList>
+#include <QThreadPool>
+
+#include "file.h"
+
+
+struct err_info;
+
+
+class Batch
+   {
+public:
+   //! the operation to perform on each stack
+   enum e_op
+      {
+      Op_pdf,        //!< convert to .pdf
+      Op_max,        //!< convert to .max
+      Op_jpeg,       //!< convert to .jpg
+      Op_info,       //!< show the type and number of pages
+      Op_sum,        //!< show a checksum of the page images
+      Op_compact,    //!< compact .max files
+      Op_thumbs      //!< write previews to the thumbnail cache
+      };
+
+   /** set up a new batch
+
+      \param op        operation to perform
+      \param jobs      number of stacks to process at once, 0 for one per CPU
+      \param force     true to overwrite existing files when converting */
+   Batch (e_op op, int jobs, bool force);
+   ~Batch ();
+
+   /** add a stack, or all the stacks in a directory tree
+
+      \param path      path to a file or directory
+      \returns true if ok, false if it does not exist */
+   bool addPath (const QString &path);
+
+   /** process all the stacks that have been added
+
+      \returns number of stacks which failed */
+   int run (void);
+
+private:
+   //! a stack to process
+   struct job_info
+      {
+      QString dir;         //!< directory (with trailing /)
+      QStringList fnames;  //!< files making up the stack (first is the stack)
+      };
+
+   /** add the stacks in a single directory, grouping JPEG pages which are
+       in separate files into a single stack
+
+      \param dir       directory (with trailing /) */
+   void addDir (const QString &dir);
+
+   /** process a single stack. This runs on the thread pool
+
+      \param job       stack to process */
+   void process (const job_info &job);
+
+   /** perform our operation on a loaded stack
+
+      \param f         stack
+      \param detail    returns detail to show
+      \param skipped   returns true if nothing needed doing
+      \returns error, or NULL if ok */
+   err_info *operate (File *f, QString &detail, bool &skipped);
+
+   /** convert a stack to another type, in the same directory
+
+      \param f         stack
+      \param type      type to convert to
+      \param detail    returns new filename
+      \param skipped   returns true if the file is already of this type or the
+                       new file exists (and we are not forcing)
+      \returns error, or NULL if ok */
+   err_info *convert (File *f, File::e_type type, QString &detail,
+         bool &skipped);
+
+   /** work out an MD5 checksum of the image data in all pages
+
+      \param f         stack
+      \param detail    returns checksum in hex
+      \returns error, or NULL if ok */
+   err_info *checksum (File *f, QString &detail);
+
+   /** write the preview of the first page to the thumbnail cache
+
+      \param f         stack
+      \param skipped   returns true if it was already there
+      \returns error, or NULL if ok */
+   err_info *thumbnail (File *f, bool &skipped);
+
+   //! \returns the name of our operation, as shown in the output
+   QString opName (void) const;
+
+private:
+   e_op _op;               //!< operation to perform
+   bool _force;            //!< overwrite existing files when converting
+   QList<job_info> _jobs;  //!< stacks to process
+   QThreadPool _pool;      //!< threads to process them
+   QMutex _mutex;          //!< protects output and the counts below
+   int _done;              //!< number of stacks which were processed ok
+   int _skipped;           //!< number of stacks which were skipped
+   int _errors;            //!< number of stacks which failed
+   };
+
+
+#endif
@@ -0,0 +1,413 @@
+/*
+License: GPL-2
+  An electronic filing cabinet: scan, print, stack, arrange
+ Copyright (C) 2009 Simon Glass, chch-kiwi@users.sourceforge.net
+ .
+ This program is free software; you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation; either version 2 of the License, or
+ (at your option) any later version.
+ .
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+ .
+ You should have received a copy of the GNU General Public License
+ along with this program; if not, write to the Free Software
+ Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301 USA
+
+X-Comment: On Debian GNU/Linux systems, the complete text of the GNU General
+ Public License can be found in the /usr/share/common-licenses/GPL file.
+*/
+
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <QBuffer>
+#include <QDir>
+#include <QElapsedTimer>
+#include <QFileInfo>
+#include <QJsonArray>
+#include <QJsonDocument>
+#include <QThread>
+
+#ifdef Q_OS_WIN
+#include <windows.h>
+#include <psapi.h>
+#else
+#include <sys/resource.h>
+#endif
+
+#include "bench.h"
+#include "config.h"
+#include "err.h"
+#include "file.h"
+#include "op.h"
+#include "pixcount.h"
+#include "utils.h"
+
+
+//! a paper size in mm
+struct paper_info
+   {
+   const char *name;
+   double width, height;
+   };
+
+static const paper_info papers [] =
+   {
+   { "A4", 210, 297 },
+   { "Letter", 215.9, 279.4 },
+   };
+
+static const int dpis [] = { 200, 300, 600 };
+
+static const int depths [] = { 1, 8, 24 };
+
+
+//! \returns the next number from a simple generator, so pages are repeatable
+static quint32 next_random (quint32 &state)
+   {
+   state = state * 1664525u + 1013904223u;
+   return state >> 8;
+   }
+
+
+//! set a pixel to the 'ink' colour
+static void ink (QImage &image, int bpp, int x, int y)
+   {
+   uchar *line = image.scanLine (y);
+
+   if (bpp == 1)
+      line [x >> 3] |= 0x80 >> (x & 7);
+   else if (bpp == 8)
+      line [x] = 30;
+   else
+      ((QRgb *)line) [x] = qRgb (20, 20, 60);
+   }
+
+
+Bench::Bench (const QString &dir, int pages)
+   {
+   _dir = dir + "/";
+   _pages = pages;
+   }
+
+
+void Bench::makePage (QImage &image, QSize size, int dpi, int bpp,
+      quint32 seed)
+   {
+   int x, y, xx, x1, top, noise;
+   int margin = dpi, pitch = dpi / 6, height = dpi / 12;
+   int period = dpi / 25, stroke = qMax (1, dpi / 100);
+   int photo_top = size.height () / 3, photo_bottom = size.height () / 2;
+   quint32 rnd = seed;
+
+   // plain paper, which is slightly noisy when scanned in grey or colour
+   if (bpp == 1)
+      {
+      image = QImage (size, QImage::Format_Mono);
+      image.setColor (0, qRgb (255, 255, 255));
+      image.setColor (1, qRgb (0, 0, 0));
+      image.fill (0);
+      }
+   else if (bpp == 8)
+      {
+      image = QImage (size, QImage::Format_Indexed8);
+      for (x = 0; x < 256; x++)
+         image.setColor (x, qRgb (x, x, x));
+      for (y = 0; y < size.height (); y++)
+         for (x = 0; x < size.width (); x++)
+            image.scanLine (y) [x] = 255 - next_random (rnd) % 8;
+      }
+   else
+      {
+      image = QImage (size, QImage::Format_RGB32);
+      for (y = 0; y < size.height (); y++)
+         for (x = 0; x < size.width (); x++)
+            {
+            noise = next_random (rnd) % 8;
+            ((QRgb *)image.scanLine (y)) [x] = qRgb (250 - noise,
+                  248 - noise, 240 - noise);
+            }
+      }
+
+   /* lines of words, each made of letter-sized boxes with vertical strokes.
+      This gives runs which are similar to text for the G4 encoder */
+   for (top = margin; top + height < size.height () - margin; top += pitch)
+      {
+      if (bpp != 1 && top + height >= photo_top && top < photo_bottom)
+         continue;
+      for (x = margin; x < size.width () - margin; x = x1 + dpi / 20)
+         {
+         x1 = qMin (x + dpi / 12 + int (next_random (rnd) % (dpi / 3)),
+               size.width () - margin);
+         for (y = top; y < top + height; y++)
+            for (xx = x; xx < x1; xx++)
+               if ((xx - x) % period < stroke || y - top < stroke
+                   || top + height - y <= stroke)
+                  ink (image, bpp, xx, y);
+
+         // sometimes end the paragraph early
+         if (next_random (rnd) % 12 == 0)
+            break;
+         }
+      }
+
+   // a smooth 'photo', for the JPEG and tile encoders
+   if (bpp != 1)
+      for (y = photo_top; y < photo_bottom; y++)
+         for (x = margin; x < size.width () - margin; x++)
+            {
+            if (bpp == 8)
+               image.scanLine (y) [x] = (x * 255 / size.width ()
+                     + y * 128 / size.height ()) & 0xff;
+            else
+               ((QRgb *)image.scanLine (y)) [x] = qRgb (
+                     x * 255 / size.width (), y * 255 / size.height (),
+                     (x + y) * 255 / (size.width () + size.height ()));
+            }
+   }
+
+
+qint64 Bench::peakRss (void)
+   {
+#ifdef Q_OS_WIN
+   PROCESS_MEMORY_COUNTERS counters;
+
+   if (!GetProcessMemoryInfo (GetCurrentProcess (), &counters,
+                              sizeof (counters)))
+      return -1;
+   return counters.PeakWorkingSetSize / 1024;
+#else
+   struct rusage usage;
+
+   // Linux reports this in KB
+   if (getrusage (RUSAGE_SELF, &usage))
+      return -1;
+   return usage.ru_maxrss;
+#endif
+   }
+
+
+void Bench::addTiming (QJsonObject &result, const char *name,
+      const timing_info &timing)
+   {
+   QJsonObject obj;
+
+   if (!timing.pages)
+      return;
+   obj ["pages"] = timing.pages;
+   obj ["ms_per_page"] = timing.ns / 1e6 / timing.pages;
+   obj ["mpixels_per_sec"] = timing.ns ? timing.pixels * 1e3 / timing.ns : 0;
+   result [name] = obj;
+   }
+
+
+err_info *Bench::runCase (const QString &paper, QSize size, int dpi, int bpp,
+      QJsonObject &result)
+   {
+   timing_info encode = {}, decode = {}, preview = {}, scale = {},
+         thumb = {}, to_pdf = {}, from_pdf = {}, blank = {};
+   QString name = QString ("bench-%1-%2-%3").arg (paper).arg (dpi).arg (bpp);
+   QString max_name = name + ".max", pdf_name = name + ".pdf";
+   qint64 pixels = qint64 (size.width ()) * size.height ();
+   QSize image_size, true_size;
+   QElapsedTimer timer;
+   QImage image, small;
+   err_info *err = NULL;
+   File *f, *fpdf;
+   int pagenum, depth;
+
+   QFile::remove (_dir + max_name);
+   QFile::remove (_dir + pdf_name);
+
+   // encode each page, in the same way as File::copyTo()
+   f = File::createFile (_dir, max_name, 0, File::Type_max);
+   err = f->create ();
+   for (pagenum = 0; !err && pagenum < _pages; pagenum++)
+      {
+      makePage (image, size, dpi, bpp, pagenum * 7919 + dpi * 31 + bpp);
+
+      QByteArray ba = QByteArray::fromRawData ((const char *)image.constBits (),
+            image.byteCount ());
+      QString title = QString ("Page %1").arg (pagenum + 1);
+      Filepage *fp;
+
+      timer.start ();
+      fp = File::createPage (File::Type_max);
+      fp->addData (image.width (), image.height (), image.depth (),
+            image.bytesPerLine (), title, false, false, pagenum, ba,
+            ba.size ());
+      err = fp->compress ();
+      if (!err)
+         err = f->addPage (fp, false);
+      delete fp;
+      encode.ns += timer.nsecsElapsed ();
+      encode.pixels += pixels;
+      encode.pages++;
+
+      // blank detection, as done on each block while scanning
+      QImage raw = bpp == 24 ? image.convertToFormat (QImage::Format_RGB888)
+            : image;
+      int raw_bytes = raw.byteCount ();
+
+      if (bpp == 24)
+         raw_bytes -= raw_bytes % 3;
+      timer.start ();
+      pixcount_dark (raw.constBits (), raw_bytes, bpp);
+      blank.ns += timer.nsecsElapsed ();
+      blank.pixels += pixels;
+      blank.pages++;
+
+      // the epeg thumbnailer is used for JPEG pages, which are never mono
+      if (!err && bpp != 1)
+         {
+         QBuffer buf;
+         byte *dest = 0;
+         int dest_size;
+         cpoint psize;
+
+         buf.open (QIODevice::WriteOnly);
+         image.save (&buf, "JPEG", 75);
+         timer.start ();
+         jpeg_thumbnail ((byte *)buf.data ().data (), buf.size (), &dest,
+               &dest_size, &psize);
+         thumb.ns += timer.nsecsElapsed ();
+         thumb.pixels += pixels;
+         thumb.pages++;
+         free (dest);
+         }
+      }
+   if (!err)
+      err = f->flush ();
+   delete f;
+   result ["max_bytes"] = QFileInfo (_dir + max_name).size ();
+
+   // read it back with a new File, so nothing is already decoded
+   f = File::createFile (_dir, max_name, 0, File::Type_max);
+   if (!err)
+      err = f->load ();
+   for (pagenum = 0; !err && pagenum < f->pagecount (); pagenum++)
+      {
+      timer.start ();
+      err = f->getImage (pagenum, false, image, image_size, true_size, depth,
+            false);
+      decode.ns += timer.nsecsElapsed ();
+      decode.pixels += pixels;
+      decode.pages++;
+
+      timer.start ();
+      if (!err)
+         err = f->getPreviewImage (pagenum, small, false);
+      preview.ns += timer.nsecsElapsed ();
+      preview.pixels += pixels;
+      preview.pages++;
+
+      timer.start ();
+      if (!err)
+         small = util_smooth_scale_image (image,
+               image.size () / CONFIG_preview_scale);
+      scale.ns += timer.nsecsElapsed ();
+      scale.pixels += pixels;
+      scale.pages++;
+      }
+
+   // convert to PDF, as --pdf does, then decode that
+   if (!err)
+      {
+      Operation op ("Converting", f->pagecount (), 0);
+
+      fpdf = File::createFile (_dir, pdf_name, 0, File::Type_pdf);
+      timer.start ();
+      err = fpdf->create ();
+      if (!err)
+         err = f->copyTo (fpdf, 3, op);
+      if (!err)
+         err = fpdf->flush ();
+      to_pdf.ns = timer.nsecsElapsed ();
+      to_pdf.pages = f->pagecount ();
+      to_pdf.pixels = pixels * to_pdf.pages;
+      delete fpdf;
+      }
+   delete f;
+
+   if (!err)
+      {
+      result ["pdf_bytes"] = QFileInfo (_dir + pdf_name).size ();
+      fpdf = File::createFile (_dir, pdf_name, 0, File::Type_pdf);
+      err = fpdf->load ();
+      for (pagenum = 0; !err && pagenum < fpdf->pagecount (); pagenum++)
+         {
+         timer.start ();
+         err = fpdf->getImage (pagenum, false, image, image_size, true_size,
+               depth, false);
+         from_pdf.ns += timer.nsecsElapsed ();
+         from_pdf.pixels += pixels;
+         from_pdf.pages++;
+         }
+      delete fpdf;
+      }
+
+   QFile::remove (_dir + max_name);
+   QFile::remove (_dir + pdf_name);
+
+   addTiming (result, "encode", encode);
+   addTiming (result, "decode", decode);
+   addTiming (result, "preview", preview);
+   addTiming (result, "scale", scale);
+   addTiming (result, "jpeg_thumbnail", thumb);
+   addTiming (result, "to_pdf", to_pdf);
+   addTiming (result, "pdf_decode", from_pdf);
+   addTiming (result, "blank_check", blank);
+   result ["peak_rss_kb"] = peakRss ();
+   return err;
+   }
+
+
+int Bench::run (void)
+   {
+   QJsonArray cases;
+   QJsonObject top;
+   unsigned p, d, b;
+   err_info *err;
+   int ret = 0;
+
+   QDir ().mkpath (_dir);
+   for (p = 0; p < sizeof (papers) / sizeof (papers [0]); p++)
+      for (d = 0; d < sizeof (dpis) / sizeof (dpis [0]); d++)
+         for (b = 0; b < sizeof (depths) / sizeof (depths [0]); b++)
+            {
+            QSize size (int (papers [p].width / 25.4 * dpis [d]),
+                        int (papers [p].height / 25.4 * dpis [d]));
+            QJsonObject result;
+
+            result ["paper"] = papers [p].name;
+            result ["dpi"] = dpis [d];
+            result ["bpp"] = depths [b];
+            result ["width"] = size.width ();
+            result ["height"] = size.height ();
+            err = runCase (papers [p].name, size, dpis [d], depths [b], result);
+            if (err)
+               {
+               result ["error"] = err->errstr;
+               ret = 1;
+               }
+            cases.append (result);
+
+            // show progress, since the whole run takes a while
+            fprintf (stderr, "%s %d dpi %d bpp: %s\n", papers [p].name,
+                     dpis [d], depths [b], err ? err->errstr : "ok");
+            }
+
+   top ["version"] = CONFIG_version_str;
+   top ["threads"] = QThread::idealThreadCount ();
+   top ["pixcount_kernel"] = pixcount_kernel ();
+   top ["pages_per_case"] = _pages;
+   top ["cases"] = cases;
+   top ["peak_rss_kb"] = peakRss ();
+   printf ("%s", QJsonDocument (top).toJson ().constData ());
+   return ret;
+   }
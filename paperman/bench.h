@@ -0,0 +1,114 @@
+/*
+License: GPL-2
+  An electronic filing cabinet: scan, print, stack, arrange
+ Copyright (C) 2009 Simon Glass, chch-kiwi@users.sourceforge.net
+ .
+ This program is free software; you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation; either version 2 of the License, or
+ (at your option) any later version.
+ .
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+ .
+ You should have received a copy of the GNU General Public License
+ along with this program; if not, write to the Free Software
+ Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301 USA
+
+X-Comment: On Debian GNU/Linux systems, the complete text of the GNU General
+ Public License can be found in the /usr/share/common-licenses/GPL file.
+*/
+/*
+   Project:    Maxview
+   File:       bench.h
+
+   This file implements a benchmark of the image codecs, run from the
+   command line with --bench.
+
+   It generates synthetic pages which are the same on every run, in each
+   combination of paper size (A4, Letter), resolution (200, 300, 600 dpi)
+   and depth (1, 8, 24 bits per pixel). For each combination it times
+   encoding the pages into a .max file, decoding them again, building
+   previews, scaling them down, making JPEG thumbnails and converting to and
+   decoding from PDF. The results, along with peak memory use, are written
+   to stdout as JSON so that they can be compared between builds.
+*/
+
+#ifndef __bench_h
+#define __bench_h
+
+
+#include <QImage>
+#include <QJsonObject>
+#include <QString>
+
+
+class File;
+struct err_info;
+
+
+class Bench
+   {
+public:
+   /** set up a benchmark
+
+      \param dir       directory to use for temporary files
+      \param pages     number of pages to use for each combination */
+   Bench (const QString &dir, int pages);
+
+   /** run the benchmark, writing the results to stdout
+
+      \returns 0 if ok, 1 on error */
+   int run (void);
+
+   /** generate a synthetic page. The result depends only on the arguments.
+       It has lines of 'text' and, for grey and colour pages, a 'photo'
+
+      \param image     returns the page
+      \param size      size of the page in pixels
+      \param dpi       resolution in dots per inch
+      \param bpp       1, 8 or 24
+      \param seed      seed for the random number generator */
+   static void makePage (QImage &image, QSize size, int dpi, int bpp,
+         quint32 seed);
+
+private:
+   //! time taken for one of the things we measure
+   struct timing_info
+      {
+      qint64 ns;        //!< total time in nanoseconds
+      qint64 pixels;    //!< total pixels processed
+      int pages;        //!< number of pages processed
+      };
+
+   /** run one combination of paper size, resolution and depth
+
+      \param paper     name of paper size
+      \param size      size of the page in pixels
+      \param dpi       resolution
+      \param bpp       bits per pixel
+      \param result    returns the results
+      \returns error, or NULL if ok */
+   err_info *runCase (const QString &paper, QSize size, int dpi, int bpp,
+         QJsonObject &result);
+
+   /** add a timing to a result, as ms per page and megapixels per second
+
+      \param result    result to update
+      \param name      name of thing measured
+      \param timing    time taken */
+   static void addTiming (QJsonObject &result, const char *name,
+         const timing_info &timing);
+
+   //! \returns the peak resident set size of this process in KB
+   static qint64 peakRss (void);
+
+private:
+   QString _dir;        //!< directory for temporary files (with trailing /)
+   int _pages;          //!< number of pages in each combination
+   };
+
+
+#endif
@@ -50,6 +50,26 @@ particular item */
 // a larger preview that we probably should try to use...
 #define CONFIG_large_preview_scale  16
 
+/** maximum size of the on-disc cache of preview images, in bytes. Older
+entries are dropped when this is exceeded */
+#define CONFIG_thumbcache_limit  (256 * 1024 * 1024)
+
+/** maximum memory used by rendered tiles in the page viewer, in bytes */
+#define CONFIG_tile_cache_limit  (64 * 1024 * 1024)
+
+/** maximum memory used by recently shown page images in the page strip,
+in bytes */
+#define CONFIG_page_thumb_limit  (64 * 1024 * 1024)
+
+/** number of pages either side of a visible page in the page strip to
+generate in advance, in case the user scrolls */
+#define CONFIG_page_prefetch  8
+
+
+/** number of synthetic pages to time for each page size, resolution and
+depth in the --bench benchmark */
+#define CONFIG_bench_pages  3
+
 
 /** this is the fraction of full colour that the blue RGB value should be
 to show a blank page - don't add brackets or you will break the code */
@@ -63,6 +83,12 @@ details */
 //#define CONFIG_use_omnipage
 
 
+/* CONFIG_use_tesslib runs tesseract OCR in-process through its library,
+rather than running the tesseract program with temporary files for each page.
+It is set by building with 'qmake CONFIG+=tesslib', which also links the
+library */
+
+
 /** define this to use the poppler library, which allows display of PDF files */
 #define CONFIG_use_poppler
 
@@ -77,4 +103,23 @@ details */
 //! port number to use for deliverymv server
 #define CONFIG_port 1968
 
+/** size of each block of file data sent by delivermv. The receiver
+acknowledges each one, so an interrupted transfer resumes from the last
+block written */
+#define CONFIG_deliver_chunk  (256 * 1024)
+
+/** maximum amount of file data delivermv sends before waiting for an
+acknowledgement */
+#define CONFIG_deliver_window  (4 * CONFIG_deliver_chunk)
+
+/** size of the receive buffer for each delivermv connection. Once it is full
+we stop reading and let TCP hold off the sender */
+#define CONFIG_deliver_buffer  (64 * 1024)
+
+/** largest delivermv message other than file data, in bytes */
+#define CONFIG_deliver_max_msg  1024
+
+/** how long delivermv waits for the other end before giving up, in ms */
+#define CONFIG_deliver_timeout  30000
+
 
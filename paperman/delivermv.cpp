@@ -38,6 +38,7 @@ X-Comment: On Debian GNU/Linux systems, the complete text of the GNU General
 
 #include <QApplication>
 #include <QString>
+#include <QStringList>
 
 #include "config.h"
 #include "err.h"
@@ -52,8 +53,17 @@ static void usage (void)
    printf ("Usage:  delivermv <opts>\n\n");
    printf ("   -h|--help       display this usage information\n");
    printf ("   -i|--info       display queue information\n");
+   printf ("   -l|--listen <addr>  with -s, listen on <addr> rather than only on\n");
+   printf ("                   this machine. Logins are not checked, so only do this\n");
+   printf ("                   on a trusted network\n");
    printf ("   -r|--root       add transfer root to list\n");
    printf ("   -s|--server     start a maxview server and wait for connections\n");
+   printf ("   -t|--to <host>  send files to a server at <host>[:port]\n");
+   printf ("\n");
+   printf ("For example, to try a transfer on this machine:\n\n");
+   printf ("   delivermv -s &\n");
+   printf ("   delivermv -t localhost stack.max\n\n");
+   printf ("An interrupted transfer resumes if the same command is run again\n");
    printf ("\n");
    }
 
@@ -89,9 +99,30 @@ static err_info *do_info (Delivery &del)
    }
 
 
-static err_info *do_server (Delivery &del)
+static err_info *do_server (Delivery &del, const QString &addr)
+   {
+   CALL (del.server (addr));
+
+   // connections are handled by the event loop
+   qApp->exec ();
+   return NULL;
+   }
+
+
+static err_info *do_send (QString host, QStringList &files)
    {
-   del.server ();
+   Maxclient client;
+   int port = CONFIG_port;
+
+   if (host.contains (':'))
+      {
+      port = host.section (':', 1).toInt ();
+      host = host.section (':', 0, 0);
+      }
+   CALL (client.connectTo (host, port));
+   foreach (const QString &fname, files)
+      CALL (client.sendFile (fname));
+   client.close ();
    return NULL;
    }
 
@@ -102,19 +133,22 @@ int main (int argc, char *argv[])
      {"help", 0, 0, 'h'},
      {"deliver", 0, 0, 'd'},
      {"info", 0, 0, 'i'},
+     {"listen", 1, 0, 'l'},
      {"collect", 0, 0, 'c'},
      {"root", 1, 0, 'r'},
      {"server", 0, 0, 's'},
+     {"to", 1, 0, 't'},
      {0, 0, 0, 0}
    };
    int op_type = -1, c;
-   QString index;
+   QString index, host, addr;
+   QStringList files;
    bool bad = false;
 
    Delivery del;
 
    while (c = getopt_long (argc, argv,
-      "h?discr:", long_options, NULL), c != -1)
+      "h?discl:r:t:", long_options, NULL), c != -1)
       switch (c)
          {
          case 'h' :
@@ -133,6 +167,10 @@ int main (int argc, char *argv[])
             op_type = 'i';
             break;
 
+         case 'l' :
+            addr = optarg;
+            break;
+
          case 'r' :
             del.addRoot (optarg);
             break;
@@ -140,14 +178,26 @@ int main (int argc, char *argv[])
          case 's' :
             op_type = 's';
             break;
+
+         case 't' :
+            op_type = 't';
+            host = optarg;
+            break;
          }
+   while (optind < argc)
+      files << argv [optind++];
 
    if (bad || op_type == -1)
       {
       usage ();
       return 1;
       }
-   if (!del.rootCount ())
+   if (op_type == 't' && !files.size ())
+      {
+      usage ();
+      return 1;
+      }
+   if (!del.rootCount () && op_type != 't')
       printf ("Warning: no transfer roots defined\n");
    QApplication app (argc, argv, false);
 
@@ -166,7 +216,11 @@ int main (int argc, char *argv[])
          break;
   
       case 's' :
-         err_complain (do_server (del));
+         err_complain (do_server (del, addr));
+         break;
+
+      case 't' :
+         err_complain (do_send (host, files));
          break;
       }
    }
@@ -1,6 +1,19 @@
 
 
+#include <errno.h>
 #include <iostream>
+#include <string.h>
+#include <unistd.h>
+#include <utime.h>
+
+#include <QDebug>
+#include <QDir>
+#include <QFileInfo>
+
+#ifdef Q_OS_LINUX
+#include <poll.h>
+#include <sys/sendfile.h>
+#endif
 
 #include "config.h"
 #include "delivery.h"
@@ -50,13 +63,22 @@ Delivery::Delivery ()
    }
 
 
-void Delivery::server (void)
+err_info *Delivery::server (const QString &addr)
    {
-   _server = new Maxserver ();
+   QString dir;
+
+   if (_roots.size ())
+      dir = _roots [0].dir () + ".transfer/incoming/";
+   else
+      dir = QDir::currentPath () + "/";
+   QDir ().mkpath (dir);
+   _server = new Maxserver (dir);
    std::cout << "delivermv - maxview wide area delivery agent\n";
    printf ("(C) 2009 Simon Glass, chch-kiwi@users.sourceforge.net, v%s\n", CONFIG_version_str);
    std::cout << std::endl;
-   _server->serve ();
+   CALL (_server->serve (addr.isEmpty ()
+         ? QHostAddress (QHostAddress::LocalHost) : QHostAddress (addr)));
+   return NULL;
    }
    
 
@@ -89,14 +111,6 @@ void Delivery::showQueues ()
    }
 
 
-Maxthread::Maxthread (int fd, QObject *parent)
-   : QThread (parent), _fd (fd)
-   {
-   _hdr.len = 0;
-   qDebug () << "new connection";
-   }
-
-
 /** returns a character representing 'byte' in our 6-bit character set [A-Za-z0-9./] */
 
 static int charset (int byte)
@@ -111,107 +125,518 @@ static int charset (int byte)
       return byte + '0';
    return byte ? '/' : '.';
    }
-   
-   
-void Maxthread::sendmsg (int type, void *msg, int size)
+
+
+Maxconn::Maxconn (QTcpSocket *sock, const QString &dir, QObject *parent)
+      : QObject (parent), _sock (sock), _dir (dir)
+   {
+   msg_hello_info hello;
+
+   _hdr.len = 0;
+   _want = 0;
+   _logged_in = false;
+   _size = _offset = _remain = 0;
+   _mtime = 0;
+   _chunk.resize (CONFIG_deliver_buffer);
+
+   // don't let Qt buffer more than this; TCP will hold off the sender
+   _sock->setParent (this);
+   _sock->setReadBufferSize (CONFIG_deliver_buffer);
+   connect (_sock, SIGNAL (readyRead ()), this, SLOT (readFromSocket ()));
+   connect (_sock, SIGNAL (disconnected ()), this, SLOT (deleteLater ()));
+   qDebug () << "new connection from" << _sock->peerAddress ().toString ();
+
+   memset (&hello, '\0', sizeof (hello));
+   hello.version = CONFIG_version;
+   hello.salt [0] = charset ((getpid () + rand ()) & 63);
+   hello.salt [1] = charset ((getpid () + rand ()) & 63);
+   sendmsg (MSGT_hello, &hello, sizeof (hello));
+   }
+
+
+Maxconn::~Maxconn ()
+   {
+   // anything we have received is kept, so the sender can resume later
+   if (_file.isOpen ())
+      _file.close ();
+   }
+
+
+void Maxconn::sendmsg (int type, const void *msg, int size)
    {
    msghdr_info hdr;
-   
+
    hdr.type = type;
    hdr.len = sizeof (hdr) + size;
    _sock->write ((const char *)&hdr, sizeof (hdr));
    _sock->write ((const char *)msg, size);
    }
-   
-   
-void Maxthread::run (void)
+
+
+void Maxconn::sendAck (int status)
    {
-   _sock = new QTcpSocket ();
+   msg_fileack_info ack;
+
+   ack.offset = _offset;
+   ack.status = status;
+   ack.pad = 0;
+   sendmsg (MSGT_fileack, &ack, sizeof (ack));
+   }
+
+
+void Maxconn::fail (err_info *err)
+   {
+   msg_error_info msg;
+
+   printf ("Error: %s\n", err->errstr);
+   memset (&msg, '\0', sizeof (msg));
+   strncpy (msg.errstr, err->errstr, sizeof (msg.errstr) - 1);
+   sendmsg (MSGT_error, &msg, sizeof (msg));
+   _sock->disconnectFromHost ();
+   }
 
-   if (!_sock->setSocketDescriptor (_fd))
+
+err_info *Maxconn::checkHeader (void)
+   {
+   if (_hdr.len < sizeof (_hdr) || _hdr.type >= MSGT_)
+      return err_make (ERRFN, ERR_invalid_transfer_message2, _hdr.type, _hdr.len);
+   if (_hdr.type == MSGT_filedata)
       {
-      emit error (err_make (ERRFN, ERR_socket_error1, _sock->error()));
-      return;
+      // file data is streamed to disc, so we only collect its header
+      if (_hdr.len < sizeof (_hdr) + sizeof (msg_filedata_info))
+         return err_make (ERRFN, ERR_invalid_transfer_message2, _hdr.type, _hdr.len);
+      _want = sizeof (msg_filedata_info);
       }
-   connect (_sock, SIGNAL (readyRead()), this, SLOT (readFromSocket ()));
-   
-   msg_hello_info hello;
-   
-   hello.version = CONFIG_version;
-   hello.salt [0] = charset ((getpid () + rand ()) & 63);
-   hello.salt [1] = charset ((getpid () + rand ()) & 63);
-   sendmsg (MSGT_hello, &hello, sizeof (hello));
-   while (_sock->waitForReadyRead ())
-      ;
+   else
+      {
+      if (_hdr.len - sizeof (_hdr) > CONFIG_deliver_max_msg)
+         return err_make (ERRFN, ERR_invalid_transfer_message2, _hdr.type, _hdr.len);
+      _want = _hdr.len - sizeof (_hdr);
+      }
+   _buff.clear ();
+   return NULL;
    }
 
 
-void Maxthread::processMsg (void)
+err_info *Maxconn::processMsg (void)
    {
-   const msg_info *msg = (const msg_info *)_buff.constData ();
-   
-   qDebug () << "msg" << msg->hdr.type;
+   const char *body = _buff.constData ();
+
+   switch (_hdr.type)
+      {
+      case MSGT_login :
+         {
+         const msg_login_info *login = (const msg_login_info *)body;
+
+         if (_want != sizeof (*login))
+            return err_make (ERRFN, ERR_invalid_transfer_message2, _hdr.type, _hdr.len);
+
+         // we don't check passwords yet
+         _logged_in = true;
+         qDebug () << "login"
+            << QString::fromUtf8 (login->domain, strnlen (login->domain, sizeof (login->domain)))
+            << QString::fromUtf8 (login->area, strnlen (login->area, sizeof (login->area)));
+         break;
+         }
+
+      case MSGT_sendfilehdr :
+         if (!_logged_in || _want != sizeof (msg_sendfilehdr_info))
+            return err_make (ERRFN, ERR_invalid_transfer_message2, _hdr.type, _hdr.len);
+         CALL (startFile ((const msg_sendfilehdr_info *)body));
+         break;
+
+      case MSGT_filedata :
+         {
+         const msg_filedata_info *data = (const msg_filedata_info *)body;
+
+         if (!_file.isOpen ())
+            return err_make (ERRFN, ERR_invalid_transfer_message2, _hdr.type, _hdr.len);
+         if (data->offset != _offset)
+            return err_make (ERRFN, ERR_transfer_offset_mismatch2,
+                  (unsigned long long)data->offset, (unsigned long long)_offset);
+         _remain = _hdr.len - sizeof (_hdr) - sizeof (*data);
+         if (_offset + _remain > _size)
+            return err_make (ERRFN, ERR_invalid_transfer_message2, _hdr.type, _hdr.len);
+         if (!_remain)
+            CALL (endData ());
+         break;
+         }
+
+      default :
+         return err_make (ERRFN, ERR_invalid_transfer_message2, _hdr.type, _hdr.len);
+      }
+   return NULL;
    }
-   
-   
-void Maxthread::readFromSocket ()
+
+
+err_info *Maxconn::copyData (bool &more)
    {
-   unsigned toread = _sock->bytesAvailable ();
-   int nread;
-   
-   if (!_hdr.len)
+   qint64 nread;
+
+   nread = _sock->read (_chunk.data (), qMin ((quint64)_chunk.size (), _remain));
+   more = nread > 0;
+   if (!more)
+      return NULL;
+   if (_file.write (_chunk.constData (), nread) != nread)
+      return err_make (ERRFN, ERR_failed_to_write_bytes1, (int)nread);
+   _offset += nread;
+   _remain -= nread;
+   if (!_remain)
+      {
+      _hdr.len = 0;
+      CALL (endData ());
+      }
+   return NULL;
+   }
+
+
+err_info *Maxconn::startFile (const msg_sendfilehdr_info *hdr)
+   {
+   QString name = QString::fromUtf8 (hdr->name, strnlen (hdr->name, sizeof (hdr->name)));
+   QFileInfo fi;
+
+   // only accept a plain leaf name, so that the client cannot write elsewhere
+   if (name.isEmpty () || name.startsWith (".") || name.contains ('/')
+       || name.contains ('\\'))
+      return err_make (ERRFN, ERR_invalid_transfer_filename1, qPrintable (name));
+   if (_file.isOpen ())
+      _file.close ();
+   _fname = _dir + name;
+   _size = hdr->size;
+   _mtime = hdr->mtime;
+   _remain = 0;
+
+   // perhaps we already have it
+   fi.setFile (_fname);
+   if (fi.exists () && (quint64)fi.size () == _size
+       && (int64_t)fi.lastModified ().toTime_t () == _mtime)
+      {
+      _offset = _size;
+      sendAck (ACK_done);
+      return NULL;
+      }
+
+   // but never replace a different file with the same name
+   if (fi.exists ())
+      return err_make (ERRFN, ERR_transfer_file_exists1, qPrintable (name));
+
+   // pick up where any earlier attempt left off
+   _file.setFileName (_dir + QString (".%1.%2-%3.part").arg (name,
+         QString::number (_size), QString::number (_mtime)));
+   if (!_file.open (QIODevice::WriteOnly | QIODevice::Append | QIODevice::Unbuffered))
+      return err_make (ERRFN, ERR_cannot_open_file1, qPrintable (_file.fileName ()));
+   _offset = _file.size ();
+   if (_offset > _size)
+      {
+      _file.resize (0);
+      _offset = 0;
+      }
+   if (_offset)
+      qDebug () << "resuming" << name << "at" << _offset;
+   return endData ();
+   }
+
+
+err_info *Maxconn::endData (void)
+   {
+   struct utimbuf times;
+   QString part;
+
+   if (_offset < _size)
       {
-      if (toread >= sizeof (_hdr))
+      sendAck (ACK_more);
+      return NULL;
+      }
+
+   /* we have it all, so move it into place. This fails if another file of
+      that name has turned up in the meantime, which we leave alone */
+   part = _file.fileName ();
+   _file.close ();
+   if (!QFile::rename (part, _fname))
+      return err_make (ERRFN, ERR_could_not_copy_file2, qPrintable (part),
+            qPrintable (_fname));
+   times.actime = times.modtime = _mtime;
+   utime (QFile::encodeName (_fname).constData (), &times);
+   printf ("Received '%s', %llu bytes\n", qPrintable (_fname),
+         (unsigned long long)_size);
+   sendAck (ACK_done);
+   return NULL;
+   }
+
+
+void Maxconn::readFromSocket (void)
+   {
+   err_info *err = NULL;
+   bool more = true;
+
+   while (!err && more && _sock->state () == QAbstractSocket::ConnectedState)
+      {
+      if (!_hdr.len)
          {
-         nread = _sock->read ((char *)&_hdr, sizeof (_hdr));
-         if (nread < (int)sizeof (_hdr))
-            emit error (err_make (ERRFN, ERR_failed_to_read_bytes1, sizeof (_hdr)));
-         _buff.clear ();
-         _buff.reserve (_hdr.len);
-         _buff.append ((const char *)&_hdr, sizeof (_hdr));
+         if (_sock->bytesAvailable () < (qint64)sizeof (_hdr))
+            break;
+         _sock->read ((char *)&_hdr, sizeof (_hdr));
+         err = checkHeader ();
+         }
+      else if (_remain)
+         err = copyData (more);
+      else if (_buff.size () < _want)
+         {
+         QByteArray ba = _sock->read (_want - _buff.size ());
+
+         more = !ba.isEmpty ();
+         _buff.append (ba);
+         }
+      else
+         {
+         err = processMsg ();
+
+         // keep the header while file data is still to come
+         if (!_remain)
+            _hdr.len = 0;
          }
       }
-   else
+   if (err)
+      fail (err);
+   }
+
+
+Maxserver::Maxserver (const QString &dir, QObject *parent)
+      : QTcpServer (parent), _dir (dir)
+   {
+   connect (this, SIGNAL (newConnection ()), this, SLOT (acceptConnections ()));
+   }
+
+
+void Maxserver::acceptConnections (void)
+   {
+   while (hasPendingConnections ())
+      new Maxconn (nextPendingConnection (), _dir, this);
+   }
+
+
+err_info *Maxserver::serve (const QHostAddress &addr)
+   {
+   if (!listen (addr, CONFIG_port))
+      return err_make (ERRFN, ERR_cannot_listen_on_port2, CONFIG_port,
+            qPrintable (errorString ()));
+   std::cout << "Server started on " << qPrintable (addr.toString ())
+         << " port " << CONFIG_port << std::endl;
+   std::cout << "Incoming files go to " << qPrintable (_dir) << std::endl;
+   return NULL;
+   }
+
+
+Maxclient::Maxclient ()
+   {
+   _sock = new QTcpSocket ();
+   }
+
+
+Maxclient::~Maxclient ()
+   {
+   close ();
+   delete _sock;
+   }
+
+
+void Maxclient::close (void)
+   {
+   if (_sock->state () != QAbstractSocket::UnconnectedState)
       {
-      if (_buff.size () + toread > _hdr.len)
-         toread = _hdr.len - _buff.size ();
-      
-      QByteArray ba;
-      ba.resize (toread);
-      nread = _sock->read (ba.data (), toread);
-      if (nread < (int)sizeof (_hdr))
-         emit error (err_make (ERRFN, ERR_failed_to_read_bytes1, sizeof (_hdr)));
-         
-      _buff.append (ba);
-      if (_buff.size () == (int)_hdr.len)
-         processMsg ();
+      _sock->disconnectFromHost ();
+      if (_sock->state () != QAbstractSocket::UnconnectedState)
+         _sock->waitForDisconnected (CONFIG_deliver_timeout);
       }
    }
- 
- 
-Maxserver::Maxserver (QObject *parent)
-      : QTcpServer (parent)
+
+
+err_info *Maxclient::sockError (void)
    {
+   return err_make (ERRFN, ERR_connection_failed2, qPrintable (_host),
+         qPrintable (_sock->errorString ()));
    }
 
 
-void Maxserver::incomingConnection (int fd)
+err_info *Maxclient::connectTo (const QString &host, int port)
    {
-   Maxthread *thread = new Maxthread (fd, this);
+   msg_hello_info hello;
+   msg_login_info login;
+
+   _host = host;
+   _sock->connectToHost (host, port);
+   if (!_sock->waitForConnected (CONFIG_deliver_timeout))
+      return sockError ();
+   CALL (readMsg (MSGT_hello, &hello, sizeof (hello)));
 
-   connect (thread, SIGNAL (finished()), thread, SLOT (deleteLater()));
-   thread->start();
+   // the server doesn't check passwords yet
+   memset (&login, '\0', sizeof (login));
+   CALL (sendmsg (MSGT_login, &login, sizeof (login)));
+   return NULL;
    }
 
 
-void Maxserver::serve (void)
+err_info *Maxclient::flush (void)
    {
-   std::cout << "Server started on port " << CONFIG_port << std::endl;
-   
-   listen (QHostAddress::Any, CONFIG_port);
-   
-   // wait forever
-   while (1)
-      waitForNewConnection (-1);
+   while (_sock->bytesToWrite ())
+      if (!_sock->waitForBytesWritten (CONFIG_deliver_timeout))
+         return sockError ();
+   return NULL;
    }
 
+
+err_info *Maxclient::sendmsg (int type, const void *msg, int size)
+   {
+   msghdr_info hdr;
+
+   hdr.type = type;
+   hdr.len = sizeof (hdr) + size;
+   _sock->write ((const char *)&hdr, sizeof (hdr));
+   _sock->write ((const char *)msg, size);
+   return flush ();
+   }
+
+
+err_info *Maxclient::sendData (QFile &file, quint64 offset, int size)
+   {
+   msghdr_info hdr;
+   msg_filedata_info data;
+
+   hdr.type = MSGT_filedata;
+   hdr.len = sizeof (hdr) + sizeof (data) + size;
+   data.offset = offset;
+   _sock->write ((const char *)&hdr, sizeof (hdr));
+   _sock->write ((const char *)&data, sizeof (data));
+
+   // the header must be on its way before we write to the socket ourselves
+   CALL (flush ());
+#ifdef Q_OS_LINUX
+   int sockfd = _sock->socketDescriptor ();
+   off_t pos = offset;
+   ssize_t done;
+
+   while (size > 0)
+      {
+      done = sendfile (sockfd, file.handle (), &pos, size);
+      if (done > 0)
+         size -= done;
+      else if (done < 0 && errno == EINTR)
+         continue;
+      else if (done < 0 && errno == EAGAIN)
+         {
+         // Qt's sockets are non-blocking, so wait for some room
+         struct pollfd pfd;
+
+         pfd.fd = sockfd;
+         pfd.events = POLLOUT;
+         if (poll (&pfd, 1, CONFIG_deliver_timeout) <= 0)
+            return err_make (ERRFN, ERR_failed_to_write_bytes1, size);
+         }
+      else
+         return err_make (ERRFN, ERR_failed_to_write_bytes1, size);
+      }
+#else
+   QByteArray buff;
+
+   if (!file.seek (offset))
+      return err_make (ERRFN, ERR_failed_to_read_bytes1, size);
+   buff = file.read (size);
+   if (buff.size () != size)
+      return err_make (ERRFN, ERR_failed_to_read_bytes1, size);
+   _sock->write (buff);
+   CALL (flush ());
+#endif
+   return NULL;
+   }
+
+
+err_info *Maxclient::readBytes (char *buff, int size)
+   {
+   while (_sock->bytesAvailable () < size)
+      if (!_sock->waitForReadyRead (CONFIG_deliver_timeout))
+         return sockError ();
+   if (_sock->read (buff, size) != size)
+      return err_make (ERRFN, ERR_failed_to_read_bytes1, size);
+   return NULL;
+   }
+
+
+bool Maxclient::msgWaiting (void)
+   {
+   msghdr_info hdr;
+
+   // pick up anything that has arrived, without waiting
+   _sock->waitForReadyRead (0);
+   if (_sock->bytesAvailable () < (qint64)sizeof (hdr))
+      return false;
+   _sock->peek ((char *)&hdr, sizeof (hdr));
+   return _sock->bytesAvailable () >= hdr.len;
+   }
+
+
+err_info *Maxclient::readMsg (int type, void *msg, int size)
+   {
+   msghdr_info hdr;
+   QByteArray body;
+
+   CALL (readBytes ((char *)&hdr, sizeof (hdr)));
+   if (hdr.len < sizeof (hdr) || hdr.len - sizeof (hdr) > CONFIG_deliver_max_msg)
+      return err_make (ERRFN, ERR_invalid_transfer_message2, hdr.type, hdr.len);
+   body.resize (hdr.len - sizeof (hdr));
+   CALL (readBytes (body.data (), body.size ()));
+   if (hdr.type == MSGT_error && body.size () == sizeof (msg_error_info))
+      {
+      const msg_error_info *err = (const msg_error_info *)body.constData ();
+
+      return err_make (ERRFN, ERR_server_reported_error1,
+            QByteArray (err->errstr, strnlen (err->errstr, sizeof (err->errstr))).constData ());
+      }
+   if (hdr.type != (uint32_t)type || body.size () != size)
+      return err_make (ERRFN, ERR_invalid_transfer_message2, hdr.type, hdr.len);
+   memcpy (msg, body.constData (), size);
+   return NULL;
+   }
+
+
+err_info *Maxclient::sendFile (const QString &path)
+   {
+   QFileInfo fi (path);
+   QFile file (path);
+   QByteArray name = fi.fileName ().toUtf8 ();
+   msg_sendfilehdr_info hdr;
+   msg_fileack_info ack;
+   quint64 sent;
+   int size;
+
+   if (!file.open (QIODevice::ReadOnly))
+      return err_make (ERRFN, ERR_cannot_open_file1, qPrintable (path));
+   if (name.size () >= (int)sizeof (hdr.name))
+      return err_make (ERRFN, ERR_invalid_transfer_filename1, name.constData ());
+   memset (&hdr, '\0', sizeof (hdr));
+   memcpy (hdr.name, name.constData (), name.size ());
+   hdr.size = fi.size ();
+   hdr.mtime = fi.lastModified ().toTime_t ();
+   CALL (sendmsg (MSGT_sendfilehdr, &hdr, sizeof (hdr)));
+
+   // the server tells us how much it already has
+   CALL (readMsg (MSGT_fileack, &ack, sizeof (ack)));
+   if (ack.offset && ack.status != ACK_done)
+      printf ("Resuming '%s' at %llu of %llu bytes\n", qPrintable (path),
+            (unsigned long long)ack.offset, (unsigned long long)hdr.size);
+   for (sent = ack.offset; ack.status != ACK_done; )
+      {
+      // keep up to a window of data in flight, collecting acks as they come
+      if (sent < hdr.size && sent - ack.offset < CONFIG_deliver_window
+          && !msgWaiting ())
+         {
+         size = qMin<quint64> (CONFIG_deliver_chunk, hdr.size - sent);
+         CALL (sendData (file, sent, size));
+         sent += size;
+         }
+      else
+         CALL (readMsg (MSGT_fileack, &ack, sizeof (ack)));
+      }
+   printf ("Sent '%s', %llu bytes\n", qPrintable (path),
+         (unsigned long long)hdr.size);
+   return NULL;
+   }
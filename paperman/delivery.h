@@ -1,9 +1,11 @@
 
 #include <stdint.h>
 
+#include <QFile>
+#include <QHostAddress>
 #include <QList>
 #include <QString>
-#include <QThread>
+#include <QStringList>
 #include <QTcpServer>
 #include <QTcpSocket>
 
@@ -18,6 +20,9 @@ enum msg_t
    MSGT_hello,       //!< hello banner
    MSGT_login,       //!< login to domain, area
    MSGT_sendfilehdr, //!< send file header info
+   MSGT_fileack,     //!< acknowledge file data received so far
+   MSGT_filedata,    //!< block of file data
+   MSGT_error,       //!< error report, after which the connection is closed
    MSGT_
    };
 
@@ -42,8 +47,41 @@ typedef struct msg_login_info
    char encrypted [16]; //!< password encrypted with given salt
    } msg_login_info;
 
-   //int32_t frag_pos;    //!< fragment position
-   //int32_t frag_size;   //!< fragment size
+
+typedef struct msg_sendfilehdr_info
+   {
+   char name [256];     //!< leaf name of file, nul-terminated UTF-8
+   uint64_t size;       //!< total size of file in bytes
+   int64_t mtime;       //!< modification time of file (seconds since 1970)
+   } msg_sendfilehdr_info;
+
+
+enum ack_t
+   {
+   ACK_more,            //!< send data from the given offset
+   ACK_done             //!< the receiver has the whole file
+   };
+
+typedef struct msg_fileack_info
+   {
+   uint64_t offset;     //!< number of bytes of the file the receiver holds
+   int32_t status;      //!< status (ack_t)
+   int32_t pad;
+   } msg_fileack_info;
+
+
+/** header of a block of file data. The data follows immediately and runs to
+    the end of the message */
+typedef struct msg_filedata_info
+   {
+   uint64_t offset;     //!< position of this data in the file
+   } msg_filedata_info;
+
+
+typedef struct msg_error_info
+   {
+   char errstr [256];   //!< error message, nul-terminated
+   } msg_error_info;
 
 
 typedef struct msg_info
@@ -52,42 +90,85 @@ typedef struct msg_info
    union
       {
       msg_login_info login;
-//      msg_sendfilehdr_info sendfilehdr;
+      msg_sendfilehdr_info sendfilehdr;
+      msg_fileack_info fileack;
+      msg_filedata_info filedata;
+      msg_error_info error;
       char data [0];
       };
    } msg_info;
 
 
-class Maxthread : public QThread
+/** a connection to the server. All connections are handled by the event loop
+in the main thread: we only ever read what has arrived, and socket reads are
+limited to CONFIG_deliver_buffer bytes so that a fast sender is held off by
+TCP rather than by us buffering its data */
+
+class Maxconn : public QObject
    {
    Q_OBJECT
 
 public:
-   Maxthread (int fd, QObject *parent);
+   /** set up a new connection, and send the hello message
 
-   void run ();
+      \param sock    socket for the connection (we take ownership)
+      \param dir     directory to hold incoming files (with trailing /)
+      \param parent  parent object */
+   Maxconn (QTcpSocket *sock, const QString &dir, QObject *parent);
+   ~Maxconn ();
 
 protected:
    /** send a message. A header is prepended.
-   
+
       \param type    message type (msg_t)
       \param msg     pointer to message contents
       \param size    size of message contents */
-   void sendmsg (int type, void *msg, int size);
+   void sendmsg (int type, const void *msg, int size);
+
+   /** deal with a message header that has just been read, working out how
+       much of the body we need to collect */
+   err_info *checkHeader (void);
+
+   /** process a message whose body (or for file data, the data header) is
+       now in _buff */
+   err_info *processMsg (void);
+
+   /** copy file data from the socket to the file, at most a buffer at a time
+
+      \param more    returns true if there may be more to read
+      \returns error, or NULL if ok */
+   err_info *copyData (bool &more);
+
+   /** start receiving a file, resuming any partial copy we already have */
+   err_info *startFile (const msg_sendfilehdr_info *hdr);
 
-   void processMsg (void);
+   /** finish off a block of file data: acknowledge it, and if the file is
+       complete, move it into place */
+   err_info *endData (void);
+
+   //! tell the sender how much of the file we have
+   void sendAck (int status);
+
+   //! report an error to the client and close the connection
+   void fail (err_info *err);
 
 public slots:
    void readFromSocket (void);
 
-signals:
-   void error (err_info *err);
-
 private:
-   int _fd;             //!< incoming file descriptor
    QTcpSocket *_sock;   //!< socket
+   QString _dir;        //!< directory for incoming files
    msghdr_info _hdr;    //!< header we have read (_hdr.len == 0 if none)
-   QByteArray _buff;    //!< byte array buffer
+   int _want;           //!< number of bytes of message body to collect
+   QByteArray _buff;    //!< message body collected so far
+   QByteArray _chunk;   //!< buffer for copying file data to disc
+   bool _logged_in;     //!< true once the client has logged in
+   QFile _file;         //!< partial file being received
+   QString _fname;      //!< final filename of the file being received
+   quint64 _size;       //!< total size of the file being received
+   int64_t _mtime;      //!< modification time of the file being received
+   quint64 _offset;     //!< number of bytes of the file that we hold
+   quint64 _remain;     //!< bytes of file data left in the current message
    };
 
 
@@ -95,7 +176,24 @@ private:
 
 The server listens for incoming connections. The protocol is very simple:
 
+   - the server sends MSGT_hello, and the client replies with MSGT_login
+   - for each file, the client sends MSGT_sendfilehdr. The server replies
+     with MSGT_fileack giving the number of bytes it already holds, which
+     is non-zero if an earlier transfer of the same file was interrupted
+   - the client sends the rest of the file in MSGT_filedata blocks, each
+     giving its offset. The server acknowledges each block once written.
+     The client keeps at most CONFIG_deliver_window bytes unacknowledged
+   - when the server has the whole file it moves it into place and sends
+     an ACK_done acknowledgement
+
+A partial file is held as a hidden file whose name includes the size and
+modification time of the original, so that a changed file starts again. A
+file which has already been received is never replaced by a different one.
 
+Logins are not checked yet, so by default the server only listens on the
+local host.
+
+All values are in host byte order.
 */
 
 class Maxserver : public QTcpServer
@@ -103,15 +201,90 @@ class Maxserver : public QTcpServer
    Q_OBJECT
 
 public:
-   Maxserver (QObject *parent = 0);
+   /** create a new server
+
+      \param dir     directory to hold incoming files
+      \param parent  parent object */
+   Maxserver (const QString &dir, QObject *parent = 0);
+
+   /** start the server. Connections are handled by the application's event
+       loop, which the caller must run
+
+      \param addr    address to listen on. Logins are not checked, so this
+                     should be the local host unless the network is trusted */
+   err_info *serve (const QHostAddress &addr);
+
+protected slots:
+   void acceptConnections (void);
+
+private:
+   QString _dir;        //!< directory for incoming files (with trailing /)
+   };
+
+
+/** a client which sends files to a server. This is a simple command-line
+client, so it blocks while sending */
+
+class Maxclient
+   {
+public:
+   Maxclient ();
+   ~Maxclient ();
+
+   /** connect to a server and log in
+
+      \param host    host name
+      \param port    port number
+      \returns error, or NULL if ok */
+   err_info *connectTo (const QString &host, int port);
+
+   /** send a file to the server, resuming from wherever it got to before
+
+      \param path    path to file
+      \returns error, or NULL if ok */
+   err_info *sendFile (const QString &path);
 
-   /** start the server */
-   void serve (void);
+   //! close the connection
+   void close (void);
 
 protected:
-   void incomingConnection (int fd);
+   //! send a message. A header is prepended.
+   err_info *sendmsg (int type, const void *msg, int size);
+
+   /** send a block of file data. The data goes straight from the file to
+       the socket where the OS allows this
+
+      \param file    file to send
+      \param offset  position of data in file
+      \param size    number of bytes to send */
+   err_info *sendData (QFile &file, quint64 offset, int size);
+
+   /** wait until there is enough data to read, then read it
+
+      \param buff    place to put data
+      \param size    number of bytes to read */
+   err_info *readBytes (char *buff, int size);
+
+   //! \returns true if a complete message is waiting to be read
+   bool msgWaiting (void);
+
+   /** read a message, which must be of the given type. An error message from
+       the server is turned into an error
+
+      \param type    message type expected (msg_t)
+      \param msg     place to put message contents
+      \param size    size of message contents */
+   err_info *readMsg (int type, void *msg, int size);
+
+   //! wait until all written data has been passed to the OS
+   err_info *flush (void);
+
+   //! \returns an error describing the socket's last error
+   err_info *sockError (void);
 
 private:
+   QTcpSocket *_sock;   //!< socket
+   QString _host;       //!< host we are connected to
    };
 
 
@@ -126,6 +299,8 @@ public:
 
    int queueSize (void);
 
+   const QString &dir (void) const { return _dir; }
+
 private:
    QString _dir;
    Transfer *_trans;
@@ -145,10 +320,14 @@ public:
 
    int rootCount (void) { return _roots.size (); }
 
-   void server (void);
+   /** start the server. Incoming files go into the .transfer/incoming
+       directory of the first root, or the current directory if none
+
+      \param addr    address to listen on, or empty to accept connections
+                     only from this machine */
+   err_info *server (const QString &addr);
 
 private:
    QList<Deliveryroot> _roots;      //!< a list of delivery roots that we are aware of
    Maxserver *_server;              //!< point to server
    };
-
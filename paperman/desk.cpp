@@ -39,6 +39,7 @@ X-Comment: On Debian GNU/Linux systems, the complete text of the GNU General
 #include <QDateTime>
 #include <QDebug>
 #include <QLinkedList>
+#include <QSaveFile>
 #include <windows.h>
 
 #include "qdir.h"
@@ -70,6 +71,12 @@ extern "C" {
 
 #define DESK_FNAME ".paperdesk"
 
+//! changes to the desk since DESK_FNAME was last written
+#define JOURNAL_FNAME ".paperdesk-journal"
+
+//! minimum number of journal entries before we rewrite the desk file
+#define JOURNAL_MIN  256
+
 
 
 enum
@@ -143,12 +150,15 @@ void Desk::setup ()
    _fbase_seq = 0;
    _row_count = 0;      // our record of the last valid row count
    _dirty = false;
+   _journal_count = 0;
    }
 
 
 void Desk::clear (void)
    {
    _files.clear ();
+   _byname.clear ();
+   _bybase.clear ();
    }
 
 
@@ -197,7 +207,7 @@ void Desk::updateRowCount (void)
 
 
 void Desk::addMatches (const QString &dirPath, const QString &match,
-               bool subdirs, Operation *op)
+               bool subdirs, Operation *op, const QSet<QString> &also)
    {
    int upto = 0;
 
@@ -229,10 +239,12 @@ void Desk::addMatches (const QString &dirPath, const QString &match,
       if (fi.isDir ())
          {
          if (fi.fileName () != "." && fi.fileName () != "..")
-            addMatches (dirPath + fi.fileName () + "/", match, subdirs, 0);
+            addMatches (dirPath + fi.fileName () + "/", match, subdirs, 0,
+                        also);
          }
       else if (match == QString::null ||
-               fi.fileName ().contains (match, Qt::CaseInsensitive)){
+               fi.fileName ().contains (match, Qt::CaseInsensitive)
+               || also.contains (fi.absoluteFilePath ())){
 
           if(fi.fileName().endsWith(".pdf") || fi.fileName().endsWith(".max")
                   || fi.fileName().endsWith(".jpg") || fi.fileName().endsWith(".jpeg"))
@@ -249,6 +261,7 @@ void Desk::addFile (File *f)
    // set position and add to list
    f->setPos (_pos);
    _files << f;
+   indexFile (f);
 
    // we now have a dirty desk
    dirty ();
@@ -332,22 +345,61 @@ File *Desk::createFile (const QString &dir, const QString fname)
 
 bool Desk::addToExistingFile (QString &fname)
 {
+   return claimFile (fname) != 0;
+}
+
+
+File *Desk::claimFile (const QString &fname)
+   {
    QString base, ext;
    int pagenum;
 
    if (!File::decodePageNumber (fname, base, pagenum, ext))
-      return false;
+      return 0;
 
-   foreach (File *f, _files)
-      {
-      if (!f->extMatchesType (ext))
-         continue;
+   // only files which have a page number themselves can claim pages
+   foreach (File *f, _bybase.values (baseKey (fname, File::typeFromName (fname))))
       if (f->claimFileAsNewPage (fname, base, pagenum))
-         return true;
-      }
+         return f;
 
-   return false;
-}
+   return 0;
+   }
+
+
+QString Desk::baseKey (const QString &fname, int type)
+   {
+   QString base, ext;
+   int pagenum;
+
+   if (!File::decodePageNumber (fname, base, pagenum, ext))
+      return QString ();
+   return QString ("%1/%2").arg (type).arg (base);
+   }
+
+
+void Desk::indexFile (File *f)
+   {
+   QString key = baseKey (f->filename (), f->type ());
+
+   _byname.insert (f->filename (), f);
+   if (!key.isEmpty ())
+      _bybase.insert (key, f);
+   }
+
+
+void Desk::unindexFile (File *f, const QString &fname)
+   {
+   if (_byname.value (fname) == f)
+      _byname.remove (fname);
+   _bybase.remove (baseKey (fname, f->type ()), f);
+   }
+
+
+void Desk::renameFile (File *f, const QString &oldname)
+   {
+   unindexFile (f, oldname);
+   indexFile (f);
+   }
 
 void Desk::readDesk (bool read_sizes)
    {
@@ -379,6 +431,8 @@ void Desk::readDesk (bool read_sizes)
    bool files = false;
    File *f;
    int pos;
+   QStringList order;
+   QHash<QString, QString> entry;
 
    if (file.open (QIODevice::ReadOnly)) while (!stream.atEnd())
       {
@@ -395,20 +449,34 @@ void Desk::readDesk (bool read_sizes)
       pos = line.indexOf ('=');
       if (files && pos != -1)
          {
-          qDebug() << "reading.";
          QString fname = line.left (pos);
 
-         QFile test (_dir + fname);
-         if (!test.exists ())
-            continue;
+         if (!entry.contains (fname))
+            order << fname;
+         entry [fname] = line.mid (pos + 1);
+         }
+      }
+   readJournal (order, entry);
+
+   // this is what is now on disc, so later changes are relative to it
+   _written_order = order;
+   _written = entry;
 
-         if (!addToExistingFile (fname))
-            {
-            f = createFile (_dir, fname);
-            line = line.mid (pos + 1);
-            f->decodeFile (line, read_sizes);
-            _files << f;
-            }
+   foreach (QString fname, order)
+      {
+      line = entry [fname];
+
+      // skip anything truncated by a crash
+      QFile test (_dir + fname);
+      if (!test.exists () || line.count (',') < 2)
+         continue;
+
+      if (!addToExistingFile (fname))
+         {
+         f = createFile (_dir, fname);
+         f->decodeFile (line, read_sizes);
+         _files << f;
+         indexFile (f);
          }
       }
 
@@ -417,10 +485,129 @@ void Desk::readDesk (bool read_sizes)
    }
 
 
+void Desk::readJournal (QStringList &order, QHash<QString, QString> &entry)
+   {
+   QFile file (_dir + JOURNAL_FNAME);
+   QString line, fname;
+   QByteArray data;
+   int pos, good;
+
+   _journal_count = 0;
+   if (!file.open (QIODevice::ReadOnly))
+      return;
+   data = file.readAll ();
+   file.close ();
+
+   /* drop anything after the last complete line, which we might have been
+      writing when we crashed, so that the next line is not joined onto it */
+   good = data.lastIndexOf ('\n') + 1;
+   if (good != data.size ())
+      {
+      data.truncate (good);
+      file.resize (good);
+      }
+
+   QTextStream stream (data);
+
+   // appendJournal() writes UTF-8
+   stream.setCodec ("UTF-8");
+   while (!stream.atEnd ())
+      {
+      line = stream.readLine ();
+      pos = line.indexOf ('=');
+      if (pos == -1)
+         continue;
+      fname = line.left (pos);
+      line = line.mid (pos + 1);
+      if (line.isEmpty ())
+         {
+         order.removeAll (fname);
+         entry.remove (fname);
+         }
+      else
+         {
+         if (!entry.contains (fname))
+            order << fname;
+         entry [fname] = line;
+         }
+      _journal_count++;
+      }
+   }
+
+
+QString Desk::encodeEntry (File *f)
+   {
+   QString line;
+   QTextStream stream (&line);
+
+   f->encodeFile (stream);
+   stream.flush ();
+   return line.mid (f->filename ().length () + 1).trimmed ();
+   }
+
+
+bool Desk::appendJournal (void)
+   {
+   QStringList order, expect, changes;
+   QHash<QString, QString> entry;
+   QString fname, value;
+
+   // only files which have changed need to be encoded again
+   foreach (File *f, _files)
+      {
+      fname = f->filename ();
+      if (!f->entryChanged () && _written.contains (fname))
+         value = _written [fname];
+      else
+         value = encodeEntry (f);
+      order << fname;
+      entry.insert (fname, value);
+      if (!_written.contains (fname) || _written [fname] != value)
+         changes << fname + '=' + value;
+      }
+
+   // removed files get an empty entry
+   foreach (fname, _written_order)
+      if (entry.contains (fname))
+         expect << fname;
+      else
+         changes << fname + '=';
+
+   /* replaying the journal adds new files at the end, so if anything else
+      has moved we must write the desk out in full */
+   foreach (fname, order)
+      if (!_written.contains (fname))
+         expect << fname;
+   if (expect != order
+       || _journal_count + changes.size () > qMax (JOURNAL_MIN, order.size ()))
+      return false;
+
+   if (changes.size ())
+      {
+      QFile file (_dir + JOURNAL_FNAME);
+
+      if (!file.open (QIODevice::WriteOnly | QIODevice::Append))
+         return false;
+      QByteArray data = (changes.join ("\n") + "\n").toUtf8 ();
+      if (file.write (data) != data.size ())
+         return false;
+      _journal_count += changes.size ();
+      }
+   foreach (File *f, _files)
+      f->entryWritten ();
+   _written_order = order;
+   _written = entry;
+   _dirty = false;
+   return true;
+   }
+
+
 bool Desk::writeDesk (void)
    {
    QFile file;
-   QString fname;
+   QString fname, value;
+   QStringList order;
+   QHash<QString, QString> entry;
 
    // remove any old file
    fname = _dir + "/maxdesk.ini";
@@ -429,16 +616,14 @@ bool Desk::writeDesk (void)
       file.remove ();
    fname = _dir + "/MaxDesk.ini";
    file.setFileName (fname);
-   if (file.exists ())
-      file.remove ();
-   file.setFileName (_dir + DESK_FNAME);
    if (file.exists ())
       file.remove ();
 
-   QTextStream stream( &file );
-   QString line;
+   // write to a new file and rename it over the old one at the end
+   QSaveFile save (_dir + DESK_FNAME);
+   QTextStream stream (&save);
 
-   if (!file.open (QIODevice::WriteOnly))
+   if (!save.open (QIODevice::WriteOnly))
       return false;
 
    // write header
@@ -453,7 +638,25 @@ bool Desk::writeDesk (void)
 
    // output the file list
    foreach (File *f, _files)
-      f->encodeFile (stream);
+      {
+      value = encodeEntry (f);
+      stream << f->filename () << '=' << value << endl;
+      order << f->filename ();
+      entry.insert (f->filename (), value);
+      }
+   stream.flush ();
+   if (!save.commit ())
+      return false;
+   foreach (File *f, _files)
+      f->entryWritten ();
+
+   // the journal is now included in the desk file
+   file.setFileName (_dir + JOURNAL_FNAME);
+   if (file.exists ())
+      file.remove ();
+   _journal_count = 0;
+   _written_order = order;
+   _written = entry;
 
    _dirty = false; // we are clean again
    return true;
@@ -462,48 +665,35 @@ bool Desk::writeDesk (void)
 
 void Desk::flush (void)
    {
-   if (_dirty)
+   if (_dirty && !_dir.isEmpty () && !appendJournal ())
       writeDesk ();
    }
 
 
 File *Desk::takeAt (int row)
    {
+   File *f = _files.takeAt (row);
+
    dirty ();
-   return _files.takeAt (row);
+   unindexFile (f, f->filename ());
+   return f;
    }
 
 
 File *Desk::findFile (QString fileName)
    {
-   QString base, ext;
-   int pagenum;
-
-   File::decodePageNumber (fileName, base, pagenum, ext);
+   File *f = _byname.value (fileName);
 
-   foreach (File *f, _files)
-      {
-      if (f->filename () == fileName)
-         return f;
-      if (!f->extMatchesType (ext))
-         continue;
-      if (f->claimFileAsNewPage (fileName, base, pagenum))
-         return f;
-      }
-   return 0;
+   return f ? f : claimFile (fileName);
    }
 
 
 File *Desk::findFile (QString fileName, int &pos)
    {
-   pos = 0;
-   foreach (File *f, _files)
-      {
-      if (f->filename () == fileName)
-         return f;
-      pos++;
-      }
-   return 0;
+   File *f = _byname.value (fileName);
+
+   pos = f ? _files.indexOf (f) : _files.size ();
+   return f;
    }
 
 
@@ -534,6 +724,7 @@ void Desk::addFile (QFileInfo &file, const QString &dir)
    f = createFile (dir, file.fileName ());
    f->setPos (_pos);
    _files << f;
+   indexFile (f);
 
   // qDebug() << "Adding: " << f->filename() << " : " << _pos;
 
@@ -897,6 +1088,7 @@ int Desk::newFile (File *fnew, File *fbase, int seq)
 
    fnew->setPos (pos);
    _files << fnew;
+   indexFile (fnew);
    dirty ();
    return _files.size () - 1; // item number we added it as
    }
@@ -2118,6 +2310,10 @@ void Desk::removeRows (int row, int count)
    {
    // qDebug () << "passed this " << count ;
    for (int i = 0; i < count; i++)
+      {
     //  qDebug() << _files.takeAt(i)->pathname();
-      _files.takeAt (row);
+      File *f = _files.takeAt (row);
+
+      unindexFile (f, f->filename ());
+      }
    }
@@ -32,7 +32,10 @@ X-Comment: On Debian GNU/Linux systems, the complete text of the GNU General
 #include "qpoint.h"
 #include "qsize.h"
 #include "qstring.h"
+#include <QHash>
 #include <QPixmap>
+#include <QSet>
+#include <QStringList>
 
 #include "err.h"
 
@@ -109,9 +112,12 @@ public:
       \param dirPath     the directory to search
       \param match       the string to match
       \param subdirs     true to also search subdirectories
-      \param operation   operation to update */
+      \param operation   operation to update
+      \param also        full paths of files to add even if their name does
+                         not match (e.g. because their text does) */
    void addMatches (const QString &dirPath, const QString &match,
-         bool subdirs = false, Operation *op = 0);
+         bool subdirs = false, Operation *op = 0,
+         const QSet<QString> &also = QSet<QString> ());
 
    /** read the maxdesk.ini file which contains positional and size
       information for each stack in the directory
@@ -123,7 +129,10 @@ public:
    void updatePosResize (int newWidth, QString match);
 
 
-   /** write the maxdesk.ini file */
+   /** write the maxdesk.ini file. This replaces the file atomically and
+       folds in (then removes) any journal
+
+      \returns true if ok, false if the file could not be written */
    bool writeDesk (void);
 
    // allocate and zero a new file structure
@@ -188,6 +197,12 @@ public:
    /** similar to the above but also returns the file position */
    File *findFile (QString fileName, int &pos);
 
+   /** update the index after a file has been renamed
+
+      \param f         the file
+      \param oldname   its previous filename */
+   void renameFile (File *f, const QString &oldname);
+
    File *getFile (int itemnum);
 
    int rowCount (void);          //!< our 'official' record of row count
@@ -528,7 +543,9 @@ public:
        filesystem */
    void dirty (void);
 
-   /** flush the desk to the filesystem */
+   /** flush the desk to the filesystem. Usually this just appends the
+       changed entries to the journal, but sometimes the whole maxdesk.ini
+       file is written instead (see writeDesk()) */
    void flush (void);
 
    /** advance the current position to the next free space */
@@ -555,6 +572,50 @@ private:
 
    bool addToExistingFile (QString &fname);
 
+   /** find a file which can claim a filename as a new page
+
+      \param fname   filename to claim
+      \returns the file which claimed it, or 0 if none */
+   File *claimFile (const QString &fname);
+
+   //! add a file to the index
+   void indexFile (File *f);
+
+   /** remove a file from the index
+
+      \param f      the file
+      \param fname  filename it was indexed under */
+   void unindexFile (File *f, const QString &fname);
+
+   /** get the key used to index a file which has a page number
+
+      \param fname  filename
+      \param type   file type
+      \returns key, or empty string if the filename has no page number */
+   static QString baseKey (const QString &fname, int type);
+
+   /** get the maxdesk.ini entry for a file (the part after the '=')
+
+      \param f      file to encode
+      \returns entry */
+   QString encodeEntry (File *f);
+
+   /** read the journal, applying each change to a list of desk entries.
+       A journal line is a desk entry, which is added to the end of the list
+       if not already there. An empty entry removes the file from the list
+
+      \param order  list of filenames in desk order, updated
+      \param entry  desk entry for each filename, updated */
+   void readJournal (QStringList &order, QHash<QString, QString> &entry);
+
+   /** append any entries which have changed since the last write to the
+       journal
+
+      \returns true if ok, false if we need to write the whole desk instead,
+               because the files have been reordered, the journal is getting
+               large or it could not be written */
+   bool appendJournal (void);
+
 
 #if 0
    err_info *scan_file (QString dir_name, QFileInfo *fi,
@@ -595,6 +656,11 @@ private:
    int _fbase_seq;      //!< current sequence number with respect to base file (0 for none)
    QString _trash_dir;  //!< current trash directory
    bool _dirty;         //!< true if the desk has been changed and we must write it back
+   QStringList _written_order;   //!< filenames on disc (desk file + journal), in order
+   QHash<QString, QString> _written;  //!< desk entry on disc for each filename
+   int _journal_count;  //!< number of entries in the journal
+   QHash<QString, File *> _byname;    //!< each file by filename
+   QMultiHash<QString, File *> _bybase;  //!< files with a page number, by baseKey()
    };
 
 
@@ -166,6 +166,7 @@ is about to be loaded and any prior changes will be lost.
 typedef struct measure_info
    {
    bool valid;          //!< true if the item data is fully loaded (not just a placeholder)
+   bool have_pixmap;    //!< true if the preview is available (perhaps from the cache before loading)
    QString title;       //!< stack title (excludes filename extension)
    QString pagename;    //!< current page name
    QString pagestr;     //!< page number string (e.g. '4 of 9')
@@ -197,6 +198,7 @@ void Desktopdelegate::measureItem (const QStyleOptionViewItem &option, const QMo
    QAbstractItemModel *model = (QAbstractItemModel *)index.model ();
    Q_ASSERT (model);
    measure.valid = model->data (index, Desktopmodel::Role_valid).toBool ();
+   measure.have_pixmap = model->data (index, Desktopmodel::Role_have_pixmap).toBool ();
    measure.title = index.model ()->data (index, Qt::DisplayRole).toString ();
    measure.pagenum = index.model ()->data (index, Desktopmodel::Role_pagenum).toInt ();
    measure.title_maxsize = model->data (index, Desktopmodel::Role_title_maxsize).toSize ();
@@ -528,7 +530,7 @@ void Desktopdelegate::paint (QPainter *painter, const QStyleOptionViewItem &opti
 
      }*/
 
-   if (measure.valid)
+   if (measure.have_pixmap)
       style->drawItemPixmap (painter, measure.pixmapRect, Qt::AlignHCenter, measure.pm);
        //style->drawItemPixmap (painter, QRect(measure.pixmapRect.x(), measure.pixmapRect.y(), 100, 142), Qt::AlignHCenter, measure.pm);
 
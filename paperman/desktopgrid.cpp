@@ -0,0 +1,159 @@
+/*
+License: GPL-2
+  An electronic filing cabinet: scan, print, stack, arrange
+ Copyright (C) 2009 Simon Glass, chch-kiwi@users.sourceforge.net
+ .
+ This program is free software; you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation; either version 2 of the License, or
+ (at your option) any later version.
+ .
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+ .
+ You should have received a copy of the GNU General Public License
+ along with this program; if not, write to the Free Software
+ Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301 USA
+
+X-Comment: On Debian GNU/Linux systems, the complete text of the GNU General
+ Public License can be found in the /usr/share/common-licenses/GPL file.
+*/
+
+
+#include <algorithm>
+#include <functional>
+
+#include "desktopgrid.h"
+
+
+//! cells are (1 << CELL_SHIFT) pixels square, a little larger than an item
+#define CELL_SHIFT   8
+
+/** the delegate's idea of the item's extent may differ a little from the
+   rectangle we are given, so search this far around a point */
+#define CELL_MARGIN  32
+
+
+Desktopgrid::Desktopgrid ()
+   {
+   }
+
+
+Desktopgrid::~Desktopgrid ()
+   {
+   }
+
+
+void Desktopgrid::clear (void)
+   {
+   _rects.clear ();
+   _cells.clear ();
+   }
+
+
+void Desktopgrid::setCount (int count)
+   {
+   int row;
+
+   for (row = count; row < _rects.size (); row++)
+      updateCells (row, _rects [row], false);
+   _rects.resize (count);
+   }
+
+
+QRect Desktopgrid::cellRange (const QRect &rect) const
+   {
+   QRect area = rect.adjusted (-CELL_MARGIN, -CELL_MARGIN, CELL_MARGIN, CELL_MARGIN);
+
+   // round towards minus infinity, since items can have negative positions
+   return QRect (QPoint (area.left () >> CELL_SHIFT, area.top () >> CELL_SHIFT),
+                 QPoint (area.right () >> CELL_SHIFT, area.bottom () >> CELL_SHIFT));
+   }
+
+
+void Desktopgrid::updateCells (int row, const QRect &rect, bool add)
+   {
+   QRect range;
+   int x, y;
+
+   if (rect.isEmpty ())
+      return;
+   range = cellRange (rect);
+   for (y = range.top (); y <= range.bottom (); y++)
+      for (x = range.left (); x <= range.right (); x++)
+         {
+         QVector<int> &cell = _cells [cellKey (x, y)];
+
+         if (add)
+            cell.append (row);
+         else
+            {
+            cell.removeOne (row);
+            if (cell.isEmpty ())
+               _cells.remove (cellKey (x, y));
+            }
+         }
+   }
+
+
+void Desktopgrid::setItem (int row, const QRect &rect)
+   {
+   if (row >= _rects.size ())
+      _rects.resize (row + 1);
+   if (_rects [row] == rect)
+      return;
+   updateCells (row, _rects [row], false);
+   _rects [row] = rect;
+   updateCells (row, rect, true);
+   }
+
+
+QList<int> Desktopgrid::itemsAt (const QPoint &point) const
+   {
+   QList<int> rows;
+   QRect near;
+
+   QHash<quint64, QVector<int> >::const_iterator it
+         = _cells.find (cellKey (point.x () >> CELL_SHIFT,
+                                point.y () >> CELL_SHIFT));
+   if (it == _cells.end ())
+      return rows;
+   foreach (int row, *it)
+      {
+      near = _rects [row].adjusted (-CELL_MARGIN, -CELL_MARGIN,
+            CELL_MARGIN, CELL_MARGIN);
+      if (near.contains (point))
+         rows << row;
+      }
+   std::sort (rows.begin (), rows.end (), std::greater<int> ());
+   return rows;
+   }
+
+
+QList<int> Desktopgrid::itemsIn (const QRect &rect) const
+   {
+   QVector<bool> seen (_rects.size ());
+   QList<int> rows;
+   QRect range;
+   int x, y;
+
+   range = cellRange (rect);
+   for (y = range.top (); y <= range.bottom (); y++)
+      for (x = range.left (); x <= range.right (); x++)
+         {
+         QHash<quint64, QVector<int> >::const_iterator it
+               = _cells.find (cellKey (x, y));
+
+         if (it != _cells.end ())
+            foreach (int row, *it)
+               if (!seen [row] && _rects [row].intersects (rect))
+                  {
+                  seen [row] = true;
+                  rows << row;
+                  }
+         }
+   std::sort (rows.begin (), rows.end ());
+   return rows;
+   }
@@ -0,0 +1,109 @@
+/*
+License: GPL-2
+  An electronic filing cabinet: scan, print, stack, arrange
+ Copyright (C) 2009 Simon Glass, chch-kiwi@users.sourceforge.net
+ .
+ This program is free software; you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation; either version 2 of the License, or
+ (at your option) any later version.
+ .
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+ .
+ You should have received a copy of the GNU General Public License
+ along with this program; if not, write to the Free Software
+ Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301 USA
+
+X-Comment: On Debian GNU/Linux systems, the complete text of the GNU General
+ Public License can be found in the /usr/share/common-licenses/GPL file.
+*/
+/*
+   Project:    Maxview
+   File:       desktopgrid.h
+
+   This file implements a spatial index of the items on a desk.
+
+   The desk is divided into square cells and each item is recorded in every
+   cell that its rectangle touches. Finding the items under a point, or
+   within a rectangle, then only needs to look at a few cells rather than
+   every item on the desk.
+
+   Items are identified by their row in the model. Higher rows are drawn
+   on top of lower ones, so the row also gives the z-order.
+*/
+
+#ifndef __desktopgrid_h
+#define __desktopgrid_h
+
+
+#include <QHash>
+#include <QList>
+#include <QRect>
+#include <QVector>
+
+
+class Desktopgrid
+   {
+public:
+   Desktopgrid ();
+   ~Desktopgrid ();
+
+   //! remove all items
+   void clear (void);
+
+   /** set the number of items. New items are empty and are not in any cell
+
+      \param count     number of items (rows) */
+   void setCount (int count);
+
+   //! \returns the number of items
+   int count (void) const { return _rects.size (); }
+
+   /** set the rectangle of an item, moving it to the right cells
+
+      \param row       item row
+      \param rect      item rectangle, in contents coordinates */
+   void setItem (int row, const QRect &rect);
+
+   //! \returns the rectangle of an item
+   QRect itemRect (int row) const { return _rects [row]; }
+
+   /** find the items which might contain a point. Since item rectangles
+       are only approximate, the caller should check each one
+
+      \param point     point to check, in contents coordinates
+      \returns rows of items near the point, topmost first */
+   QList<int> itemsAt (const QPoint &point) const;
+
+   /** find the items which intersect a rectangle
+
+      \param rect      rectangle to check, in contents coordinates
+      \returns rows of items intersecting the rectangle, in row order */
+   QList<int> itemsIn (const QRect &rect) const;
+
+private:
+   /** add an item to, or remove it from, all the cells its rectangle
+       touches
+
+      \param row       item row
+      \param rect      item rectangle
+      \param add       true to add, false to remove */
+   void updateCells (int row, const QRect &rect, bool add);
+
+   //! \returns the cells touched by a rectangle, as (left, top, right, bottom)
+   QRect cellRange (const QRect &rect) const;
+
+   //! \returns the key for a cell
+   static quint64 cellKey (int x, int y)
+      { return (quint64)(quint32)x << 32 | (quint32)y; }
+
+private:
+   QVector<QRect> _rects;     //!< rectangle of each item, by row
+   QHash<quint64, QVector<int> > _cells;  //!< rows in each cell
+   };
+
+
+#endif
@@ -54,6 +54,7 @@ X-Comment: On Debian GNU/Linux systems, the complete text of the GNU General
 #include "maxview.h"
 #include "op.h"
 #include "paperstack.h"
+#include "textindex.h"
 #include "utils.h"
 
 
@@ -105,6 +106,11 @@ Desktopmodel::Desktopmodel(QObject *parent)
       this, SIGNAL (undoChanged ()));
 
    connect (_updateTimer, SIGNAL (timeout()), this, SLOT (nextUpdate ()));
+
+   _thumbnailer = new Thumbnailer (this);
+   connect (_thumbnailer, SIGNAL (ready (const QList<Thumbnailer::result_info> &)),
+            this, SLOT (previewsReady (const QList<Thumbnailer::result_info> &)));
+   connect (_thumbnailer, SIGNAL (idle ()), this, SLOT (previewsIdle ()));
    connect (qApp, SIGNAL (aboutToQuit ()),
                this, SLOT (aboutToQuit ()));
    if (!_unknown)
@@ -143,6 +149,22 @@ Desktopmodel::~Desktopmodel()
 #define FILE_INDEX(row,f) createIndex (row, 0, (void *)f)
 
 
+/** make sure that a stack is loaded before we look at its pages. A stack
+    whose preview came from the thumbnail cache is not loaded until something
+    needs it. As with a preview, if we can't load it, still mark it as valid
+    otherwise we will keep loading it
+
+   \param f    stack to check */
+static void ensure_loaded (File *f)
+   {
+   if (!f->valid () && f->hasPixmap ())
+      {
+      f->load ();
+      f->setValid (true);
+      }
+   }
+
+
 QVariant Desktopmodel::data(const QModelIndex &index, int role) const
    {
 //    qDebug () << "data" << index << role;
@@ -157,18 +179,18 @@ QVariant Desktopmodel::data(const QModelIndex &index, int role) const
 
 //    qDebug () << f->filename () << role;
 #ifdef CONFIG_delay_dirscan
-   // if we don't have valid information for this stack, make a note to get it
-   if (!f->valid () && role == Role_pixmap)
+   /* if we don't have valid information for this stack, ask for a preview.
+      This only happens when the item is painted, so visible items go to
+      the front of the queue */
+   if (!f->valid () && !f->hasPixmap () && role == Role_pixmap)
       {
       Desktopmodel *model = (Desktopmodel *)this;
 
       // don't add if already there (can happen with multiple redraws of an item)
-      if (!model->_pending_scan_list.contains (index))
+      if (!model->_pending_previews.contains (f->pathname ()))
          {
-         // restart the timer if not running
-         if (_pending_scan_list.isEmpty ())
-            _updateTimer->start (DELAY_TIME);
-         model->_pending_scan_list << index;
+         model->_pending_previews.insert (f->pathname (), index);
+         model->_thumbnailer->request (f, true);
          }
       }
 #endif // CONFIG_delay_dirscan
@@ -204,6 +226,7 @@ QVariant Desktopmodel::data(const QModelIndex &index, int role) const
          return f->pageTitle (-1);
 
       case Role_pagecount :
+         ensure_loaded (f);
          return f->pagecount ();
 
       case Role_title_maxsize :
@@ -233,6 +256,7 @@ QVariant Desktopmodel::data(const QModelIndex &index, int role) const
          QStringList name;
          int i;
 
+         ensure_loaded (f);
          for (i = 0; i < f->pagecount (); i++)
             name << f->pageTitle (i);
          return name;
@@ -241,6 +265,9 @@ QVariant Desktopmodel::data(const QModelIndex &index, int role) const
       case Role_valid :
          return f->valid ();
 
+      case Role_have_pixmap :
+         return f->valid () || f->hasPixmap ();
+
       case Role_droptarget :
          return _drop_target && index == *_drop_target;
 
@@ -336,6 +363,7 @@ bool Desktopmodel::setData(const QModelIndex &index, const QVariant &value, int
          {
          int newpage = value.toInt ();
 
+         ensure_loaded (f);
          if (newpage < 0)
             newpage = 0;
          if (newpage >= f->pagecount ())
@@ -762,6 +790,8 @@ void Desktopmodel::buildItem (QModelIndex index, const char* str)
 
 void Desktopmodel::aboutToQuit (void)
    {
+   Textindex::saveAll ();
+
    // we need to make sure that the maxdesk.ini file is saved
 /*FIXME: port this
    if (_desk)
@@ -1329,28 +1359,94 @@ void Desktopmodel::progress (const char *fmt, ...)
    }
 
 
-#ifdef CONFIG_delay_dirscan
-
-void Desktopmodel::nextUpdate (void)
+void Desktopmodel::previewsReady (const QList<Thumbnailer::result_info> &results)
    {
-   if (_pending_scan_list.isEmpty ())
+   QHash<QModelIndex, QList<int> > changed;
+
+   foreach (const Thumbnailer::result_info &res, results)
       {
-      // nothing to do, so finish
-      _updateTimer->stop ();
-      emit updateDone ();
+      QPersistentModelIndex ind = _pending_previews.take (res.key);
+      File *f = ind.isValid () ? getFile (ind) : 0;
+
+      // the stack may have been built or renamed since we asked
+      if (!f || f->valid () || f->pathname () != res.key
+          || (res.file && res.file->type () != f->type ()))
+         {
+         delete res.file;
+         continue;
+         }
+
+      /* a preview from the cache comes without the stack, which we leave
+         unloaded until something needs it, unless the page number has
+         moved on */
+      if (res.cached)
+         {
+         if (res.pagenum == f->pagenum ())
+            f->setPixmap (QPixmap::fromImage (res.image));
+         else
+            {
+            f->load ();
+            f->setValid (true);
+            f->pixmap (true);
+            }
+         changed [ind.parent ()] << ind.row ();
+         continue;
+         }
+
+      /* take over what the worker loaded. If it couldn't load it, still mark
+         it as valid otherwise we will keep loading it */
+      if (res.file)
+         {
+         f->adopt (res.file);
+         delete res.file;
+         }
+      f->setValid (true);
+      if (res.failed)
+         f->setErr ((err_info *)&res.err);
+
+      /* if the page number has moved on, or the stack can't be previewed
+         in the background, fall back to building it here */
+      if (res.pagenum != f->pagenum () || f->type () == File::Type_other)
+         f->pixmap (true);
+      else if (f->pagenum () < f->pagecount ())
+         f->setPixmap (res.image.isNull () ? QPixmap ()
+                       : QPixmap::fromImage (res.image));
+      changed [ind.parent ()] << ind.row ();
       }
-   else
+
+   // tell the view in as few signals as we can, one per run of rows
+   QHashIterator<QModelIndex, QList<int> > it (changed);
+   while (it.hasNext ())
       {
-      // build this one
-      QModelIndex ind = _pending_scan_list.takeFirst ();
+      it.next ();
+      QList<int> rows = it.value ();
+      int i, first;
 
-      if (ind.isValid ())
-         buildItem (ind);
-      _updateTimer->start (DELAY_TIME);
+      qSort (rows);
+      for (i = first = 0; i < rows.size (); i++)
+         if (i == rows.size () - 1 || rows [i + 1] != rows [i] + 1)
+            {
+            emit dataChanged (index (rows [first], 0, it.key ()),
+                              index (rows [i], 0, it.key ()));
+            first = i + 1;
+            }
       }
    }
 
-#else
+
+void Desktopmodel::previewsIdle (void)
+   {
+   if (_pending_previews.isEmpty ())
+      emit updateDone ();
+   }
+
+
+void Desktopmodel::cancelPendingPreviews (void)
+   {
+   foreach (const QString &key, _thumbnailer->cancelQueued ())
+      _pending_previews.remove (key);
+   }
+
 
 void Desktopmodel::nextUpdate (void)
    {
@@ -1399,8 +1495,6 @@ void Desktopmodel::nextUpdate (void)
       }
    }
 
-#endif
-
 
 void Desktopmodel::stopUpdate (void)
    {
@@ -1486,7 +1580,17 @@ QModelIndex Desktopmodel::refresh (QString dirPath, QString rootPath, int sizeWi
       desk->advance ();
       }
    qDebug () << "Refreshing...";
-   desk->addMatches (dirPath, match, subdirs, op);
+
+   // include stacks whose text matches, as well as those whose name does
+   QSet<QString> text_matches;
+   if (subdirs && !match.isEmpty () && !_rootPath.isEmpty ())
+      text_matches = Textindex::instance (_rootPath)->find (match).keys ()
+            .toSet ();
+   desk->addMatches (dirPath, match, subdirs, op, text_matches);
+
+   // pick up any stacks which have changed since we last indexed them
+   if (!subdirs && !_rootPath.isEmpty ())
+      Textindex::instance (_rootPath)->update (dirPath);
    if (add_items)
       {
       /* we are re-using the same subdir desk for the new search. All the
@@ -1503,8 +1607,9 @@ QModelIndex Desktopmodel::refresh (QString dirPath, QString rootPath, int sizeWi
 //    emit viewRefreshed ();
 
 #ifdef CONFIG_delay_dirscan
-   // no pending list at present
-   _pending_scan_list.clear ();
+   // no pending previews at present
+   cancelPendingPreviews ();
+   _pending_previews.clear ();
 #else
    // work out which item to add first
    _upto = 0;  //_items.size () > 0 ? 0 : -1;
@@ -1967,11 +2072,45 @@ bool Desktopproxy::filterAcceptsRow (int source_row, const QModelIndex& source_p
    if (!nm.endsWith(".pdf") && !nm.endsWith(".jpg") && !nm.endsWith(".jpeg") && !nm.endsWith(".max")){
        return false;
    }
+   if (textMatches (f))
+      return true;
 
    return QSortFilterProxyModel::filterAcceptsRow (source_row, source_parent);
    }
 
 
+bool Desktopproxy::textMatches (File *f) const
+   {
+   QString dir;
+   int pagenum;
+
+   if (_text_matches.isEmpty ())
+      return false;
+   if (_text_matches.contains (f->pathname ()))
+      return true;
+
+   // each page of a JPEG stack is in its own file
+   if (f->type () == File::Type_jpeg)
+      {
+      dir = QFileInfo (f->pathname ()).path () + "/";
+      for (pagenum = 1; pagenum < f->pagecount (); pagenum++)
+         if (_text_matches.contains (dir + f->pageFilename (pagenum)))
+            return true;
+      }
+   return false;
+   }
+
+
+void Desktopproxy::setTextMatches (const QSet<QString> &paths)
+   {
+   if (paths != _text_matches)
+      {
+      _text_matches = paths;
+      invalidateFilter ();
+      }
+   }
+
+
 void Desktopproxy::setRows (int parent_row, int child_count, QList<int> &rows)
    {
    _subset = true;
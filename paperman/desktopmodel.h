@@ -49,6 +49,9 @@ struct max_page_info;
 #include "qabstractitemmodel.h"
 
 #include <QSortFilterProxyModel>
+#include <QSet>
+
+#include "thumbnailer.h"
 
 
 class QUndoStack;
@@ -146,6 +149,7 @@ public:
       Role_keywords,          // QString  the keywords
       Role_notes,             // QString  the notes
       Role_error,             // QString  an error message, if available
+      Role_have_pixmap,       // bool     preview is available, even if the item has not been built
 
       Role_count,
       Role_type
@@ -462,6 +466,29 @@ public:
       \param pages   the page numbers to unstack, bit n is true to unstack page n */
    void deletePages (QModelIndex &ind, QBitArray &pages);
 
+   /** compact a list of stacks, so that they no longer contain space left
+       behind by deleted pages and other changes. This cannot be undone, and
+       if any stack is compacted it clears the undo stack, since earlier page
+       deletions can no longer be undone either. Stacks whose file type does
+       not support compaction are skipped, and reported in the error
+
+       Commits any pending scan
+
+      \param list    list of stacks to compact
+      \param parent  parent index
+      \returns       error, or NULL if none */
+   err_info *compactStacks (QModelIndexList &list, QModelIndex parent);
+
+   /** OCR all pages in a list of stacks which do not have any text yet, and
+       store the text in the stacks. This cannot be undone
+
+       Commits any pending scan
+
+      \param list    list of stacks to OCR
+      \param parent  parent index
+      \returns       error, or NULL if none */
+   err_info *ocrStacks (QModelIndexList &list, QModelIndex parent);
+
    /** create and execute a new undo record to move stacks to a new position.
        Supports undo
 
@@ -1177,6 +1204,11 @@ public:
       \param slist         list of indexes to add from parent model */
    void cloneModel (Desktopmodel *contents, QModelIndex parent);
 
+   /** drop any previews which have been requested but not started yet.
+       The view calls this when it scrolls, since the items that need a
+       preview will ask again when they are painted */
+   void cancelPendingPreviews (void);
+
 public slots:
 
    /** refresh the viewer with files from the given directory.
@@ -1205,6 +1237,14 @@ protected slots:
    /** add the next item in the maxview to the viewer */
    void nextUpdate (void);
 
+   /** handle a batch of previews from the thumbnailer. Each stack is
+       marked valid and given its pixmap, and the view is told about the
+       changed rows */
+   void previewsReady (const QList<Thumbnailer::result_info> &results);
+
+   //! called when the thumbnailer has nothing more to do
+   void previewsIdle (void);
+
    /** save the maxdesk file */
    void aboutToQuit (void);
 
@@ -1279,15 +1319,15 @@ protected:
    /** restore persistent model indexes (some may become invalid) */
    void restorePersistentIndexes (void);
 
-   /** email a set of files
-   
-      \param fname   filename to use for zip file (if required). The extension 
+   /** email a set of files. The files are copied into the message, so any
+       temporary ones can be deleted when this returns
+
+      \param fname   filename to use for zip file (if required). The extension
                      of this is ignored and replaced with .zip
       \param fnameList list of filenames to send (each a full path)
-      \param can_delete returns true if the original files can be deleted, 
-                     false if the email program wants them to stay around
+      \param receiver  address to send to
       \returns error or NULL if ok */
-   err_info *emailFiles (QString &fname, QStringList &fnamelist, bool &can_delete, QString receiver);
+   err_info *emailFiles (const QString &fname, QStringList &fnamelist, QString receiver);
 
 private:
    QList<Desk *> _desks;  //!< the model directories
@@ -1332,7 +1372,10 @@ private:
    QPixmap _unknown;
    QPixmap _no_access;
    QStringList _persistent_filenames;  //!< list of filename for each persistent model index (used when saving)
-   QList<QPersistentModelIndex> _pending_scan_list; //!< list of stacks which need to be scanned
+   Thumbnailer *_thumbnailer;   //!< generates stack previews in the background
+
+   //! stacks waiting for a preview, keyed by pathname
+   QHash<QString, QPersistentModelIndex> _pending_previews;
 
    /** this field should not be required any more. With the previous model
        revision, files were deleted in opDeleteStacks() before they were
@@ -1369,13 +1412,24 @@ public:
    // set up the proxy to include only the given rows from the parent
    void setRows (int parent_row, int child_count, QList<int> &rows);
 
+   /** set the stacks whose text matches the filter string. These are
+       included even if their name does not match
+
+      \param paths     full paths of matching stacks (see Textindex) */
+   void setTextMatches (const QSet<QString> &paths);
+
 protected:
    bool filterAcceptsRow (int source_row, const QModelIndex& source_parent) const;
 
+private:
+   //! \returns true if a file is in _text_matches
+   bool textMatches (File *f) const;
+
 private:
    QBitArray _rows;
    int _parent_row;
    bool _subset;
+   QSet<QString> _text_matches;  //!< stacks whose text matches the filter
    };
 
 
@@ -44,6 +44,7 @@ Desktopview::Desktopview (QWidget *parent)
    _auto_scrolling = false;
    _timer_id = 1;
    _position_items = true;
+   _grid_valid = false;
    setViewMode (IconMode);
 
     //setViewMode (ListMode);
@@ -155,11 +156,15 @@ QSize Desktopview::setPositions (const char* str)
       {
        qDebug() << "resetting... " << str;
 //       printf ("rows %d\n", model ()->rowCount (parent));
-      for (int i = 0; i < model ()->rowCount (parent); i++)
+
+      // the spatial index holds the positions, so we don't need the model
+      updateGrid ();
+      for (int i = 0; i < _grid.count (); i++)
          {
          ind = model ()->index (i, 0, parent);
-         QPoint p = model ()->data (ind, Desktopmodel::Role_position).toPoint ();
-         QSize size = model ()->data (ind, Desktopmodel::Role_maxsize).toSize ();
+         QRect rect = _grid.itemRect (i);
+         QPoint p = rect.topLeft ();
+         QSize size = rect.size ();
          setPositionForIndex (p, ind);
          size += QSize (p.x (), p.y ());
          maxsize = maxsize.expandedTo (size);
@@ -189,6 +194,8 @@ void Desktopview::dataChanged (const QModelIndex &topLeft, const QModelIndex &bo
       QPoint p = model ()->data (index, Desktopmodel::Role_position).toPoint ();
 //       printf ("   - row %d\n", row);
       setPositionForIndex (p, index);
+      if (_grid_valid && parent == rootIndex ())
+         updateGridItem (index);
       }
 
    // this is needed for stackItems()
@@ -206,10 +213,70 @@ void Desktopview::slotModelChanged ()
 void Desktopview::rowsInserted (const QModelIndex & parent, int start, int end)
    {
 //    printf ("rowInserted\n");
+   if (parent == rootIndex ())
+      _grid_valid = false;
    QListView::rowsInserted (parent, start, end);
    }
 
 
+void Desktopview::rowsAboutToBeRemoved (const QModelIndex & parent, int start, int end)
+   {
+   if (parent == rootIndex ())
+      _grid_valid = false;
+   QListView::rowsAboutToBeRemoved (parent, start, end);
+   }
+
+
+void Desktopview::reset (void)
+   {
+   _grid_valid = false;
+   QListView::reset ();
+   }
+
+
+void Desktopview::setRootIndex (const QModelIndex &index)
+   {
+   _grid_valid = false;
+   QListView::setRootIndex (index);
+   }
+
+
+void Desktopview::doItemsLayout (void)
+   {
+   _grid_valid = false;
+   QListView::doItemsLayout ();
+   }
+
+
+void Desktopview::updateGrid (void) const
+   {
+   QModelIndex parent = rootIndex ();
+   int count;
+
+   if (_grid_valid)
+      return;
+   _grid.clear ();
+   if (!model ())
+      return;
+   count = model ()->rowCount (parent);
+   _grid.setCount (count);
+   for (int i = 0; i < count; i++)
+      updateGridItem (model ()->index (i, 0, parent));
+   _grid_valid = true;
+   }
+
+
+void Desktopview::updateGridItem (const QModelIndex &index) const
+   {
+   QPoint p;
+   QSize size;
+
+   p = model ()->data (index, Desktopmodel::Role_position).toPoint ();
+   size = model ()->data (index, Desktopmodel::Role_maxsize).toSize ();
+   _grid.setItem (index.row (), QRect (p, size));
+   }
+
+
 QModelIndex Desktopview::indexAt (const QPoint &in_point) const
    {
    QModelIndex ind;
@@ -220,29 +287,22 @@ QModelIndex Desktopview::indexAt (const QPoint &in_point) const
 
    if (!model () || !_position_items)
       return QModelIndex ();
-   int count = model ()->rowCount (parent);
+   updateGrid ();
+   int count = _grid.count ();
    // convert point to contents coordinates
    point += QPoint (horizontalScrollBar ()->value (), verticalScrollBar ()->value ());
 
    if (count > 0)
       {
-      for (int i = count - 1; i >= 0; i--)
+      // only look at items near the point, topmost first
+      foreach (int row, _grid.itemsAt (point))
          {
-         ind = model ()->index (i, 0, parent);
-//          QRect rect = rectForIndex (ind);
-//          if (rect.contains (point))
-            {
-            QPoint p = model ()->data (ind, Desktopmodel::Role_position).toPoint ();
-            opt.rect = QRect (p.x (), p.y (), 1, 1); //QRect (rect.x (), rect.y ());
-            // check we really are inside the item - the delegate knows
-            if (del->containsPoint (opt, ind, point))
-               {
-               //static int upto = 0;
-
-//                qDebug () << upto++ << "row" << ind.row ();
-               return ind;
-               }
-            }
+         ind = model ()->index (row, 0, parent);
+         opt.rect = QRect (_grid.itemRect (row).topLeft (), QSize (1, 1));
+
+         // check we really are inside the item - the delegate knows
+         if (del->containsPoint (opt, ind, point))
+            return ind;
          }
       return QModelIndex ();
       }
@@ -250,6 +310,41 @@ QModelIndex Desktopview::indexAt (const QPoint &in_point) const
    }
 
 
+void Desktopview::setSelection (const QRect &rect,
+      QItemSelectionModel::SelectionFlags command)
+   {
+   QModelIndex parent = rootIndex (), ind;
+   QItemSelection selection;
+   QRect area;
+
+   if (!model () || !_position_items)
+      {
+      QListView::setSelection (rect, command);
+      return;
+      }
+
+   // a click selects only the item actually under the pointer
+   area = rect.normalized ();
+   if (area.width () <= 1 && area.height () <= 1)
+      {
+      ind = indexAt (area.topLeft ());
+      if (ind.isValid ())
+         selection.select (ind, ind);
+      }
+   else
+      {
+      updateGrid ();
+      area.translate (horizontalScrollBar ()->value (), verticalScrollBar ()->value ());
+      foreach (int row, _grid.itemsIn (area))
+         {
+         ind = model ()->index (row, 0, parent);
+         selection.select (ind, ind);
+         }
+      }
+   selectionModel ()->select (selection, command);
+   }
+
+
 void Desktopview::dropEvent (QDropEvent* event)
    {
    QAbstractItemModel *model = this->model ();
@@ -356,6 +451,18 @@ void Desktopview::resizeEvent (QResizeEvent *event)
    }
 
 
+void Desktopview::scrollContentsBy (int dx, int dy)
+   {
+   Desktopmodel *dmodel = model () ? _modelconv->getDesktopmodel (model ()) : 0;
+
+   QListView::scrollContentsBy (dx, dy);
+
+   // items now on screen will request their previews again when painted
+   if (dmodel)
+      dmodel->cancelPendingPreviews ();
+   }
+
+
 #define AUTOSCROLL_PERIOD 100
 
 void Desktopview::checkAutoscroll (QPoint pos)
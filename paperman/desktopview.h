@@ -29,6 +29,8 @@ X-Comment: On Debian GNU/Linux systems, the complete text of the GNU General
 #include <QListView>
 // #include <QTreeView>
 
+#include "desktopgrid.h"
+
 class Desktopmodelconv;
 
 
@@ -105,6 +107,12 @@ public:
    /** returns the index at the given position */
    QModelIndex indexAt (const QPoint &point) const;
 
+   //! the model has been reset, so forget item positions
+   void reset (void);
+
+   //! change the directory being shown
+   void setRootIndex (const QModelIndex &index);
+
    /** arrange all items in the directory by the given sort order */
    void arrangeBy (int type);
 
@@ -150,6 +158,8 @@ public slots:
 
    void rowsInserted (const QModelIndex & parent, int start, int end);
 
+   void rowsAboutToBeRemoved (const QModelIndex & parent, int start, int end);
+
    void slotIndexesMoved (const QModelIndexList & indexes);
 
    /** the model has been changed in some way - we reposition items */
@@ -168,6 +178,10 @@ protected:
    //! handle resizing the view (we adjust the scroll steps)
    void resizeEvent (QResizeEvent *event);
 
+   /** handle scrolling the view. Queued preview requests are cancelled
+       since they are likely for items which are no longer visible */
+   void scrollContentsBy (int dx, int dy);
+
    /** handle moving the mouse when dragging (we change the cursor
        and autoscroll) */
    void dragMoveEvent (QDragMoveEvent *event);
@@ -187,6 +201,15 @@ protected:
    //! update the view size based on the items within it
    void updateGeometries (void);
 
+   /** select the items within a rectangle, using the spatial index
+
+      \param rect      rectangle in viewport coordinates
+      \param command   how to change the selection */
+   void setSelection (const QRect &rect, QItemSelectionModel::SelectionFlags command);
+
+   //! lay out the items again (e.g. when the model is sorted)
+   void doItemsLayout (void);
+
    //! handle a timer event (used for autoscrolling)
    void timerEvent (QTimerEvent *event);
 
@@ -196,6 +219,15 @@ protected slots:
 private:
    void checkAutoscroll (QPoint pos);
 
+   /** rebuild the spatial index from the model if it is out of date. This
+       is the only place where every row is read from the model */
+   void updateGrid (void) const;
+
+   /** update the spatial index entry for a row from the model
+
+      \param index     model index of the item */
+   void updateGridItem (const QModelIndex &index) const;
+
 private:
    QPersistentModelIndex _context_index;    //!< item that context menu was opened on
    int _timer_id;          //!< event timer
@@ -205,6 +237,8 @@ private:
    int _sel_summary;   //!< last caculated selection summary
    bool _position_items;   //!< true to position items where we want them
    bool _size_flag = false;    ///first time returns wrong size fo skip it
+   mutable Desktopgrid _grid;    //!< spatial index of item positions
+   mutable bool _grid_valid;     //!< true if _grid matches the model
    };
 
 
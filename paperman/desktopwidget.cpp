@@ -68,6 +68,7 @@ X-Comment: On Debian GNU/Linux systems, the complete text of the GNU General
 #include "maxview.h"
 #include "pagewidget.h"
 #include "senddialog.h"
+#include "textindex.h"
 #include "utils.h"
 
 
@@ -320,6 +321,8 @@ void Desktopwidget::addActions(void)
    addAction (_act_unstack_all, "&Unstack all", SLOT(unstackStacks ()), "Ctrl+U");
    addAction (_act_rename_stack, "&Rename stack", SLOT(renameStack ()), "F2");  //"F2,Ctrl+R");
    addAction (_act_rename_page, "Re&name page", SLOT (renamePage ()), "Shift+F2");
+   addAction (_act_compact, "&Compact stack", SLOT (compactStacks ()), "");
+   addAction (_act_ocr, "&OCR stack", SLOT (ocrStacks ()), "");
 
    addAction (_act_duplicate_page, "Duplicate p&age", SLOT (duplicatePage ()), "Ctrl+Shift+I");
    addAction (_act_duplicate_max, "as &Max", SLOT (duplicateMax ()), "Ctrl+Shift+D");
@@ -1129,6 +1132,7 @@ void Desktopwidget::matchUpdate (QString match, bool subdirs, bool reset)
    if (subdirs || reset)
       {
        qDebug()<<"yes:";
+      _proxy->setTextMatches (QSet<QString> ());
       _proxy->setFilterFixedString ("");
 //       _updating = true;
       if (subdirs) // this might take a long time
@@ -1149,9 +1153,25 @@ void Desktopwidget::matchUpdate (QString match, bool subdirs, bool reset)
    else
       {
       QModelIndex ind;
+      QMap<QString, QList<int> > text_matches;
+      int pages = 0;
+
       qDebug()<<"no:";
+
+      // look for stacks whose text matches, as well as their name
+      QModelIndex root = _model->findRoot (index);
+      QString root_path = _model->data (root, QDirModel::FilePathRole).toString ();
+      if (!match.isEmpty () && !root_path.isEmpty ())
+         text_matches = Textindex::instance (root_path)->find (match);
+      foreach (const QList<int> &list, text_matches)
+         pages += list.size ();
+      if (pages)
+         emit newContents (tr ("Text found on %1 page(s) in %2 stack(s)")
+               .arg (pages).arg (text_matches.size ()));
+
       // update the proxy
       qDebug () << "match" << match;
+      _proxy->setTextMatches (text_matches.keys ().toSet ());
       _proxy->setFilterFixedString (match);
 
       // scroll to the first match
@@ -1262,6 +1282,12 @@ void Desktopwidget::slotPopupMenu (QModelIndex &index)
    context_menu->addAction (_act_rename_page);
    _act_rename_page->setEnabled (_view->isSelection (Desktopview::SEL_one_multipage));
 
+   context_menu->addAction (_act_compact);
+   _act_compact->setEnabled (at_least_one);
+
+   context_menu->addAction (_act_ocr);
+   _act_ocr->setEnabled (at_least_one);
+
    QMenu *submenu = context_menu->addMenu (tr ("&Duplicate..."));
    submenu->addAction (_act_duplicate_page);
    _act_duplicate_page->setEnabled (at_least_one);
@@ -1564,6 +1590,33 @@ void Desktopwidget::deleteStacks (void)
    }
 
 
+void Desktopwidget::compactStacks (void)
+   {
+   QModelIndex parent = _view->rootIndexSource ();
+   QModelIndexList list = _view->getSelectedListSource ();
+   int ok;
+
+   ok = QMessageBox::question(
+            this,
+            tr("Confirmation -- maxview"),
+            tr("Compacting %n stack(s) will clear the undo history. Continue?",
+               "", list.size ()),
+            QMessageBox::Ok, QMessageBox::Cancel);
+
+   if (ok == QMessageBox::Ok)
+      err_complain (_contents->compactStacks (list, parent));
+   }
+
+
+void Desktopwidget::ocrStacks (void)
+   {
+   QModelIndex parent = _view->rootIndexSource ();
+   QModelIndexList list = _view->getSelectedListSource ();
+
+   err_complain (_contents->ocrStacks (list, parent));
+   }
+
+
 void Desktopwidget::unstackStacks (void)
    {
    QModelIndex parent = _view->rootIndexSource ();
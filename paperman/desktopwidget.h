@@ -340,6 +340,12 @@ private slots:
    //! delete selected stacks
    void deleteStacks (void);
 
+   //! compact the selected stacks, removing unused space
+   void compactStacks (void);
+
+   //! OCR the selected stacks, storing the text in them
+   void ocrStacks (void);
+
    //! unstack selected stacks
    void unstackStacks (void);
 
@@ -435,7 +441,7 @@ private:
    QAction *_act_rename_stack, *_act_rename_page, *_act_duplicate_page;
    QAction *_act_duplicate_max, *_act_duplicate_pdf, *_act_duplicate_tiff;
    QAction *_act_duplicate_odd, *_act_duplicate_even;
-   QAction *_act_duplicate_jpeg;
+   QAction *_act_duplicate_jpeg, *_act_compact, *_act_ocr;
    QAction *_act_email, *_act_email_max, *_act_email_pdf;
    QAction *_act_send, *_act_deliver_out;
 
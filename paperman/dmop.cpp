@@ -33,6 +33,7 @@ X-Comment: On Debian GNU/Linux systems, the complete text of the GNU General
 
 #include <QFile>
 #include <QDir>
+#include <QFileInfo>
 #include <QProcess>
 #include <QThread>
 #include <QDebug>
@@ -142,6 +143,17 @@ err_info *Desktopmodel::opRestackStacks (QModelIndexList &list, QModelIndex pare
    int upto = 0;
    QModelIndex pind;
    int out_destpage = in_destpage; // destination page for first stack
+   int count = 0;
+
+   // the merge copies every page of each destination stack as well
+   for (int i = 0; i < list.size (); i++)
+      {
+      count += getFile (list [i])->pagecount ();
+      foreach (pind, pages_list [i])
+         if (pind != QModelIndex ())
+            count += getFile (pind)->pagecount ();
+      }
+   Operation op (tr ("Stacking"), count, 0);
 
    // work through each stack in the list
    foreach (ind, list)
@@ -160,7 +172,8 @@ err_info *Desktopmodel::opRestackStacks (QModelIndexList &list, QModelIndex pare
 
       QString finalPath=f->pathname();
       std::vector<std::string> fileNames;
-      fileNames.push_back(f->pathname().toStdString());
+      QModelIndexList merged;
+      fileNames.push_back(QFile::encodeName(f->pathname()).constData());
 
       //f->kill();
 
@@ -183,24 +196,27 @@ err_info *Desktopmodel::opRestackStacks (QModelIndexList &list, QModelIndex pare
 
 
 
-            fileNames.push_back(pdel->pathname().toStdString());
+            fileNames.push_back(QFile::encodeName(pdel->pathname()).constData());
 
            // Q_ASSERT (pind.isValid ());
           //  removeRows (pind.row (), 1, parent);
 
-            delete_list << pind;
+            merged << pind;
             }
          }
 
       f->setPagenum (old_pagenum);
       //f->close();
 
-      PDFCore p;
+      HummusPDFCore p;
 
       f->kill();
       //CALLB (f->stackItem (f));
-      int status=p.merge(fileNames,finalPath.toStdString());
-      printf(p.getErrorMsg().c_str());
+      // the original is left alone on failure, so keep the stacks too
+      if (!p.merge (fileNames, finalPath, &op))
+         delete_list << merged;
+      else if (!e)
+         e = err_make (ERRFN, ERR_pdf_creation_error1, p.getErrorMsg ().c_str ());
       f->setValid(false);
       f->load();
       buildItem (ind);
@@ -594,19 +610,23 @@ err_info *Desktopmodel::opStackTrash (QModelIndex &ind, QString &newname)
    QString finalPath = f->pathname();
    err_info *e = NULL;
 
-   PDFCore p;
+   HummusPDFCore p;
 
    f->kill();
    std::vector<std::string> fileNames;
-   fileNames.push_back(newname.toStdString());
-   fileNames.push_back(finalPath.toStdString());
+   fileNames.push_back(QFile::encodeName(newname).constData());
+   fileNames.push_back(QFile::encodeName(finalPath).constData());
 
-   int status = p.merge(fileNames,finalPath.toStdString());
-   printf(p.getErrorMsg().c_str());
+   if (p.merge (fileNames, finalPath))
+      e = err_make (ERRFN, ERR_pdf_creation_error1, p.getErrorMsg ().c_str ());
    f->setValid(false);
    f->load();
    buildItem (ind);
 
+   // keep the page in the trash if we could not stack it
+   if (e)
+      return e;
+
    QFile file (newname);
 
    if (file.exists () && !file.remove ())
@@ -821,49 +841,11 @@ err_info *Desktopmodel::opDeletePages (QModelIndex &ind, QBitArray &pages,
       QByteArray &del_info, int &count)
    {
    File *f = getFile (ind);
-   qDebug() << "Step 1";
    err_info *e = NULL;
 
    if (f)
       {
-
-       HummusPDFCore p;
-       int sz = f->pagecount();
-       qDebug() << "Step 2";
-
-       QString pname = f->pathname();
-       qDebug() << "Step 3";
-
-
-       f->kill();
-       qDebug() << "Step 4";
-
-       //std::vector<std::string> fileNames;
-       //fileNames.push_back(pname.toStdString());
-       //fileNames.push_back("C:/Users/Ayman/Documents/ZeyChem.pdf");
-
-
-       //int status = p.merge(fileNames, pname.toStdString());
-       //int status=p.remove(pname.toStdString(), i);
-       //qDebug(p.getErrorMsg().c_str());
-
-       /*for (int i = sz - 1; i >=0  ; i--)
-          if (pages.testBit (i)){
-              //int status = p.merge(fileNames, pname.toStdString());
-              int status=p.remove(pname.toStdString(), i);
-              qDebug(p.getErrorMsg().c_str());
-          }*/
-
-       qDebug() << "Remove page: " << pname << " : " << pages;
-       int status=p.remove(pages, pname.toStdString());
-       qDebug(p.getErrorMsg().c_str());
-
-      f->setValid(false);
-      f->load();
-
-       //f->kill();
-      //e = f->removePages (pages, del_info, count);
-     // f->load();
+      e = f->removePages (pages, del_info, count);
       buildItem (ind);
       getDesk (ind.parent ())->dirty ();
       }
@@ -931,10 +913,8 @@ err_info *Desktopmodel::opRenamePage (const QModelIndex &index, int pagenum, QSt
    }
 
 
-err_info *Desktopmodel::emailFiles (QString &fname, QStringList &fnamelist, bool &can_delete, QString receiver)
+err_info *Desktopmodel::emailFiles (const QString &fname, QStringList &fnamelist, QString receiver)
 {
-   can_delete = true;
-
    QString mineStr = QCoreApplication::applicationDirPath() + "/mime.types";
    qDebug() << mineStr ;
    Email email(this, mineStr);
@@ -944,30 +924,16 @@ err_info *Desktopmodel::emailFiles (QString &fname, QStringList &fnamelist, bool
   // email.setSubject("Subject");
   // email.setMessageText("Body");
 
-   for (int i = 0; i < fnamelist.size(); i++){
-    email.addAttachment(fnamelist[i]);
-   }
-   email.openInDefaultProgram();
+   // if we have more than one file, use a zip. This is compressed straight
+   // into the email rather than into a temporary zip file
+   if (fnamelist.size () > 1)
+      email.addZipAttachment (QFileInfo (fname).completeBaseName () + ".zip",
+                              fnamelist);
+   else if (fnamelist.size ())
+      email.addAttachment (fnamelist [0]);
+   if (!email.openInDefaultProgram ())
+      return err_make (ERRFN, ERR_could_not_open_email_program);
 
-   return NULL;
-// if we have more than one file, use a zip
-   if (fnamelist.size () == 1)
-      {
-      fname = fnamelist [0];
-      can_delete = false;   // we need to keep the file for the email program
-      }
-   else
-      CALL (util_buildZip (fname, fnamelist));
-
-// call thunderbird
-   QStringList args;
-   args << "-compose"
-         << QString ("subject=Files,body=see attachment,attachment='file://%1'").arg (fname);
-
-   QProcess *myProcess = new QProcess();
-   myProcess->startDetached ("thunderbird", args);
-
-   //FIXME check for error in process
    return NULL;
 }
 
@@ -1012,17 +978,15 @@ err_info *Desktopmodel::opEmailFiles (QModelIndex parent, QModelIndexList &slist
       }
       op.setProgress (upto++);
    }
-   bool can_delete = false;
    if (!e)
-      e = emailFiles (fname, fname_list, can_delete, receiver);
+      e = emailFiles (fname, fname_list, receiver);
 
-   // delete the files if we are allowed
-   if (can_delete)
-      foreach (QString fname, tmp_list)
-         {
-         QFile f (fname);
-         f.remove ();
-         }
+   // the message has its own copy of the files, so remove the temporary ones
+   foreach (QString fname, tmp_list)
+      {
+      QFile f (fname);
+      f.remove ();
+      }
    return e;
 }
 
@@ -36,6 +36,8 @@ X-Comment: On Debian GNU/Linux systems, the complete text of the GNU General
 #include "desktopmodel.h"
 #include "desktopundo.h"
 #include "file.h"
+#include "ocrbatch.h"
+#include "op.h"
 #include <QDebug>
 
 err_info *Desktopmodel::stackItems (QModelIndex dest, QModelIndexList &list,
@@ -183,6 +185,75 @@ void Desktopmodel::deletePages (QModelIndex &ind, QBitArray &pages)
    }
 
 
+err_info *Desktopmodel::compactStacks (QModelIndexList &list, QModelIndex parent)
+   {
+   err_info *err = NULL;
+   QStringList skipped;
+   bool compacted = false;
+
+   _modelconv->assertIsSource (0, &parent, &list);
+   if (!checkScanStack (list, parent))
+      return NULL;
+   foreach (const QModelIndex &ind, list)
+      {
+      File *f = getFile (ind);
+
+      if (!f)
+         continue;
+      err = f->compact ();
+
+      // some file types cannot be compacted, so just tell the user
+      if (err && err->errnum == ERR_no_available_for_this_file_type)
+         {
+         skipped << f->filename ();
+         err = NULL;
+         continue;
+         }
+      emit dataChanged (ind, ind);
+
+      // even on error, the stack may have been replaced
+      compacted = true;
+      if (err)
+         break;
+      }
+
+   /* the positions recorded for any deleted pages in compacted stacks are
+      now meaningless. The undo stack cannot drop individual commands, so it
+      is only cleared if something was compacted */
+   if (compacted)
+      _undo->clear ();
+   if (!err && skipped.size ())
+      err = err_make (ERRFN, ERR_stacks_not_compacted1,
+                      qPrintable (skipped.join (", ")));
+   return err;
+   }
+
+
+err_info *Desktopmodel::ocrStacks (QModelIndexList &list, QModelIndex parent)
+   {
+   err_info *err = NULL;
+
+   _modelconv->assertIsSource (0, &parent, &list);
+   if (!checkScanStack (list, parent))
+      return NULL;
+
+   Operation op (tr ("OCR"), listPagecount (list), 0);
+   Ocrbatch batch (op);
+
+   foreach (const QModelIndex &ind, list)
+      {
+      File *f = getFile (ind);
+
+      if (f)
+         err = batch.addFile (f);
+      emit dataChanged (ind, ind);
+      if (err)
+         break;
+      }
+   return err;
+   }
+
+
 void Desktopmodel::moveToDir (QModelIndexList &list, QModelIndex parent, QString &dir,
          QStringList &trashlist, bool copy)
    {
@@ -11,6 +11,52 @@
 #include <QDebug>
 
 #include "mimetypemanager.h"
+#include "zip.h"
+
+
+//! Amount of an attachment to read at a time (a multiple of 57, which encodes to one line)
+#define ATTACHMENT_CHUNK (57 * 1024)
+
+
+/**
+  * A write-only device which base64-encodes everything written to it into
+  * another device, in lines of 76 characters.
+  */
+class Base64Writer : public QIODevice
+{
+public:
+    explicit Base64Writer(QIODevice* target) : target(target) { open(QIODevice::WriteOnly); }
+
+    bool isSequential() const { return true; }
+
+    void close()
+    {
+        // the last line may be short and padded
+        if (!pending.isEmpty())
+            target->write(pending.toBase64().append("\r\n"));
+        pending.clear();
+        QIODevice::close();
+    }
+
+protected:
+    qint64 readData(char*, qint64) { return -1; }
+
+    qint64 writeData(const char* data, qint64 len)
+    {
+        QByteArray out;
+        int i;
+
+        pending.append(data, len);
+        for (i = 0; i + 57 <= pending.size(); i += 57)
+            out.append(pending.mid(i, 57).toBase64()).append("\r\n");
+        pending.remove(0, i);
+        return target->write(out) == out.size() ? len : -1;
+    }
+
+private:
+    QIODevice* target;
+    QByteArray pending;     // input not yet making up a whole line
+};
 
 
 /**
@@ -23,9 +69,13 @@ Email::Email(QObject*parent, const QString& mimeTypesPath) :
 }
 
 /**
-  * \todo Documentation
+  * Writes the email to a temporary .eml file and opens it in the default mail
+  * client. Attachments are copied into the file, so they can be deleted once
+  * this returns.
+  *
+  * Returns true if the file was written and the mail client opened.
   */
-void Email::openInDefaultProgram()
+bool Email::openInDefaultProgram()
 {
     QString email = "Content-Type: multipart/alternative; boundary=\"BitshiftDynamicsMailerBoundary\"\r\n";
 
@@ -54,51 +104,83 @@ void Email::openInDefaultProgram()
     email.append(p.messageText);
     email.append("\r\n\r\n");
 
-    // Add attachments
-    foreach (QString filePath, p.attachments) {
-        QFileInfo fileInfo(filePath);
-        QString fileName   = fileInfo.fileName();
-        QString fileSuffix = fileInfo.suffix();
-        QString mimeType   = mimeTypes->mimeTypeFromExtension(fileSuffix);
+    // Create temporary file and open it in the user's default email composer
+    QString tmpFilePath = QDir::tempPath().append(QString("/ComposedEmail-%1.eml").arg(QDateTime::currentDateTime().toTime_t()));
+    QFile tmpFile(tmpFilePath);
+    if (tmpFile.open(QIODevice::WriteOnly) == false) {
+        qDebug() << "Failed opening temp file for email composing:" << tmpFilePath;
+
+        emit composerOpened(false);
+        return false;
+    }
 
+    tmpFile.write(email.toLatin1());
+
+    // Add attachments, encoding them straight into the file so that large
+    // ones never have to fit in memory
+    foreach (QString filePath, p.attachments) {
         QFile attachmentFile(filePath);
         if (attachmentFile.open(QIODevice::ReadOnly) == false) {
             qDebug() << "Failed loading attachment.";
 
+            tmpFile.remove();
             emit composerOpened(false);
-            return;
+            return false;
         }
 
-        QByteArray fileData = attachmentFile.readAll();
-        attachmentFile.close();
+        tmpFile.write(attachmentHeader(QFileInfo(filePath).fileName()).toLatin1());
 
-        email.append("\r\n--BitshiftDynamicsMailerBoundary\r\n");
-        email.append("Content-Type: multipart/mixed;\r\n");
-        email.append("        boundary=\"BitshiftDynamicsMailerBoundary\"\r\n\r\n");
-
-        email.append("--BitshiftDynamicsMailerBoundary\r\n");
-        email.append("Content-Disposition: inline;\r\n");
-        email.append("        filename=\"").append(fileName).append("\"\r\n");
-        email.append("Content-Type: ").append(mimeType).append(";\r\n");
-        email.append("        name=\"").append(fileName).append("\"\r\n");
-        email.append("Content-Transfer-Encoding: base64\r\n\r\n");
-
-        email.append(fileData.toBase64());
+        Base64Writer encoder(&tmpFile);
+        while (!attachmentFile.atEnd())
+            encoder.write(attachmentFile.read(ATTACHMENT_CHUNK));
+        encoder.close();
     }
 
+    // Zip attachments are compressed straight into the file too
+    for (int i = 0; i < p.zipAttachments.size(); i++) {
+        tmpFile.write(attachmentHeader(p.zipAttachments[i].first).toLatin1());
 
-    // Create temporary file and open it in the user's default email composer
-    QString tmpFilePath = QDir::tempPath().append(QString("/ComposedEmail-%1.eml").arg(QDateTime::currentDateTime().toTime_t()));
-    QFile tmpFile(tmpFilePath);
-    if (tmpFile.open(QIODevice::WriteOnly) == false) {
-        qDebug() << "Failed opening temp file for email composing:" << tmpFilePath;
+        Base64Writer encoder(&tmpFile);
+        Zip zip;
+        bool ok = zip.createArchive(&encoder, false) == Zip::Ok;
 
-        emit composerOpened(false);
-        return;
-    }
+        foreach (const QString& path, p.zipAttachments[i].second)
+            ok = ok && zip.addFile(path) == Zip::Ok;
+        ok = zip.closeArchive() == Zip::Ok && ok;
+        encoder.close();
+        if (!ok) {
+            qDebug() << "Failed zipping attachment" << p.zipAttachments[i].first;
 
-    tmpFile.write(email.toLatin1());
+            tmpFile.remove();
+            emit composerOpened(false);
+            return false;
+        }
+    }
     tmpFile.close();
 
-    emit composerOpened(QDesktopServices::openUrl(QUrl(tmpFilePath)));
+    bool opened = QDesktopServices::openUrl(QUrl::fromLocalFile(tmpFilePath));
+
+    emit composerOpened(opened);
+    return opened;
+}
+
+/**
+  * Returns the MIME headers which go before an attachment's base64 data.
+  */
+QString Email::attachmentHeader(const QString& fileName)
+{
+    QString mimeType = mimeTypes->mimeTypeFromExtension(QFileInfo(fileName).suffix());
+    QString header;
+
+    header.append("\r\n--BitshiftDynamicsMailerBoundary\r\n");
+    header.append("Content-Type: multipart/mixed;\r\n");
+    header.append("        boundary=\"BitshiftDynamicsMailerBoundary\"\r\n\r\n");
+
+    header.append("--BitshiftDynamicsMailerBoundary\r\n");
+    header.append("Content-Disposition: inline;\r\n");
+    header.append("        filename=\"").append(fileName).append("\"\r\n");
+    header.append("Content-Type: ").append(mimeType).append(";\r\n");
+    header.append("        name=\"").append(fileName).append("\"\r\n");
+    header.append("Content-Transfer-Encoding: base64\r\n\r\n");
+    return header;
 }
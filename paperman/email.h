@@ -26,7 +26,14 @@ public slots:
 
     void addAttachment(const QString& path)          { p.attachments.append(path); }
 
-    void openInDefaultProgram();
+    /**
+      * Adds a zip file containing the given files. The zip is compressed straight
+      * into the email, so no temporary copy is made.
+      */
+    void addZipAttachment(const QString& name, const QStringList& paths)
+                                                     { p.zipAttachments.append(qMakePair(name, paths)); }
+
+    bool openInDefaultProgram();
 
 signals:
     /**
@@ -36,6 +43,8 @@ signals:
     void composerOpened(bool successful);
 
 private:
+    QString attachmentHeader(const QString& fileName);
+
     EmailPrivate p;
     MimeTypeManager* mimeTypes;
 };
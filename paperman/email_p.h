@@ -7,7 +7,9 @@
 #define EMAILPRIVATE_H
 
 #include <QString>
+#include <QStringList>
 #include <QList>
+#include <QPair>
 
 
 /**
@@ -21,6 +23,7 @@ struct EmailPrivate
     QString messageText;
 
     QList<QString> attachments;
+    QList<QPair<QString, QStringList> > zipAttachments;   // zip name, files to put in it
 };
 
 #endif // EMAILPRIVATE_H
@@ -471,6 +471,22 @@ int epeg_copy(Epeg_Image *im, int width, int height, int stride)
    return 0;
 }
 
+/* decode the image at the size set by epeg_decode_size_set() and return a
+pointer to the pixels, which remain owned by the image. Lines are top-down,
+'stride' bytes apart, with 'components' bytes per pixel (1 for grey, 3 for
+RGB, 4 for CMYK). Returns NULL on error */
+
+const unsigned char *epeg_pixels_get(Epeg_Image *im, int *stride, int *components)
+{
+    if (_epeg_decode(im) != 0)
+        return NULL;
+    if (_epeg_scale(im) != 0)
+        return NULL;
+    *components = im->in.jinfo.output_components;
+    *stride = im->in.jinfo.output_width * *components;
+    return im->pixels;
+}
+
 /**
 * Set the output file path for the image when saved.
 * @param im A handle to an opened Epeg image.
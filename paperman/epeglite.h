@@ -123,6 +123,7 @@ void			epeg_quality_set(Epeg_Image *im, int quality, int smoothing);
 int				epeg_encode(Epeg_Image *im);
 int epeg_raw(Epeg_Image *im, int stride);
 int epeg_copy(Epeg_Image *im, int width, int height, int stride);
+const unsigned char *epeg_pixels_get(Epeg_Image *im, int *stride, int *components);
 void			epeg_file_output_set(Epeg_Image *im, const char *file);
 void
 epeg_memory_output_set(Epeg_Image *im, unsigned char **data, int *size);
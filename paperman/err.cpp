@@ -102,11 +102,22 @@ static const char *err_msg [ERR_count] =
    "Directory '%s' could not be added",
    "Directories '%s' and '%s' ('%s') overlap - dropping the latter",
    "Could not remove directory '%s'",
+   "Cannot listen on port %d: %s",
+   "Connection to '%s' failed: %s",
+   "Invalid transfer message type %d, length %d",
+   "Invalid transfer filename '%s'",
+   "Transfer data is for offset %llu, but %llu bytes are held",
+   "Server reported error: %s",
+   "These stacks were not compacted, since their file type does not support it: %s",
+   "Could not write the email or open it in your email program",
+   "A different file called '%s' has already been received",
    };
 
 
-static err_info static_err;
-static err_info static_copy;
+/* errors are made on worker threads as well as the GUI thread, so each
+thread has its own */
+static thread_local err_info static_err;
+static thread_local err_info static_copy;
 
 
 err_info *err_copy (err_info *err)
@@ -114,6 +114,15 @@ enum
    ERR_directory_could_not_be_added1,
    ERR_directories_and_overlap3,
    ERR_could_not_remove_dir1,
+   ERR_cannot_listen_on_port2,
+   ERR_connection_failed2,
+   ERR_invalid_transfer_message2,
+   ERR_invalid_transfer_filename1,
+   ERR_transfer_offset_mismatch2,
+   ERR_server_reported_error1,
+   ERR_stacks_not_compacted1,
+   ERR_could_not_open_email_program,
+   ERR_transfer_file_exists1,
 
    ERR_count
    };
@@ -30,6 +30,8 @@ X-Comment: On Debian GNU/Linux systems, the complete text of the GNU General
 #include <QPainter>
 #include <QPixmap>
 #include <QTextStream>
+#include <QThread>
+#include <QtConcurrent>
 
 #include "config.h"
 #include "desk.h"
@@ -42,6 +44,7 @@ X-Comment: On Debian GNU/Linux systems, the complete text of the GNU General
 #include "maxview.h"
 #include "mem.h"
 #include "op.h"
+#include "thumbcache.h"
 #include "utils.h"
 #include "hummuspdfcore.h"
 
@@ -116,6 +119,7 @@ void File::setup (void)
    _annot_loaded = false;
    _env_loaded = false;
    _ref_to = 0;
+   _entry_changed = true;
    }
 
 
@@ -148,6 +152,7 @@ void File::updateFilename (const QString &fname)
    _filename = fname;
    _leaf = removeExtension (_filename, _ext);
    _pathname = _dir + _filename;
+   _entry_changed = true;
    if (_ext == ".max")
       _basename = _leaf;
    else
@@ -294,6 +299,8 @@ void File::setPos (QPoint pos, const char* str)
       pos.setX (0);
    if (pos.y () < 0)
       pos.setY (0);
+   if (pos != _pos)
+      _entry_changed = true;
    _pos = pos;
    }
 
@@ -307,6 +314,7 @@ QString File::getAnnotName (e_annot type)
 void File::setPagenum (int pagenum)
    {
    _pagenum = pagenum;
+   _entry_changed = true;
    }
 
 
@@ -314,18 +322,21 @@ void File::setPreviewMaxsize (QSize size)
    {
 //    qDebug () << "setPreviewMaxsize" << size;
    _preview_maxsize = size;
+   _entry_changed = true;
    }
 
 
 void File::setTitleMaxsize (QSize size)
    {
    _title_maxsize = size;
+   _entry_changed = true;
    }
 
 
 void File::setPagenameMaxsize (QSize size)
    {
    _pagename_maxsize = size;
+   _entry_changed = true;
    }
 
 
@@ -469,18 +480,91 @@ void File::setValid (bool valid)
    }
 
 
+bool File::hasPixmap (void) const
+   {
+   return !_pixmap.isNull ();
+   }
+
+
 QPixmap File::pixmap (bool)
    {
    return *unknown;
    }
 
 
+void File::setPixmap (const QPixmap &pixmap)
+   {
+   _pixmap = pixmap;
+   }
+
+
+err_info *File::getCachedPreviewImage (int pagenum, QImage &image, bool blank)
+   {
+   Thumbcache *cache = Thumbcache::instance ();
+   QString path = _dir + pageFilename (pagenum);
+
+   // the cache only holds normal previews of what is on disc
+   if (blank || isDirty ())
+      return getPreviewImage (pagenum, image, blank);
+
+   if (cache->find (path, pagenum, image))
+      return NULL;
+   CALL (getPreviewImage (pagenum, image, false));
+   cache->insert (path, pagenum, image);
+   return NULL;
+   }
+
+
+bool File::isDirty (void)
+   {
+   return false;
+   }
+
+
+err_info *File::compact (void)
+   {
+   return not_impl ();
+   }
+
+
+err_info *File::putPageText (int, const QString &)
+   {
+   return not_impl ();
+   }
+
+
+err_info *File::getPreviewPixmap (int pagenum, QPixmap &pixmap, bool blank)
+   {
+   QImage image;
+
+   CALL (getCachedPreviewImage (pagenum, image, blank));
+   pixmap = QPixmap::fromImage (image);
+   return pixmap.isNull () ? err_make (ERRFN, ERR_failed_to_generate_preview_image) : NULL;
+   }
+
+
+QString File::pageFilename (int)
+   {
+   return _filename;
+   }
+
+
 int File::pagenum (void)
    {
    return _pagenum;
    }
 
 
+void File::adopt (File *other)
+   {
+   _size = other->_size;
+   _timestamp = other->_timestamp;
+   _valid = other->_valid;
+   setErr (other->_err);
+   other->_valid = false;
+   }
+
+
 err_info *File::err (void)
    {
    return _err;
@@ -591,7 +675,10 @@ err_info *File::rename (QString &fname, bool auto_rename)
    err = ::rename (qPrintable (oldname), qPrintable (newname));
    if (err)
       return err_make (ERRFN, ERR_could_not_execute1, "rename");
+   oldname = _filename;
    updateFilename (name);
+   if (_desk)
+      _desk->renameFile (this, oldname);
    fname = name;
    return NULL;
    }
@@ -927,15 +1014,85 @@ err_info *File::duplicateAny (File::e_type type, int odd_even, Operation &op, Fi
    }
 
 
+/** the result of compressing a page on the thread pool. Errors live in
+    thread-local storage, so the worker must copy its error out before it
+    moves on to something else */
+typedef struct copy_result
+   {
+   bool failed;                  //!< true if compression failed
+   err_info err;                 //!< the error, if failed
+   } copy_result;
+
+
+/** a page being converted by File::copyTo(). The page data refers to the
+    image, so we must keep it until the page has been written */
+typedef struct copy_job
+   {
+   QImage image;                 //!< decoded page image
+   Filepage *fp;                 //!< page to write
+   QFuture<copy_result> done;    //!< compression of the page
+   } copy_job;
+
+
+/** compress a page, on a pool thread
+
+   \param fp       page to compress
+   eturns result, including a copy of any error */
+static copy_result copy_compress (Filepage *fp)
+   {
+   copy_result res;
+   err_info *err;
+
+   err = fp->compress ();
+   res.failed = err != NULL;
+   if (err)
+      res.err = *err;
+   return res;
+   }
+
+
+/** wait for the first page in the pipeline to be compressed, then add it to
+    the new file
+
+   \param fnew     file to add to
+   \param pending  pages in the pipeline, in page order
+   \param op       operation to update with progress
+   \returns error, or NULL if ok */
+static err_info *copy_write (File *fnew, QList<copy_job> &pending,
+      Operation &op)
+   {
+   copy_job job = pending.takeFirst ();
+   copy_result res;
+   err_info *err;
+
+   // make our own copy of the worker's error
+   res = job.done.result ();
+   err = res.failed ? err_copy (&res.err) : NULL;
+   if (!err)
+      err = fnew->addPage (job.fp, false);
+   delete job.fp;
+   op.incProgress (1);
+   return err;
+   }
+
+
 err_info *File::copyTo (File *fnew, int odd_even, Operation &op, bool verbose)
    {
    int pagenum;
    int page_count = pagecount ();
+   QList<copy_job> pending;
+   err_info *err = NULL;
 
    // we may generate fewer pages than we receive
    int out_page_count = 0;
 
-   for (pagenum = 0; pagenum < page_count; pagenum++)
+   /* Pages are decoded and written here, one at a time, since neither file
+      is thread-safe. Compression is done by the thread pool, so that it
+      overlaps with decoding the following pages. We limit the number of
+      pages in flight, since each holds a full image */
+   int max_pending = qMax (2, QThread::idealThreadCount () + 1);
+
+   for (pagenum = 0; pagenum < page_count && !err; pagenum++)
       {
       if (verbose)
          printf ("\rpage %d/%d", pagenum + 1, page_count); fflush (stdout);
@@ -948,15 +1105,17 @@ err_info *File::copyTo (File *fnew, int odd_even, Operation &op, bool verbose)
       QImage image;
       QSize size, trueSize;
       int bpp;
-      Filepage *fp = createPage (fnew->type ());
 
-      CALL (getImage (pagenum, false, image, size, trueSize, bpp, false));
+      err = getImage (pagenum, false, image, size, trueSize, bpp, false);
+      if (err)
+         break;
 
       // if no image, do the next page
       if (image.isNull ())
          continue;
 
-      QByteArray ba = QByteArray::fromRawData ((const char *)image.bits (),
+      Filepage *fp = createPage (fnew->type ());
+      QByteArray ba = QByteArray::fromRawData ((const char *)image.constBits (),
                                                image.byteCount ());
 
 //       int stride = (trueSize.width () * bpp + 7) / 8;
@@ -968,11 +1127,36 @@ err_info *File::copyTo (File *fnew, int odd_even, Operation &op, bool verbose)
       fp->addData (image.width (), image.height (), image.depth (), stride,
             name, false, false, out_page_count, ba, ba.size ());
 
-      fp->compress ();
-      CALL (fnew->addPage (fp, false));
+      copy_job job;
+
+      job.image = image;
+      job.fp = fp;
+      job.done = QtConcurrent::run (copy_compress, fp);
+      pending << job;
       out_page_count++;
-      op.incProgress (1);
+
+      // write out pages which are ready, in order
+      while (!err && !pending.isEmpty ()
+             && (pending.size () >= max_pending
+                 || pending.first ().done.isFinished ()))
+         err = copy_write (fnew, pending, op);
+      }
+
+   // finish off the rest of the pages, but don't write any after an error
+   while (!pending.isEmpty ())
+      {
+      if (err)
+         {
+         copy_job job = pending.takeFirst ();
+
+         job.done.waitForFinished ();
+         delete job.fp;
+         }
+      else
+         err = copy_write (fnew, pending, op);
       }
+   if (err)
+      return err;
    fnew->flush ();
    fnew->load ();
    return NULL;
@@ -164,6 +164,14 @@ public:
 
    virtual void *kill (void) = 0;  // was desk->ensureMax
 
+   /** take over the loaded state of another File object for the same file,
+       so that a file loaded on another thread (e.g. by the Thumbnailer) need
+       not be loaded again. The other object is left unloaded, ready to be
+       deleted. Subclasses must call this base version
+
+      \param other   file to take state from, of the same type as this one */
+   virtual void adopt (File *other);
+
 
    /** create the file (on the filesystem). It doesn't need to be written to
        as we will call flush() later for that */
@@ -204,6 +212,14 @@ public:
 
    virtual err_info *getPageText (int pagenum, QString &str) = 0;
 
+   /** store the OCR text for a page, so that getPageText() returns it. The
+       file must be flushed afterwards
+
+      \param pagenum  page number
+      \param str      text to store
+      \returns error, or NULL if ok */
+   virtual err_info *putPageText (int pagenum, const QString &str);
+
    /** gets the total size of a file in bytes. this should include data not
        yet flushed to the filesystem */
    virtual int getSize (void) = 0;
@@ -227,12 +243,46 @@ public:
      If 'blank' then the image should be returned blank, either by using
      colour_image_for_blank() or setting the palette.
 
+     This only deals in QImage, so it may be called from a worker thread,
+     provided that nothing else is using this File object at the time.
+
+      \param pagenum    page number within stack
+      \param image      returns preview image
+      \param blank      true to show image as 'blank'
+      \returns error, or NULL if none */
+   virtual err_info *getPreviewImage (int pagenum, QImage &image, bool blank) = 0;
+
+   /** returns the preview image for a particular page, using the thumbnail
+       cache if possible. Like getPreviewImage() this may be called from a
+       worker thread
+
+      \param pagenum    page number within stack
+      \param image      returns preview image
+      \param blank      true to show image as 'blank'
+      \returns error, or NULL if none */
+   err_info *getCachedPreviewImage (int pagenum, QImage &image, bool blank);
+
+   /** returns true if the file has changes which have not yet been written
+       to disc. While this is true, the thumbnail cache is not used since it
+       would give us the preview of the file on disc */
+   virtual bool isDirty (void);
+
+   /** returns the preview pixmap for a particular page. This converts the
+       result of getPreviewImage() so must only be called from the GUI thread
+
       \param pagenum    page number within stack
       \param pixmap     returns pixmap
-      \param do_scale always false, not used (TODO: remove?)
       \param blank      true to show image as 'blank'
       \returns error, or NULL if none */
-   virtual err_info *getPreviewPixmap (int pagenum, QPixmap &pixmap, bool blank) = 0;
+   virtual err_info *getPreviewPixmap (int pagenum, QPixmap &pixmap, bool blank);
+
+   /** returns the filename (within the directory) which holds the given
+       page. For most types this is just the stack's filename, but types
+       which store each page separately return that page's file
+
+      \param pagenum    page number within stack
+      \returns filename containing the page */
+   virtual QString pageFilename (int pagenum);
 
    /** returns the image for a particular page.
 
@@ -283,6 +333,13 @@ public:
       \returns error, or NULL If ok */
    virtual err_info *stackStack (File *src) = 0;
 
+   /** rewrite the file so that it contains no unused space. This is only
+       supported by some file types. Since pages which have been deleted are
+       dropped, it is not possible to undo their deletion afterwards
+
+      \returns error, or NULL if ok */
+   virtual err_info *compact (void);
+
    /** duplicate a file */
    virtual err_info *duplicate (File *&fnew, File::e_type type, const QString &uniq,
       int odd_even, Operation &op, bool &supported) = 0;
@@ -293,6 +350,10 @@ public:
    /** returns the type name */
    static QString typeName (e_type type);
 
+   /** sets the preview pixmap for the current page, when this has been
+       generated elsewhere (e.g. by a Thumbnailer) */
+   void setPixmap (const QPixmap &pixmap);
+
    /** returns the type name of this file (JPEG, PDF, etc.) */
    QString typeName (void);
 
@@ -330,6 +391,13 @@ public:
 
    void encodeFile (QTextStream &stream);
 
+   /** \returns true if anything written by encodeFile() may have changed
+       since entryWritten() was last called */
+   bool entryChanged (void) const { return _entry_changed; }
+
+   //! note that the desk entry for this file is now on disc
+   void entryWritten (void) { _entry_changed = false; }
+
    QString filename (void) const;
    QString &basename (void);
    QString &leaf (void);
@@ -356,6 +424,10 @@ public:
    bool valid (void);
    void setValid (bool valid);
 
+   /** returns true if we have a preview pixmap. This can be true before the
+       file is loaded, when the preview came from the thumbnail cache */
+   bool hasPixmap (void) const;
+
    int pagenum (void);
 
    err_info *err (void);
@@ -466,6 +538,7 @@ protected:
    err_info _serr;  //!< place to put error
    err_info *_err;  //!< last error which occured with this item
    bool _valid;      //!< true if we have scanned this file and know what it contains
+   bool _entry_changed;  //!< true if the desk entry needs to be encoded again
 
    // annotation data
    bool _annot_loaded;               // true if data has been loaded
@@ -27,12 +27,16 @@ X-Comment: On Debian GNU/Linux systems, the complete text of the GNU General
 #include <QImage>
 #include <QProcess>
 
+#include "epeglite.h"
 #include "filejpeg.h"
 #include "utils.h"
 
 
 #define DPI 300.0
 
+//! width of preview images in pixels
+#define PREVIEW_WIDTH 100
+
 
 
 Filejpeg::Filejpeg (const QString &dir, const QString &filename, Desk *desk)
@@ -54,16 +58,32 @@ err_info *Filejpeg::load (void)
 
    if (!_valid)
       {
+      QSize size;
+      int bpp, pagenum = _has_pagenum ? _base_pagenum : 0;
+
        qDebug() << " JPEG: " << _filename << " : " << _has_pagenum;
 
-      addSubPage(_filename, _has_pagenum ? _base_pagenum : 0);
-      err = _pages [0]->load (_dir);
+      addSubPage(_filename, pagenum);
+
+      /* just check the header here - pages are decoded when needed. A page
+         file can be opened on its own, in which case the pages before it
+         are just placeholders, so check our own page */
+      err = _pages [pagenum]->getInfo (_dir, size, bpp);
       _valid = err == 0;
       }
 
    return err;
    }
 
+void Filejpeg::adopt (File *other)
+   {
+   File::adopt (other);
+
+   // the other file has checked the header, so do the rest of load()
+   if (_valid)
+      addSubPage (_filename, _has_pagenum ? _base_pagenum : 0);
+   }
+
 void *Filejpeg::kill(void){
     while (!_pages.isEmpty ())
        {
@@ -319,13 +339,32 @@ err_info *Filejpeg::getPageText (int pagenum, QString &str)
    QStringList args;
 
    CALL (checkPage (pagenum));
-   args << "-b" << "-TextLayerText" << _pathname;
+   args << "-b" << "-TextLayerText" << _pages [pagenum]->pathname (_dir);
    CALL (run_exiftool (process, "load ocr text (TextLayerText)", args));
    str = utilRemoveQuotes (process.readAllStandardOutput ());
    return NULL;
    }
 
 
+err_info *Filejpeg::putPageText (int pagenum, const QString &str)
+   {
+   QProcess process;
+   QStringList args;
+   const Filejpegpage *page;
+
+   CALL (getPage (pagenum, page));
+   args << "-TextLayerText=" + str;
+#if defined(Q_OS_MAC) || defined(Q_OS_WIN32)
+   args << "-overwrite_original_in_place";
+#else
+   args << "-overwrite_original" << "-preserve";
+#endif
+   args << page->pathname (_dir);
+   CALL (run_exiftool (process, "save ocr text (TextLayerText)", args));
+   return NULL;
+   }
+
+
 /** gets the total size of a file in bytes. this should include data not
       yet flushed to the filesystem */
 int Filejpeg::getSize (void)
@@ -350,7 +389,8 @@ err_info *Filejpeg::loadPage (int pagenum, QImage &image)
    Filejpegpage *page;
 
    CALL (getPage (pagenum, page));
-   CALL (page->load (_dir));
+   if (page->getImage ().isNull ())
+      CALL (page->load (_dir));
 
    image = page->getImage ();
 
@@ -361,14 +401,12 @@ err_info *Filejpeg::getImageInfo (int pagenum, QSize &size,
       QSize &true_size, int &bpp, int &image_size, int &compressed_size,
       QDateTime &timestamp)
    {
-   QImage image;
-
-   CALL (loadPage (pagenum, image));
+   Filejpegpage *page;
 
-   size = image.size ();
+   CALL (getPage (pagenum, page));
+   CALL (page->getInfo (_dir, size, bpp));
    true_size = size;
-   bpp = image.depth ();
-   image_size = image.byteCount ();
+   image_size = (size.width () * bpp + 31) / 32 * 4 * size.height ();
    compressed_size = -1;
    timestamp = _timestamp;
    return NULL;
@@ -377,12 +415,11 @@ err_info *Filejpeg::getImageInfo (int pagenum, QSize &size,
 
 err_info *Filejpeg::getPreviewInfo (int pagenum, QSize &size, int &bpp)
    {
-   QImage image;
-
-   CALL (loadPage (pagenum, image));
+   Filejpegpage *page;
 
-   size = image.size () / 24;
-   bpp = image.depth ();
+   CALL (getPage (pagenum, page));
+   CALL (page->getInfo (_dir, size, bpp));
+   size /= 24;
    return NULL;
    }
 
@@ -398,25 +435,31 @@ QPixmap Filejpeg::pixmap (bool recalc)
    }
 
 
-err_info *Filejpeg::getPreviewPixmap (int pagenum, QPixmap &pixmap, bool blank)
+err_info *Filejpeg::getPreviewImage (int pagenum, QImage &image, bool blank)
    {
-   QSize size;
-   QImage image;
+   Filejpegpage *page;
 
-   CALL (loadPage (pagenum, image));
-   size = image.size () / 24;
-   int x = image.size().width()/100;
-   int y = image.size().height()/x;
-   size = QSize(100, y);
-   image = image.scaled (size, Qt::KeepAspectRatio, Qt::SmoothTransformation);
+   CALL (getPage (pagenum, page));
+   CALL (page->getPreview (_dir, PREVIEW_WIDTH, image));
    if (blank)
+      {
+      image = image.convertToFormat (QImage::Format_RGB32);
       colour_image_for_blank (image);
-   pixmap = QPixmap::fromImage(image);
-//    qDebug () << "pixmap" << pixmap.width () << pixmap.height ();
+      }
+//    qDebug () << "image" << image.width () << image.height ();
    return NULL;
    }
 
 
+bool Filejpeg::isDirty (void)
+   {
+   foreach (const Filejpegpage *page, _pages)
+      if (page && page->changed ())
+         return true;
+   return false;
+   }
+
+
 err_info *Filejpeg::getImage (int pagenum, bool,
             QImage &image, QSize &size, QSize &trueSize, int &bpp, bool blank)
    {
@@ -589,17 +632,27 @@ err_info *Filejpeg::duplicate (File *&, File::e_type, const QString &,
    return NULL;
    }
 
+QString Filejpeg::pageFilename (int pagenum)
+   {
+   // don't load() here, since that decodes the first page
+   if (pagenum < 0 || pagenum >= _pages.size () || !_pages [pagenum]
+       || _pages [pagenum]->filename ().isEmpty ())
+      return _filename;
+   return _pages [pagenum]->filename ();
+   }
+
 bool Filejpeg::addSubPage(const QString &filename, int pagenum)
 {
     qDebug () << "ADDSUB" << _pages.size();
    while (pagenum > _pages.size())
       _pages << new Filejpegpage ();
 
-   // Cannot overwrite a page
+   // Cannot overwrite a page, but can fill in a placeholder
    if (_pages.size() > pagenum)
       {
-      if (_pages[pagenum])
+      if (_pages[pagenum] && !_pages[pagenum]->filename ().isEmpty ())
          return false;
+      delete _pages[pagenum];
       _pages[pagenum] = new Filejpegpage (filename);
       }
    else
@@ -674,6 +727,90 @@ err_info *Filejpegpage::load (const QString &dir)
    return 0;
    }
 
+err_info *Filejpegpage::getInfo (const QString &dir, QSize &size, int &bpp)
+   {
+   QString path = pathname (dir);
+   Epeg_Image *im;
+   int width, height;
+
+   if (!_image.isNull ())
+      {
+      size = _image.size ();
+      bpp = _image.depth ();
+      return 0;
+      }
+
+   im = epeg_file_open (QFile::encodeName (path).constData ());
+   if (!im)
+      return err_make (ERRFN, ERR_cannot_open_file1, qPrintable (path));
+   epeg_size_get (im, &width, &height);
+   size = QSize (width, height);
+
+   // QImage decodes greyscale to 8bpp and everything else to 32bpp
+   bpp = im->color_space == EPEG_GRAY8 ? 8 : 32;
+   epeg_close (im);
+
+   return 0;
+   }
+
+err_info *Filejpegpage::getPreview (const QString &dir, int width, QImage &image)
+   {
+   QString path = pathname (dir);
+   const unsigned char *pixels;
+   Epeg_Image *im;
+   int scale, stride, nc, y;
+
+   image = QImage ();
+   if (_image.isNull ())
+      {
+      im = epeg_file_open (QFile::encodeName (path).constData ());
+      if (!im)
+         return err_make (ERRFN, ERR_cannot_open_file1, qPrintable (path));
+
+      /* let libjpeg scale by up to 1/8 while decoding, but stay at least
+         as wide as the preview so the final scaling is smooth */
+      scale = qBound (1, im->in.w / width, 8);
+      epeg_decode_size_set (im, im->in.w / scale, im->in.h / scale);
+      pixels = epeg_pixels_get (im, &stride, &nc);
+
+      // we leave CMYK to Qt, which knows about Adobe's inverted version
+      if (pixels && (nc == 1 || nc == 3))
+         {
+         image = QImage (im->out.w, im->out.h,
+                  nc == 1 ? QImage::Format_Indexed8 : QImage::Format_RGB888);
+         for (y = 0; y < im->out.h; y++)
+            memcpy (image.scanLine (y), pixels + y * stride, im->out.w * nc);
+         if (nc == 1)
+            {
+            QVector<QRgb> table (256);
+
+            for (y = 0; y < 256; y++)
+               table [y] = qRgb (y, y, y);
+            image.setColorTable (table);
+            }
+         }
+      epeg_close (im);
+      }
+
+   // fall back to decoding the whole thing
+   if (image.isNull ())
+      {
+      if (_image.isNull ())
+         CALL (load (dir));
+      image = _image;
+      }
+
+   if (image.width () != width)
+      image = image.scaledToWidth (width, Qt::SmoothTransformation);
+
+   return 0;
+   }
+
+bool Filejpegpage::changed (void) const
+   {
+   return _changed;
+   }
+
 err_info *Filejpegpage::flush (const QString &dir)
    {
    QString path = pathname (dir);
@@ -707,6 +844,11 @@ QString Filejpegpage::pathname (const QString &dir) const
    return dir + _filename;
 }
 
+const QString &Filejpegpage::filename (void) const
+{
+   return _filename;
+}
+
 void Filejpegpage::setFilename (const QString &fname)
 {
    _filename = fname;
@@ -55,6 +55,8 @@ public:
 
    virtual void *kill (void);  // was desk->ensureMax
 
+   virtual void adopt (File *other);
+
 
    virtual err_info *create (void);
 
@@ -65,6 +67,8 @@ public:
    bool claimFileAsNewPage (const QString &fname, QString &base_fname,
                             int pagenum);
 
+   QString pageFilename (int pagenum);
+
    // accessing and changing metadata
 
    virtual int pagecount (void);
@@ -79,6 +83,8 @@ public:
 
    virtual err_info *getPageText (int pagenum, QString &str);
 
+   virtual err_info *putPageText (int pagenum, const QString &str);
+
    virtual int getSize (void);
 
    virtual err_info *renamePage (int pagenum, QString &name);
@@ -94,7 +100,9 @@ public:
    // image related
    virtual QPixmap pixmap (bool recalc = false);
 
-   virtual err_info *getPreviewPixmap (int pagenum, QPixmap &pixmap, bool blank);
+   virtual err_info *getPreviewImage (int pagenum, QImage &image, bool blank);
+
+   virtual bool isDirty (void);
 
    virtual err_info *getImage (int pagenum, bool do_scale,
                QImage &image, QSize &Size, QSize &trueSize, int &bpp, bool blank);
@@ -208,6 +216,35 @@ public:
     */
    err_info *load (const QString &dir);
 
+   /**
+    * Get the size and depth of this page without decoding it
+    *
+    * If the image is in memory we use that, otherwise only the JPEG header
+    * is read.
+    *
+    * \param dir     Directory containing file
+    * \param size    Returns image size in pixels
+    * \param bpp     Returns bits per pixel, as the decoded image would have
+    * \return error, or 0 if none
+    */
+   err_info *getInfo (const QString &dir, QSize &size, int &bpp);
+
+   /**
+    * Get a reduced-size copy of this page
+    *
+    * If the image is not in memory, libjpeg scales it by up to 1/8 while
+    * decoding, so the full-size image is never built.
+    *
+    * \param dir     Directory containing file
+    * \param width   Width wanted in pixels
+    * \param image   Returns the preview image
+    * \return error, or 0 if none
+    */
+   err_info *getPreview (const QString &dir, int width, QImage &image);
+
+   /** \returns true if the image has changed since it was last written */
+   bool changed (void) const;
+
 
    /**
     * Flash the JPEG to its file
@@ -243,6 +280,9 @@ public:
 
    QString pathname (const QString &dir) const;
 
+   /** \returns the filename of this page (without directory) */
+   const QString &filename (void) const;
+
    void setFilename (const QString &fname);
 
    err_info *remove (const QString &dir) const;
@@ -44,6 +44,10 @@ X-Comment: On Debian GNU/Linux systems, the complete text of the GNU General
 #include <QDebug>
 #include <QFileInfo>
 #include <QHash>
+#include <QMutex>
+#include <QSet>
+#include <QThread>
+#include <QtConcurrent>
 
 #include "errno.h"
 #include "jpeglib.h"
@@ -59,11 +63,21 @@ X-Comment: On Debian GNU/Linux systems, the complete text of the GNU General
 
 #include "desk.h"
 #include "filemax.h"
+#include "thumbcache.h"
 #include "utils.h"
 
 
-static FILE *debugf = 0;
-static int debug_level = 0;
+/* pages are compressed and decoded on worker threads, each of which sets
+these from its own debug settings */
+static thread_local FILE *debugf = 0;
+static thread_local int debug_level = 0;
+
+/** positions of the chunks of pages deleted in this session, by stack
+    pathname. The deletion might still be undone, even after the stack has
+    been reloaded, so these must not be reused. Stacks are loaded on worker
+    threads too, hence the mutex */
+static QHash<QString, QSet<int> > deleted_chunks;
+static QMutex deleted_chunks_mutex;
 
 #define warning(x) do {if (debug_level >= 0) dprintf x; } while (0)
 #define debug1(x) do {if (debug_level >= 1) dprintf x; } while (0)
@@ -468,6 +482,9 @@ Filemax::Filemax (const QString &dir, const QString &filename, Desk *desk)
    _fin = NULL;
    max_clear_cache (_cache);
    max_clear_cache (_scache);
+   _mapfile = NULL;
+   _map = NULL;
+   _map_size = 0;
    _bermuda = _tunguska = _annot = _trail = _b0 = _b4 = 0;
    _envelope = 0;
    _chunkid_next = 0;
@@ -734,6 +751,14 @@ err_info *Filemax::max_cache_data (cache_info &cache, int pos,
    {
    int n;
 
+   // if the file is mapped, there is no need to copy anything
+   if (datap)
+      {
+      *datap = max_map_data (pos, size);
+      if (*datap)
+         return NULL;
+      }
+
    cache.buff.resize (size);
 
    // read the data
@@ -761,6 +786,11 @@ byte *Filemax::max_check_scache (int pos)
    err_info *err = NULL;
 
 #define CACHE_4K_SIZE  4096
+   // use the mapping if we have one
+   ptr = max_map_data (pos, 4);
+   if (ptr)
+      return ptr;
+
    // if the cache has the wrong data, load it
    if (pos < _scache.pos || (pos + 4 > _scache.pos + _scache.buff.size ()))
       err = max_cache_data (_scache, pos, CACHE_4K_SIZE, 4, NULL);
@@ -778,8 +808,15 @@ byte *Filemax::max_check_scache (int pos)
 
 err_info *Filemax::max_read_data (int pos, byte *buf, int size)
    {
+   byte *map = max_map_data (pos, size);
    int count;
 
+   if (map)
+      {
+      memcpy (buf, map, size);
+      return NULL;
+      }
+
    // read the data
    fseek (_fin, pos, SEEK_SET);
    count = fread (buf, 1, size, _fin);
@@ -791,6 +828,9 @@ err_info *Filemax::max_write_data (int pos, byte *data, int size)
    {
    int count;
 
+   // the file may grow, so go back to reading through the caches
+   max_unmap ();
+
    // write the data
    fseek (_fin, pos, SEEK_SET);
    count = fwrite (data, 1, size, _fin);
@@ -813,6 +853,56 @@ void Filemax::max_clear_cache (cache_info &cache, int pos, int size)
    }
 
 
+void Filemax::max_map (void)
+   {
+   max_unmap ();
+   if (!_fin || _size <= 0)
+      return;
+
+   /* QFile does not take over the handle, so we still own _fin. We keep the
+      same QFile until the file is closed, so earlier mappings stay valid */
+   if (!_mapfile)
+      {
+      _mapfile = new QFile;
+      if (!_mapfile->open (fileno (_fin), QIODevice::ReadOnly))
+         {
+         delete _mapfile;
+         _mapfile = NULL;
+         return;
+         }
+      }
+   _map = (byte *)_mapfile->map (0, _size);
+   if (_map)
+      _map_size = _size;
+   }
+
+
+void Filemax::max_unmap (void)
+   {
+   /* the caller may still hold pointers into the mapping, e.g. from
+      max_cache_data(), so leave it in place until the file is closed */
+   _map = NULL;
+   _map_size = 0;
+   }
+
+
+void Filemax::max_close_map (void)
+   {
+   // closing the QFile removes all its mappings
+   max_unmap ();
+   delete _mapfile;
+   _mapfile = NULL;
+   }
+
+
+byte *Filemax::max_map_data (int pos, int size)
+   {
+   if (!_map || pos < 0 || size < 0 || pos > _map_size - size)
+      return NULL;
+   return _map + pos;
+   }
+
+
 err_info *Filemax::read_part (part_info &part, int pos)
    {
    CALL (getworde (pos, &part.start));
@@ -1173,9 +1263,11 @@ err_info *Filemax::decode_init (decode_info &decode, chunk_info &chunk,
    int size;
    err_info *err;
 
-   decode.debug = _debug;
-   debug_level = decode.debug->level;
-   debugf = decode.debug->logf;
+   // tiles decoded in parallel each bring their own debug info, since the
+   // step counter is updated as we go. The debug globals are set up by
+   // decode_image()
+   if (!decode.debug)
+      decode.debug = _debug;
 
    decode.version_a = _version_a;
    decode.inptr = data;
@@ -1400,13 +1492,11 @@ err_info *Filemax::decode_tileinfo (chunk_info &chunk)
    }
 
 err_info *Filemax::decode_tile (chunk_info &chunk,
-         decode_info &decode, int code, int pos, int size, byte *ptr,
+         decode_info &decode, int code, byte *data, int size, byte *ptr,
          cpoint &tile_size)
    {
-   byte *data;
    err_info *e;
 
-   CALL (max_cache_data (_cache, pos, size, size, &data));
    debug3 (("decode_tile: source data extends from %p to %p\n", data,
          data + size));
 /*
@@ -1546,15 +1636,33 @@ static void calc_true_size (chunk_info *chunk, QSize &true_size)
    }
 
 
+/** information about a single tile to be decoded, collected before any
+decoding starts so that the tiles can be shared out between threads */
+typedef struct tile_job
+   {
+   int tilenum;        //!< tile number
+   int code;           //!< tile code (0x43 = compressed, 0x44 = raw)
+   byte *data;         //!< tile data, within the prefetched tile data
+   int size;           //!< number of bytes of tile data
+   byte *ptr;          //!< top left of the tile in the output image
+   cpoint tile_size;   //!< size of tile to decode
+   err_info *err;      //!< error from decoding, or NULL if ok
+   } tile_job;
+
+
 err_info *Filemax::decode_tiledata (chunk_info &chunk,
                    decode_info &decode, byte *&imagep, QSize *image_size)
    {
    part_info *part;
-   int x, y, pos, size;
-   int code;
+   int x, y, i, pos, size, start, extent;
    cpoint tile_size;
    byte *ptr, *image;
    debug_info *debug = _debug;
+   QVector<int> offset;
+   QVector<tile_job> jobs;
+   QByteArray tiledata;
+   byte *tilebase = NULL;
+   int tilebytes = 0;
 
    // image is always in chunk 4
    part = _version_a ? NULL : &chunk.parts [PT_tiledata];
@@ -1583,29 +1691,68 @@ err_info *Filemax::decode_tiledata (chunk_info &chunk,
    chunk.image_bytes = size;
    debug3 (("image buffer extends from %p to %p\n", image, image + size));
 
-   pos = _version_a ? chunk.start + 0x42 : chunk.start + 0x20 + part->start;
+   /* work out where each tile's header sits relative to the start of the
+      tile data. This only depends on the tile info, so we can find out how
+      much data there is and read it all in one go, rather than a tile at a
+      time through the cache */
+   start = _version_a ? chunk.start + 0x42 : chunk.start + 0x20 + part->start;
+   offset.resize (chunk.tile_extent.x * chunk.tile_extent.y);
+   for (i = pos = extent = 0; i < offset.size (); i++)
+      {
+      int my_tilenum = i;
+
+      offset [i] = pos;
+      if (!_version_a)
+         pos += 4;
+      if (my_tilenum < chunk.tile_count && chunk.tile [my_tilenum].size > 0)
+         extent = qMax (extent, pos + chunk.tile [my_tilenum].size - 4);
+      else
+         extent = qMax (extent, pos);
+      pos += my_tilenum < chunk.tile_count ? chunk.tile [my_tilenum].size - 4 : 0;
+      }
+   if (extent > _size - start)
+      extent = _size - start;
+   if (extent > 0)
+      {
+      /* decode straight from the mapped file if we can. The decoder reads
+         a word at a time, so make sure it can't run off the end */
+      tilebase = max_map_data (start, extent + 8);
+      if (!tilebase)
+         {
+         tiledata.resize (extent);
+         CALL (max_read_data (start, (byte *)tiledata.data (), extent));
+         tilebase = (byte *)tiledata.data ();
+         }
+      tilebytes = extent;
+      }
+
    for (y = 0; y < chunk.tile_extent.y; y++)
       for (x = 0; x < chunk.tile_extent.x; x++)
          {
-         int tilenum, my_tilenum;
+         int tilenum, my_tilenum, code;
+         byte *hdr;
+
+         ptr = get_tile_size (chunk, x, y, &tile_size, &my_tilenum, -1, -1);
+         pos = offset [my_tilenum];
+         hdr = tilebase + pos;
 
          // older files didn't have a tilenum and code
          if (_version_a)
             {
-            tilenum = y * chunk.tile_extent.x + x;  // calculate
+            tilenum = my_tilenum;  // calculate
             code = 0x0043;
             }
          else
             {
-            CALL (gethwe (pos, &tilenum));
-
-            CALL (gethwe (pos + 2, &code));
+            if (pos + 4 > tilebytes)
+               return err_make (ERRFN, ERR_file_position_out_of_range3,
+                        start + pos, 0, _size);
+            tilenum = hdr [0] | (hdr [1] << 8);
+            code = hdr [2] | (hdr [3] << 8);
             pos += 4;
             }
          debug2 (("code = %x, tilenum=%x\n", code, tilenum));
 
-         ptr = get_tile_size (chunk, x, y, &tile_size, &my_tilenum, -1, -1);
-
          if (tilenum != my_tilenum)
             ;
          else if (tilenum >= debug->start_tile
@@ -1626,20 +1773,59 @@ err_info *Filemax::decode_tiledata (chunk_info &chunk,
                }
 
             debug2 (("decoding tile %d at %x: code %x (%d, %d), "
-                     "size %d x %d (0x%x x 0x%x)\n", tilenum, pos, code, x, y,
+                     "size %d x %d (0x%x x 0x%x)\n", tilenum, start + pos, code, x, y,
                   tile_size.x, tile_size.y, tile_size.x, tile_size.y));
-            if (debug->compf)
-               fprintf (debug->compf, "decode_tile %d\n", tilenum);
 
             if (chunk.tile [tilenum].size <= 0)
                debug2 (("   - size %d (0x%x) <= 0 so skipping tile\n",
                      chunk.tile [tilenum].size, chunk.tile [tilenum].size));
             else
-               CALL (decode_tile (chunk, decode, code, pos,
-                      chunk.tile [tilenum].size - 4, ptr, tile_size));
+               {
+               tile_job job;
+
+               if (pos + chunk.tile [tilenum].size - 4 > tilebytes)
+                  return err_make (ERRFN, ERR_file_position_out_of_range3,
+                           start + pos, 0, _size);
+               job.tilenum = tilenum;
+               job.code = code;
+               job.data = hdr + (_version_a ? 0 : 4);
+               job.size = chunk.tile [tilenum].size - 4;
+               job.ptr = ptr;
+               job.tile_size = tile_size;
+               job.err = NULL;
+               jobs << job;
+               }
             }
-         pos += chunk.tile [my_tilenum].size - 4;
          }
+
+   /* each tile decodes into its own area of the image, so they can be done
+      in parallel. But we need the tile widths to be clipped to the image
+      first, and we want the debug output to stay in order */
+   if (jobs.size () > 1 && image_size && debug_level < 2 && !debug->compf)
+      {
+      QtConcurrent::blockingMap (jobs, [this, &chunk] (tile_job &job)
+         {
+         decode_info tdecode;
+         debug_info tdebug = *_debug;
+
+         memset (&tdecode, '\0', sizeof (tdecode));
+         tdecode.debug = &tdebug;
+         job.err = decode_tile (chunk, tdecode, job.code, job.data, job.size,
+                                job.ptr, job.tile_size);
+         free_tables (tdecode);
+         });
+      for (i = 0; i < jobs.size (); i++)
+         CALL (jobs [i].err);
+      }
+   else for (i = 0; i < jobs.size (); i++)
+      {
+      tile_job &job = jobs [i];
+
+      if (debug->compf)
+         fprintf (debug->compf, "decode_tile %d\n", job.tilenum);
+      CALL (decode_tile (chunk, decode, job.code, job.data, job.size,
+                         job.ptr, job.tile_size));
+      }
    imagep = image;
    return NULL;
    }
@@ -1845,7 +2031,9 @@ err_info *Filemax::decode_preview (chunk_info &chunk, int flip,
       {
       CALL (max_cache_data (_cache, chunk.start, chunk.size, chunk.size, &buf));
 
-      CALL (rle_decode (_filename, buf + 0x42, chunk.size, &chunk.preview_size,
+      if (chunk.size <= 0x42)
+         return err_make (ERRFN, ERR_unable_to_read_preview);
+      CALL (rle_decode (_filename, buf + 0x42, chunk.size - 0x42, &chunk.preview_size,
                  chunk.bits, &wrote, flip, &preview));
       }
    else if (chunk.parts.size () > PT_preview)
@@ -2079,16 +2267,24 @@ err_info *Filemax::chunk_find (int pos, chunk_info *&chunkp, bool *tempp)
    if (tempp)
       *tempp = false;
    chunkp = NULL;
-   if (_all_chunks_loaded) for (int i = 0; i < _chunks.size (); i++)
+
+   /* if we haven't loaded everything, only the chunks which are loaded
+      have a valid start position */
+   for (int i = 0; i < _chunks.size (); i++)
       {
       chunk_info &chunk = _chunks [i];
 
-      if (chunk.start == pos)
+      if ((_all_chunks_loaded || chunk.loaded) && chunk.start == pos)
          {
          chunkp = &chunk;
          return NULL;
          }
       }
+   if (_loose_chunks.contains (pos))
+      {
+      chunkp = &_loose_chunks [pos];
+      return NULL;
+      }
 
    // if temporary loading, try to load it
    if (tempp && pos)
@@ -2100,6 +2296,15 @@ err_info *Filemax::chunk_find (int pos, chunk_info *&chunkp, bool *tempp)
       return read_chunk (*chunkp, pos);
       }
 
+   /* otherwise load it by itself, rather than loading every chunk in the
+      file just to find this one */
+   if (!_all_chunks_loaded && pos > 0 && pos < _size)
+      {
+      chunkp = &_loose_chunks [pos];
+      chunk_init (*chunkp);
+      return read_chunk (*chunkp, pos);
+      }
+
    return err_make (ERRFN, ERR_chunk_at_pos_not_found1, pos);
    }
 
@@ -2186,7 +2391,13 @@ err_info *Filemax::ensure_all_chunks (void)
       debug3 (("\nChunk %d: ", i));
       if (chunk->loaded)
          continue;
-      CALL (read_chunk (*chunk, pos));
+
+      /* we may already have this one, loaded by itself. Any pointer to it
+         from chunk_find() is no longer valid */
+      if (_loose_chunks.contains (pos))
+         *chunk = _loose_chunks.take (pos);
+      else
+         CALL (read_chunk (*chunk, pos));
       pos += chunk->size;
 //      debug3 (("chunk %d: start=%d, size=%d\n", i, chunk->start, chunk->size));
       }
@@ -2194,6 +2405,8 @@ err_info *Filemax::ensure_all_chunks (void)
    // do this here otherwise ensure_titlestr might use temporary loading
    _all_chunks_loaded = true;
 
+   find_free_chunks ();
+
    // get titles
    for (int i = 0; i < _pages.size (); i++)
       ensure_titlestr (i, _pages [i]);
@@ -2202,6 +2415,45 @@ err_info *Filemax::ensure_all_chunks (void)
    }
 
 
+void Filemax::find_free_chunks (void)
+   {
+   QSet<int> refs;
+   int i;
+
+   /* we don't know enough about old files to be sure which chunks are not
+      needed */
+   _free_chunks.clear ();
+   if (_version_a)
+      return;
+
+   // collect every chunk position which is referred to
+   refs << _bermuda << _tunguska << _annot << _trail << _envelope
+        << _b0 << _b4;
+   for (i = 0; i < _pages.size (); i++)
+      {
+      page_info &page = _pages [i];
+
+      refs << page.roswell << page.image << page.noti1 << page.noti2
+           << page.title << page.text;
+      }
+
+   // chunks of deleted pages are kept in case the deletion is undone
+   deleted_chunks_mutex.lock ();
+   refs += deleted_chunks.value (_pathname);
+   deleted_chunks_mutex.unlock ();
+
+   /* the 'used' flag is not reliable on its own (our own roswell and title
+      chunks were once written with it clear), so check both */
+   for (i = 0; i < _chunks.size (); i++)
+      {
+      chunk_info &chunk = _chunks [i];
+
+      if (!chunk.used && chunk.size && !refs.contains (chunk.start))
+         _free_chunks.insert (chunk.size, chunk.start);
+      }
+   }
+
+
 err_info *Filemax::page_read_roswell (page_info &page)
    {
    page.image = getword (page.roswell + POS_roswell_image);
@@ -2385,10 +2637,12 @@ err_info *Filemax::max_openf (FILE *fin)
    fstat (fileno (fin), &stat);
    _size = stat.st_size;
    _timestamp.setTime_t (stat.st_ctime);
+   max_close_map ();
    _fin = fin;
 
    if (!_size)
       return err_make (ERRFN, ERR_signature_failure1, -1);
+   max_map ();
 
    CALL (setup_max ());
    return NULL;
@@ -2439,8 +2693,13 @@ void Filemax::max_free (void)
    for (i = 0; i < _chunks.size (); i++)
       chunk_free (_chunks [i]);
    _chunks.clear ();
+   for (QMap<int, chunk_info>::iterator it = _loose_chunks.begin ();
+        it != _loose_chunks.end (); it++)
+      chunk_free (*it);
+   _loose_chunks.clear ();
    max_clear_cache (_cache);
    max_clear_cache (_scache);
+   max_close_map ();
    if (_fin)
       fclose (_fin);
    }
@@ -3990,93 +4249,129 @@ err_info *encode_tile (chunk_info &chunk, encode_info &encode, int *sizep,
    }
 
 
-static int build_tiledata (chunk_info &chunk, int stride, int bpp,
-                           debug_info &debug)
+/** encode a single tile into the worker's scratch buffer, and then copy it
+into its own buffer in chunk.tile. Each tile has its own slot there, so the
+output order does not depend on which thread gets to a tile first
+
+   \returns 0 if ok, else -ve error number */
+static int build_tile (chunk_info &chunk, encode_info &encode, int tilenum,
+                       int stride, int bpp, debug_info &debug)
    {
-   int x, y, size;
-   int ret, temp;
+   int x, y, size, temp;
+   int tile_line_bytes, my_tilenum;
    cpoint tile_size;
    byte *ptr;
-   encode_info encode;
-   tile_info *tile;
+   tile_info *tile = &chunk.tile [tilenum];
    err_info *e;
 
-   // ensure image width is a multiple of 32 bits
-   chunk.line_bytes = (chunk.line_bytes + 3) & ~3;
+   x = tilenum % chunk.tile_extent.x;
+   y = tilenum / chunk.tile_extent.x;
 
-   debug2 (("image size %d x %d\n", chunk.image_size.x, chunk.image_size.y));
+   // recalculate tile_line_bytes each time
+   ptr = get_tile_size (chunk, x, y, &tile_size, &my_tilenum, stride,
+            encode.tile_line_bytes);
 
-   // allocate enough memory for encoding each tile
-   encode.size = chunk.tile_size.x * chunk.tile_size.y;  // should be enough
-   encode.buff = (byte *)malloc (encode.size);
-   if (!encode.buff)
-      return ERR (-ENOMEM);
+   calc_tile_bytes (tile_size.x, chunk.image_size.x, bpp,
+              &tile_line_bytes, &temp, false);
+//       printf ("tile_size.x=%d, encode.tile_line_bytes=%d, tlb=%d\n",
+//               tile_size.x, encode.tile_line_bytes, tile_line_bytes);
+   if (tilenum >= debug.start_tile
+      && (debug.num_tiles == INT_MAX
+          || tilenum < debug.start_tile + debug.num_tiles))
+      {
+      debug2 (("encoding tile %d (%d, %d), bpp %d, size %d x %d (0x%x x 0x%d)\n", tilenum, x, y,
+            bpp, tile_size.x, tile_size.y, tile_size.x, tile_size.y));
+      e = encode_tile (chunk, encode, &size, ptr, &tile_size, stride,
+            bpp, tile_line_bytes, debug.max_steps);
+      if (e)
+         {
+         printf ("encode_tile() failed, tile %d\n", tilenum);
+         return 0;
+         }
+      if (size > encode.size)
+         {
+         printf("Encode size %d, buffer only %d\n", size, encode.size);
+         return ERR (-ENOMEM);
+         }
+      tile->size = size + 4;
+      tile->buf = (byte *)malloc (tile->size);
+      if (!tile->buf)
+         return -ENOMEM;
 
-   calc_tile_bytes (chunk.tile_size.x, chunk.image_size.x, bpp,
-                    &encode.tile_line_bytes, &temp, false);
+      // add header data
+      *(short *)tile->buf = tilenum;
+      *(short *)(tile->buf + 2) = 0x43;
+      memcpy (tile->buf + 4, encode.buff, size);
 
-   tile = chunk.tile;
-   for (y = 0, ret = 0; !ret && y < chunk.tile_extent.y; y++)
-      for (x = 0; x < chunk.tile_extent.x; x++, tile++)
-         {
-         int tilenum;
-         int tile_line_bytes;
+      debug2 (("tile %d,%d: encoded to %d bytes: %p\n", x, y, tile->size,
+               tile->buf));
+      }
+   else
+      {
+      static unsigned zero;
 
-         // recalculate tile_line_bytes each time
-         ptr = get_tile_size (chunk, x, y, &tile_size, &tilenum, stride,
-                  encode.tile_line_bytes);
+      printf ("skip %d: %d-%d\n", tilenum, debug.start_tile,
+              debug.num_tiles);
+      tile->buf = (byte *)&zero;
+      tile->size = 4;
+      }
+   return 0;
+   }
 
-         calc_tile_bytes (tile_size.x, chunk.image_size.x, bpp,
-                    &tile_line_bytes, &temp, false);
-//       printf ("tile_size.x=%d, encode.tile_line_bytes=%d, tlb=%d\n",
-//               tile_size.x, encode.tile_line_bytes, tile_line_bytes);
-         if (tilenum >= debug.start_tile
-            && (debug.num_tiles == INT_MAX
-                || tilenum < debug.start_tile + debug.num_tiles))
-            {
-            debug2 (("encoding tile %d (%d, %d), bpp %d, size %d x %d (0x%x x 0x%d)\n", tilenum, x, y,
-                  bpp, tile_size.x, tile_size.y, tile_size.x, tile_size.y));
-            e = encode_tile (chunk, encode, &size, ptr, &tile_size, stride,
-                  bpp, tile_line_bytes, debug.max_steps);
-            if (e)
-               {
-               printf ("encode_tile() failed, tile %d\n", tilenum);
-               break;
-               }
-            if (size > encode.size)
-               {
-               printf("Encode size %d, buffer only %d\n", size, encode.size);
-               return ERR (-ENOMEM);
-               }
-            tile->size = size + 4;
-            tile->buf = (byte *)malloc (tile->size);
-            if (!tile->buf)
-               {
-               ret = -ENOMEM;
-               break;
-               }
 
-            // add header data
-            *(short *)tile->buf = tilenum;
-            *(short *)(tile->buf + 2) = 0x43;
-            memcpy (tile->buf + 4, encode.buff, size);
+static int build_tiledata (chunk_info &chunk, int stride, int bpp,
+                           debug_info &debug)
+   {
+   int i, ret, temp;
+   int tile_line_bytes, workers;
+   QVector<int> results;
+   QAtomicInt next_tile;
+
+   // ensure image width is a multiple of 32 bits
+   chunk.line_bytes = (chunk.line_bytes + 3) & ~3;
 
-            debug2 (("tile %d,%d: encoded to %d bytes: %p\n", x, y, tile->size,
-                     tile->buf));
-            }
-         else
-            {
-            static unsigned zero;
+   debug2 (("image size %d x %d\n", chunk.image_size.x, chunk.image_size.y));
 
-            printf ("skip %d: %d-%d\n", tilenum, debug.start_tile,
-                    debug.num_tiles);
-            tile->buf = (byte *)&zero;
-            tile->size = 4;
-            }
+   calc_tile_bytes (chunk.tile_size.x, chunk.image_size.x, bpp,
+                    &tile_line_bytes, &temp, false);
+
+   /* the tiles are independent, so share them out between the threads in
+      the pool. Each worker has its own scratch buffer and takes the next
+      tile that nobody has started on yet. With debugging enabled we stay
+      on one thread so that the output makes sense */
+   workers = qMin (QThread::idealThreadCount (), chunk.tile_count);
+   if (workers < 1 || debug_level >= 2 || debug.max_steps != INT_MAX)
+      workers = 1;
+   results.fill (0, workers);
+
+   auto worker = [&] (int &result)
+      {
+      encode_info encode;
+      int tilenum;
+
+      // allocate enough memory for encoding each tile
+      encode.size = chunk.tile_size.x * chunk.tile_size.y;  // should be enough
+      encode.buff = (byte *)malloc (encode.size);
+      encode.tile_line_bytes = tile_line_bytes;
+      if (!encode.buff)
+         {
+         result = ERR (-ENOMEM);
+         return;
          }
-   free (encode.buff);
-   return ret;
+      while (!result && (tilenum = next_tile.fetchAndAddOrdered (1))
+                  < chunk.tile_count)
+         result = build_tile (chunk, encode, tilenum, stride, bpp, debug);
+      free (encode.buff);
+      };
+
+   if (workers == 1)
+      worker (results [0]);
+   else
+      QtConcurrent::blockingMap (results, worker);
 
+   for (i = ret = 0; !ret && i < results.size (); i++)
+      ret = results [i];
+   return ret;
    }
 
 
@@ -4498,6 +4793,11 @@ static void write_roswell (byte *buf, page_info &page)
    data [0x42 / 2] = page.image;
    data [0x42 / 2 + 1] = page.image >> 16;
    idata [0x8c / 4] = page.title;
+   data [POS_roswell_text / 2] = page.text;
+   data [POS_roswell_text / 2 + 1] = page.text >> 16;
+   idata [POS_roswell_noti1 / 4] = page.noti1;
+   data [POS_roswell_noti2 / 2] = page.noti2;
+   data [POS_roswell_noti2 / 2 + 1] = page.noti2 >> 16;
    }
 
 
@@ -4570,8 +4870,10 @@ void Filemax::write_max_header (void)
    idata [0xa4 / 4] = _bermuda;
    idata [0xa8 / 4] = _tunguska;
    idata [0xac / 4] = _annot;
+   idata [0xb0 / 4] = _b0;
+   idata [0xb4 / 4] = _b4;
    idata [0xb8 / 4] = _trail;
-   idata [POS_envelope / 4] = _trail;
+   idata [POS_envelope / 4] = _envelope;
    }
 
 /* converts the information in the various chunk->... variables into
@@ -4795,8 +5097,9 @@ err_info *Filemax::insert_chunk (chunk_info &new_chunk, int *posp)
 //      printf ("chunk %d, old size = %d, ", chunk - _chunk, chunk->size);
       if (new_chunk.size > chunk->size)
          {
-         // chunk too small, so throw it away
+         // chunk too small, so throw it away, but keep the space for later
          remove_chunk (*chunk);
+         _free_chunks.insert (chunk->size, oldpos);
          oldpos = 0;
          chunk = NULL;
          }
@@ -4804,13 +5107,19 @@ err_info *Filemax::insert_chunk (chunk_info &new_chunk, int *posp)
       // otherwise expand our new chunk if necessary
       // we can't cope with any gaps!
       else
-         {
-         unsigned short *ptr = (unsigned short *)new_chunk.buf;
+         CALL (expand_chunk (new_chunk, chunk->size));
+      }
 
-         new_chunk.size = chunk->size;
-         ptr [1] = chunk->size;
-         ptr [2] = chunk->size >> 16;
-         }
+   // try to fill a hole left by an unused chunk
+   while (!chunk && (oldpos = find_free_chunk (new_chunk.size)) != 0)
+      {
+      CALL (chunk_find (oldpos, chunk, NULL));
+
+      // it may have been brought back into use since
+      if (chunk->used)
+         chunk = NULL;
+      else
+         CALL (expand_chunk (new_chunk, chunk->size));
       }
 
    // allocate a new chunk if required
@@ -4838,6 +5147,39 @@ err_info *Filemax::insert_chunk (chunk_info &new_chunk, int *posp)
    }
 
 
+int Filemax::find_free_chunk (int size)
+   {
+   QMultiMap<int, int>::iterator it = _free_chunks.lowerBound (size);
+   int pos;
+
+   // don't waste more than a quarter of the space
+   if (it == _free_chunks.end () || it.key () > size + size / 4)
+      return 0;
+   pos = it.value ();
+   _free_chunks.erase (it);
+   return pos;
+   }
+
+
+err_info *Filemax::expand_chunk (chunk_info &chunk, int size)
+   {
+   unsigned short *ptr;
+
+   Q_ASSERT (size >= chunk.size);
+   if (size == chunk.size)
+      return NULL;
+
+   // flush_chunk() writes the whole chunk, so the buffer must grow too
+   CALL (mem_realloc (CV &chunk.buf, size, "expand_chunk"));
+   memset (chunk.buf + chunk.size, '\0', size - chunk.size);
+   ptr = (unsigned short *)chunk.buf;
+   ptr [1] = size;
+   ptr [2] = size >> 16;
+   chunk.size = size;
+   return NULL;
+   }
+
+
 /* creates or updates a bermuda chunk. If one already exists (_bermuda
 non-zero), then updates it. But if it is too large to fit in the currently
 allocated area, it will mark the old one as unused and create a new one */
@@ -4865,6 +5207,7 @@ err_info *Filemax::create_annot (void)
 
    chunk_init (chunk);
    chunk.type = CT_annot;
+   chunk.used = 1;
    chunk.flags = CHUNKF_annot;
 
    CALL (build_chunk (chunk));
@@ -4883,6 +5226,7 @@ err_info *Filemax::create_envelope (void)
 
    chunk_init (chunk);
    chunk.type = CT_env;
+   chunk.used = 1;
    chunk.flags = CHUNKF_env;
 
    CALL (build_chunk (chunk));
@@ -4900,6 +5244,7 @@ err_info *Filemax::create_roswell (page_info &page)
    chunk_init (chunk);
    chunk.chunkid = page.chunkid;
    chunk.type = CT_roswell;
+   chunk.used = 1;
    chunk.size = 0x1a0;  // always this size?
    chunk.textflag = 0;
    chunk.flags = CHUNKF_roswell;
@@ -4924,6 +5269,7 @@ err_info *Filemax::create_title (page_info &page)
    chunk_init (chunk);
    chunk.chunkid = page.chunkid;
    chunk.type = CT_title;
+   chunk.used = 1;
    chunk.size = ALIGN_CHUNK (POS_chunk_header_size
                      + strlen (page.titlestr.toLatin1()) + 1);
    chunk.textflag = 0;  // not text, is title
@@ -4984,6 +5330,8 @@ err_info *Filemax::merge_chunk (Filemax *src, int chunk_pos, int *new_pos)
    {
    chunk_info *srcchunk, *destchunk;
    byte *data;
+   QByteArray copy;
+   int size;
 
    // do nothing if no chunk
    if (!chunk_pos)
@@ -4996,14 +5344,18 @@ err_info *Filemax::merge_chunk (Filemax *src, int chunk_pos, int *new_pos)
    if (!srcchunk->loaded)
       CALL (src->read_chunk (*srcchunk, chunk_pos));
 
-   // create new chunk in destchunk
-   CALL (alloc_chunk (srcchunk->size, &destchunk));
+   /* create new chunk in destchunk. If we are copying within a file this
+      moves srcchunk, so we are done with it now */
+   size = srcchunk->size;
+   CALL (alloc_chunk (size, &destchunk));
    // destchunk->loaded, ->saved will be 0
 
    // copy data
-   CALL (src->max_cache_data (src->_cache, chunk_pos, srcchunk->size, srcchunk->size, &data));
+   CALL (src->max_cache_data (src->_cache, chunk_pos, size, size, &data));
 
-   // update chunkid
+   // update chunkid (in a copy, since the source data may be mapped)
+   copy = QByteArray ((const char *)data, size);
+   data = (byte *)copy.data ();
    *(unsigned short *)(data + 6) = _chunkid_next;
    CALL (max_write_data (destchunk->start, data, destchunk->size));
 
@@ -5015,6 +5367,21 @@ err_info *Filemax::merge_chunk (Filemax *src, int chunk_pos, int *new_pos)
    }
 
 
+err_info *Filemax::flush_chunk (chunk_info &chunk)
+   {
+   if (chunk.loaded && !chunk.saved)
+      {
+      CALL (build_chunk (chunk));
+
+      // write the chunk to disc
+      assert (chunk.buf);
+      CALL (max_write_data (chunk.start, chunk.buf, chunk.size));
+      chunk.saved = true;
+      }
+   return NULL;
+   }
+
+
 err_info *Filemax::flush_chunks (void)
    {
    int i;
@@ -5022,19 +5389,15 @@ err_info *Filemax::flush_chunks (void)
    // flush all the chunks
    for (i = 0; i < _chunks.size (); i++)
       {
-      chunk_info &chunk = _chunks [i];
-
-      if (chunk.loaded && !chunk.saved)
-         {
+      if (_chunks [i].loaded && !_chunks [i].saved)
          printf ("   - flush chunk %d\n", i);
-         CALL (build_chunk (chunk));
-
-         // write the chunk to disc
-         assert (chunk.buf);
-         CALL (max_write_data (chunk.start, chunk.buf, chunk.size));
-         chunk.saved = true;
-         }
+      CALL (flush_chunk (_chunks [i]));
       }
+
+   // and any which we loaded by themselves
+   for (QMap<int, chunk_info>::iterator it = _loose_chunks.begin ();
+        it != _loose_chunks.end (); it++)
+      CALL (flush_chunk (*it));
    return NULL;
    }
 
@@ -5057,7 +5420,9 @@ err_info *Filemax::flush_pages (void)
 
 err_info *Filemax::flush (void)
    {
-   ensure_all_chunks ();
+   /* we don't need to load all the chunks here: anything that has changed
+      is already in memory, and chunk_find() can pick up the old title and
+      bermuda chunks by themselves */
 
    // write back any changed page titles
    CALL (flush_pages ());
@@ -5076,10 +5441,34 @@ err_info *Filemax::flush (void)
    // update the file size
    QFileInfo fi (_pathname);
    _size = fi.size ();
+
+   // we have finished writing, so can map the file again
+   max_map ();
+
+   /* the modification time may not have moved on far enough for the
+      preview cache to notice, so drop our old previews */
+   Thumbcache::instance ()->remove (_pathname);
    return NULL;
    }
 
 
+bool Filemax::isDirty (void)
+   {
+   int i;
+
+   for (i = 0; i < _chunks.size (); i++)
+      if (_chunks [i].loaded && !_chunks [i].saved)
+         return true;
+   foreach (const chunk_info &chunk, _loose_chunks)
+      if (chunk.loaded && !chunk.saved)
+         return true;
+   for (i = 0; i < _pages.size (); i++)
+      if (_pages [i].title_loaded && !_pages [i].title_saved)
+         return true;
+   return false;
+   }
+
+
 err_info *Filemax::merge_chunks (Filemax *src,
            page_info &dstpage, page_info &srcpage)
    {
@@ -5090,8 +5479,29 @@ err_info *Filemax::merge_chunks (Filemax *src,
    }
 
 
+void Filemax::hold_page_chunks (const page_info &page, bool hold)
+   {
+   QMutexLocker locker (&deleted_chunks_mutex);
+   QSet<int> &held = deleted_chunks [_pathname];
+   int pos [] = { page.roswell, page.image, page.title, page.text };
+   unsigned i;
+
+   for (i = 0; i < sizeof (pos) / sizeof (pos [0]); i++)
+      if (pos [i])
+         {
+         if (hold)
+            held << pos [i];
+         else
+            held.remove (pos [i]);
+         }
+   if (held.isEmpty ())
+      deleted_chunks.remove (_pathname);
+   }
+
+
 err_info *Filemax::free_page (page_info &page)
    {
+   hold_page_chunks (page, true);
    page.titlestr.clear ();
    CALL (remove_chunknum (page.roswell));
    CALL (remove_chunknum (page.image));
@@ -5103,6 +5513,7 @@ err_info *Filemax::free_page (page_info &page)
 
 err_info *Filemax::restore_page (page_info &page)
    {
+   hold_page_chunks (page, false);
    CALL (restore_chunknum (page.roswell));
    CALL (restore_chunknum (page.image));
    CALL (restore_chunknum (page.title));
@@ -5308,6 +5719,42 @@ err_info *Filemax::load ()  // was desk->ensureMax
    }
 
 
+void Filemax::adopt (File *fother)
+   {
+   Filemax *other = (Filemax *)fother;
+
+   File::adopt (other);
+
+   // swap rather than copy, so that the other object frees what we had
+   qSwap (_fin, other->_fin);
+   qSwap (_version, other->_version);
+   qSwap (_cache, other->_cache);
+   qSwap (_scache, other->_scache);
+   qSwap (_mapfile, other->_mapfile);
+   qSwap (_map, other->_map);
+   qSwap (_map_size, other->_map_size);
+   qSwap (_chunk0_start, other->_chunk0_start);
+   qSwap (_chunks, other->_chunks);
+   qSwap (_signature, other->_signature);
+   qSwap (_bermuda, other->_bermuda);
+   qSwap (_tunguska, other->_tunguska);
+   qSwap (_annot, other->_annot);
+   qSwap (_trail, other->_trail);
+   qSwap (_envelope, other->_envelope);
+   qSwap (_b0, other->_b0);
+   qSwap (_b4, other->_b4);
+   qSwap (_pages, other->_pages);
+   qSwap (_hdr, other->_hdr);
+   qSwap (_chunkid_next, other->_chunkid_next);
+   qSwap (_hdr_updated, other->_hdr_updated);
+   qSwap (_debug, other->_debug);
+   qSwap (_version_a, other->_version_a);
+   qSwap (_all_chunks_loaded, other->_all_chunks_loaded);
+   qSwap (_loose_chunks, other->_loose_chunks);
+   qSwap (_free_chunks, other->_free_chunks);
+   }
+
+
 err_info *Filemax::getAnnot (e_annot type, QString &text)
    {
    if (!_valid)
@@ -5333,8 +5780,14 @@ err_info *Filemax::getPageText (int pagenum, QString &str)
       return NULL;
    CALL (chunk_find (page->text, chunk, &temp));
    QByteArray ba (chunk->size, '\0');
-   CALL (max_read_data (chunk->start + POS_text_start, (byte *)ba.data (),
-            chunk->size - POS_text_start));
+
+   // the text may not have been written to disc yet
+   if (chunk->buf)
+      memcpy (ba.data (), chunk->buf + POS_text_start,
+              chunk->size - POS_text_start);
+   else
+      CALL (max_read_data (chunk->start + POS_text_start, (byte *)ba.data (),
+               chunk->size - POS_text_start));
    if (temp)
       {
       chunk_free (*chunk);
@@ -5345,6 +5798,54 @@ err_info *Filemax::getPageText (int pagenum, QString &str)
    }
 
 
+err_info *Filemax::putPageText (int pagenum, const QString &str)
+   {
+   page_info *page;
+   chunk_info chunk, *roswell;
+   QByteArray ba = str.toUtf8 ();
+   unsigned short *data;
+   byte *buf;
+   int oldpos;
+
+   CALL (find_page (pagenum, page));
+   if (!page->have_roswell && page->roswell)
+      CALL (page_read_roswell (*page));
+   oldpos = page->text;
+
+   chunk_init (chunk);
+   chunk.chunkid = page->chunkid;
+   chunk.type = CT_text;
+   chunk.used = 1;
+   chunk.size = ALIGN_CHUNK (POS_text_start + ba.size () + 1);
+   chunk.textflag = 3;  // text, not title
+   chunk.flags = CHUNKF_text;
+   chunk.titletype = 0;
+   CALL (alloc_chunk_buf (chunk, &buf));
+   add_generic_chunk_header (chunk, buf);
+   memcpy (buf + POS_text_start, ba.constData (), ba.size () + 1);
+   CALL (insert_chunk (chunk, &page->text));
+
+   /* a page without a roswell chunk needs one to point to the text. It is
+      added to the bermuda chunk when the file is flushed */
+   if (!page->roswell)
+      return create_roswell (*page);
+
+   // if the text has moved, point the roswell at its new position
+   if (page->text != oldpos)
+      {
+      CALL (chunk_find (page->roswell, roswell, NULL));
+      if (!roswell->buf)
+         CALL (read_chunk_buf (*roswell));
+      data = (unsigned short *)roswell->buf;
+      data [POS_roswell_text / 2] = page->text;
+      data [POS_roswell_text / 2 + 1] = page->text >> 16;
+      roswell->loaded = true;
+      roswell->saved = false;
+      }
+   return NULL;
+   }
+
+
 err_info *Filemax::renamePage (int pagenum, QString &name)
    {
    if (_valid)
@@ -5493,7 +5994,7 @@ err_info *Filemax::unstackPages (int pagenum, int pagecount, bool remove,
       remove_pages (pagenum, pagecount);
 
    if (_pagenum >= _pages.size ())
-      _pagenum = _pages.size () - 1;
+      setPagenum (_pages.size () - 1);
    return NULL;
    }
 
@@ -5597,6 +6098,106 @@ err_info *Filemax::duplicate (File *&, File::e_type , const QString &,
    }
 
 
+err_info *Filemax::compact_to (Filemax *dest)
+   {
+   page_info *dstpage;
+   int i;
+
+   CALL (dest->create ());
+   for (i = 0; i < _pages.size (); i++)
+      {
+      page_info &page = _pages [i];
+
+      if (!page.have_roswell && page.roswell)
+         CALL (page_read_roswell (page));
+
+      // create destination page
+      CALL (dest->page_add (dest->_chunkid_next, page.titlestr, dstpage));
+
+      // copy chunks, including the page's annotations
+      CALL (dest->merge_chunks (this, *dstpage, page));
+      CALL (dest->merge_chunk (this, page.noti1, &dstpage->noti1));
+      CALL (dest->merge_chunk (this, page.noti2, &dstpage->noti2));
+
+      // create roswell chunk, keeping the original timestamp
+      dstpage->timestamp = page.timestamp;
+      CALL (dest->create_roswell (*dstpage));
+
+      dest->_chunkid_next++;
+      }
+
+   // the annotations, envelope and other blocks are copied as is
+   CALL (dest->merge_chunk (this, _annot, &dest->_annot));
+   CALL (dest->merge_chunk (this, _envelope, &dest->_envelope));
+   CALL (dest->merge_chunk (this, _tunguska, &dest->_tunguska));
+   CALL (dest->merge_chunk (this, _trail, &dest->_trail));
+   CALL (dest->merge_chunk (this, _b0, &dest->_b0));
+   CALL (dest->merge_chunk (this, _b4, &dest->_b4));
+
+   // write the header and bermuda chunk
+   CALL (dest->flush ());
+   return NULL;
+   }
+
+
+err_info *Filemax::compact (void)
+   {
+   QString tmpname = "." + _filename + ".compact";
+   Filemax *dest;
+   err_info *err;
+
+   CALL (load ());
+
+   // make sure that everything is on disc, and that we know where it is
+   CALL (flush ());
+   CALL (ensure_all_chunks ());
+
+   // write a new file next to this one, so we can rename it into place
+   dest = new Filemax (_dir, tmpname, _desk);
+   err = compact_to (dest);
+   delete dest;
+   if (err)
+      {
+      QFile::remove (_dir + tmpname);
+      return err;
+      }
+
+   /* close our file, since Windows will not replace an open file, and
+      switch to the new one. If that fails we go back to the old one, which
+      is untouched */
+   max_free ();
+   _fin = NULL;
+   err = util_replaceFile (_dir + tmpname, _pathname);
+   if (err)
+      {
+      QFile::remove (_dir + tmpname);
+      err = err_copy (err);   // load() may make its own error
+      }
+
+   /* reload, forgetting everything we knew about the old layout. Deleted
+      pages are gone for good now */
+   if (!err)
+      {
+      deleted_chunks_mutex.lock ();
+      deleted_chunks.remove (_pathname);
+      deleted_chunks_mutex.unlock ();
+      }
+   _pages.clear ();
+   _hdr.clear ();
+   _free_chunks.clear ();
+   _bermuda = _tunguska = _annot = _trail = _b0 = _b4 = 0;
+   _envelope = 0;
+   _chunkid_next = 0;
+   _hdr_updated = false;
+   _all_chunks_loaded = false;
+   _valid = false;
+   CALL (load ());
+
+   Thumbcache::instance ()->remove (_pathname);
+   return err;
+   }
+
+
 err_info *Filemax::remove ()
    {
    QFile file (_dir + _filename);
@@ -5691,7 +6292,7 @@ err_info *Filemax::getPreviewInfo (int pagenum, QSize &Size, int &bpp)
    }
 
 
-err_info *Filemax::getPreviewPixmap (int pagenum, QPixmap &pixmap, bool blank)
+err_info *Filemax::getPreviewImage (int pagenum, QImage &image, bool blank)
    {
    byte *preview;
    QString path;
@@ -5715,7 +6316,6 @@ err_info *Filemax::getPreviewPixmap (int pagenum, QPixmap &pixmap, bool blank)
 
    QVector<QRgb> table;
    table.reserve (256);
-   QImage image;
 
    // create a greyscale palette
    switch (bpp)
@@ -5738,9 +6338,10 @@ err_info *Filemax::getPreviewPixmap (int pagenum, QPixmap &pixmap, bool blank)
          break;
       }
 
-   pixmap = QPixmap::fromImage(image);
+   // the image refers to our preview buffer, so take a copy before freeing it
+   image = image.copy ();
    free (preview);
-   return pixmap.isNull () ? err_make (ERRFN, ERR_failed_to_generate_preview_image) : NULL;
+   return image.isNull () ? err_make (ERRFN, ERR_failed_to_generate_preview_image) : NULL;
    }
 
 
@@ -33,6 +33,8 @@ X-Comment: On Debian GNU/Linux systems, the complete text of the GNU General
 
 
 #include <QDateTime>
+#include <QFile>
+#include <QMap>
 
 #include "file.h"
 #include "utils.h"
@@ -159,6 +161,8 @@ public:
 
    virtual void *kill (void);  // was desk->ensureMax
 
+   virtual void adopt (File *other);
+
 
    virtual err_info *create (void);
 
@@ -181,6 +185,8 @@ public:
 
    virtual err_info *getPageText (int pagenum, QString &str);
 
+   virtual err_info *putPageText (int pagenum, const QString &str);
+
    virtual int getSize (void);
 
    virtual err_info *renamePage (int pagenum, QString &name);
@@ -196,7 +202,9 @@ public:
    // image related
    virtual QPixmap pixmap (bool recalc = false);
 
-   virtual err_info *getPreviewPixmap (int pagenum, QPixmap &pixmap, bool blank);
+   virtual err_info *getPreviewImage (int pagenum, QImage &image, bool blank);
+
+   virtual bool isDirty (void);
 
    virtual err_info *getImage (int pagenum, bool do_scale,
                QImage &image, QSize &Size, QSize &trueSize, int &bpp, bool blank);
@@ -219,6 +227,8 @@ public:
    virtual err_info *duplicate (File *&fnew, File::e_type type, const QString &uniq,
       int odd_even, Operation &op, bool &supported);
 
+   virtual err_info *compact (void);
+
 
    /*********** end of functions which the base class should implement ******/
 
@@ -290,7 +300,10 @@ private:
    err_info *merr_make (const char *func_name, int errnum, ...);
 
    /** read data into the cache and return a pointer to it. This data will
-   survive until the next max_cache_data() call */
+   survive until the next max_cache_data() call. If the file is mapped, this
+   points into the mapping and must not be changed. The mapping is kept until
+   the file is closed, so this stays valid if we then write to the file,
+   although it may not show what we wrote */
    err_info *max_cache_data (cache_info &cache, int pos,
          int size, int min, byte **datap);
 
@@ -312,6 +325,26 @@ private:
 
    void max_clear_cache (cache_info &cache, int pos = 0, int size = -1);
 
+   /** map the file into memory, so that reading does not need a system call
+       for each access. We stop using the mapping as soon as we write to the
+       file (since it might grow), and map it again in flush() */
+   void max_map (void);
+
+   /** stop using the memory mapping, so that all reads go through the
+       caches. The mapping itself stays until the file is closed, so
+       pointers already obtained from it remain valid */
+   void max_unmap (void);
+
+   //! remove all mappings of the file. This is done when the file is closed
+   void max_close_map (void);
+
+   /** get a pointer to file data in the memory mapping
+
+      \param pos    file position
+      \param size   number of bytes required
+      \returns pointer to data, or NULL if that range is not mapped */
+   byte *max_map_data (int pos, int size);
+
    /** read a header for an image 'part' - images consist of a number of parts
    each containing different types of data. This function reads the position
    and size of a particular part
@@ -353,10 +386,15 @@ private:
 
    err_info *decode_tileinfo (chunk_info &chunk);
 
+   /** decode a single tile from data that has already been read from the
+   file. This does not touch the file or its caches, so several tiles can be
+   decoded at once provided that each has its own decode_info */
    err_info *decode_tile (chunk_info &chunk,
-            struct decode_info &decode, int code, int pos, int size, byte *ptr,
+            struct decode_info &decode, int code, byte *data, int size, byte *ptr,
             cpoint &tile_size);
 
+   /** decode all the tiles of an image chunk. The tile data is read in one
+   go and the tiles are then decoded across the thread pool where possible */
    err_info *decode_tiledata (chunk_info &chunk,
                      decode_info &decode, byte *&imagep, QSize *image_size);
 
@@ -396,6 +434,11 @@ private:
    /** find a chunk at the given position. If tempp, then it may be loaded temporarily
    in which case *tempp will be set to true on exit
 
+   The pointer is only valid until the next call which adds or loads chunks:
+   alloc_chunk() (and so insert_chunk() and the create_...() functions)
+   moves the chunk list, and ensure_all_chunks() moves chunks loaded by
+   themselves into it. Look the chunk up again after any of these. Functions
+   which need every chunk call ensure_all_chunks() before finding any
 
       chunkp   set to point to the chunk, or NULL If not found */
    err_info *chunk_find (int pos, chunk_info *&chunkp, bool *tempp);
@@ -408,6 +451,10 @@ private:
 
    err_info *ensure_all_chunks (void);
 
+   /** work out which chunks are not in use, so that their space can be
+       reused. This is called once all chunks are loaded */
+   void find_free_chunks (void);
+
    err_info *page_read_roswell (page_info &page);
 
    err_info *setup_max (void);
@@ -529,6 +576,22 @@ private:
       \returns NULL if ok, else err_info * */
    err_info *insert_chunk (chunk_info &new_chunk, int *posp);
 
+   /** find an unused chunk which can hold a new chunk of the given size.
+       We don't accept chunks which are much larger than needed, since the
+       rest of the space would be wasted
+
+      \param size       size of the new chunk
+      \returns position of unused chunk, or 0 if none */
+   int find_free_chunk (int size);
+
+   /** expand a new chunk to fill the given size, since chunks in a max file
+       must be contiguous. The extra space is zeroed
+
+      \param chunk      chunk to expand (with buf set up)
+      \param size       new size, which must not be smaller than the old
+      \returns NULL if ok, else err_info * */
+   err_info *expand_chunk (chunk_info &chunk, int size);
+
    err_info *create_bermuda (void);
 
    err_info *create_annot (void);
@@ -544,6 +607,14 @@ private:
 
    err_info *write_max (FILE *f);
 
+   /** copy all the pages of this file into a new file, without any unused
+       chunks. Every block referred to by the header or a page's roswell
+       chunk is copied. This is used by compact()
+
+      \param dest       file to create and write to
+      \returns NULL if ok, else err_info * */
+   err_info *compact_to (Filemax *dest);
+
    /** write a set of pages to a given filename
 
       Note that this will destroy maxpage in the process, so the call does
@@ -556,6 +627,9 @@ private:
 
    err_info *merge_chunk (Filemax *src, int chunk_pos, int *new_pos);
 
+   //! write a chunk to disc if it has changed
+   err_info *flush_chunk (chunk_info &chunk);
+
    err_info *flush_chunks (void);
 
    err_info *flush_pages (void);
@@ -567,6 +641,13 @@ private:
 
    err_info *max_rename_page (int pagenum, char *newname);
 
+   /** record that the chunks of a deleted page must not be reused until the
+       deletion is undone or the stack is compacted
+
+      \param page     page to update
+      \param hold     true to hold the chunks, false to release them */
+   void hold_page_chunks (const page_info &page, bool hold);
+
    err_info *free_page (page_info &page);
 
    err_info *restore_page (page_info &page);
@@ -597,6 +678,12 @@ private:
    cache_info _cache;    // main cache, for large reads
    cache_info _scache;   // small cache, for byte/halfword/word reads
 
+   /* the file mapped into memory, if possible. While this is set up, reads
+      come straight from here rather than through the caches */
+   QFile *_mapfile;      //!< file used to create the mapping, or NULL
+   byte *_map;           //!< start of mapped data, or NULL if none
+   int _map_size;        //!< number of bytes mapped
+
    // the 4k cache (for word, halfword and byte reads
 //    byte *_cache_4k;
 //   int _cache_4k_pos;       //!< file position of data in cache
@@ -624,6 +711,20 @@ private:
    bool _version_a;  //!< true if this is an old version A file
 //   err_info *_err;    //!< the last error that occurred
    bool _all_chunks_loaded;  //!< true if all chunk data has been loaded
+
+   /** chunks which have been loaded by position before all chunks were
+       loaded, so we don't know their place in _chunks. These are moved into
+       _chunks by ensure_all_chunks(), after which pointers to them are not
+       valid. A QMap is used so that pointers to these remain valid as
+       others are added */
+   QMap <int, chunk_info> _loose_chunks;
+
+   /** unused chunks in the file which can be reused for new chunks, as
+       file position indexed by chunk size. Only chunks which were already
+       unused when the file was loaded, or which have been outgrown by
+       insert_chunk(), are added here. Chunks of deleted pages are not, since
+       the deletion might still be undone */
+   QMultiMap <int, int> _free_chunks;
    };
 
 
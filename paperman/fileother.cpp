@@ -156,7 +156,7 @@ QPixmap Fileother::pixmap (bool)
 
 
 
-err_info *Fileother::getPreviewPixmap (int, QPixmap &, bool)
+err_info *Fileother::getPreviewImage (int, QImage &, bool)
    {
    return not_impl ();
    }
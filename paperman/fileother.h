@@ -87,7 +87,7 @@ public:
    // image related
    virtual QPixmap pixmap (bool recalc = false);
 
-   virtual err_info *getPreviewPixmap (int pagenum, QPixmap &pixmap, bool blank);
+   virtual err_info *getPreviewImage (int pagenum, QImage &image, bool blank);
 
    virtual err_info *getImage (int pagenum, bool do_scale,
                QImage &image, QSize &Size, QSize &trueSize, int &bpp, bool blank);
@@ -28,12 +28,16 @@ X-Comment: On Debian GNU/Linux systems, the complete text of the GNU General
 #include <QApplication>
 
 #include "filepdf.h"
+#include "hummuspdfcore.h"
 #include "pdfio.h"
 
 
 
 #define DPI 300.0
 
+//! width of preview images in pixels
+#define PREVIEW_WIDTH 100
+
 
 
 Filepdf::Filepdf (const QString &dir, const QString &filename, Desk *desk)
@@ -134,6 +138,15 @@ err_info *Filepdf::load (void)
    }
 
 
+void Filepdf::adopt (File *fother)
+   {
+   Filepdf *other = (Filepdf *)fother;
+
+   File::adopt (other);
+   qSwap (_pdfio, other->_pdfio);
+   }
+
+
   // was desk->ensureMax
 
 /** create the file (on the filesystem). It doesn't need to be written to
@@ -268,26 +281,16 @@ QPixmap Filepdf::pixmap (bool recalc)
    }
 
 
-err_info *Filepdf::getPreviewPixmap (int pagenum, QPixmap &pixmap, bool blank)
+err_info *Filepdf::getPreviewImage (int pagenum, QImage &image, bool blank)
    {
+   CALL (_pdfio->getPreview (_filename, pagenum, PREVIEW_WIDTH, image));
 
-  //  QScreen *srn = QApplication::screens().at(0);
-  //  qreal dotsPerInch = (qreal)srn->logicalDotsPerInch();
-
-   QImage img;
-   CALL (_pdfio->getImage (_filename, pagenum, img, DPI, DPI, false));
-   if (blank)
-      colour_image_for_blank (img);
-   QPixmap sizeImg = QPixmap::fromImage(img);
-
-   int dpi = DPI/(sizeImg.width()/100);
-   QImage image;
-   CALL (_pdfio->getImage (_filename, pagenum, image, dpi, dpi, true));
+   // colour_image_for_blank() needs a 32bpp image, which a thumbnail may not be
    if (blank)
+      {
+      image = image.convertToFormat (QImage::Format_RGB32);
       colour_image_for_blank (image);
-
-   pixmap = QPixmap::fromImage(image);
-   // qDebug () << "pixmap" << pixmap.width () << pixmap.height ();
+      }
    return NULL;
    }
 
@@ -333,17 +336,46 @@ err_info *Filepdf::addPage (const Filepage *mp, bool do_flush)
 err_info *Filepdf::removePages (QBitArray &pages,
       QByteArray &del_info, int &count)
    {
-
-    return not_impl ();
+   HummusPDFCore p;
+   std::vector<unsigned long> removed;
+   int status;
+
+   // the page tree is updated in place, so let go of the file first
+   kill ();
+   status = p.remove (pages, _pathname.toStdString (), removed);
+   setValid (false);
+   CALL (load ());
+   if (status)
+      return err_make (ERRFN, ERR_pdf_creation_error1,
+                       p.getErrorMsg ().c_str ());
+
+   // the pages are still in the file, so we just need their object IDs
+   del_info = QByteArray ((const char *)removed.data (),
+                          removed.size () * sizeof (unsigned long));
+   count = removed.size ();
+   return NULL;
    }
 
 
 
 
-err_info *Filepdf::restorePages (QBitArray &,
-   QByteArray &, int )
+err_info *Filepdf::restorePages (QBitArray &pages,
+   QByteArray &del_info, int count)
    {
-   return not_impl ();
+   HummusPDFCore p;
+   const unsigned long *ids = (const unsigned long *)del_info.constData ();
+   std::vector<unsigned long> removed (ids, ids + count);
+   int status;
+
+   Q_ASSERT (del_info.size () == int (count * sizeof (unsigned long)));
+   kill ();
+   status = p.restore (pages, removed, _pathname.toStdString ());
+   setValid (false);
+   CALL (load ());
+   if (status)
+      return err_make (ERRFN, ERR_pdf_creation_error1,
+                       p.getErrorMsg ().c_str ());
+   return NULL;
    }
 
 
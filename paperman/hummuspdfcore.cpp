@@ -2,42 +2,86 @@
 #include <sstream>
 #include <cmath>
 #include <iostream>
+#include <QCoreApplication>
 #include <QFile>
+#include <QFileInfo>
 #include <QDebug>
 #include <QBitArray>
 #include <err.h>
+#include <stdio.h>
+#include "op.h"
+#include "utils.h"
 #include <PDFWriter/PDFWriter/PDFWriter.h>
 #include <PDFWriter/PDFWriter/PDFPage.h>
 #include <PDFWriter/PDFWriter/PDFWriter.h>
 #include <PDFWriter/PDFWriter/PDFPageInput.h>
+#include <PDFWriter/PDFWriter/PDFParser.h>
+#include <PDFWriter/PDFWriter/PDFDictionary.h>
+#include <PDFWriter/PDFWriter/PDFIndirectObjectReference.h>
+#include <PDFWriter/PDFWriter/PDFObjectCast.h>
+#include <PDFWriter/PDFWriter/PDFDocumentCopyingContext.h>
+#include <PDFWriter/PDFWriter/DictionaryContext.h>
+#include <PDFWriter/PDFWriter/ObjectsContext.h>
+#include <PDFWriter/PDFWriter/RefCountPtr.h>
 
 HummusPDFCore::HummusPDFCore(){
     errorMsg="None";
 }
 
-int HummusPDFCore::merge(std::vector<std::string> &files, std::string dest){
+int HummusPDFCore::merge(std::vector<std::string> &files, const QString &dest, Operation *op){
+    // dest is often one of the inputs, so write alongside it and rename at the end.
+    // Hummus opens files with a narrow fopen(), so keep our own name ASCII
+    QString tmp=QFileInfo(dest).path()+QString("/.merge-%1.pdf").arg(QCoreApplication::applicationPid());
     PDFWriter pdfWriter;
+    err_info *err;
 
     EStatusCode status;
 
-    status=pdfWriter.StartPDF(dest, ePDFVersion13);
+    status=pdfWriter.StartPDF(QFile::encodeName(tmp).constData(), ePDFVersion13);
 
     if (status!=PDFHummus::eSuccess){
-        errorMsg="failed to start pdf "+dest;
+        errorMsg="failed to start pdf "+tmp.toStdString();
         return status;
     }
 
-    for (unsigned int i=0;i<files.size();i++){
-        status=pdfWriter.AppendPDFPagesFromPDF(files[i], PDFPageRange()).first;
-        if (status!=PDFHummus::eSuccess){
-            errorMsg="failed to merge "+files[i]+"\n";
+    errorMsg="";
+    for (unsigned int i=0;i<files.size() && status==PDFHummus::eSuccess;i++){
+        PDFDocumentCopyingContext *copying=pdfWriter.CreatePDFCopyingContext(files[i]);
+
+        if (!copying){
+            errorMsg="failed to open "+files[i];
+            status=PDFHummus::eFailure;
             break;
         }
+
+        // pages are copied one at a time straight into the output, so only the
+        // page being copied is held in memory. The copying context remembers
+        // which source objects it has written, so fonts and images shared by
+        // several pages of a source are only copied once
+        unsigned long count=copying->GetSourceDocumentParser()->GetPagesCount();
+        for (unsigned long j=0;j<count;j++){
+            status=copying->AppendPDFPageFromPDF(j).first;
+            if (status!=PDFHummus::eSuccess){
+                errorMsg="failed to merge "+files[i];
+                break;
+            }
+            if (op)
+                op->incProgress(1);
+        }
+        delete copying;
+    }
+
+    if (pdfWriter.EndPDF()!=PDFHummus::eSuccess && status==PDFHummus::eSuccess){
+        errorMsg="failed to end pdf "+tmp.toStdString();
+        status=PDFHummus::eFailure;
+    }
+    // dest is an existing file, which rename() will not replace on Windows
+    if (status==PDFHummus::eSuccess && (err=util_replaceFile(tmp, dest))){
+        errorMsg=err->errstr;
+        status=PDFHummus::eFailure;
     }
-    status=pdfWriter.EndPDF();
-    errorMsg="";
     if (status!=PDFHummus::eSuccess)
-        errorMsg+="failed to end pdf "+dest;
+        QFile::remove(tmp);
 
     return status;
 }
@@ -180,254 +224,248 @@ error:
 
 
 int HummusPDFCore::reorder(int num, int list, std::string srcPath){
-    //https://github.com/galkahana/PDF-Writer/wiki/PDF-Parsing
+    PDFWriter pdfWriter;
+    std::vector<unsigned long> ids, ordered;
     EStatusCode status;
-    InputFile pdfFile;
-    PDFParser parser;
-    status=pdfFile.OpenFile(srcPath);
-    if (status!=PDFHummus::eSuccess){
-        errorMsg="failed to open pdf";
-        return status;
-    }
-    status=parser.StartPDFParsing(pdfFile.GetInputStream());
-    if (status!=PDFHummus::eSuccess){
-        errorMsg="failed to parse pdf";
-        return status;
-    }
-
-    unsigned int long pageNum=parser.GetPagesCount();
-    if (!pageNum){
-        errorMsg="pdf is empty or failed to parse content";
-        return PDFHummus::eFailure;
-    }
-    errorMsg="";
-
-    //pageNum = 1;
-
-    std::vector<std::string> fileNames;
-
-    QString src = QString::fromStdString(srcPath);
-    QStringList sp = src.split("/");
-    QStringList ps = sp[sp.size()-1].split(".");
-
-    std::string baseFileName = ps[0].toStdString();
-
-    std::string destDir = "";
-
-    for(int i = 0; i < sp.size() - 1; i++){
-        destDir = destDir + sp[i].toStdString() + "/";
-    }
-
-    qDebug() << "Test: " << QString::fromStdString(destDir) << " : " << QString::fromStdString(baseFileName);
 
-   // split(srcPath, destDir, baseFileName, false);
-   // return 0;
-    for (unsigned int long i=0;i<pageNum;i++){
-        //std::string fullDest=destDir+'/'+baseFileName+"_"+intZeroPadding(i+1,pageNum);
-        std::string fullDest=destDir+baseFileName;
-        fullDest = fullDest + "processed_" + intZeroPadding(i+1,pageNum);
-        fileNames.push_back(fullDest + ".pdf");
-
-        PDFPageInput pageInput(&parser,parser.ParsePage(i));
-        PDFRectangle mediaBox=pageInput.GetMediaBox();
-
-        PDFWriter pdfWriter;
-        PDFPage* page=new PDFPage();
-        status=pdfWriter.StartPDF(fullDest+".pdf", ePDFVersion13);
-        page->SetMediaBox(mediaBox);
-        PDFPageRange singlePageRange;
-
-        singlePageRange.mType = PDFPageRange::eRangeTypeSpecific;
-        singlePageRange.mSpecificRanges.push_back(ULongAndULong(i,i));
-
-        //qDebug() << "Tetete";
-
-
-        status=pdfWriter.MergePDFPagesToPage(page,srcPath,singlePageRange);
-        if (status!=PDFHummus::eSuccess)
-            goto error;
-
-        status=pdfWriter.WritePageAndRelease(page);
-        if (status!=PDFHummus::eSuccess)
-            goto error;
-
-        status=pdfWriter.EndPDF();
-        if (status!=PDFHummus::eSuccess)
-            goto error;
-
-        //qDebug() << "Tetete";
-        continue;
-error:
-        errorMsg+="failed to split page "+intZeroPadding(i+1,pageNum)+"\n";
-
-    }
-
-    std::vector<std::string> ordered;
+    status=(EStatusCode)startUpdate(pdfWriter, srcPath, ids);
+    if (status!=PDFHummus::eSuccess)
+        return status;
 
     num = num - 1;
     list = list - 1;
+    if (num < 0 || list < 0 || num >= (int)ids.size() || list >= (int)ids.size()){
+        errorMsg="page number out of range";
+        pdfWriter.EndPDF();
+        return PDFHummus::eFailure;
+    }
     if(num < list){
         for(int i = 0; i < num; i++){
-            ordered.push_back(fileNames[i]);
+            ordered.push_back(ids[i]);
         }
-        ordered.push_back(fileNames[list]);
-        ordered.push_back(fileNames[num]);
+        ordered.push_back(ids[list]);
+        ordered.push_back(ids[num]);
         for(int i = num + 1; i < list; i++){
-            ordered.push_back(fileNames[i]);
+            ordered.push_back(ids[i]);
         }
-        for(int i = list + 1; i < fileNames.size(); i++){
-            ordered.push_back(fileNames[i]);
+        for(int i = list + 1; i < (int)ids.size(); i++){
+            ordered.push_back(ids[i]);
         }
     }
     else{
         for(int i = 0; i < list; i++){
-            ordered.push_back(fileNames[i]);
+            ordered.push_back(ids[i]);
         }
         for(int i = list + 1; i < num; i++){
-            ordered.push_back(fileNames[i]);
+            ordered.push_back(ids[i]);
         }
-        ordered.push_back(fileNames[num]);
-        ordered.push_back(fileNames[list]);
-        for(int i = num + 1; i < fileNames.size(); i++){
-            ordered.push_back(fileNames[i]);
+        ordered.push_back(ids[num]);
+        ordered.push_back(ids[list]);
+        for(int i = num + 1; i < (int)ids.size(); i++){
+            ordered.push_back(ids[i]);
         }
 
     }
 
-    merge(ordered, srcPath);
-
-    for (unsigned int i=0;i<fileNames.size();i++){
-        QString f = QString::fromStdString(fileNames[i]);
-        QFile file (f);
-
-        if (file.exists () && !file.remove ())
-           err_make (ERRFN, ERR_could_not_remove_file2,
-                     file.fileName ().toLatin1 ().constData(),
-                     file.errorString ().toLatin1 ().constData());
-    }
-
-    return status;
+    return finishUpdate(pdfWriter, ordered);
 }
 
 int HummusPDFCore::remove(QBitArray pages, std::string srcPath){
+    std::vector<unsigned long> removed;
 
+    return remove(pages, srcPath, removed);
+}
 
+int HummusPDFCore::remove(QBitArray pages, std::string srcPath, std::vector<unsigned long> &removed){
+    PDFWriter pdfWriter;
+    std::vector<unsigned long> ids, kept;
     EStatusCode status;
-    InputFile pdfFile;
-    PDFParser parser;
-    status=pdfFile.OpenFile(srcPath);
-    if (status!=PDFHummus::eSuccess){
-        errorMsg="failed to open pdf";
-        return status;
-    }
-    status=parser.StartPDFParsing(pdfFile.GetInputStream());
-    if (status!=PDFHummus::eSuccess){
-        errorMsg="failed to parse pdf";
+
+    status=(EStatusCode)startUpdate(pdfWriter, srcPath, ids);
+    if (status!=PDFHummus::eSuccess)
         return status;
-    }
 
-    unsigned int long pageNum=parser.GetPagesCount();
-    if (!pageNum){
-        errorMsg="pdf is empty or failed to parse content";
+    // the removed pages stay in the file, so that they can be restored
+    removed.clear();
+    for (unsigned int i=0; i<ids.size(); i++){
+        if (i < (unsigned int)pages.size() && pages.testBit(i))
+            removed.push_back(ids[i]);
+        else
+            kept.push_back(ids[i]);
+    }
+    if (kept.empty()){
+        errorMsg="cannot remove every page";
+        pdfWriter.EndPDF();
         return PDFHummus::eFailure;
     }
-    errorMsg="";
-
-    //pageNum = 1;
 
-    std::vector<std::string> fileNames;
-
-   /* for (int i = sz - 1; i >=0  ; i--)
-       if (pages.testBit (i)){
-           int status=p.remove(pname.toStdString(), i);
-           qDebug(p.getErrorMsg().c_str());
-       }*/
-
-    QString src = QString::fromStdString(srcPath);
-    QStringList sp = src.split("/");
-    QStringList ps = sp[sp.size()-1].split(".");
+    return finishUpdate(pdfWriter, kept);
+}
 
-    std::string baseFileName = ps[0].toStdString();
+int HummusPDFCore::restore(QBitArray pages, const std::vector<unsigned long> &removed, std::string srcPath){
+    PDFWriter pdfWriter;
+    std::vector<unsigned long> ids, restored;
+    unsigned int upto=0, srcnum=0;
+    EStatusCode status;
 
-    std::string destDir = "";
+    status=(EStatusCode)startUpdate(pdfWriter, srcPath, ids);
+    if (status!=PDFHummus::eSuccess)
+        return status;
 
-    for(int i = 0; i < sp.size() - 1; i++){
-        destDir = destDir + sp[i].toStdString() + "/";
+    for (unsigned int i=0; i<ids.size()+removed.size(); i++){
+        if (i < (unsigned int)pages.size() && pages.testBit(i) && upto < removed.size())
+            restored.push_back(removed[upto++]);
+        else if (srcnum < ids.size())
+            restored.push_back(ids[srcnum++]);
     }
 
-    std::vector<std::string> fn;
-
-    for (unsigned int long i=0; i<pageNum; i++){
-
-        if (!pages.testBit (i)){
+    return finishUpdate(pdfWriter, restored);
+}
 
-            std::string fullDest=destDir+baseFileName;
-            fullDest = fullDest + "processed_" + intZeroPadding(i+1,pageNum);
-            fn.push_back(fullDest + ".pdf");
+int HummusPDFCore::startUpdate(PDFWriter &pdfWriter, std::string srcPath, std::vector<unsigned long> &ids){
+    EStatusCode status;
 
-            PDFPageInput pageInput(&parser,parser.ParsePage(i));
-            PDFRectangle mediaBox=pageInput.GetMediaBox();
+    // the update is appended to the file, leaving what is there alone
+    status=pdfWriter.ModifyPDF(srcPath, ePDFVersion13, "");
+    if (status!=PDFHummus::eSuccess){
+        errorMsg="failed to open pdf "+srcPath;
+        return status;
+    }
 
-            PDFWriter pdfWriter;
-            PDFPage* page=new PDFPage();
-            status=pdfWriter.StartPDF(fullDest + ".pdf", ePDFVersion13);
-            page->SetMediaBox(mediaBox);
-            PDFPageRange singlePageRange;
+    PDFParser &parser=pdfWriter.GetModifiedFileParser();
+    unsigned long pageNum=parser.GetPagesCount();
+    if (!pageNum){
+        errorMsg="pdf is empty or failed to parse content";
+        pdfWriter.EndPDF();
+        return PDFHummus::eFailure;
+    }
+    errorMsg="";
 
-            singlePageRange.mType = PDFPageRange::eRangeTypeSpecific;
-            singlePageRange.mSpecificRanges.push_back(ULongAndULong(i,i));
+    ids.clear();
+    for (unsigned long i=0; i<pageNum; i++)
+        ids.push_back(parser.GetPageObjectID(i));
+    return PDFHummus::eSuccess;
+}
 
-            status=pdfWriter.MergePDFPagesToPage(page,srcPath,singlePageRange);
-            if (status!=PDFHummus::eSuccess)
-                goto error;
+int HummusPDFCore::finishUpdate(PDFWriter &pdfWriter, const std::vector<unsigned long> &ids){
+    PDFParser &parser=pdfWriter.GetModifiedFileParser();
+    ObjectsContext &objects=pdfWriter.GetObjectsContext();
+    std::vector<unsigned long> moved;
+    EStatusCode status=PDFHummus::eSuccess;
+
+    // find the root of the page tree
+    PDFObjectCastPtr<PDFDictionary> catalog(parser.QueryDictionaryObject(parser.GetTrailer(), "Root"));
+    PDFObjectCastPtr<PDFIndirectObjectReference> rootRef;
+    if (catalog.GetPtr())
+        rootRef=catalog->QueryDirectObject("Pages");
+    if (!rootRef.GetPtr()){
+        errorMsg="cannot find the pdf page tree";
+        pdfWriter.EndPDF();
+        return PDFHummus::eFailure;
+    }
+    ObjectIDType rootId=rootRef->mObjectID;
+    PDFObjectCastPtr<PDFDictionary> root(parser.ParseNewObject(rootId));
+
+    // pages further down the tree must move up to the root. Check them all
+    // before writing anything
+    for (unsigned int i=0; root.GetPtr() && i<ids.size(); i++){
+        PDFObjectCastPtr<PDFDictionary> page(parser.ParseNewObject(ids[i]));
+        if (!page.GetPtr()){
+            status=PDFHummus::eFailure;
+            break;
+        }
+        PDFObjectCastPtr<PDFIndirectObjectReference> parent(page->QueryDirectObject("Parent"));
+        if (!parent.GetPtr() || parent->mObjectID!=rootId)
+            moved.push_back(ids[i]);
+    }
+    if (!root.GetPtr() || status!=PDFHummus::eSuccess){
+        errorMsg="failed to read the pdf page tree";
+        pdfWriter.EndPDF();
+        return PDFHummus::eFailure;
+    }
 
-            status=pdfWriter.WritePageAndRelease(page);
-            if (status!=PDFHummus::eSuccess)
-                goto error;
+    PDFDocumentCopyingContext *copying=pdfWriter.CreatePDFCopyingContextForModifiedFile();
+    if (!copying){
+        errorMsg="failed to update the pdf page tree";
+        pdfWriter.EndPDF();
+        return PDFHummus::eFailure;
+    }
 
-            status=pdfWriter.EndPDF();
-            if (status!=PDFHummus::eSuccess)
-                goto error;
+    for (unsigned int i=0; i<moved.size(); i++){
+        PDFObjectCastPtr<PDFDictionary> page(parser.ParseNewObject(moved[i]));
+        movePage(parser, objects, copying, moved[i], page.GetPtr(), rootId);
+    }
 
+    // now the root itself, keeping everything but the list of pages
+    objects.StartModifiedIndirectObject(rootId);
+    DictionaryContext *dict=objects.StartDictionary();
+    MapIterator<PDFNameToPDFObjectMap> it=root->GetIterator();
+    while (it.MoveNext()){
+        std::string key=it.GetKey()->GetValue();
+        if (key=="Kids" || key=="Count")
             continue;
-    error:
-            errorMsg+="failed to split page "+intZeroPadding(i+1,pageNum)+"\n";
-        }
+        dict->WriteKey(key);
+        copying->CopyDirectObjectAsIs(it.GetValue());
     }
+    dict->WriteKey("Count");
+    dict->WriteIntegerValue(ids.size());
+    dict->WriteKey("Kids");
+    objects.StartArray();
+    for (unsigned int i=0; i<ids.size(); i++)
+        objects.WriteIndirectObjectReference(ids[i]);
+    objects.EndArray(eTokenSeparatorEndLine);
+    objects.EndDictionary(dict);
+    objects.EndIndirectObject();
+    delete copying;
 
-    /*status=pdfWriter.EndPDF();
+    status=pdfWriter.EndPDF();
     if (status!=PDFHummus::eSuccess)
-        errorMsg+="failed to split page";*/
-    merge(fn, srcPath);
-
-    for (unsigned int i=0;i<fn.size();i++){
-        QString f = QString::fromStdString(fn[i]);
-        QFile file (f);
+        errorMsg="failed to end pdf";
+    return status;
+}
 
-        if (file.exists () && !file.remove ())
-           err_make (ERRFN, ERR_could_not_remove_file2,
-                     file.fileName ().toLatin1 ().constData(),
-                     file.errorString ().toLatin1 ().constData());
+void HummusPDFCore::movePage(PDFParser &parser, ObjectsContext &objects,
+                             PDFDocumentCopyingContext *copying, unsigned long id,
+                             PDFDictionary *page, unsigned long rootId){
+    // attributes which a page can inherit from the page tree
+    static const char *inherited[]={"Resources", "MediaBox", "CropBox", "Rotate", NULL};
+
+    objects.StartModifiedIndirectObject(id);
+    DictionaryContext *dict=objects.StartDictionary();
+    MapIterator<PDFNameToPDFObjectMap> it=page->GetIterator();
+    while (it.MoveNext()){
+        if (it.GetKey()->GetValue()=="Parent")
+            continue;
+        dict->WriteKey(it.GetKey()->GetValue());
+        copying->CopyDirectObjectAsIs(it.GetValue());
     }
 
-    /*QString f = QString::fromStdString(srcPath);
-    QFile file (f);
-
-    if (file.exists () && !file.remove ())
-       err_make (ERRFN, ERR_could_not_remove_file2,
-                 file.fileName ().toLatin1 ().constData(),
-                 file.errorString ().toLatin1 ().constData());
-
-    QString g = QString::fromStdString(destDir + baseFileName + "(test).pdf");
-    QFile gile (g);
-
-    if (gile.exists () && !gile.rename (QString::fromStdString(srcPath)))
-       err_make (ERRFN, ERR_could_not_remove_file2,
-                 file.fileName ().toLatin1 ().constData(),
-                 file.errorString ().toLatin1 ().constData());*/
+    // the page loses its old parents, so must hold anything it inherited
+    for (int i=0; inherited[i]; i++){
+        if (page->Exists(inherited[i]))
+            continue;
+        RefCountPtr<PDFObject> value(findInherited(parser, page, inherited[i]));
+        if (value.GetPtr()){
+            dict->WriteKey(inherited[i]);
+            copying->CopyDirectObjectAsIs(value.GetPtr());
+        }
+    }
+    dict->WriteKey("Parent");
+    dict->WriteObjectReferenceValue(rootId);
+    objects.EndDictionary(dict);
+    objects.EndIndirectObject();
+}
 
+PDFObject *HummusPDFCore::findInherited(PDFParser &parser, PDFDictionary *page, const std::string &key){
+    PDFObjectCastPtr<PDFDictionary> node(parser.QueryDictionaryObject(page, "Parent"));
 
-    return status;
+    // a broken file could have a loop here, so don't go on forever
+    for (int depth=0; node.GetPtr() && depth<32; depth++){
+        if (node->Exists(key))
+            return node->QueryDirectObject(key);
+        node=parser.QueryDictionaryObject(node.GetPtr(), "Parent");
+    }
+    return NULL;
 }
 
 
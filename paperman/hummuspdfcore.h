@@ -3,20 +3,56 @@
 #include <string>
 #include <vector>
 #include <QBitArray>
+#include <QString>
+
+class PDFWriter;
+class PDFParser;
+class PDFDictionary;
+class PDFObject;
+class ObjectsContext;
+class PDFDocumentCopyingContext;
+class Operation;
 
 class HummusPDFCore
 {
 public:
     HummusPDFCore();
-    int merge(std::vector<std::string>&,std::string);
+    // merge files into dest page by page, without loading whole documents.
+    // Dest may be one of the inputs. If op is given, it advances once per page.
+    // Files are opened with fopen(), so must be encoded with QFile::encodeName()
+    int merge(std::vector<std::string>&,const QString &dest,Operation *op=0);
     int split(std::string, std::string, std::string, bool split);
+
+    // reorder, remove and restore append an update to the file which
+    // rewrites only the page tree, so they don't copy any page content
     int reorder(int num, int list, std::string path);
     int remove(QBitArray pages, std::string path);
+
+    // as above, returning the object IDs of the removed pages for restore()
+    int remove(QBitArray pages, std::string path, std::vector<unsigned long> &removed);
+
+    // put back pages removed by remove(). Bit n of pages is set if page n of
+    // the restored document is one of the removed pages
+    int restore(QBitArray pages, const std::vector<unsigned long> &removed, std::string path);
     std::string getErrorMsg();
 
 private:
     std::string errorMsg;
     std::string intZeroPadding(int, int c);
+
+    // open a pdf for an incremental update and get the object ID of each page
+    int startUpdate(PDFWriter &pdfWriter, std::string path, std::vector<unsigned long> &ids);
+
+    // write a new page tree holding the given pages, and finish the update
+    int finishUpdate(PDFWriter &pdfWriter, const std::vector<unsigned long> &ids);
+
+    // rewrite a page so that it hangs directly off the root of the page tree
+    void movePage(PDFParser &parser, ObjectsContext &objects,
+                  PDFDocumentCopyingContext *copying, unsigned long id,
+                  PDFDictionary *page, unsigned long rootId);
+
+    // find an attribute which a page inherits from the page tree above it
+    PDFObject *findInherited(PDFParser &parser, PDFDictionary *page, const std::string &key);
 };
 
 #endif // PDFCORE_H
@@ -26,10 +26,13 @@ C           copy        scan and print to default printer, save to 'photocopy' f
 */
 
 
+#include <stdlib.h>
 #include <unistd.h>
 #include <getopt.h>
 
 #include <QDebug>
+#include <QDir>
+#include <QFileInfo>
 #include <QSettings>
 #include <QTranslator>
 
@@ -45,7 +48,10 @@ C           copy        scan and print to default printer, save to 'photocopy' f
 #include "dirmodel.h"
 #include "mainwidget.h"
 #include "mainwindow.h"
+#include "batch.h"
+#include "bench.h"
 #include "desk.h"
+#include "filemax.h"
 #include "maxview.h"
 #include "op.h"
 #include "editablelabel.h"
@@ -72,24 +78,96 @@ static void usage (void)
    printf ("maxview - An electronic filing cabinet: scan, print, stack, arrange\n\n");
    printf ("(C) 2011 Simon Glass, chch-kiwi@users.sourceforge.net, v%s\n\n",
            CONFIG_version_str);
-   printf ("Usage:  maxview <opts>  <dir/file>\n\n");
-/*
-   printf ("   -p|--pdf        convert given file to .pdf\n");
-   printf ("   -m|--max        convert given file to .max\n");
-   printf ("   -j|--jpeg       convert given file to .jpg\n");
-   printf ("   -v|--verbose    be verbose\n");
-*/
+   printf ("Usage:  maxview <opts>  <dir/file>...\n\n");
+   printf ("   -p|--pdf        convert given stacks to .pdf\n");
+   printf ("   -m|--max        convert given stacks to .max\n");
+   printf ("   -j|--jpeg       convert given stacks to .jpg\n");
+   printf ("   -i|--info       show the type and size of each stack\n");
+   printf ("   -s|--sum        show an MD5 checksum of the page images in each stack\n");
+   printf ("   -c|--compact    compact the given .max file(s), removing unused space\n");
+   printf ("   -T|--thumbs     write previews of each stack to the thumbnail cache\n");
+   printf ("   -B|--bench      time the image codecs on synthetic pages, writing JSON;\n");
+   printf ("                   any dir given is used for temporary files\n");
+   printf ("   -J|--jobs <n>   number of stacks to process at once (default: one per CPU)\n");
+   printf ("   -f|--force      force overwriting of existing file\n");
    printf ("   -h|--help       display this usage information\n");
 /*
+   printf ("   -v|--verbose    be verbose\n");
    printf ("   -d|--debug <n>  set debug level (0-3)\n");
-   printf ("   -f|--force      force overwriting of existing file\n");
    printf ("   -r|--relocate   move a processed file into a 'xxx.old' subdirectory\n");
-   printf ("   -i|--info       display full info about a file\n");
    printf ("      --index <f>  build/update an index file f for the given directory\n");
-   printf ("\n");
-   printf ("If none of -p, -m, -j are specified, maxview opens in desktop "
-          "mode, displaying\nthumbails of the given directory\n");
 */
+   printf ("\n");
+   printf ("The operations above run without a display. Directories are searched for\n");
+   printf ("stacks, including all subdirectories. For each stack, a tab-separated line\n");
+   printf ("is written to stdout with the operation, status (ok, skip or error), time\n");
+   printf ("taken in ms, number of pages, path and detail (e.g. error message).\n\n");
+   printf ("If no operation is specified, maxview opens in desktop mode\n");
+   }
+
+
+/** run a batch operation on the stacks given on the command line
+
+   \param op_type    operation (command-line option character)
+   \param jobs       number of stacks to process at once, 0 for one per CPU
+   \param force      true to overwrite existing files
+   \param argc       number of arguments
+   \param argv       arguments, with the stacks / directories from optind
+   \returns exit code */
+
+static int run_batch (int op_type, int jobs, bool force, int argc, char *argv[])
+   {
+   Batch::e_op op = Batch::Op_info;
+   int ret = 0, i;
+
+   // no GUI is needed, so this can run on servers
+   QCoreApplication app (argc, argv);
+
+   QCoreApplication::setOrganizationName("maxview");
+   QCoreApplication::setApplicationName("maxview");
+
+   switch (op_type)
+      {
+      case 'p' :
+         op = Batch::Op_pdf;
+         break;
+      case 'm' :
+         op = Batch::Op_max;
+         break;
+      case 'j' :
+         op = Batch::Op_jpeg;
+         break;
+      case 'i' :
+         op = Batch::Op_info;
+         break;
+      case 's' :
+         op = Batch::Op_sum;
+         break;
+      case 'c' :
+         op = Batch::Op_compact;
+         break;
+      case 'T' :
+         op = Batch::Op_thumbs;
+         break;
+      }
+
+   if (optind == argc)
+      {
+      usage ();
+      return 1;
+      }
+
+   Batch batch (op, jobs, force);
+
+   for (i = optind; i < argc; i++)
+      if (!batch.addPath (argv [i]))
+         {
+         fprintf (stderr, "%s: not found\n", argv [i]);
+         ret = 1;
+         }
+   if (batch.run ())
+      ret = 1;
+   return ret;
    }
 
 
@@ -108,25 +186,32 @@ int main (int argc, char *argv[])
 //    err_info *e;
    static struct option long_options[] = {
 //     {"index", 0, 0, '1'},
+     {"bench", 0, 0, 'B'},
+     {"compact", 0, 0, 'c'},
      {"help", 0, 0, 'h'},
-/*
      {"jpg", 0, 0, 'j'},
-     {"debug", 1, 0, 'd'},
+     {"jpeg", 0, 0, 'j'},
      {"force", 0, 0, 'f'},
      {"info", 0, 0, 'i'},
+     {"jobs", 1, 0, 'J'},
      {"max", 0, 0, 'm'},
      {"pdf", 0, 0, 'p'},
-     {"relocate", 0, 0, 'r'},
      {"sum", 0, 0, 's'},
+     {"thumbs", 0, 0, 'T'},
+/*
+     {"debug", 1, 0, 'd'},
+     {"relocate", 0, 0, 'r'},
      {"test", 0, 0, 't'},
      {"verbose", 0, 0, 'v'},
 */
      {0, 0, 0, 0}
    };
    int op_type = -1, c;
+   int jobs = 0;
+   bool force = false;
    QString index;
 
-   while (c = getopt_long (argc, argv, "h",
+   while (c = getopt_long (argc, argv, "BcfhijmpsTJ:",
                            long_options, NULL), c != -1)
       switch (c)
          {
@@ -136,9 +221,20 @@ int main (int argc, char *argv[])
 	 case 'p' :
 	 case 'i' :
 	 case 'j' :
+	 case 'c' :
+	 case 'T' :
+	 case 'B' :
 	    op_type = c;
 	    break;
 
+	 case 'J' :
+	    jobs = atoi (optarg);
+	    break;
+
+	 case 'f' :
+	    force = true;
+	    break;
+
 	 case '1' :
 	    op_type = c;
 	    index = QString (optarg);
@@ -158,6 +254,20 @@ int main (int argc, char *argv[])
 */
 	 }
 
+   // nor does the benchmark
+   if (op_type == 'B')
+      {
+      QCoreApplication app (argc, argv);
+      Bench bench (optind < argc ? argv [optind] : QDir::tempPath (),
+            CONFIG_bench_pages);
+
+      return bench.run ();
+      }
+
+   // batch operations don't need the GUI at all
+   if (op_type != -1 && op_type != 't' && op_type != '1')
+      return run_batch (op_type, jobs, force, argc, argv);
+
    if (optind < argc)
       dir = argv [optind];
 
@@ -209,17 +319,6 @@ int main (int argc, char *argv[])
    switch (op_type)
       {
 #if 0
-      case 's' :
-	 {
-	 QString mydir = QString (dir);
-	 Desk *maxdesk = new Desk (mydir, QString::null);
-
-	 // decode everything in the given directory and checksum it
-	 if (!maxdesk->checksum ())
-	    printf ("checksum error\n");
-	 break;
-	 }
-
       case 't' :
 	 {
 	 QString fname = QString (dir);
@@ -236,51 +335,8 @@ int main (int argc, char *argv[])
 //	   printf ("test error %s\n", e->errstr);
 	 break;
 	 }
-
-      case 'p' :
-	 {
-	 Desk maxdesk (QString::null, QString::null);
-	 QString fname = QString (dir);
-
-	 // convert the file to PDF
-	 maxdesk.convertPdf (fname);
-	 break;
-	 }
-
-      case 'j' :
-	 {
-	 Desk maxdesk (QString::null, QString::null);
-	 QString fname = QString (dir);
-
-	 // convert the file to JPEG
-	 maxdesk.convertJpeg (fname);
-	 break;
-	 }
-
-      case 'm' :
-	 {
-	 Desk maxdesk (QString::null, QString::null);
-	 QString fname = QString (dir);
-
-      // convert the file to .max
-	 e = maxdesk.convertMax (fname, QString::null, verbose, force, reloc);
-	 if (e)
-	    printf ("error: %s\n", e->errstr);
-	 break;
-	 }
-
-      case 'i' :
-	 {
-	 Desk maxdesk (QString::null, QString::null, false, false, false);
-	 QString fname = QString (dir);
-
-         // decode print info on the file
-	 e = maxdesk.dumpInfo (fname, debug);
-	 if (e)
-	    printf ("error: %s\n", e->errstr);
-	 break;
-	 }
 #endif
+
       case -1 :
          {
 	 me = new Mainwindow ();
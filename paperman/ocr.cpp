@@ -56,35 +56,34 @@ Ocr::~Ocr ()
 
 
 Ocr *Ocr::getOcr (err_info *&err)
+   {
+   err = NULL;
+   if (!static_ocr)
+      static_ocr = newOcr (err);
+   return static_ocr;
+   }
+
+
+Ocr *Ocr::newOcr (err_info *&err)
    {
    Ocr *ocr;
 
    err = NULL;
 #ifdef CONFIG_use_omnipage
-   if (!static_ocr)
-      {
-      // should support dynamic loading for this
-      ocr = new Ocromni ();
-      err = ocr->init ();
-      if (err)
-         {
-         qDebug () << "Omnipage enginer error" << err->errstr;
-         delete ocr;
-         }
-      else
-         static_ocr = ocr;
-      }
+   // should support dynamic loading for this
+   ocr = new Ocromni ();
+   err = ocr->init ();
+   if (!err)
+      return ocr;
+   qDebug () << "Omnipage enginer error" << err->errstr;
+   delete ocr;
 #endif
-   if (!static_ocr)
-      {
-      ocr = new Ocrtess ();
-      err = ocr->init ();
-      if (err)
-         delete ocr;
-      else
-         static_ocr = ocr;
-      }
-   return static_ocr;
+   ocr = new Ocrtess ();
+   err = ocr->init ();
+   if (!err)
+      return ocr;
+   delete ocr;
+   return 0;
    }
 
 
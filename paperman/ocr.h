@@ -64,6 +64,14 @@ public:
       \returns ocr engine, or 0 if none could be found */
    static Ocr *getOcr (err_info *&err);
 
+   /** sets up a new instance of the best available Ocr engine. Engines are
+       not thread-safe, so each thread doing OCR needs its own
+
+      \param err     error returned, NULL if ok
+      \returns ocr engine (which the caller must delete), or 0 if none could
+               be found */
+   static Ocr *newOcr (err_info *&err);
+
 protected:
    e_engine _engine;  //!< ocr engine we are using
    };
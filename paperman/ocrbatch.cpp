@@ -0,0 +1,191 @@
+/*
+License: GPL-2
+  An electronic filing cabinet: scan, print, stack, arrange
+ Copyright (C) 2009 Simon Glass, chch-kiwi@users.sourceforge.net
+ .
+ This program is free software; you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation; either version 2 of the License, or
+ (at your option) any later version.
+ .
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+ .
+ You should have received a copy of the GNU General Public License
+ along with this program; if not, write to the Free Software
+ Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301 USA
+
+X-Comment: On Debian GNU/Linux systems, the complete text of the GNU General
+ Public License can be found in the /usr/share/common-licenses/GPL file.
+*/
+
+
+#include <QImage>
+#include <QList>
+#include <QThread>
+#include <QThreadStorage>
+#include <QtConcurrent>
+
+#include "err.h"
+#include "file.h"
+#include "ocr.h"
+#include "ocrbatch.h"
+#include "op.h"
+
+
+//! OCR engine for each worker thread, deleted when the thread exits
+static QThreadStorage<Ocr *> engines;
+
+
+/** the result of OCRing a page. Errors live in thread-local storage, so the
+    worker copies its error here rather than passing back a pointer */
+typedef struct ocr_result
+   {
+   bool failed;         //!< true if something went wrong
+   err_info err;        //!< the error, if failed
+   QString text;        //!< text found
+   } ocr_result;
+
+
+typedef struct ocr_job
+   {
+   int pagenum;                  //!< page number
+   QFuture<ocr_result> done;     //!< OCR of the page
+   } ocr_job;
+
+
+/** OCR an image using this thread's engine, creating it if needed. This
+    runs in a worker thread
+
+   \param image    image to OCR
+   \returns result */
+static ocr_result ocr_image (QImage image)
+   {
+   ocr_result res;
+   err_info *err = NULL;
+
+   if (!engines.hasLocalData ())
+      engines.setLocalData (Ocr::newOcr (err));
+   if (engines.hasLocalData ())
+      err = engines.localData ()->imageToText (image, res.text);
+   res.failed = err != NULL;
+   if (err)
+      res.err = *err;
+   return res;
+   }
+
+
+/** wait for the first page in the pipeline to be OCRed, then store its text
+
+   \param f        file to store into
+   \param pending  pages in the pipeline
+   \param op       operation to update with progress
+   \returns error, or NULL if ok */
+static err_info *ocr_store (File *f, QList<ocr_job> &pending, Operation &op)
+   {
+   ocr_job job = pending.takeFirst ();
+   ocr_result res = job.done.result ();
+
+   op.incProgress (1);
+   if (res.failed)
+      return err_copy (&res.err);
+   return f->putPageText (job.pagenum, res.text);
+   }
+
+
+Ocrbatch::Ocrbatch (Operation &op)
+   : _op (op)
+   {
+   _count = 0;
+   }
+
+
+int Ocrbatch::count (void) const
+   {
+   return _count;
+   }
+
+
+err_info *Ocrbatch::addFile (File *f)
+   {
+   int pagenum, page_count = f->pagecount ();
+   QList<ocr_job> pending;
+   err_info *err = NULL;
+   bool changed = false;
+
+   // only these can hold text for any page
+   if (f->type () != File::Type_max && f->type () != File::Type_jpeg)
+      {
+      _op.incProgress (page_count);
+      return NULL;
+      }
+
+   // as with File::copyTo(), limit the number of images in flight
+   int max_pending = qMax (2, QThread::idealThreadCount () + 1);
+
+   for (pagenum = 0; pagenum < page_count && !err; pagenum++)
+      {
+      QImage image;
+      QSize size, trueSize;
+      QString text;
+      int bpp;
+
+      // don't OCR any page twice
+      err = f->getPageText (pagenum, text);
+      if (!err && text.trimmed ().isEmpty ())
+         err = f->getImage (pagenum, false, image, size, trueSize, bpp, false);
+      if (err)
+         break;
+      if (image.isNull ())
+         {
+         _op.incProgress (1);
+         continue;
+         }
+
+      ocr_job job;
+
+      job.pagenum = pagenum;
+      job.done = QtConcurrent::run (ocr_image, image);
+      pending << job;
+
+      while (!err && !pending.isEmpty ()
+             && (pending.size () >= max_pending
+                 || pending.first ().done.isFinished ()))
+         {
+         err = ocr_store (f, pending, _op);
+         if (!err)
+            {
+            changed = true;
+            _count++;
+            }
+         }
+      }
+
+   // wait for the rest, but don't store any after an error
+   while (!pending.isEmpty ())
+      {
+      if (err)
+         pending.takeFirst ().done.waitForFinished ();
+      else
+         {
+         err = ocr_store (f, pending, _op);
+         if (!err)
+            {
+            changed = true;
+            _count++;
+            }
+         }
+      }
+
+   // keep whatever we stored before any error
+   if (changed)
+      {
+      err_info *e = f->flush ();
+
+      if (!err)
+         err = e;
+      }
+   return err;
+   }
@@ -0,0 +1,71 @@
+/*
+License: GPL-2
+  An electronic filing cabinet: scan, print, stack, arrange
+ Copyright (C) 2009 Simon Glass, chch-kiwi@users.sourceforge.net
+ .
+ This program is free software; you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation; either version 2 of the License, or
+ (at your option) any later version.
+ .
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+ .
+ You should have received a copy of the GNU General Public License
+ along with this program; if not, write to the Free Software
+ Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301 USA
+
+X-Comment: On Debian GNU/Linux systems, the complete text of the GNU General
+ Public License can be found in the /usr/share/common-licenses/GPL file.
+*/
+/*
+   Project:    Maxview
+   File:       ocrbatch.h
+
+   This file implements OCR of whole stacks.
+
+   Each worker thread keeps its own OCR engine for as long as the thread
+   lives, since starting an engine is slow and engines are not thread-safe.
+   Pages are decoded on the calling thread, handed to the workers as images,
+   and the text is stored back in the file, again on the calling thread.
+   Pages which already have text are skipped, so a stack can be OCRed again
+   without repeating any work.
+*/
+
+#ifndef __ocrbatch_h
+#define __ocrbatch_h
+
+
+class File;
+class Operation;
+
+struct err_info;
+
+
+class Ocrbatch
+   {
+public:
+   /** set up a new batch
+
+      \param op      operation to update, which advances once per page */
+   Ocrbatch (Operation &op);
+
+   /** OCR every page of a file which does not have any text yet, storing
+       the text in the file. Files which cannot store text are skipped
+
+      \param f       file to process
+      \returns error, or NULL if ok */
+   err_info *addFile (File *f);
+
+   //! \returns the number of pages OCRed so far
+   int count (void) const;
+
+private:
+   Operation &_op;      //!< operation to update
+   int _count;          //!< number of pages OCRed
+   };
+
+
+#endif
@@ -34,6 +34,11 @@ X-Comment: On Debian GNU/Linux systems, the complete text of the GNU General
 
 #include "err.h"
 
+#include "config.h"
+
+#ifdef CONFIG_use_tesslib
+#include <tesseract/baseapi.h>
+#endif
 
 #include "ocrtess.h"
 
@@ -42,32 +47,125 @@ X-Comment: On Debian GNU/Linux systems, the complete text of the GNU General
 Ocrtess::Ocrtess (void)
    {
    _engine = OCRE_tesseract;
+   _api = 0;
    }
 
 
 Ocrtess::~Ocrtess ()
    {
+#ifdef CONFIG_use_tesslib
+   if (_api)
+      {
+      _api->End ();
+      delete _api;
+      }
+#endif
    }
 
 
 err_info *Ocrtess::init (void)
    {
+#ifdef CONFIG_use_tesslib
+   // loading the language data is slow, so this is only done once per engine
+   _api = new tesseract::TessBaseAPI ();
+   if (_api->Init (NULL, "eng"))
+      {
+      delete _api;
+      _api = 0;
+      return err_make (ERRFN, ERR_ocr_engine_not_present_or_broken2,
+         "tesseract", "cannot load the language data");
+      }
+   return NULL;
+#else
    QFile file ("/usr/bin/tesseract");
 
    if (!file.exists ())
       return err_make (ERRFN, ERR_ocr_engine_not_present_or_broken2,
          "tesseract", "/usr/bin/tesseract does not exist");
    return NULL;
+#endif
    }
 
 
 err_info *Ocrtess::imageToText (QImage &image, QString &text)
+   {
+   if (_api)
+      return libToText (image, text);
+   return runToText (image, text);
+   }
+
+
+//! returns true if an 8bpp image has a colour table running from black to white
+static bool is_grey_ramp (const QImage &image)
+   {
+   if (image.colorCount () != 256)
+      return false;
+   for (int i = 0; i < 256; i++)
+      if (image.color (i) != qRgb (i, i, i))
+         return false;
+   return true;
+   }
+
+
+err_info *Ocrtess::libToText (const QImage &image, QString &text)
+   {
+#ifdef CONFIG_use_tesslib
+   QImage conv;
+   const QImage *img = &image;
+   int bytes_per_pixel;
+   char *out;
+
+   // tesseract wants 1bpp with 1 as white, or 8bpp greyscale
+   if (image.format () == QImage::Format_Mono && image.colorCount () == 2)
+      {
+      bytes_per_pixel = 0;
+
+      // scans use 1 as black, so flip the bits in a copy
+      if (qGray (image.color (1)) < qGray (image.color (0)))
+         {
+         conv = image.copy ();
+         conv.invertPixels ();
+         img = &conv;
+         }
+      }
+   else if (image.format () == QImage::Format_Grayscale8
+       || (image.format () == QImage::Format_Indexed8 && is_grey_ramp (image)))
+      bytes_per_pixel = 1;
+   else
+      {
+      conv = image.convertToFormat (QImage::Format_Grayscale8);
+      img = &conv;
+      bytes_per_pixel = 1;
+      }
+
+   _api->SetImage (img->constBits (), img->width (), img->height (),
+                   bytes_per_pixel, img->bytesPerLine ());
+   if (image.dotsPerMeterX () > 0)
+      _api->SetSourceResolution (qRound (image.dotsPerMeterX () * 0.0254));
+   out = _api->GetUTF8Text ();
+   _api->Clear ();
+   if (!out)
+      return err_make (ERRFN, ERR_ocr_engine_not_present_or_broken2,
+         "tesseract", "recognition failed");
+   text = QString::fromUtf8 (out);
+   delete [] out;
+   return NULL;
+#else
+   Q_UNUSED (image);
+   Q_UNUSED (text);
+   return err_make (ERRFN, ERR_ocr_engine_not_present_or_broken2,
+      "tesseract", "library support is not built in");
+#endif
+   }
+
+
+err_info *Ocrtess::runToText (QImage &image, QString &text)
    {
    char base [200], tmp [200], tmp2 [200], out [200];
    char cmd [400];
    int fd;
 
-   // this function should really use tesseract as a library
+   // this is only used when we are not built with the tesseract library
 
    /* sadly:
 
@@ -90,23 +188,30 @@ err_info *Ocrtess::imageToText (QImage &image, QString &text)
 
    strcpy (tmp2, base);
    strcat (tmp2, ".tif");
-   int errnum = err_systemf ("convert %s %s", tmp, tmp2);
-   if (errnum)
-      return err_make (ERRFN, ERR_could_not_execute1, "convert");
-
    strcpy (out, base);
    sprintf (cmd, "/usr/bin/tesseract %s %s", tmp2, out);
-   errnum = err_systemf (cmd);
-   if (errnum)
-      return err_make (ERRFN, ERR_tesseract_not_present2, cmd, strerror (errno));
-
    strcat (out, ".txt");
-   QFile file (out);
-   if (!file.open (QIODevice::ReadOnly))
-      return err_make (ERRFN, ERR_cannot_open_file1, out);
 
-   QByteArray ba = file.readAll ();
-   text = ba.constData ();
-   return NULL;
+   err_info *err = NULL;
+   if (err_systemf ("convert %s %s", tmp, tmp2))
+      err = err_make (ERRFN, ERR_could_not_execute1, "convert");
+   else if (err_systemf (cmd))
+      err = err_make (ERRFN, ERR_tesseract_not_present2, cmd, strerror (errno));
+   else
+      {
+      QFile file (out);
+
+      if (!file.open (QIODevice::ReadOnly))
+         err = err_make (ERRFN, ERR_cannot_open_file1, out);
+      else
+         text = file.readAll ().constData ();
+      }
+
+   // don't leave our temporary files lying around
+   unlink (base);
+   unlink (tmp);
+   unlink (tmp2);
+   unlink (out);
+   return err;
    }
 
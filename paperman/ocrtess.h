@@ -25,6 +25,12 @@ X-Comment: On Debian GNU/Linux systems, the complete text of the GNU General
 #include "ocr.h"
 
 
+namespace tesseract
+   {
+   class TessBaseAPI;
+   }
+
+
 class Ocrtess : public Ocr
    {
 public:
@@ -35,5 +41,23 @@ public:
    err_info *imageToText (QImage &image, QString &text);
 
    err_info *init (void);
+
+private:
+   /** convert an image to text with the tesseract library. 1bpp and 8bpp
+       greyscale images are passed to tesseract as they are
+
+      \param image   image to convert
+      \param text    returns the text
+      \returns error, or NULL if ok */
+   err_info *libToText (const QImage &image, QString &text);
+
+   /** convert an image to text by running the tesseract program on it
+
+      \param image   image to convert
+      \param text    returns the text
+      \returns error, or NULL if ok */
+   err_info *runToText (QImage &image, QString &text);
+
+   tesseract::TessBaseAPI *_api;   //!< library engine, 0 if not in use
    };
 
@@ -42,7 +42,10 @@ Operation::Operation (QString name, int count, QWidget *parent)
 //    setFocusPolicy (Qt::NoFocus);
    _maximum = count;
    qDebug () << "operation max" << _maximum;
-   connect (this, SIGNAL (progress(int, QString)), main_widget, SLOT (setProgress (int, QString)));
+
+   // there is no main widget when running from the command line
+   if (main_widget)
+      connect (this, SIGNAL (progress(int, QString)), main_widget, SLOT (setProgress (int, QString)));
    emit progress (-1, name);
    _upto = 0;
    }
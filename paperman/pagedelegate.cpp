@@ -219,7 +219,9 @@ void Pagedelegate::paint (QPainter *painter, const QStyleOptionViewItem &option,
 
    measureItem (option, index, measure, &offset);
 
-//    Pageinfo *pi = measure.pageinfo;
+   // the page is visible, so make sure its proper pixmap is on its way
+   if (measure.dodgy && measure.pageinfo)
+      measure.pageinfo->ensurePixmap ();
 
    painter->save ();
 
@@ -0,0 +1,262 @@
+/*
+License: GPL-2
+  An electronic filing cabinet: scan, print, stack, arrange
+ Copyright (C) 2009 Simon Glass, chch-kiwi@users.sourceforge.net
+ .
+ This program is free software; you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation; either version 2 of the License, or
+ (at your option) any later version.
+ .
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+ .
+ You should have received a copy of the GNU General Public License
+ along with this program; if not, write to the Free Software
+ Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301 USA
+
+X-Comment: On Debian GNU/Linux systems, the complete text of the GNU General
+ Public License can be found in the /usr/share/common-licenses/GPL file.
+*/
+
+
+#include <QDateTime>
+#include <QDebug>
+#include <QFileInfo>
+#include <QMutexLocker>
+#include <QRunnable>
+#include <QThread>
+#include <QTimer>
+
+#include "err.h"
+#include "file.h"
+#include "pageloader.h"
+#include "utils.h"
+
+
+//! time to wait for more images to arrive before telling the model, in ms
+#define FLUSH_DELAY 30
+
+
+/** a worker which keeps taking requests from the Pageloader until there are
+none left */
+
+class Pageloadjob : public QRunnable
+   {
+public:
+   Pageloadjob (Pageloader *owner) : _owner (owner) {}
+
+   void run (void);
+
+private:
+   /** create the image for a request. This follows
+       Desktopmodel::getScaledImage() but only deals in QImage
+
+      \param f     file to use
+      \param req   request
+      \param image returns the image
+      \returns error, or NULL if none */
+   err_info *makeImage (File *f, const Pageloader::request_info &req,
+         QImage &image);
+
+   Pageloader *_owner;
+   };
+
+
+err_info *Pageloadjob::makeImage (File *f, const Pageloader::request_info &req,
+      QImage &image)
+   {
+   QSize preview_size, isize, tsize;
+   int bpp;
+
+   CALL (f->load ());
+   CALL (f->getPreviewInfo (req.pagenum, preview_size, bpp));
+
+   // if the preview is big enough, use it
+   if (req.size.width () <= preview_size.width () + 20
+      && req.size.height () <= preview_size.height () + 20)
+      {
+      CALL (f->getCachedPreviewImage (req.pagenum, image, req.blank));
+      if (image.width () != req.size.width ()
+         && image.height () != req.size.height ())
+         image = image.scaled (req.size, Qt::KeepAspectRatio,
+               Qt::SmoothTransformation);
+      }
+   else
+      {
+      CALL (f->getImage (req.pagenum, false, image, isize, tsize, bpp,
+            req.blank));
+      if (image.width () != req.size.width ()
+         && image.height () != req.size.height ())
+         image = util_smooth_scale_image (image, req.size);
+      }
+   return NULL;
+   }
+
+
+void Pageloadjob::run (void)
+   {
+   Pageloader::request_info req;
+   QString path;
+   QDateTime mtime;
+   qint64 size = 0;
+   File *f = 0;
+
+   while (_owner->takeNext (req))
+      {
+      Pageloader::result_info res;
+
+      res.key = req.key;
+      res.item = req.item;
+      res.size = req.size;
+      res.blank = req.blank;
+
+      /* use our own File object so that we don't need to worry about what
+         the GUI thread is doing with the real one. Keep it for the next
+         request, which is likely to be for the same stack, unless the stack
+         has changed on disc since we loaded it. Each page of a JPEG stack
+         is a separate file, which opens on its own with its page in the
+         same place as in the stack */
+      QFileInfo fi (req.dir + req.fname);
+
+      if (!f || path != fi.filePath () || mtime != fi.lastModified ()
+          || size != fi.size ())
+         {
+         delete f;
+         path = fi.filePath ();
+         mtime = fi.lastModified ();
+         size = fi.size ();
+         f = File::createFile (req.dir, req.fname, 0, req.type);
+         }
+
+      // any error just leaves the image null
+      if (makeImage (f, req, res.image))
+         res.image = QImage ();
+      _owner->finished (res);
+      }
+   delete f;
+   }
+
+
+Pageloader::Pageloader (QObject *parent)
+      : QObject (parent)
+   {
+   _workers = 0;
+
+   // leave a core for the GUI thread
+   _pool.setMaxThreadCount (qMax (1, QThread::idealThreadCount () - 1));
+
+   _flushTimer = new QTimer (this);
+   _flushTimer->setSingleShot (true);
+   connect (_flushTimer, SIGNAL (timeout ()), this, SLOT (flush ()));
+   }
+
+
+Pageloader::~Pageloader ()
+   {
+   cancelQueued ();
+   _pool.waitForDone ();
+   }
+
+
+void Pageloader::request (const request_info &req, bool urgent)
+   {
+   QMutexLocker locker (&_mutex);
+   int i;
+
+   if (_pending.contains (req.key))
+      {
+      // move it to the front if it hasn't started yet
+      if (urgent)
+         for (i = 0; i < _queue.size (); i++)
+            if (_queue [i].key == req.key)
+               {
+               _queue.move (i, 0);
+               break;
+               }
+      return;
+      }
+
+   if (urgent)
+      _queue.prepend (req);
+   else
+      _queue.append (req);
+   _pending.insert (req.key, true);
+
+   if (_workers < _pool.maxThreadCount ())
+      {
+      _workers++;
+      _pool.start (new Pageloadjob (this));
+      }
+   }
+
+
+void Pageloader::cancelQueued (void)
+   {
+   QMutexLocker locker (&_mutex);
+
+   foreach (const request_info &req, _queue)
+      _pending.remove (req.key);
+   _queue.clear ();
+   }
+
+
+bool Pageloader::isPending (const QString &key) const
+   {
+   QMutexLocker locker (&_mutex);
+
+   return _pending.contains (key);
+   }
+
+
+bool Pageloader::takeNext (request_info &req)
+   {
+   QMutexLocker locker (&_mutex);
+
+   if (_queue.isEmpty ())
+      {
+      _workers--;
+      return false;
+      }
+   req = _queue.takeFirst ();
+   return true;
+   }
+
+
+void Pageloader::finished (const result_info &res)
+   {
+   bool first;
+
+   _mutex.lock ();
+   _pending.remove (res.key);
+   first = _results.isEmpty ();
+   _results << res;
+   _mutex.unlock ();
+
+   // we are on a worker thread, so get the GUI thread to start the timer
+   if (first)
+      QMetaObject::invokeMethod (this, "scheduleFlush", Qt::QueuedConnection);
+   }
+
+
+void Pageloader::scheduleFlush (void)
+   {
+   if (!_flushTimer->isActive ())
+      _flushTimer->start (FLUSH_DELAY);
+   }
+
+
+void Pageloader::flush (void)
+   {
+   QList<result_info> results;
+
+   _mutex.lock ();
+   results = _results;
+   _results.clear ();
+   _mutex.unlock ();
+
+   if (!results.isEmpty ())
+      emit ready (results);
+   }
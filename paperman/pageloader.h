@@ -0,0 +1,135 @@
+/*
+License: GPL-2
+  An electronic filing cabinet: scan, print, stack, arrange
+ Copyright (C) 2009 Simon Glass, chch-kiwi@users.sourceforge.net
+ .
+ This program is free software; you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation; either version 2 of the License, or
+ (at your option) any later version.
+ .
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+ .
+ You should have received a copy of the GNU General Public License
+ along with this program; if not, write to the Free Software
+ Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301 USA
+
+X-Comment: On Debian GNU/Linux systems, the complete text of the GNU General
+ Public License can be found in the /usr/share/common-licenses/GPL file.
+*/
+/*
+   Project:    Maxview
+   File:       pageloader.h
+
+   This file implements a service which generates the page images shown in
+   the page strip on a pool of worker threads, so that opening a stack with
+   many pages does not hold up the GUI.
+
+   It works like the Thumbnailer, except that requests are for a particular
+   page at a particular size. Pages which are small enough come from the
+   preview (and so the thumbnail cache), others are decoded and scaled.
+   Each worker keeps its File object open between requests, since these
+   usually come from the same stack.
+*/
+
+#ifndef __pageloader_h
+#define __pageloader_h
+
+
+#include <QHash>
+#include <QImage>
+#include <QList>
+#include <QMutex>
+#include <QObject>
+#include <QSize>
+#include <QThreadPool>
+
+#include "file.h"
+
+
+class QTimer;
+
+
+class Pageloader : public QObject
+   {
+   Q_OBJECT
+
+   friend class Pageloadjob;
+
+public:
+   //! a request for a page image
+   struct request_info
+      {
+      QString key;         //!< key for this request
+      QString dir;         //!< directory containing the file (with trailing /)
+      QString fname;       //!< filename holding the page
+      File::e_type type;   //!< file type
+      int item;            //!< item number in the page model
+      int pagenum;         //!< page number within the stack
+      QSize size;          //!< maximum size of the image required
+      bool blank;          //!< true to show the page as blank
+      };
+
+   //! a finished page image
+   struct result_info
+      {
+      QString key;         //!< key from the request
+      int item;            //!< item number from the request
+      QSize size;          //!< size from the request
+      bool blank;          //!< blank flag from the request
+      QImage image;        //!< page image, null if we could not make one
+      };
+
+   Pageloader (QObject *parent = 0);
+   ~Pageloader ();
+
+   /** request a page image. If there is already a request with this key,
+       it is just moved to the front if urgent
+
+      \param req      request to add
+      \param urgent   true to put this ahead of other requests (e.g. because
+                      it is visible) */
+   void request (const request_info &req, bool urgent);
+
+   //! drop all requests which have not been started yet
+   void cancelQueued (void);
+
+   //! \returns true if there is a request outstanding for the given key
+   bool isPending (const QString &key) const;
+
+signals:
+   /** emitted (on the GUI thread) with a batch of finished page images */
+   void ready (const QList<Pageloader::result_info> &results);
+
+private slots:
+   //! start the batch timer, if not already running
+   void scheduleFlush (void);
+
+   //! send out all finished page images
+   void flush (void);
+
+private:
+   /** called by a worker to get the next request
+
+      \param req   returns the request
+      \returns true if there was one, false if the worker should exit */
+   bool takeNext (request_info &req);
+
+   //! called by a worker when a request is complete
+   void finished (const result_info &res);
+
+private:
+   QThreadPool _pool;         //!< our worker threads
+   mutable QMutex _mutex;     //!< protects everything below
+   QList<request_info> _queue;   //!< requests not yet started, most urgent first
+   QHash<QString, bool> _pending;   //!< keys queued or being worked on
+   QList<result_info> _results;   //!< finished images waiting to go out
+   int _workers;              //!< number of workers started
+   QTimer *_flushTimer;       //!< batches up finished images
+   };
+
+
+#endif
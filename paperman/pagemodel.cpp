@@ -23,13 +23,17 @@ X-Comment: On Debian GNU/Linux systems, the complete text of the GNU General
 
 
 #include <QBitArray>
+#include <QDateTime>
 #include <QDebug>
+#include <QFileInfo>
 #include <QIcon>
 #include <QMimeData>
 #include <QPainter>
 #include <QTimer>
 
+#include "config.h"
 #include "desktopmodel.h"
+#include "file.h"
 #include "pagemodel.h"
 
 Q_DECLARE_METATYPE(QPixmap *)
@@ -47,11 +51,17 @@ Pagemodel::Pagemodel (QObject *parent)
    _lost_contents = 0;
    _own_scan = _lost_scan = false;
    _rescaling = false;
+   _commits = 0;
 
    // create the pages
    _updateTimer = new QTimer (this);
    _updateTimer->setSingleShot(true);
    connect (_updateTimer, SIGNAL (timeout()), this, SLOT (nextUpdate ()));
+
+   _thumbs.setMaxCost (CONFIG_page_thumb_limit / 1024);
+   _loader = new Pageloader (this);
+   connect (_loader, SIGNAL (ready (const QList<Pageloader::result_info> &)),
+            this, SLOT (pagesReady (const QList<Pageloader::result_info> &)));
    }
 
 
@@ -66,6 +76,8 @@ void Pagemodel::clear (void)
    disownScanning ();
    _contents = 0;
    _stackindex = QModelIndex ();
+   _stack_key.clear ();
+   _loader->cancelQueued ();
 //    qDebug () << "Pagemodel::clear";
    _start = _count = _row_count = 0;
    _column_count = 1;
@@ -95,6 +107,14 @@ void Pagemodel::reset (const Desktopmodel *model, const QModelIndex &index,
    Q_ASSERT (_column_count > 0);
    Q_ASSERT (_start >= 0);
 
+   /* page pixmaps for the old stack are no longer of interest. Those for
+      this stack can be reused if it hasn't changed on disc since */
+   _loader->cancelQueued ();
+   QFileInfo fi (_contents->getFile (_stackindex)->pathname ());
+   _stack_key = QString ("%1\n%2\n%3").arg (fi.absoluteFilePath ())
+         .arg (fi.size ()).arg (fi.lastModified ().toMSecsSinceEpoch ());
+   _commits = 0;
+
 //    _row_count = (_count + _column_count - 1) / _column_count;
    _row_count = count;
    Q_ASSERT (_row_count >= 0);
@@ -351,10 +371,139 @@ bool Pagemodel::dropMimeData(const QMimeData *data,
 
 void Pagemodel::setPagesize (QSize size)
    {
+   if (size != _pagesize)
+      {
+      // anything not yet started is now the wrong size
+      _loader->cancelQueued ();
+      _placeholder = QPixmap ();
+      }
    _pagesize = size;
    }
 
 
+QPixmap Pagemodel::placeholder (void) const
+   {
+   QSize size = _pagesize;
+
+   if (_placeholder.isNull () && size.isValid ())
+      {
+      // assume a portrait A4 page, which is the common case
+      size.setWidth (qMin (size.width (), size.height () * 210 / 297));
+      _placeholder = QPixmap (size);
+      _placeholder.fill (Qt::white);
+
+      QPainter p (&_placeholder);
+
+      p.setPen (Qt::lightGray);
+      p.drawRect (QRect (QPoint (0, 0), size - QSize (1, 1)));
+      }
+   return _placeholder;
+   }
+
+
+QString Pagemodel::thumbKey (int item, QSize size, bool blank) const
+   {
+   return QString ("%1\n%2\n%3\n%4x%5\n%6").arg (_stack_key).arg (_commits)
+         .arg (_start + item).arg (size.width ()).arg (size.height ())
+         .arg (blank);
+   }
+
+
+bool Pagemodel::requestPage (int item)
+   {
+   File *f;
+   int i;
+
+   if (!_stackindex.isValid () || item < 0 || item >= _count)
+      return true;
+
+   // the worker reads the file from disc, so it can't see unsaved changes
+   f = _contents->getFile (_stackindex);
+   if (f->isDirty () || _pages [item].scanning ())
+      return false;
+
+   // the page being painted first, then those nearby in case of scrolling
+   loadPage (item, true);
+   for (i = 1; i <= CONFIG_page_prefetch; i++)
+      {
+      if (item + i < _count)
+         loadPage (item + i, false);
+      if (item - i >= 0)
+         loadPage (item - i, false);
+      }
+   return true;
+   }
+
+
+void Pagemodel::loadPage (int item, bool urgent)
+   {
+   Pageinfo *pi = ensurePage (item);
+   Pageloader::request_info req;
+   File *f;
+   QPixmap *pm;
+
+   if (pi->hasPixmap (_pagesize) || pi->scanning ())
+      return;
+
+   // maybe we had this one recently
+   req.key = thumbKey (item, _pagesize, pi->isBlank ());
+   pm = _thumbs.object (req.key);
+   if (pm)
+      {
+      QModelIndex ind = index (item, 0, QModelIndex ());
+
+      pi->setPixmap (*pm, _pagesize);
+      emit dataChanged (ind, ind);
+      return;
+      }
+
+   // if it has already been requested, we only need to bump its priority
+   if (pi->requested () == _pagesize && !urgent)
+      return;
+
+   f = _contents->getFile (_stackindex);
+   req.item = item;
+   req.pagenum = _start + item;
+   req.dir = QFileInfo (f->pathname ()).path () + "/";
+   req.fname = f->pageFilename (req.pagenum);
+   req.type = f->type ();
+   req.size = _pagesize;
+   req.blank = pi->isBlank ();
+   _loader->request (req, urgent);
+   pi->setRequested (_pagesize);
+   }
+
+
+void Pagemodel::pagesReady (const QList<Pageloader::result_info> &results)
+   {
+   int first = -1, last = -1;
+
+   foreach (const Pageloader::result_info &res, results)
+      {
+      QPixmap pm = res.image.isNull () ? placeholder ()
+            : QPixmap::fromImage (res.image);
+
+      // keep it even if no longer wanted, since we may come back to this size
+      if (!res.image.isNull ())
+         _thumbs.insert (res.key, new QPixmap (pm),
+               qMax (1, pm.width () * pm.height () * 4 / 1024));
+
+      // drop results for another stack, size or blank setting
+      if (res.item >= _count || res.key != thumbKey (res.item, _pagesize,
+                                                      _pages [res.item].isBlank ()))
+         continue;
+      _pages [res.item].setPixmap (pm, res.size);
+      if (first == -1 || res.item < first)
+         first = res.item;
+      if (res.item > last)
+         last = res.item;
+      }
+   if (first != -1)
+      emit dataChanged (index (first, 0, QModelIndex ()),
+            index (last, 0, QModelIndex ()));
+   }
+
+
 void Pagemodel::setScale (int scale_down)
    {
    if (_scale_down != scale_down)
@@ -599,6 +748,13 @@ err_info *Pagemodel::commit (void)
    if (!contents)
       return NULL;
 
+   // pages are about to move, so nothing cached for this stack is valid now
+   if (!lost)
+      {
+      _loader->cancelQueued ();
+      _commits++;
+      }
+
    // delete any pages marked for deletion
    QBitArray ba (pages->size ());
 
@@ -673,6 +829,7 @@ Pageinfo::Pageinfo (void)
    {
    _valid = false;
    _pixmap = QPixmap();
+   _requested = QSize ();
    _blank = false;
    _remove = false;
    _scanning = false;
@@ -728,6 +885,8 @@ void Pageinfo::haltRescale ()
 void Pageinfo::invalidate ()
    {
    _valid = false;
+   _pixmap = _temp = QPixmap ();
+   _requested = QSize ();
    _coverage = "";
    _blank = _remove = _scanning = false;
    }
@@ -746,29 +905,48 @@ void Pageinfo::scanDone (QString coverage, bool mark_blank)
 
 QPixmap Pageinfo::pixmap (bool &dodgy)
    {
-   // if we have no pixmap yet, ask for one
+   QSize size = _model->pagesize ();
+
+   dodgy = !hasPixmap (size);
+
+   // if we have no pixmap yet, show something while we wait for it
    if (_pixmap.isNull ())
+      return _model->placeholder ();
+   else if (size != _size)
       {
-      _rescale = true;
-      Pagemodel *mod = (Pagemodel *)_model;
-      mod->ensureRescale ();
-      dodgy = true;
-      return _pixmap;
+      /* for now just rescale the pixmap we have. This is called while
+         painting, so do it quickly, and only once for each size */
+      if (_temp.isNull ()
+          || (_temp.width () != size.width () && _temp.height () != size.height ()))
+         _temp = _pixmap.scaled (size, Qt::KeepAspectRatio, Qt::FastTransformation);
+      return _temp;
       }
-   else if (_model->pagesize () != _size)
+   return _pixmap;
+   }
+
+
+void Pageinfo::ensurePixmap (void)
+   {
+   Pagemodel *mod = (Pagemodel *)_model;
+
+   if (!mod || hasPixmap (_model->pagesize ()))
+      return;
+
+   // if it can't be done in the background, do it here a bit later
+   if (!mod->requestPage (_itemnum))
       {
-      // remember to rescale later
       _rescale = true;
-      Pagemodel *mod = (Pagemodel *)_model;
       mod->ensureRescale ();
-
-      // for now just rescale the pixmap we have
-      const QPixmap &pm = QPixmap (_pixmap.scaled (_model->pagesize (), Qt::KeepAspectRatio, Qt::SmoothTransformation));
-      dodgy = true;
-      return pm;
       }
-   dodgy = false;
-   return _pixmap;
+   }
+
+
+void Pageinfo::setPixmap (const QPixmap &pixmap, QSize size)
+   {
+   _pixmap = pixmap;
+   _temp = QPixmap ();
+   _size = size;
+   _rescale = false;
    }
 
 
@@ -784,6 +962,7 @@ bool Pageinfo::updatePixmap (void)
     qDebug () << "updatePixmap" << _itemnum << _size;
    QModelIndex ind = _model->index (_itemnum, 0, QModelIndex ());
    _model->getPixmap (ind, _size, _pixmap, _blank);
+   _temp = QPixmap ();
 
    // we rescaled
    _rescale = false;
@@ -38,12 +38,15 @@ X-Comment: On Debian GNU/Linux systems, the complete text of the GNU General
 
 
 #include <QAbstractItemModel>
+#include <QCache>
 #include <QHash>
 #include <QImage>
 #include <QPixmap>
 #include <QSize>
 #include <QVector>
 
+#include "pageloader.h"
+
 
 class QPixmap;
 class QTimer;
@@ -64,8 +67,35 @@ public:
    /** returns a pixmap for the page. Hopefully this will require very
        little action as the correctly scaled pixmap is already stored.
        However, if the scale has since changed, then this function will
-       rescale the pixmap that it returns as a temporary measure */
+       quickly rescale the pixmap that it returns as a temporary measure.
+       If there is no pixmap yet, a placeholder is returned. This does not
+       request a new pixmap - see ensurePixmap() for that
+
+      \param dodgy  returns true if the pixmap is not the final one */
    QPixmap pixmap (bool &dodgy);
+
+   /** ask for a pixmap at the current page size, if we don't already have
+       one. This is called when the page is painted */
+   void ensurePixmap (void);
+
+   /** check whether we have an up-to-date pixmap
+
+      \param size   size required
+      \returns true if we have a pixmap of that size */
+   bool hasPixmap (QSize size) const
+      { return !_pixmap.isNull () && _size == size && !_rescale; }
+
+   /** set the pixmap for the page, which has arrived from the Pageloader
+
+      \param pixmap  new pixmap
+      \param size    page size that the pixmap was made for */
+   void setPixmap (const QPixmap &pixmap, QSize size);
+
+   //! \returns the page size we last asked the Pageloader for
+   QSize requested (void) const { return _requested; }
+
+   //! record the page size we have asked the Pageloader for
+   void setRequested (QSize size) { _requested = size; }
    int pagenum (void) { return _pagenum; }
    int itemnum (void) { return _itemnum; }
    QString pagename (void) { return _pagename; }
@@ -139,6 +169,8 @@ public:
 private:
    bool _valid;            //!< true if this page has been set up
    QPixmap _pixmap;        //!< page image
+   QPixmap _temp;          //!< _pixmap quickly scaled to the current page size
+   QSize _requested;       //!< page size requested from the Pageloader
    int _pagenum;           //!< item number (used to construct index)
    const Pagemodel *_model; //!< page model
    QString _pagename;           //!< the page number
@@ -330,6 +362,20 @@ public:
       \param blank   true if the pixmap should be modified to show the page as blank */
    void getPixmap (const QModelIndex &ind, QSize &size, QPixmap &pixmap, bool blank = false) const;
 
+   /** ask for the pixmap for a page to be generated in the background,
+       along with those of nearby pages. The model will emit dataChanged()
+       when each arrives
+
+      \param item    item number to generate
+      \returns true if ok, false if the stack has changes which are not yet
+                on disc, so the pixmap must be generated here instead */
+   bool requestPage (int item);
+
+   /** returns a placeholder pixmap to show while a page is being generated
+
+      \returns pixmap of the page size */
+   QPixmap placeholder (void) const;
+
    /** indicates that one or more pages need rescaling. This will start doing
        this in the background */
    void scheduleRescale (void);
@@ -364,6 +410,28 @@ protected:
 protected slots:
    void nextUpdate (void);    //!< do the next rescale update
 
+   /** handle a batch of page images from the Pageloader
+
+      \param results  list of results */
+   void pagesReady (const QList<Pageloader::result_info> &results);
+
+private:
+   /** request the pixmap for a page from the Pageloader, unless we already
+       have it or it is in the cache
+
+      \param item    item number
+      \param urgent  true if the page is visible */
+   void loadPage (int item, bool urgent);
+
+   /** work out the key for a page image, used for the cache and for the
+       Pageloader
+
+      \param item    item number
+      \param size    page size
+      \param blank   true if the page is to be shown as blank
+      \returns key */
+   QString thumbKey (int item, QSize size, bool blank) const;
+
 private:
    const Desktopmodel *_contents;    //!< stack model
    QPersistentModelIndex _stackindex;  //!< index of stack in _model that we are displaying
@@ -387,4 +455,10 @@ private:
    QVector<Pageinfo> _scan_pages;   //!< scanned pages
    QHash<int, QString> _annot_updates;
    int _target = -1;
+
+   Pageloader *_loader;    //!< generates page pixmaps in the background
+   QCache<QString, QPixmap> _thumbs;  //!< recently used page pixmaps, cost in KB
+   QString _stack_key;     //!< identifies the stack and its version on disc
+   int _commits;           //!< number of commits since reset, part of _stack_key
+   mutable QPixmap _placeholder;    //!< cached placeholder pixmap
    };
@@ -0,0 +1,202 @@
+/*
+License: GPL-2
+  An electronic filing cabinet: scan, print, stack, arrange
+ Copyright (C) 2009 Simon Glass, chch-kiwi@users.sourceforge.net
+ .
+ This program is free software; you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation; either version 2 of the License, or
+ (at your option) any later version.
+ .
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+ .
+ You should have received a copy of the GNU General Public License
+ along with this program; if not, write to the Free Software
+ Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301 USA
+
+X-Comment: On Debian GNU/Linux systems, the complete text of the GNU General
+ Public License can be found in the /usr/share/common-licenses/GPL file.
+*/
+
+
+#include <QDebug>
+#include <QPainter>
+#include <QTransform>
+
+#include "config.h"
+#include "pagetiles.h"
+
+
+//! size of each tile in display pixels
+#define TILE_SIZE    256
+
+
+Pagetiles::Pagetiles ()
+   {
+   setLimit (CONFIG_tile_cache_limit);
+   }
+
+
+Pagetiles::~Pagetiles ()
+   {
+   }
+
+
+void Pagetiles::setImage (const QImage &image)
+   {
+   clear ();
+   if (!image.isNull ())
+      _levels << image;
+   }
+
+
+void Pagetiles::clear (void)
+   {
+   _levels.clear ();
+   _tiles.clear ();
+   }
+
+
+void Pagetiles::setLimit (qint64 limit)
+   {
+   _tiles.setMaxCost (limit / 1024);
+   }
+
+
+QSize Pagetiles::displaySize (double scale, int rotate) const
+   {
+   QSize size;
+
+   if (_levels.isEmpty ())
+      return QSize ();
+   size = QSize (qRound (_levels [0].width () * scale),
+                 qRound (_levels [0].height () * scale));
+   if (rotate % 180 == 90)
+      size.transpose ();
+   return size;
+   }
+
+
+int Pagetiles::chooseLevel (double scale)
+   {
+   int level = 0;
+
+   /* move down the pyramid while the next level is still at least as large
+      as the display, so we never reduce by more than half */
+   while (scale * 2 <= 1.0 / (1 << level)
+          && _levels [level].width () > TILE_SIZE
+          && _levels [level].height () > TILE_SIZE)
+      {
+      if (level + 1 == _levels.size ())
+         {
+         const QImage &image = _levels [level];
+
+         _levels << image.scaled ((image.width () + 1) / 2,
+               (image.height () + 1) / 2, Qt::IgnoreAspectRatio,
+               Qt::SmoothTransformation);
+         }
+      level++;
+      }
+   return level;
+   }
+
+
+QPixmap Pagetiles::renderTile (const QRect &rect, double scale, int rotate,
+      bool smooth)
+   {
+   int level = chooseLevel (scale);
+   const QImage &image = _levels [level];
+   double factor = scale * _levels [0].width () / image.width ();
+   double width = _levels [0].width () * scale;
+   double height = _levels [0].height () * scale;
+   QTransform trans, rot;
+   QImage tile (rect.size (), QImage::Format_RGB32);
+   QRect src;
+
+   // map from the pyramid level to the scaled page, then rotate it
+   switch (rotate)
+      {
+      case 90 :
+         rot = QTransform (0, 1, -1, 0, height, 0);
+         break;
+
+      case 180 :
+         rot = QTransform (-1, 0, 0, -1, width, height);
+         break;
+
+      case 270 :
+         rot = QTransform (0, -1, 1, 0, 0, width);
+         break;
+      }
+   trans = QTransform::fromScale (factor, factor) * rot;
+
+   // pick out the part of the level we need, plus a margin for filtering
+   src = trans.inverted ().mapRect (QRectF (rect)).toAlignedRect ()
+         .adjusted (-2, -2, 2, 2) & image.rect ();
+
+   tile.fill (Qt::white);
+   QPainter p (&tile);
+
+   if (smooth)
+      p.setRenderHint (QPainter::SmoothPixmapTransform);
+   p.setTransform (trans * QTransform::fromTranslate (-rect.x (), -rect.y ()));
+   p.drawImage (src.topLeft (), image.copy (src));
+   p.end ();
+   return QPixmap::fromImage (tile);
+   }
+
+
+bool Pagetiles::paint (QPainter &painter, const QRect &rect, double scale,
+      int rotate, bool smooth)
+   {
+   QRect page, area, trect;
+   bool all_smooth = true;
+   tile_key key;
+   tile_info *info;
+   int x, y;
+
+   if (_levels.isEmpty () || scale <= 0)
+      return true;
+   page = QRect (QPoint (0, 0), displaySize (scale, rotate));
+   area = rect & page;
+   if (area.isEmpty ())
+      return true;
+
+   key.scale = qRound64 (scale * 1000000);
+   key.rotate = rotate;
+   for (y = area.top () / TILE_SIZE; y <= area.bottom () / TILE_SIZE; y++)
+      for (x = area.left () / TILE_SIZE; x <= area.right () / TILE_SIZE; x++)
+         {
+         key.x = x;
+         key.y = y;
+         trect = QRect (x * TILE_SIZE, y * TILE_SIZE, TILE_SIZE, TILE_SIZE)
+               & page;
+         info = _tiles.object (key);
+
+         // a smooth tile will do even if we were only asked for a fast one
+         if (!info || (smooth && !info->smooth))
+            {
+            QPixmap pixmap = renderTile (trect, scale, rotate, smooth);
+
+            info = new tile_info;
+            info->pixmap = pixmap;
+            info->smooth = smooth;
+
+            // the cache may delete this immediately if it is very large
+            _tiles.insert (key, info, trect.width () * trect.height () * 4 / 1024);
+            painter.drawPixmap (trect.topLeft (), pixmap);
+            if (!smooth)
+               all_smooth = false;
+            }
+         else
+            {
+            painter.drawPixmap (trect.topLeft (), info->pixmap);
+            if (!info->smooth)
+               all_smooth = false;
+            }
+         }
+   return all_smooth;
+   }
@@ -0,0 +1,147 @@
+/*
+License: GPL-2
+  An electronic filing cabinet: scan, print, stack, arrange
+ Copyright (C) 2009 Simon Glass, chch-kiwi@users.sourceforge.net
+ .
+ This program is free software; you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation; either version 2 of the License, or
+ (at your option) any later version.
+ .
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+ .
+ You should have received a copy of the GNU General Public License
+ along with this program; if not, write to the Free Software
+ Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301 USA
+
+X-Comment: On Debian GNU/Linux systems, the complete text of the GNU General
+ Public License can be found in the /usr/share/common-licenses/GPL file.
+*/
+/*
+   Project:    Maxview
+   File:       pagetiles.h
+
+   This file implements a tiled renderer for the page viewer.
+
+   Rather than scaling the whole page each time the zoom changes, the page
+   is split into fixed-size tiles in display coordinates and only those
+   tiles which are actually visible are rendered. Rendered tiles are kept
+   in a cache which is limited in size, so that scrolling back over a part
+   of the page does not render it again.
+
+   Tiles are rendered from a small pyramid of reduced copies of the page
+   (1/2, 1/4, ...) which is built as needed. A tile is never reduced by
+   more than a factor of two from the level it comes from, so even fast
+   scaling looks reasonable and smooth scaling is cheap.
+*/
+
+#ifndef __pagetiles_h
+#define __pagetiles_h
+
+
+#include <QCache>
+#include <QHash>
+#include <QImage>
+#include <QList>
+#include <QPixmap>
+
+
+class QPainter;
+
+
+class Pagetiles
+   {
+public:
+   Pagetiles ();
+   ~Pagetiles ();
+
+   /** set the page image to display. This drops the pyramid and all cached
+       tiles
+
+      \param image     page image (this is shared, not copied) */
+   void setImage (const QImage &image);
+
+   //! drop the page image, the pyramid and all cached tiles
+   void clear (void);
+
+   /** set the maximum amount of memory to use for cached tiles
+
+      \param limit     maximum size in bytes */
+   void setLimit (qint64 limit);
+
+   /** work out the size of the page in display coordinates
+
+      \param scale     display scale (1.0 is normal)
+      \param rotate    rotation amount: 0, 90, 180, 270
+      \returns the size of the scaled, rotated page */
+   QSize displaySize (double scale, int rotate) const;
+
+   /** paint part of the page. The painter should be set up so that the
+       top left of the page is at (0, 0)
+
+      \param painter   painter to use
+      \param rect      area to paint, in display coordinates
+      \param scale     display scale (1.0 is normal)
+      \param rotate    rotation amount: 0, 90, 180, 270
+      \param smooth    true to use smooth scaling, false to use fast scaling.
+                       Smooth tiles are used if they are already available
+      \returns true if all the tiles painted were smooth */
+   bool paint (QPainter &painter, const QRect &rect, double scale, int rotate,
+         bool smooth);
+
+private:
+   //! the key for a tile in the cache
+   struct tile_key
+      {
+      qint64 scale;     //!< display scale, in millionths
+      int rotate;       //!< rotation amount
+      int x, y;         //!< tile position, in tiles
+
+      bool operator== (const tile_key &other) const
+         {
+         return scale == other.scale && rotate == other.rotate
+               && x == other.x && y == other.y;
+         }
+      };
+
+   //! a rendered tile
+   struct tile_info
+      {
+      QPixmap pixmap;   //!< the tile, in display coordinates
+      bool smooth;      //!< true if it was rendered with smooth scaling
+      };
+
+   friend uint qHash (const tile_key &key);
+
+   /** select the pyramid level to render from at a given scale, building it
+       if necessary
+
+      \param scale     display scale
+      \returns level number, 0 being the full-size page */
+   int chooseLevel (double scale);
+
+   /** render a single tile
+
+      \param rect      tile area, in display coordinates
+      \param scale     display scale
+      \param rotate    rotation amount: 0, 90, 180, 270
+      \param smooth    true to use smooth scaling
+      \returns the rendered tile */
+   QPixmap renderTile (const QRect &rect, double scale, int rotate, bool smooth);
+
+private:
+   QList<QImage> _levels;     //!< page pyramid, full size first
+   QCache<tile_key, tile_info> _tiles;    //!< cached tiles, cost in KB
+   };
+
+
+inline uint qHash (const Pagetiles::tile_key &key)
+   {
+   return qHash (key.scale) ^ (key.rotate << 24) ^ (key.x << 12) ^ key.y;
+   }
+
+
+#endif
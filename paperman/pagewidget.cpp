@@ -52,6 +52,7 @@ X-Comment: On Debian GNU/Linux systems, the complete text of the GNU General
 #include "ocr.h"
 #include "pagedelegate.h"
 #include "pagemodel.h"
+#include "pagetiles.h"
 #include "pagetools.h"
 #include "pageview.h"
 #include "pagewidget.h"
@@ -62,11 +63,6 @@ X-Comment: On Debian GNU/Linux systems, the complete text of the GNU General
 #include "qxmlconfig.h"
 
 
-/** we use pixmaps to speed up redraw, but don't use one if the size in any dimension is
-   greater than this */
-
-#define MAX_PIXMAP_SIZE 2000
-
 /** this is the distance we scroll in response to the mouse wheel */
 #define WHEEL_SCROLL_Y  50
 
@@ -151,6 +147,7 @@ Pagewidget::Pagewidget (Desktopmodelconv *modelconv, QString base, QWidget *pare
 
    _ocr_split = new QSplitter (Qt::Vertical, this);
 
+   _tiles = new Pagetiles ();
    _area = new MyScrollArea (this);
    _ocr_bar = new Ui_Ocrbar ();
    _ocr_area = new QWidget (this);
@@ -268,6 +265,7 @@ Pagewidget::~Pagewidget ()
    delete _pageattr;
    delete _ocr_bar;
    delete _timer;
+   delete _tiles;
 //    checkSubsystem (-1);
 //   delete _page;
    }
@@ -530,35 +528,14 @@ void Pagewidget::slotDelayedUpdate (void)
 
 void Pagewidget::clearViewport (void)
    {
-   _too_big = false;
-   _pixmap = QPixmap ();
    _image = QImage ();
-   _area->setPixmapImage (_pixmap, _image, _too_big, 0);
+   _tiles->clear ();
+   _area->setTiles (_tiles, 0, true);
 //    _area->setScale (_scale);
    _area->viewport ()->update ();
    }
 
 
-static void adjustMatrix (QPainter &p, QSize size, int rotate)
-{
-   // return;
-   if (rotate)
-      {
-      QPoint tp;
-
-      // rotate and translate back to the origin
-      p.rotate (rotate);
-      if (rotate == 270)
-         tp = QPoint (-size.width (), 0);
-      else if (rotate == 90)
-         tp = QPoint (0, -size.height ());
-      else // 180
-         tp = QPoint (-size.width (), -size.height ());
-      p.translate (tp);
-      }
-}
-
-
 void Pagewidget::updateViewport (bool updateScale, bool force_smooth, bool delay_smoothing)
    {
 
@@ -626,46 +603,18 @@ void Pagewidget::updateViewport (bool updateScale, bool force_smooth, bool delay
       {
       case SUBSYS_pixmap :
          {
-//         printf ("image size %d, %d\n", _image.width (), _image.height ());
-
-//         printf ("updateScale = %d\n", updateScale);
-         if (updateScale)
-            {
-            _too_big = widgetSize.width () > MAX_PIXMAP_SIZE || widgetSize.height () > MAX_PIXMAP_SIZE;
-            //_too_big = true;
-
-            if (!_too_big && _pixmap.size () != finalSize)
-               {
-                qDebug() << "Here 1 " << finalSize << " " << _pixmap.size();
-//               printf ("pixmap resize %d, %d\n", pixmap_size.width (), pixmap_size.height ());
-               _pixmap = QPixmap(finalSize);
-               _pixmap.fill ();
-               }
-
-            if (!_too_big && !_image.isNull ())
-               {
-                qDebug() << "Here 2";
-               QImage small = _smoothing || force_smooth
-                  ? _image.scaled(widgetSize, Qt::IgnoreAspectRatio,
-                                  Qt::SmoothTransformation)
-                  : _image.scaledToWidth (widgetSize.width ());
-
-               // create a pixmap of the right scale
-               QPainter p (&_pixmap);
-
-               adjustMatrix (p, small.size (), _rotate);
-               p.drawImage (0, 0, small);
-               }
-            }
+         /* only the visible tiles are rendered, so we can afford to smooth
+            them straight away unless the user is busy zooming */
+         bool smooth = _smoothing || force_smooth || !delay_smoothing;
 
          _area->setSize (finalSize);
-         _area->setPixmapImage (_pixmap, _image, _too_big, _rotate);
+         _area->setTiles (_tiles, _rotate, smooth);
          _area->setScale (_scale);
          _area->viewport ()->update ();
 
          // if not smoothed, remember to do this later
-         if (!_smoothing && !force_smooth && !_too_big)
-            _timer->start (delay_smoothing ? 200 : 0);
+         if (!smooth)
+            _timer->start (200);
          break;
          }
 #if 0
@@ -796,6 +745,7 @@ void Pagewidget::slotPreviewPage (const QModelIndex &ind)
    _modelconv->indexToSource (_model, sindex);
    err = contents->getImage (sindex, _pagenum, false,
                   _image, size, scaledSize, bpp);
+   _tiles->setImage (_image);
    if (!err)
       updateViewport (true, false, false);
    else
@@ -1338,6 +1288,8 @@ MyScrollArea::MyScrollArea (QWidget *parent)
    setVerticalScrollBarPolicy (Qt::ScrollBarAsNeeded);
    _size = QSize (-1, -1);
    _rotate = 0;
+   _tiles = 0;
+   _smooth = true;
    }
 
 
@@ -1358,12 +1310,11 @@ void MyScrollArea::setSize (QSize &size)
    }
 
 
-void MyScrollArea::setPixmapImage (QPixmap &pixmap, QImage &image, bool too_big, int rotate)
+void MyScrollArea::setTiles (Pagetiles *tiles, int rotate, bool smooth)
    {
-   _pixmap = pixmap;
-   _image = image;
-   _too_big = too_big;
+   _tiles = tiles;
    _rotate = rotate;
+   _smooth = smooth;
    }
 
 
@@ -1372,97 +1323,15 @@ void MyScrollArea::paintEvent (QPaintEvent *event)
    emit signalPainting ();
 
    QPainter painter (viewport ());
-   QPoint tp = QPoint(0, 0);
-
-   if (_too_big)
-      {
-       qDebug() << "big";
-      if (_rotate == 90)
-         {
-         tp = QPoint (0, -_image.height ());
-         }
-
-      //adjustMatrix (painter, _image.size (), _rotate);
-      painter.scale(_scale, _scale);
-      }
+   QPoint origin (horizontalScrollBar()->value (), verticalScrollBar()->value ());
 
-   QMatrix m = painter.matrix ();
-
-   QRect exposedRect;
-
-   if(_rotate % 180 == 60){
-       exposedRect = m
-                    .translate (-verticalScrollBar()->value (), -horizontalScrollBar()->value ())
-                    .inverted ()
-                    .mapRect (event->rect ())
-                    .adjusted (-1, -1, 1, 1);
-   }
-   else{
-       exposedRect = m
-                     .translate (-horizontalScrollBar()->value (), -verticalScrollBar()->value ())
-                     .inverted ()
-                     .mapRect (event->rect ())
-                     .adjusted (-1, -1, 1, 1);
-   }
-
-  if (_rotate % 180 == 60)
-      exposedRect = QRect (exposedRect.y (), exposedRect.x (), exposedRect.height (), exposedRect.width ());
-
-   // the adjust is to account for half pixels along edges
-  // qDebug () << "exposed" << exposedRect << "image" << _pixmap.size ();
-
-  QPointF target = QPointF (0, 0);
-   if(_rotate == 90 )
-       target = QPointF (0, -exposedRect.width());
-
-   // set up the blanking rectangles so that the page is clearly visible
-
-   // right rect draws to the right of the image, extending to the bottom of the viewer
-   QRect rrect = exposedRect;
-//    rrect.translate (-horizontalScrollBar()->value (), -verticalScrollBar()->value ());
-
-   // bottom rect draws under the image, extending only to the right side of the image
-   QRect brect = rrect;
-
-//   QPointF center(exposedRect.width() / 2., exposedRect.height() / 2.); // widget center
-//   painter.translate(center);
-//   painter.rotate(_rotate);
-//   painter.drawPixmap(-pix.rect().center(), pix);
-
-   //painter.rotate (_rotate);
-
-  // painter.translate (target);
-
-   if (_too_big && !_image.isNull ())
-      {
-      painter.drawImage(target, _image, exposedRect);
-//       rrect.setLeft (_image->width ());
-//       brect.setTop (_image->height ());
-//       brect.setRight (_image->width ());
-      }
-   else if (!_pixmap.isNull ())
+   // anything outside the page is left grey so that the page is clearly visible
+   painter.fillRect (event->rect (), QBrush (Qt::lightGray));
+   if (_tiles)
       {
-       rrect.setLeft(0);
-       rrect.setTop(0);
-       painter.fillRect(rrect, QBrush(Qt::lightGray));
-      painter.drawPixmap(tp, _pixmap, exposedRect);
-
-     /* if(_rotate % 180 == 90){
-          rrect.setLeft (_pixmap.width () - verticalScrollBar()->value ());
-          rrect.setTop (-horizontalScrollBar()->value ());
-          brect.setTop (_pixmap.height ());
-          brect.setRight (_pixmap.width ());
-          painter.fillRect (rrect, QBrush (Qt::lightGray));
-          painter.fillRect (brect, QBrush (Qt::lightGray));
-        }
-      else{
-          rrect.setLeft (_pixmap.width () -horizontalScrollBar()->value ());
-          rrect.setTop (-verticalScrollBar()->value ());
-          brect.setTop (_pixmap.height ());
-          brect.setRight (_pixmap.width ());
-          painter.fillRect (rrect, QBrush (Qt::lightGray));
-          painter.fillRect (brect, QBrush (Qt::lightGray));
-        }*/
+      painter.translate (-origin);
+      _tiles->paint (painter, event->rect ().translated (origin), _scale,
+            _rotate, _smooth);
       }
    }
 
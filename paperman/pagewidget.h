@@ -47,6 +47,7 @@ class Desktopmodelconv;
 class Desk;
 class Mainwidget;
 class Pagedelegate;
+class Pagetiles;
 class Pagetools;
 class Pagemodel;
 class Pageview;
@@ -79,12 +80,12 @@ public:
       \param scale   the scale to set (1.0 is normal) */
    void setScale (double scale);
 
-   /** set the pixmap or image to display
+   /** set the page tiles to display
 
-      \param pixmap  the pixmap to display
-      \param image   the image to display (if the pixmap is too big)
-      \param too_big true to display the image instead of the pixmap */
-   void setPixmapImage (QPixmap &pixmap, QImage &image, bool too_big, int rotate);
+      \param tiles   the tiled page to display
+      \param rotate  rotation amount: 0, 90, 180, 270
+      \param smooth  true to render with smooth scaling, false for speed */
+   void setTiles (Pagetiles *tiles, int rotate, bool smooth);
 
    /** set the size of the pixmap, used to set up the scrollbars correctly
 
@@ -120,10 +121,9 @@ protected:
 
 private:
    double _scale;    //!< scale of the image
-   QPixmap _pixmap;  //!< current pixmap being displayed
-   QImage _image;    //!< current image being displayed, for when the pixmap is too big
+   Pagetiles *_tiles;   //!< the tiled page being displayed
+   bool _smooth;     //!< true to render tiles with smooth scaling
    QSize _size;      //!< size of current pixmap
-   bool _too_big;      //!< true if the scaling is too big to use a pixmap
    QPoint _scroll_origin;   //!< scroll origin
    QPoint _mouse_origin;   //!< scroll origin
    int _rotate;         //!< rotation amount: 0, 90, 180, 270
@@ -408,8 +408,8 @@ private:
    QPersistentModelIndex _index;        // index of current stack displayed
 /*   struct Desk *_desk;
    struct file_info *_file;*/
-   QPixmap _pixmap;
    QImage _image;
+   Pagetiles *_tiles;        //!< tiled renderer for _image
    int _pagenum;             //!< current page number being displayed
    int _start;             //!< start page to show
    int _count;             //!< number of pages to shoe
@@ -420,7 +420,6 @@ private:
 //    QGraphicsView *_view;
    MyScrollArea *_area;
    int _subsys;         // display subsystem to use
-   bool _too_big;      //!< true if the scaling is too big to use a pixmap
 
    /** timer used to handle updates */
    QTimer *_timer;
@@ -3,6 +3,7 @@ LANGUAGE = C++
 TARGET = Paperman
 QT += widgets
 QT += printsupport
+QT += concurrent
 
 DEFINES -= UNICODE
 
@@ -26,7 +27,17 @@ INCLUDEPATH += /msys64/mingw32/include
 # libraries for omnipage
 #LIBS += -lkernelapi -Wl,-rpath-link,$$OCRLIBPATH,-rpath,$$OCRLIBPATH
 
+# in-process tesseract OCR: build with 'qmake CONFIG+=tesslib'. Without
+# this, the tesseract program is run for each page
+tesslib {
+   DEFINES += CONFIG_use_tesslib
+   LIBS += -ltesseract
+}
+
 LIBS += -lpodofo
+
+# GetProcessMemoryInfo(), for the benchmark's peak memory use
+win32:LIBS += -lpsapi
 LIBS += -ltiff -ljpeg
 
 INCLUDEPATH += qi /usr/local/lib
@@ -78,6 +89,7 @@ HEADERS += desktopwidget.h \
    desk.h \
     mimetypemanager.h \
     pagepos.h \
+    pagetiles.h \
    pagewidget.h \
     pdfcore.h \
    qxmlconfig.h \
@@ -111,10 +123,12 @@ HEADERS += desktopwidget.h \
  pagetools.h \
  dirmodel.h \
  dirview.h \
+ desktopgrid.h \
  desktopview.h \
  desktopdelegate.h \
  desktopundo.h \
  printopt.h \
+ pageloader.h \
  pagemodel.h \
  pageview.h \
  pagedelegate.h \
@@ -133,6 +147,13 @@ HEADERS += desktopwidget.h \
  senddialog.h \
  transfer.h \
     filejpeg.h \
+    thumbcache.h \
+    ocrbatch.h \
+    textindex.h \
+    batch.h \
+    bench.h \
+    pixcount.h \
+    thumbnailer.h \
     qlistwidgetitemiterator.h
 
 SOURCES += \
@@ -144,6 +165,7 @@ SOURCES += \
    maxview.cpp \
    md5.c \
     mimetypemanager.cpp \
+    pagetiles.cpp \
     pagewidget.cpp \
     pdfcore.cpp \
    qxmlconfig.cpp \
@@ -177,10 +199,12 @@ SOURCES += \
  pagetools.cpp \
  dirmodel.cpp \
  dirview.cpp \
+ desktopgrid.cpp \
  desktopview.cpp \
  desktopdelegate.cpp \
  desktopundo.cpp \
  printopt.cpp \
+ pageloader.cpp \
  pagemodel.cpp \
  pageview.cpp \
  pagedelegate.cpp \
@@ -199,6 +223,13 @@ SOURCES += \
  senddialog.cpp \
  transfer.cpp \
     filejpeg.cpp \
+    thumbcache.cpp \
+    ocrbatch.cpp \
+    textindex.cpp \
+    batch.cpp \
+    bench.cpp \
+    pixcount.cpp \
+    thumbnailer.cpp \
     qlistwidgetitemiterator.cpp
 
 # add qtcreator debug macros if we are debugging
@@ -40,10 +40,18 @@ X-Comment: On Debian GNU/Linux systems, the complete text of the GNU General
 #include "file.h"
 #include "filemax.h"
 #include "paperstack.h"
+#include "pixcount.h"
 //#include "qscanner.h"
 #include "qxmlconfig.h"
 
 
+//! number of horizontal bands we record page coverage for
+#define COVERAGE_BANDS 32
+
+//! number of bands at the top and at the bottom which may hold a header or footer
+#define EDGE_BANDS 2
+
+
 
 Paperstack::Paperstack (QString stackName, QString pageName, bool jpeg)
    {
@@ -263,6 +271,10 @@ PPage::PPage (int pagenum, int width, int height, int depth, int stride,
    _pixelTarget = width * height;
    if (blank_threshold)
       _pixelTarget /= blank_threshold;
+   _bands.fill (0, COVERAGE_BANDS);
+   _bandBytes = qMax (1, (height + COVERAGE_BANDS - 1) / COVERAGE_BANDS * stride);
+   _scanned = 0;
+   _carryLen = 0;
 //    _model = model;
 //printf ("pixel target %d of %d\n", _pixelTarget, width * height);
    if (_jpeg)
@@ -320,7 +332,16 @@ void PPage::clear (void)
 
 bool PPage::isBlank (void)
    {
-   return _blank;
+   int band, body = 0;
+
+   if (_blank)
+      return true;
+
+   /* marks which are only in the header or footer (e.g. a fax header or a
+      page number) don't make a page worth keeping */
+   for (band = EDGE_BANDS; band < COVERAGE_BANDS - EDGE_BANDS; band++)
+      body += _bands [band];
+   return body < _pixelTarget;
    }
 
 
@@ -478,51 +499,69 @@ void PPage::finishJpeg (void)
    }
 
 
-#define RGB_THRESHOLD 240
-#define GREY_THRESHOLD 251
+void PPage::countBand (const unsigned char *buf, int size, int band)
+   {
+   int count = pixcount_dark (buf, size, _depth);
+
+   _bands [qMin (band, COVERAGE_BANDS - 1)] += count;
+   _nonblankPixels += count;
+   }
 
 
 bool PPage::checkBlank (const unsigned char *buf, int size)
    {
-   // number of bits set in a 4-bit number
-   static char bit_count [16] =
-      {
-      0, 1, 1, 2, 1, 2, 2, 3,
-      1, 2, 2, 3, 2, 3, 3, 4
-      };
-   int count = 0, pixels;
-   const unsigned char *end = buf + size;
-
-   // scan the buffer counting the number of non-blank pixels
-   switch (_depth)
-      {
-      case 1 :
-         for (; buf < end; buf++)
-            count += bit_count [*buf & 0xf] + bit_count [*buf >> 4];
-         break;
+   int pixels, len, band;
 
-      case 8 :
-         for (; buf < end; buf++)
-            if (*buf < GREY_THRESHOLD)
-               count++;
-         break;
+   // work out total pixels in this block
+   pixels = size * 8 / _depth;
 
-      case 24 :
-         for (; buf < end; buf += 3)
-            if (buf [0] < RGB_THRESHOLD
-               || buf [1] < RGB_THRESHOLD
-               || buf [2] < RGB_THRESHOLD)
-               count++;
-         break;
+   // finish off any RGB pixel which was split over the last block
+   if (_carryLen)
+      {
+      len = qMin (size, 3 - _carryLen);
+      memcpy (_carry + _carryLen, buf, len);
+      _carryLen += len;
+      buf += len;
+      size -= len;
+      _scanned += len;
+      if (_carryLen == 3)
+         {
+         countBand (_carry, 3, (_scanned - 1) / _bandBytes);
+         _carryLen = 0;
+         }
       }
 
-   // work out total pixels in this block
-   pixels = size * 8 / _depth;
+   /* scan the buffer counting the number of non-blank pixels, one band at a
+      time. The counting is vectorised, so this is cheap even at 600dpi */
+   while (size > 0)
+      {
+      band = _scanned / _bandBytes;
+      len = qMin (size, (band + 1) * _bandBytes - _scanned);
+      if (_depth == 24)
+         {
+         len -= len % 3;
+         if (!len && size < 3)
+            {
+            // keep the start of the pixel until we get the rest
+            memcpy (_carry, buf, size);
+            _carryLen = size;
+            _scanned += size;
+            break;
+            }
+
+         // a pixel which straddles two bands goes in the first
+         if (!len)
+            len = 3;
+         }
+      countBand (buf, len, band);
+      buf += len;
+      size -= len;
+      _scanned += len;
+      }
 
    // if more than 1 in COVERAGE pixels are blank, consider it blank
-//   printf ("count = %d, pixels = %d\n", count, pixels);
+//   printf ("count = %d, pixels = %d\n", _nonblankPixels, pixels);
 
-   _nonblankPixels += count;
    _pixels += pixels;
 //printf ("pixels = %d, non blank = %d\n",_pixels,  _nonblankPixels);
    if (_nonblankPixels < _pixelTarget)
@@ -39,6 +39,7 @@ X-Comment: On Debian GNU/Linux systems, the complete text of the GNU General
 
 #include <QMutex>
 #include <QThread>
+#include <QVector>
 #include <QWaitCondition>
 
 #include "qstring.h"
@@ -159,12 +160,19 @@ private:
    /** returns the raw size of the page in bytes */
    int size (void);
 
-   /** returns true if paper is blank */
+   /** returns true if paper is blank. A page with marks only in its header
+       or footer band counts as blank */
    bool isBlank (void);
 
    /** returns a string representing the page coverage */
    QString coverageStr ();
 
+   /** returns the number of dark pixels in each horizontal band of the
+       page, from top to bottom. This shows where any marks on a page are,
+       e.g. to tell a near-blank page with a header from one with a few
+       specks all over */
+   const QVector<int> &bandCoverage (void) const { return _bands; }
+
    /** clear the page's buffer, releasing any memory used */
    void clear (void);
 
@@ -183,9 +191,21 @@ private:
    int pagenum (void) const { return _pagenum; }
 
 private:
-   /** return true if the given bytes indicate a blank page */
+   /** count the dark pixels in some more image data, and return true if the
+       page is still blank
+
+      \param buf    image data, following on from the last call
+      \param size   number of bytes
+      \returns true if the page is still blank */
    bool checkBlank (const unsigned char *buf, int size);
 
+   /** add the dark pixels in some image data to the count for a band
+
+      \param buf    image data, which must be whole pixels
+      \param size   number of bytes
+      \param band   band to add to */
+   void countBand (const unsigned char *buf, int size, int band);
+
 private:
    int _size;     //!< size of image in bytes
    int _width;    //!< width of image
@@ -201,6 +221,11 @@ private:
    int _nonblankPixels;     //!< number of non-white pixels
    int _pixels;         //!< total number of pixels
    int _pixelTarget;    //!< number of non-white pixels we need to have a non-blank page
+   QVector<int> _bands;    //!< number of non-white pixels in each band
+   int _bandBytes;      //!< number of image bytes in each band
+   int _scanned;        //!< number of image bytes passed to checkBlank()
+   unsigned char _carry [3];  //!< start of an RGB pixel split between blocks
+   int _carryLen;       //!< number of bytes in _carry
    bool _mark_blank;    //!< true to mark page blank
 //   Desktopmodel *_model;   //!< model that this page is destined for
    QByteArray _data;    //!< data bytes
@@ -23,6 +23,8 @@ X-Comment: On Debian GNU/Linux systems, the complete text of the GNU General
 
 
 
+#include <stdlib.h>
+
 #include <QDebug>
 
 #include "podofo/podofo.h"
@@ -37,6 +39,9 @@ X-Comment: On Debian GNU/Linux systems, the complete text of the GNU General
 
 #define EXCEPTIONS
 
+//! width of an A4 page in points, for when a page does not give its size
+#define A4_WIDTH_PT 595.0
+
 
 #ifdef EXCEPTIONS
 #define mytry try
@@ -473,6 +478,114 @@ err_info *Pdfio::getImage (QString fname, int pagenum, QImage &image, double xsc
    }
 
 
+err_info *Pdfio::getPreview (QString fname, int pagenum, int width,
+      QImage &image)
+   {
+   CALL (get_thumbnail (fname, pagenum, image));
+   if (!image.isNull ())
+      {
+      if (image.width () > width)
+         image = image.scaledToWidth (width, Qt::SmoothTransformation);
+      return NULL;
+      }
+
+#ifdef CONFIG_use_poppler
+   Poppler::Page *page;
+   QSizeF fsize;
+   double dpi;
+
+   /* the page size is in points, so we can work out the resolution we need
+      without rendering anything */
+   CALL (find_page (pagenum, page));
+   fsize = page->pageSizeF ();
+   if (fsize.width () <= 0 && _doc)
+      {
+      mytry
+         {
+         fsize.setWidth (_doc->GetPage (pagenum)->GetMediaBox ().GetWidth ());
+         }
+#ifdef EXCEPTIONS
+      catch (const PdfError &)
+         {
+         }
+#endif
+      }
+   if (fsize.width () <= 0)
+      fsize.setWidth (A4_WIDTH_PT);
+   dpi = width * 72.0 / fsize.width ();
+   image = page->renderToImage (dpi, dpi);
+   delete page;
+   if (image.isNull ())
+      return err_make (ERRFN, ERR_failed_to_generate_preview_image);
+   return NULL;
+#else
+   return err_make (ERRFN, ERR_pdf_previewing_requires_poppler);
+#endif
+   }
+
+
+err_info *Pdfio::get_thumbnail (QString fname, int pagenum, QImage &image)
+   {
+   image = QImage ();
+   if (!_doc || pagenum < 0 || pagenum >= _doc->GetPageCount ())
+      return NULL;
+   mytry
+      {
+      const PdfDictionary *dict;
+      const PdfObject *obj = get_thumbnail_obj (pagenum, dict);
+      const PdfObject *filter;
+      int width, height, bpp, stride;
+      char *buff;
+      pdf_long len;
+
+      if (!obj || !obj->HasStream () || !dict->GetKey ("Width")
+          || !dict->GetKey ("Height"))
+         return NULL;
+
+      // JPEG thumbnails are common, and Qt can decode those directly
+      filter = dict->GetKey ("Filter");
+      if (filter && filter->IsName ()
+          && filter->GetName ().GetName () == "DCTDecode")
+         {
+         obj->GetStream ()->GetCopy (&buff, &len);
+         image.loadFromData ((const uchar *)buff, len, "JPEG");
+         free (buff);
+         return NULL;
+         }
+
+      // otherwise we need something PoDoFo can decode, in a simple format
+      if ((filter && !(filter->IsName ()
+                 && filter->GetName ().GetName () == "FlateDecode"))
+          || !dict->GetKey ("BitsPerComponent")
+          || !dict->GetKey ("ColorSpace")
+          || !dict->GetKey ("ColorSpace")->IsName ())
+         return NULL;
+      get_image_details (dict, width, height, bpp);
+      if (bpp != 1 && bpp != 8 && bpp != 24)
+         return NULL;
+      obj->GetStream ()->GetFilteredCopy (&buff, &len);
+      stride = (width * bpp + 7) / 8;
+      if (len < stride * height)
+         {
+         free (buff);
+         return err_make (ERRFN, ERR_pdf_decoder_returned_too_little_data_for_page_expected_got4,
+            qPrintable (fname), pagenum + 1, stride * height, len);
+         }
+      Filepage::getImageFromLines (buff, width, height, bpp, stride,
+            image, true, false, bpp == 1);
+      free (buff);
+      }
+#ifdef EXCEPTIONS
+   catch (const PdfError &)
+      {
+      // we can still render the page, so this is not fatal
+      image = QImage ();
+      }
+#endif
+   return NULL;
+   }
+
+
 err_info *Pdfio::flush (void)
    {
    return close ();
@@ -607,14 +720,14 @@ const PdfObject *Pdfio::get_xobject_image (const PdfReference &ref, const PdfDic
 
    obj = _doc->GetObjects ().GetObject (ref);
 //    qDebug () << "obj" << obj;
-   if (!obj->IsDictionary())
+   if (!obj || !obj->IsDictionary() || !obj->HasStream ())
       return 0;
    dict = &obj->GetDictionary();
 
-   const PdfObject* pObjType = dict->GetKey( PdfName::KeyType );
-   const PdfObject* pObjSubType = dict->GetKey( PdfName::KeySubtype );
-   if( ( pObjType && pObjType->IsName() && ( pObjType->GetName().GetName() == "XObject" ) ) ||
-      ( pObjSubType && pObjSubType->IsName() && ( pObjSubType->GetName().GetName() == "Image" ) ) )
+   /* thumbnails need not have /Type /XObject /Subtype /Image, so accept any
+      stream which describes an image */
+   if (dict->GetKey ("Width") && dict->GetKey ("Height")
+       && dict->GetKey ("BitsPerComponent"))
       return obj;
    return 0;
    }
@@ -85,6 +85,17 @@ public :
    err_info *getImage (QString fname, int pagenum, QImage &image, double xscale,
          double yscale, bool preview);
 
+   /** gets a preview image for a page, about the given width. If the page
+       has an embedded thumbnail (/Thumb) we use that, otherwise the page is
+       rendered once, at whatever resolution gives the right width
+
+      \param fname     filename (for error messages)
+      \param pagenum   page number (0...n-1)
+      \param width     width wanted in pixels
+      \param image     returns the preview image
+      \returns error, or NULL if ok */
+   err_info *getPreview (QString fname, int pagenum, int width, QImage &image);
+
    /** looks at the image/preview for the given page and returns its size
        in pixels, or QSize() if none
 
@@ -148,12 +159,28 @@ protected:
    const PoDoFo::PdfObject *get_image_obj (int pagenum,
          const PoDoFo::PdfDictionary *&dict);
 
+   /** looks up an object and checks that it is an image, i.e. a stream with
+       a width, height and bits per component
+
+       \param ref       reference to object
+       \param dict      returns object dictionary if found
+       \return pointer to object, or 0 if not an image */
    const PoDoFo::PdfObject *get_xobject_image (const PoDoFo::PdfReference &ref,
       const PoDoFo::PdfDictionary *&dict);
 
    const PoDoFo::PdfObject *get_thumbnail_obj (int pagenum,
          const PoDoFo::PdfDictionary *&dict);
 
+   /** decodes the embedded thumbnail for a page, if there is one which we
+       can understand. We handle JPEG thumbnails and those which PoDoFo can
+       decode itself into 1, 8 or 24bpp lines
+
+      \param fname     filename (for error messages)
+      \param pagenum   page number (0...n-1)
+      \param image     returns the thumbnail, or a null image if none
+      \returns error, or NULL if ok */
+   err_info *get_thumbnail (QString fname, int pagenum, QImage &image);
+
    /** given an image dictionary, get the image details from it.
 
       We only support RGB images with 24bpp and grey images with 1 or 8bpp
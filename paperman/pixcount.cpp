@@ -0,0 +1,292 @@
+/*
+License: GPL-2
+  An electronic filing cabinet: scan, print, stack, arrange
+ Copyright (C) 2009 Simon Glass, chch-kiwi@users.sourceforge.net
+ .
+ This program is free software; you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation; either version 2 of the License, or
+ (at your option) any later version.
+ .
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+ .
+ You should have received a copy of the GNU General Public License
+ along with this program; if not, write to the Free Software
+ Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301 USA
+
+X-Comment: On Debian GNU/Linux systems, the complete text of the GNU General
+ Public License can be found in the /usr/share/common-licenses/GPL file.
+*/
+
+
+#include <stdint.h>
+#include <string.h>
+
+#include "pixcount.h"
+
+#if defined (__GNUC__) && (defined (__x86_64__) || defined (__i386__))
+#define PIXCOUNT_x86
+#include <immintrin.h>
+#endif
+
+
+//! bits 0, 3, 6 ... in a mask with one bit per byte, i.e. the first byte of each RGB pixel
+#define RGB_FIRST_48  0x249249249249ULL
+#define RGB_FIRST_64  0x9249249249249249ULL
+
+//! as above, for the 32 bits after the first 64
+#define RGB_FIRST_96  0x24924924ULL
+
+
+typedef int (*count_fn) (const unsigned char *buf, int size);
+
+//! the functions we use for each depth
+struct kernels_info
+   {
+   count_fn bits;       //!< 1bpp
+   count_fn grey;       //!< 8bpp
+   count_fn rgb;        //!< 24bpp
+   const char *name;    //!< name of the fastest one in use
+   };
+
+
+/* plain C versions, which also deal with the odd bytes left over by the
+   vector versions */
+
+static inline __attribute__ ((always_inline)) int count_bits (
+      const unsigned char *buf, int size)
+   {
+   const unsigned char *end = buf + size;
+   uint64_t word;
+   int count = 0;
+
+   for (; buf + 8 <= end; buf += 8)
+      {
+      memcpy (&word, buf, 8);
+      count += __builtin_popcountll (word);
+      }
+   for (; buf < end; buf++)
+      count += __builtin_popcount (*buf);
+   return count;
+   }
+
+
+static int bits_scalar (const unsigned char *buf, int size)
+   {
+   return count_bits (buf, size);
+   }
+
+
+static int grey_scalar (const unsigned char *buf, int size)
+   {
+   const unsigned char *end = buf + size;
+   int count = 0;
+
+   for (; buf < end; buf++)
+      if (*buf < PIXCOUNT_grey_threshold)
+         count++;
+   return count;
+   }
+
+
+static int rgb_scalar (const unsigned char *buf, int size)
+   {
+   const unsigned char *end = buf + size - size % 3;
+   int count = 0;
+
+   for (; buf < end; buf += 3)
+      if (buf [0] < PIXCOUNT_rgb_threshold
+          || buf [1] < PIXCOUNT_rgb_threshold
+          || buf [2] < PIXCOUNT_rgb_threshold)
+         count++;
+   return count;
+   }
+
+
+#ifdef PIXCOUNT_x86
+
+//! the same as bits_scalar(), but using the popcnt instruction
+__attribute__ ((target ("popcnt")))
+static int bits_popcnt (const unsigned char *buf, int size)
+   {
+   return count_bits (buf, size);
+   }
+
+
+/* For grey, each byte is compared with the threshold using an unsigned
+   minimum, since there is no unsigned compare. Each lane of the accumulator
+   counts up to 255 matches, then they are added up with a sum of absolute
+   differences against zero */
+
+__attribute__ ((target ("sse2")))
+static int grey_sse2 (const unsigned char *buf, int size)
+   {
+   const __m128i zero = _mm_setzero_si128 ();
+   const __m128i limit = _mm_set1_epi8 ((char)(PIXCOUNT_grey_threshold - 1));
+   int count = 0, done = 0, i;
+
+   while (size - done >= 16)
+      {
+      __m128i acc = zero;
+
+      for (i = 0; i < 255 && size - done >= 16; i++, done += 16)
+         {
+         __m128i x = _mm_loadu_si128 ((const __m128i *)(buf + done));
+
+         acc = _mm_sub_epi8 (acc, _mm_cmpeq_epi8 (_mm_min_epu8 (x, limit), x));
+         }
+      acc = _mm_sad_epu8 (acc, zero);
+      count += _mm_cvtsi128_si32 (acc) + _mm_extract_epi16 (acc, 4);
+      }
+   return count + grey_scalar (buf + done, size - done);
+   }
+
+
+__attribute__ ((target ("avx2")))
+static int grey_avx2 (const unsigned char *buf, int size)
+   {
+   const __m256i zero = _mm256_setzero_si256 ();
+   const __m256i limit = _mm256_set1_epi8 ((char)(PIXCOUNT_grey_threshold - 1));
+   uint64_t sums [4];
+   int count = 0, done = 0, i;
+
+   while (size - done >= 32)
+      {
+      __m256i acc = zero;
+
+      for (i = 0; i < 255 && size - done >= 32; i++, done += 32)
+         {
+         __m256i x = _mm256_loadu_si256 ((const __m256i *)(buf + done));
+
+         acc = _mm256_sub_epi8 (acc,
+               _mm256_cmpeq_epi8 (_mm256_min_epu8 (x, limit), x));
+         }
+      _mm256_storeu_si256 ((__m256i *)sums, _mm256_sad_epu8 (acc, zero));
+      count += int (sums [0] + sums [1] + sums [2] + sums [3]);
+      }
+   return count + grey_scalar (buf + done, size - done);
+   }
+
+
+/* For RGB, we get a mask with one bit per byte saying whether it is dark.
+   ORing each bit with the next two puts the result for each pixel in the
+   bit for its first byte, which we pick out and count. Working on 48 (or
+   96) bytes at a time means that pixels never straddle two blocks */
+
+__attribute__ ((target ("sse2,popcnt")))
+static int rgb_sse2 (const unsigned char *buf, int size)
+   {
+   const __m128i limit = _mm_set1_epi8 ((char)(PIXCOUNT_rgb_threshold - 1));
+   int count = 0, done = 0, i;
+
+   for (; size - done >= 48; done += 48)
+      {
+      uint64_t mask = 0;
+
+      for (i = 0; i < 3; i++)
+         {
+         __m128i x = _mm_loadu_si128 ((const __m128i *)(buf + done + i * 16));
+
+         mask |= (uint64_t)_mm_movemask_epi8 (
+               _mm_cmpeq_epi8 (_mm_min_epu8 (x, limit), x)) << (i * 16);
+         }
+      mask |= mask >> 1 | mask >> 2;
+      count += __builtin_popcountll (mask & RGB_FIRST_48);
+      }
+   return count + rgb_scalar (buf + done, size - done);
+   }
+
+
+__attribute__ ((target ("avx2,popcnt")))
+static int rgb_avx2 (const unsigned char *buf, int size)
+   {
+   const __m256i limit = _mm256_set1_epi8 ((char)(PIXCOUNT_rgb_threshold - 1));
+   uint32_t mask [3];
+   uint64_t lo, hi;
+   int count = 0, done = 0, i;
+
+   for (; size - done >= 96; done += 96)
+      {
+      for (i = 0; i < 3; i++)
+         {
+         __m256i x = _mm256_loadu_si256 ((const __m256i *)(buf + done + i * 32));
+
+         mask [i] = (uint32_t)_mm256_movemask_epi8 (
+               _mm256_cmpeq_epi8 (_mm256_min_epu8 (x, limit), x));
+         }
+
+      // 96 bits don't fit in one word, so carry across into the low one
+      lo = mask [0] | (uint64_t)mask [1] << 32;
+      hi = mask [2];
+      lo |= (lo >> 1 | hi << 63) | (lo >> 2 | hi << 62);
+      hi |= hi >> 1 | hi >> 2;
+      count += __builtin_popcountll (lo & RGB_FIRST_64)
+            + __builtin_popcountll (hi & RGB_FIRST_96);
+      }
+   return count + rgb_scalar (buf + done, size - done);
+   }
+
+#endif
+
+
+//! work out which functions to use on this CPU
+static kernels_info choose_kernels (void)
+   {
+   kernels_info k = { bits_scalar, grey_scalar, rgb_scalar, "scalar" };
+
+#ifdef PIXCOUNT_x86
+   __builtin_cpu_init ();
+   if (__builtin_cpu_supports ("popcnt"))
+      {
+      k.bits = bits_popcnt;
+      k.name = "popcnt";
+      }
+   if (__builtin_cpu_supports ("sse2"))
+      {
+      k.grey = grey_sse2;
+      if (__builtin_cpu_supports ("popcnt"))
+         k.rgb = rgb_sse2;
+      k.name = "sse2";
+      }
+   if (__builtin_cpu_supports ("avx2") && __builtin_cpu_supports ("popcnt"))
+      {
+      k.grey = grey_avx2;
+      k.rgb = rgb_avx2;
+      k.name = "avx2";
+      }
+#endif
+   return k;
+   }
+
+
+//! \returns the functions to use, choosing them the first time
+static const kernels_info &kernels (void)
+   {
+   static const kernels_info k = choose_kernels ();
+
+   return k;
+   }
+
+
+int pixcount_dark (const unsigned char *buf, int size, int depth)
+   {
+   switch (depth)
+      {
+      case 1 :
+         return kernels ().bits (buf, size);
+      case 8 :
+         return kernels ().grey (buf, size);
+      case 24 :
+         return kernels ().rgb (buf, size);
+      }
+   return 0;
+   }
+
+
+const char *pixcount_kernel (void)
+   {
+   return kernels ().name;
+   }
@@ -0,0 +1,60 @@
+/*
+License: GPL-2
+  An electronic filing cabinet: scan, print, stack, arrange
+ Copyright (C) 2009 Simon Glass, chch-kiwi@users.sourceforge.net
+ .
+ This program is free software; you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation; either version 2 of the License, or
+ (at your option) any later version.
+ .
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+ .
+ You should have received a copy of the GNU General Public License
+ along with this program; if not, write to the Free Software
+ Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301 USA
+
+X-Comment: On Debian GNU/Linux systems, the complete text of the GNU General
+ Public License can be found in the /usr/share/common-licenses/GPL file.
+*/
+/*
+   Project:    Maxview
+   File:       pixcount.h
+
+   This file counts the dark (non-white) pixels in raw image data, as used
+   for detecting blank pages while scanning.
+
+   There are vector versions for x86 (SSE2, AVX2 and hardware popcount),
+   chosen when first used according to what the CPU supports, and plain C
+   versions for everything else.
+*/
+
+#ifndef __pixcount_h
+#define __pixcount_h
+
+
+//! grey pixels darker than this are not white
+#define PIXCOUNT_grey_threshold  251
+
+//! RGB pixels with any channel darker than this are not white
+#define PIXCOUNT_rgb_threshold   240
+
+
+/** count the dark pixels in some image data
+
+   \param buf       image data
+   \param size      number of bytes (a multiple of 3 for 24bpp)
+   \param depth     bits per pixel: 1 (a set bit is black), 8 (grey) or 24
+                    (RGB)
+   \returns number of dark pixels */
+int pixcount_dark (const unsigned char *buf, int size, int depth);
+
+/** returns the name of the code used by pixcount_dark() on this CPU, e.g.
+    "avx2" */
+const char *pixcount_kernel (void);
+
+
+#endif
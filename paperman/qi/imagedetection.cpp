@@ -18,9 +18,136 @@
 #include "imagedetection.h"
 
 #include <math.h>
+#include <string.h>
 
 #include <qimage.h>
 
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define IMAGEDETECTION_X86
+#include <emmintrin.h>
+#endif
+
+typedef void (*AddRowFn)(const uchar* gray,int n,quint32* colsum,
+                         quint32* colsq,quint64& rowsum,quint64& rowsq);
+
+/** Add grey values from x onwards to the statistics, one at a time. This
+    deals with the end of a row for the vector version.
+ */
+static void addRowTail(const uchar* gray,int x,int n,quint32* colsum,
+                       quint32* colsq,quint64& sum,quint64& sq)
+{
+  for(;x < n;x++)
+  {
+    uint g = gray[x];
+    sum += g;
+    sq += g * g;
+    if(colsum)
+    {
+      colsum[x] += g;
+      colsq[x] += g * g;
+    }
+  }
+}
+
+/** Add one row of grey values to the statistics. The sum and sum of squares
+    of the row are returned, and if colsum is not null each grey value and its
+    square are added to the per-column totals. 32 bits is enough for the
+    column totals of any image with fewer than 66000 rows.
+ */
+static void addRowScalar(const uchar* gray,int n,quint32* colsum,
+                         quint32* colsq,quint64& rowsum,quint64& rowsq)
+{
+  quint64 sum = 0;
+  quint64 sq = 0;
+  addRowTail(gray,0,n,colsum,colsq,sum,sq);
+  rowsum = sum;
+  rowsq = sq;
+}
+
+#ifdef IMAGEDETECTION_X86
+/** The same as addRowScalar(), but 16 pixels at a time using SSE2. This is
+    built for SSE2 whatever the compiler flags, and only used if the CPU has it.
+ */
+__attribute__((target("sse2")))
+static void addRowSse2(const uchar* gray,int n,quint32* colsum,
+                       quint32* colsq,quint64& rowsum,quint64& rowsq)
+{
+  int x = 0;
+  quint64 sum = 0;
+  quint64 sq = 0;
+  const __m128i zero = _mm_setzero_si128();
+  __m128i vsum = zero;
+  __m128i vsq = zero;
+  for(;x + 16 <= n;x += 16)
+  {
+    __m128i v = _mm_loadu_si128((const __m128i*)(gray + x));
+    __m128i lo = _mm_unpacklo_epi8(v,zero);
+    __m128i hi = _mm_unpackhi_epi8(v,zero);
+    vsum = _mm_add_epi64(vsum,_mm_sad_epu8(v,zero));
+    vsq = _mm_add_epi32(vsq,_mm_add_epi32(_mm_madd_epi16(lo,lo),
+                                          _mm_madd_epi16(hi,hi)));
+    if(colsum)
+    {
+      // 255 * 255 still fits in an unsigned 16-bit lane
+      __m128i sqlo = _mm_mullo_epi16(lo,lo);
+      __m128i sqhi = _mm_mullo_epi16(hi,hi);
+      __m128i* cs = (__m128i*)(colsum + x);
+      __m128i* cq = (__m128i*)(colsq + x);
+      _mm_storeu_si128(cs,_mm_add_epi32(_mm_loadu_si128(cs),_mm_unpacklo_epi16(lo,zero)));
+      _mm_storeu_si128(cs + 1,_mm_add_epi32(_mm_loadu_si128(cs + 1),_mm_unpackhi_epi16(lo,zero)));
+      _mm_storeu_si128(cs + 2,_mm_add_epi32(_mm_loadu_si128(cs + 2),_mm_unpacklo_epi16(hi,zero)));
+      _mm_storeu_si128(cs + 3,_mm_add_epi32(_mm_loadu_si128(cs + 3),_mm_unpackhi_epi16(hi,zero)));
+      _mm_storeu_si128(cq,_mm_add_epi32(_mm_loadu_si128(cq),_mm_unpacklo_epi16(sqlo,zero)));
+      _mm_storeu_si128(cq + 1,_mm_add_epi32(_mm_loadu_si128(cq + 1),_mm_unpackhi_epi16(sqlo,zero)));
+      _mm_storeu_si128(cq + 2,_mm_add_epi32(_mm_loadu_si128(cq + 2),_mm_unpacklo_epi16(sqhi,zero)));
+      _mm_storeu_si128(cq + 3,_mm_add_epi32(_mm_loadu_si128(cq + 3),_mm_unpackhi_epi16(sqhi,zero)));
+    }
+  }
+  quint64 s64[2];
+  quint32 s32[4];
+  _mm_storeu_si128((__m128i*)s64,vsum);
+  _mm_storeu_si128((__m128i*)s32,vsq);
+  sum = s64[0] + s64[1];
+  sq = quint64(s32[0]) + s32[1] + s32[2] + s32[3];
+  addRowTail(gray,x,n,colsum,colsq,sum,sq);
+  rowsum = sum;
+  rowsq = sq;
+}
+#endif
+
+/** Work out which addRow() to use on this CPU.
+ */
+static AddRowFn chooseAddRow()
+{
+#ifdef IMAGEDETECTION_X86
+  __builtin_cpu_init();
+  if(__builtin_cpu_supports("sse2"))
+    return addRowSse2;
+#endif
+  return addRowScalar;
+}
+
+/** Add one row of grey values to the statistics, using the fastest version
+    for this CPU, which is chosen the first time.
+ */
+static void addRow(const uchar* gray,int n,quint32* colsum,quint32* colsq,
+                   quint64& rowsum,quint64& rowsq)
+{
+  static const AddRowFn fn = chooseAddRow();
+  fn(gray,n,colsum,colsq,rowsum,rowsq);
+}
+
+/** Work out the mean (truncated, as it always was) and standard deviation
+    of n grey values from their sum and sum of squares.
+ */
+static void meanDev(quint64 sum,quint64 sq,int n,int& avg,double& dev)
+{
+  avg = int(sum / quint64(n));
+  // sum of (g - avg)^2, expanded so that we only need one pass
+  qint64 var = qint64(sq) - 2 * qint64(avg) * qint64(sum) + qint64(n) * avg * avg;
+  dev = n > 1 ? sqrt(double(var) / double(n - 1)) : 0.0;
+}
+
 ImageDetection::ImageDetection(QImage* image,bool multiple_images,QRgb rgb,
                                double factor,double min_size)
 {
@@ -30,6 +157,9 @@ ImageDetection::ImageDetection(QImage* image,bool multiple_images,QRgb rgb,
   mRgb = rgb;
   mFactor = factor;
   mMinSize = min_size;
+  mMaxSize = 0;
+  mWidth = 0;
+  mHeight = 0;
   mpImage = 0;
   if(image)
     setImage(image);
@@ -41,6 +171,180 @@ ImageDetection::~ImageDetection()
 void ImageDetection::setImage(QImage* image)
 {
   mpImage = image;
+  mGray.clear();
+  mFilled.clear();
+}
+/** No descriptions */
+void ImageDetection::setMaxSize(int size)
+{
+  mMaxSize = size;
+  mGray.clear();
+  mFilled.clear();
+}
+/** Make the grey copy of the image, reduced if necessary. Each row is read
+    once with scanLine(), and we note whether it is filled with mRgb.
+ */
+void ImageDetection::makeGray()
+{
+  QImage image = *mpImage;
+  QVector <uchar> lut(256);
+  QVector <bool> lut_match(256);
+  QVector <uchar> row;
+  QVector <quint32> acc;
+  int x,y,i;
+
+  if(!mGray.isEmpty() || image.isNull())
+    return;
+  switch(image.format())
+  {
+    case QImage::Format_Mono:
+    case QImage::Format_MonoLSB:
+    case QImage::Format_Indexed8:
+      for(i = 0;i < image.colorCount() && i < 256;i++)
+      {
+        lut[i] = qGray(image.color(i));
+        lut_match[i] = image.color(i) == mRgb;
+      }
+      break;
+    case QImage::Format_RGB32:
+    case QImage::Format_ARGB32:
+      break;
+    default:
+      image = image.convertToFormat(QImage::Format_ARGB32);
+      break;
+  }
+
+  // reduce by a whole number so that neither side is larger than mMaxSize
+  int w = image.width();
+  int h = image.height();
+  int step = 1;
+  if(mMaxSize > 0)
+    step = qMax(1,(qMax(w,h) + mMaxSize - 1) / mMaxSize);
+  mWidth = (w + step - 1) / step;
+  mHeight = (h + step - 1) / step;
+  mGray.resize(mWidth * mHeight);
+  mFilled.fill(true,mHeight);
+  row.resize(w);
+  acc.resize(mWidth);
+
+  for(y = 0;y < h;y++)
+  {
+    const uchar* line = image.constScanLine(y);
+    bool filled = true;
+
+    switch(image.format())
+    {
+      case QImage::Format_Mono:
+        for(x = 0;x < w;x++)
+        {
+          i = (line[x >> 3] >> (7 - (x & 7))) & 1;
+          row[x] = lut[i];
+          filled = filled && lut_match[i];
+        }
+        break;
+      case QImage::Format_MonoLSB:
+        for(x = 0;x < w;x++)
+        {
+          i = (line[x >> 3] >> (x & 7)) & 1;
+          row[x] = lut[i];
+          filled = filled && lut_match[i];
+        }
+        break;
+      case QImage::Format_Indexed8:
+        for(x = 0;x < w;x++)
+        {
+          row[x] = lut[line[x]];
+          filled = filled && lut_match[line[x]];
+        }
+        break;
+      default:
+      {
+        const QRgb* p = (const QRgb*)line;
+        // pixel() reports RGB32 pixels as opaque
+        QRgb alpha = image.format() == QImage::Format_RGB32 ? 0xff000000 : 0;
+        for(x = 0;x < w;x++)
+        {
+          row[x] = qGray(p[x]);
+          filled = filled && (p[x] | alpha) == mRgb;
+        }
+        break;
+      }
+    }
+    if(!filled)
+      mFilled[y / step] = false;
+    if(step == 1)
+    {
+      memcpy(mGray.data() + y * mWidth,row.constData(),w);
+      continue;
+    }
+
+    // average each step x step block
+    for(x = 0;x < w;x++)
+      acc[x / step] += row[x];
+    if((y + 1) % step == 0 || y == h - 1)
+    {
+      int rows = (y % step) + 1;
+      uchar* out = mGray.data() + (y / step) * mWidth;
+      for(x = 0;x < mWidth;x++)
+      {
+        int cols = qMin(step,w - x * step);
+        out[x] = acc[x] / (rows * cols);
+        acc[x] = 0;
+      }
+    }
+  }
+}
+/** Work out the grey level statistics of the rows top to bottom (inclusive)
+    in a single pass. Each output may be null if it is not needed. Row
+    results are indexed from top; column results cover the whole range.
+ */
+void ImageDetection::lineStats(int top,int bottom,QVector <int>* row_avg,
+                               QVector <double>* row_dev,
+                               QVector <int>* col_avg,
+                               QVector <double>* col_dev)
+{
+  QVector <quint32> colsum;
+  QVector <quint32> colsq;
+  quint64 sum,sq;
+  int y,x;
+
+  if(row_avg)
+    row_avg->resize(qMax(0,bottom - top + 1));
+  if(row_dev)
+    row_dev->resize(qMax(0,bottom - top + 1));
+  if(col_avg || col_dev)
+  {
+    colsum.fill(0,mWidth);
+    colsq.fill(0,mWidth);
+  }
+  for(y = top;y <= bottom;y++)
+  {
+    int avg;
+    double dev;
+    addRow(mGray.constData() + y * mWidth,mWidth,
+           colsum.isEmpty() ? 0 : colsum.data(),colsq.data(),sum,sq);
+    meanDev(sum,sq,mWidth,avg,dev);
+    if(row_avg)
+      (*row_avg)[y - top] = avg;
+    if(row_dev)
+      (*row_dev)[y - top] = dev;
+  }
+  if(colsum.isEmpty())
+    return;
+  if(col_avg)
+    col_avg->resize(mWidth);
+  if(col_dev)
+    col_dev->resize(mWidth);
+  for(x = 0;x < mWidth;x++)
+  {
+    int avg;
+    double dev;
+    meanDev(colsum[x],colsq[x],bottom - top + 1,avg,dev);
+    if(col_avg)
+      (*col_avg)[x] = avg;
+    if(col_dev)
+      (*col_dev)[x] = dev;
+  }
 }
 /** Find the first line, beginning at the bottom of the image, which
     is not filled with color rgb.
@@ -48,13 +352,11 @@ void ImageDetection::setImage(QImage* image)
 int ImageDetection::lastValidLine()
 {
   int y;
-  for(y = mpImage->height() - 1;y >= 0; y--)
+  makeGray();
+  for(y = mHeight - 1;y >= 0; y--)
   {
-    for(int x = 0;x < mpImage->width();x++)
-    {
-      if(mpImage->pixel(x,y) != mRgb)
-        return y;
-    }
+    if(!mFilled[y])
+      return y;
   }
   return y;
 }
@@ -64,6 +366,7 @@ QVector <int> ImageDetection::findVerticalLines(double std_dev)
   QVector <int> result;
   QVector <bool> v_array;
   QVector <double> v_stddev_array;
+  QVector <int> v_avg_array;
   result.resize(0);
   if(mpImage->isNull())
     return result;
@@ -71,26 +374,12 @@ QVector <int> ImageDetection::findVerticalLines(double std_dev)
   int ll = lastValidLine();
 
   v_array.resize(ll+1);
-  v_stddev_array.resize(ll+1);
+  lineStats(0,ll,&v_avg_array,&v_stddev_array,0,0);
   int i;
   int avg = 0;
   for(i = 0;i <= ll ;i++)
   {
-    int val = 0;
-    int x;
-    double sum = 0.0;
-    int n;
-    for(x = 0;x < mpImage->width();x++)
-    {
-      val += qGray(mpImage->pixel(x,i));
-    }
-    n = mpImage->width();
-    avg = int(double(val)/double(n));
-    for(x = 0;x < mpImage->width();x++)
-    {
-      sum += double(pow((qGray(mpImage->pixel(x,i)) - avg),2.0));
-    }
-    v_stddev_array[i] = sqrt(sum/double(n-1));
+    avg = v_avg_array[i];
     if(mBlackBg == true)
     {
       if((avg < mAvgMinMax) && (v_stddev_array[i] < std_dev))
@@ -176,31 +465,20 @@ QVector <int> ImageDetection::findHorizontalLines(int top,int bottom,double std_
   QVector <int> result;
   QVector <bool> h_array;
   QVector <double> h_stddev_array;
+  QVector <int> h_avg_array;
   result.resize(0);
   if(mpImage->isNull())
     return result;
 
   int i;
   int avg;
-  int n;
 
-  h_array.resize(mpImage->width());
-  h_stddev_array.resize(mpImage->width());
-  for(i = 0;i < mpImage->width();i++)
+  makeGray();
+  h_array.resize(mWidth);
+  lineStats(top,bottom,0,0,&h_avg_array,&h_stddev_array);
+  for(i = 0;i < mWidth;i++)
   {
-    int val = 0;
-    double sum = 0.0;
-    for(int y = top;y <= bottom;y++)
-    {
-      val += qGray(mpImage->pixel(i,y));
-    }
-    n = bottom-top+1;
-    avg = int(double(val)/double(n));
-    for(int y = top;y < bottom;y++)
-    {
-      sum += double(pow((qGray(mpImage->pixel(i,y)) - avg),2.0));
-    }
-    h_stddev_array[i] = sqrt(sum/double(n-1));
+    avg = h_avg_array[i];
     if(mBlackBg == true)
     {
       if((avg < mAvgMinMax) && (h_stddev_array[i] < std_dev))
@@ -254,35 +532,17 @@ QVector<double> ImageDetection::autoSelect()
   double sizefactor = mMinSize;
 
   int ll = lastValidLine();
-  if(ll <= int(double(mpImage->height())*sizefactor))
+  if(ll <= int(double(mHeight)*sizefactor))
     return rects;
   rects.resize(0);
-  h_array.resize(mpImage->width());
+  h_array.resize(mWidth);
   v_array.resize(ll);
-  h_stddev_array.resize(mpImage->width());
-  v_stddev_array.resize(ll);
+
+  //rows and columns in one pass
+  lineStats(0,ll-1,0,&v_stddev_array,0,&h_stddev_array);
 
   int i;
-  int avg = 0;
   double std_dev = 0.0;
-  for(i = 0;i < ll ;i++)
-  {
-    int val = 0;
-    int x;
-    double sum = 0.0;
-    int n;
-    n = mpImage->width();
-    for(x = 0;x < mpImage->width();x++)
-    {
-      val += qGray(mpImage->pixel(x,i));
-    }
-    avg = int(double(val)/double(n));
-    for(x = 0;x < mpImage->width();x++)
-    {
-      sum += double(pow((qGray(mpImage->pixel(x,i)) - avg),2.0));
-    }
-    v_stddev_array[i] = sqrt(sum/double(n-1));
-  }
   std_dev_max = 0.0;
   std_dev_min = 20000.0;
   for(i = 0;i < int(v_stddev_array.size()) ;i++)
@@ -293,21 +553,6 @@ QVector<double> ImageDetection::autoSelect()
       std_dev_min = v_stddev_array[i];
   }
 //determine horizontal lines
-  for(i = 0;i < mpImage->width();i++)
-  {
-    int val = 0;
-    double sum = 0.0;
-    for(int y = 0;y < ll;y++)
-    {
-      val += qGray(mpImage->pixel(i,y));
-    }
-    avg = int(double(val)/double(ll));
-    for(int y = 0;y < ll;y++)
-    {
-      sum += double(pow((qGray(mpImage->pixel(i,y)) - avg),2.0));
-    }
-    h_stddev_array[i] = sqrt(sum/double(ll-1));
-  }
   for(i = 0;i < int(h_stddev_array.size()) ;i++)
   {
     if(h_stddev_array[i] > std_dev_max)
@@ -327,10 +572,10 @@ QVector<double> ImageDetection::autoSelect()
     if(hlines.size() >= 2)
     {
        rects.resize(rects.size() + 4);
-       rects[rects.size() - 4] = double(hlines[0])/double(mpImage->width());
-       rects[rects.size() - 3] = double(hlines[1])/double(mpImage->width());
-       rects[rects.size() - 2] = double(lines[c])/double(mpImage->height());
-       rects[rects.size() - 1] = double(lines[c+1])/double(mpImage->height());
+       rects[rects.size() - 4] = double(hlines[0])/double(mWidth);
+       rects[rects.size() - 3] = double(hlines[1])/double(mWidth);
+       rects[rects.size() - 2] = double(lines[c])/double(mHeight);
+       rects[rects.size() - 1] = double(lines[c+1])/double(mHeight);
     }
   }
   return rects;
@@ -38,6 +38,10 @@ public:
   QVector<double> autoSelect();
   /** No descriptions */
   void setGrayLimit(int min_or_max,bool black_bg);
+  /** Allow the detection to work on a copy of the image reduced so that
+      neither side is larger than size pixels. 0 means full size.
+   */
+  void setMaxSize(int size);
 private:
   /** No descriptions */
   QImage* mpImage;
@@ -49,6 +53,14 @@ private:
   QVector <int> findVerticalLines(double std_dev);
   /** No descriptions */
   QVector <int> findHorizontalLines(int top,int bottom,double std_dev);
+  /** Make the grey copy of the image, if not done already */
+  void makeGray();
+  /** Grey level mean and standard deviation of each row from top to
+      bottom, and of each column over those rows, in a single pass.
+   */
+  void lineStats(int top,int bottom,QVector <int>* row_avg,
+                 QVector <double>* row_dev,QVector <int>* col_avg,
+                 QVector <double>* col_dev);
   /** No descriptions */
   bool mMultipleImages;
   /** No descriptions */
@@ -59,6 +71,15 @@ private:
   double mFactor;
   bool mBlackBg;
   int mAvgMinMax;
+  /** Largest side of the grey copy, 0 for full size */
+  int mMaxSize;
+  /** Grey copy of the image, one byte per pixel */
+  QVector <uchar> mGray;
+  /** Size of the grey copy */
+  int mWidth;
+  int mHeight;
+  /** True for each row of the grey copy which is filled with mRgb */
+  QVector <bool> mFilled;
 };
 
 #endif
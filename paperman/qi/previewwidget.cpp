@@ -1235,6 +1235,8 @@ void PreviewWidget::slotAutoSelection()
   bool ms = mpListView->isVisible();
 
   ImageDetection imagedetection(&image,ms,qRgb(0,0,0),factor,sizefactor);
+  //the selection is relative, so a reduced copy of the preview is enough
+  imagedetection.setMaxSize(1024);
 
   int bgtype = xmlConfig->intValue("AUTOSELECT_BG_TYPE",0);
   if(bgtype == 0)
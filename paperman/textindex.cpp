@@ -0,0 +1,928 @@
+/*
+License: GPL-2
+  An electronic filing cabinet: scan, print, stack, arrange
+ Copyright (C) 2009 Simon Glass, chch-kiwi@users.sourceforge.net
+ .
+ This program is free software; you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation; either version 2 of the License, or
+ (at your option) any later version.
+ .
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+ .
+ You should have received a copy of the GNU General Public License
+ along with this program; if not, write to the Free Software
+ Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301 USA
+
+X-Comment: On Debian GNU/Linux systems, the complete text of the GNU General
+ Public License can be found in the /usr/share/common-licenses/GPL file.
+*/
+
+
+#include <algorithm>
+#include <string.h>
+
+#include <QDataStream>
+#include <QDateTime>
+#include <QDebug>
+#include <QDir>
+#include <QFileInfo>
+#include <QMutexLocker>
+#include <QRunnable>
+#include <QSaveFile>
+#include <QThread>
+
+#include "file.h"
+#include "textindex.h"
+
+
+//! first item in the document table, so we can change the format later
+#define INDEX_HEADER "maxview-textindex 1"
+
+//! directory holding the index, within the repository root
+#define INDEX_DIR ".maxview-index/"
+
+//! file in the index directory which shows that the whole repository was scanned
+#define SCANNED_FILE "scanned"
+
+//! number of postings to hold in memory before writing a new segment
+#define MERGE_POSTINGS  4000000
+
+//! number of bits used for the page number in a search result
+#define PAGE_BITS       20
+
+//! shortest and longest words that we index
+#define WORD_MIN        2
+#define WORD_MAX        32
+
+//! shortest word which is taken as a prefix when searching
+#define PREFIX_MIN      3
+
+
+//! journal record types
+enum
+   {
+   JOURNAL_add = 1,     //!< a document was indexed
+   JOURNAL_remove       //!< a document has gone
+   };
+
+
+/** header of the word table file. This is followed by 'count' term_entry
+records sorted by word, then the words themselves */
+
+struct term_header
+   {
+   char magic [8];      //!< TERM_MAGIC
+   quint32 count;       //!< number of words
+   quint32 pad;
+   };
+
+//! an entry in the word table
+struct term_entry
+   {
+   quint64 str_off;     //!< offset of word, from the end of the table
+   quint64 post_off;    //!< offset of postings in the postings file
+   quint32 str_len;     //!< length of word in bytes (UTF-8)
+   quint32 post_count;  //!< number of postings
+   };
+
+static const char TERM_MAGIC [8] = { 'M', 'V', 'T', 'E', 'R', 'M', '1', 0 };
+
+
+//! \returns the directory part of a document path (with trailing /)
+static QString doc_dir (const QString &path)
+   {
+   return path.left (path.lastIndexOf ('/') + 1);
+   }
+
+
+/** postings are stored as pairs of variable-length integers: the difference
+from the previous document number, then the page number. Each integer is
+stored 7 bits at a time, low bits first, with the top bit set on all but the
+last byte */
+
+static void put_varint (QByteArray &buf, quint32 val)
+   {
+   while (val >= 0x80)
+      {
+      buf.append (char (val | 0x80));
+      val >>= 7;
+      }
+   buf.append (char (val));
+   }
+
+
+static const uchar *get_varint (const uchar *ptr, quint32 &val)
+   {
+   int shift;
+
+   for (val = 0, shift = 0; *ptr & 0x80; ptr++, shift += 7)
+      val |= quint32 (*ptr & 0x7f) << shift;
+   val |= quint32 (*ptr++) << shift;
+   return ptr;
+   }
+
+
+/** decode a list of postings, appending (doc, pagenum) pairs to a vector
+
+   \param ptr      start of postings
+   \param count    number of postings
+   \param out      vector to add to */
+
+static void decode_postings (const uchar *ptr, int count, QVector<quint32> &out)
+   {
+   quint32 doc = 0, val;
+   int i;
+
+   for (i = 0; i < count; i++)
+      {
+      ptr = get_varint (ptr, val);
+      doc += val;
+      ptr = get_varint (ptr, val);
+      out << doc << val;
+      }
+   }
+
+
+//! \returns entry 'i' in a mapped word table
+static const term_entry *term_at (const uchar *table, quint32 i)
+   {
+   return (const term_entry *)(table + sizeof (term_header)) + i;
+   }
+
+
+//! \returns the word for an entry in a mapped word table
+static const char *term_word (const uchar *table, const term_entry *ent)
+   {
+   const term_header *hdr = (const term_header *)table;
+
+   return (const char *)term_at (table, hdr->count) + ent->str_off;
+   }
+
+
+//! compare a word in the word table with one we are looking for
+static int compare_term (const char *str, int len, const QByteArray &word)
+   {
+   int cmp = memcmp (str, word.constData (), qMin (len, word.size ()));
+
+   return cmp ? cmp : len - word.size ();
+   }
+
+
+/** a worker which keeps taking requests from the Textindex until there are
+none left */
+
+class Textindexjob : public QRunnable
+   {
+public:
+   Textindexjob (Textindex *owner) : _owner (owner) {}
+
+   void run (void);
+
+private:
+   Textindex *_owner;
+   };
+
+
+void Textindexjob::run (void)
+   {
+   Textindex::request_info req;
+
+   // indexing is never urgent, so keep out of the way of the GUI
+   QThread::currentThread ()->setPriority (QThread::LowPriority);
+   while (_owner->takeNext (req))
+      _owner->scan (req);
+   }
+
+
+static QHash<QString, Textindex *> indexes;
+
+
+Textindex *Textindex::instance (const QString &root)
+   {
+   QString path = QDir (root).absolutePath ();
+   Textindex *index = indexes.value (path);
+
+   if (!index)
+      {
+      index = new Textindex (path);
+      indexes.insert (path, index);
+      }
+   return index;
+   }
+
+
+void Textindex::saveAll (void)
+   {
+   foreach (Textindex *index, indexes)
+      delete index;
+   indexes.clear ();
+   }
+
+
+Textindex::Textindex (const QString &root)
+   {
+   _root = root + "/";
+   _dir = _root + INDEX_DIR;
+   _gen = 0;
+   _seg.terms = _seg.postings = 0;
+   _seg.table = _seg.data = 0;
+   _seg.count = 0;
+   _delta_count = 0;
+   _working = false;
+   _stop = false;
+
+   // one thread is plenty, since we are mostly waiting for the disc
+   _pool.setMaxThreadCount (1);
+   load ();
+
+   /* if this is a new index, start by indexing the whole repository. If we
+      were stopped part way through, carry on: stacks which are already
+      indexed are skipped */
+   if (!QFile::exists (_dir + SCANNED_FILE))
+      update (root, true);
+   }
+
+
+Textindex::~Textindex ()
+   {
+   _mutex.lock ();
+   _queue.clear ();
+   _stop = true;
+   _mutex.unlock ();
+   _pool.waitForDone ();
+   _journal.close ();
+   unmapSegment (_seg);
+   }
+
+
+QString Textindex::indexFile (const char *name, int gen) const
+   {
+   return _dir + QString ("%1.%2").arg (name).arg (gen);
+   }
+
+
+void Textindex::load (void)
+   {
+   QFile file (_dir + "docs");
+   QString header;
+   quint32 gen, count, i;
+   doc_info doc;
+
+   if (file.open (QIODevice::ReadOnly))
+      {
+      QDataStream stream (&file);
+
+      stream.setVersion (QDataStream::Qt_5_0);
+      stream >> header >> gen >> count;
+      if (header == INDEX_HEADER && mapSegment (_seg, gen))
+         {
+         _gen = gen;
+         _docs.reserve (count);
+         for (i = 0; i < count && stream.status () == QDataStream::Ok; i++)
+            {
+            stream >> doc.path >> doc.size >> doc.mtime >> doc.live;
+            if (doc.live)
+               {
+               _docid.insert (doc.path, _docs.size ());
+               _dirdocs.insert (doc_dir (doc.path), doc.path);
+               }
+            _docs << doc;
+            }
+         }
+      if (stream.status () != QDataStream::Ok || _docs.size () != int (count))
+         {
+         // start again rather than give wrong results
+         qDebug () << "Textindex: cannot read" << file.fileName ();
+         unmapSegment (_seg);
+         _docs.clear ();
+         _docid.clear ();
+         _dirdocs.clear ();
+         _gen = 0;
+         QFile::remove (_dir + SCANNED_FILE);
+         }
+      }
+   replayJournal ();
+   }
+
+
+bool Textindex::mapSegment (segment_info &seg, int gen)
+   {
+   const term_header *hdr;
+
+   seg.terms = new QFile (indexFile ("terms", gen));
+   seg.postings = new QFile (indexFile ("postings", gen));
+   if (seg.terms->open (QIODevice::ReadOnly)
+       && seg.postings->open (QIODevice::ReadOnly)
+       && seg.terms->size () >= qint64 (sizeof (term_header)))
+      {
+      seg.table = seg.terms->map (0, seg.terms->size ());
+      hdr = (const term_header *)seg.table;
+      if (seg.table && !memcmp (hdr->magic, TERM_MAGIC, sizeof (TERM_MAGIC))
+          && seg.terms->size () >= qint64 (sizeof (term_header)
+                  + hdr->count * sizeof (term_entry)))
+         {
+         seg.count = hdr->count;
+
+         // an empty file cannot be mapped, but then there are no postings
+         seg.data = seg.postings->size ()
+               ? seg.postings->map (0, seg.postings->size ()) : 0;
+         if (seg.data || !seg.postings->size ())
+            return true;
+         }
+      }
+   unmapSegment (seg);
+   return false;
+   }
+
+
+void Textindex::unmapSegment (segment_info &seg)
+   {
+   // closing the files also removes the mappings
+   delete seg.terms;
+   delete seg.postings;
+   seg.terms = seg.postings = 0;
+   seg.table = seg.data = 0;
+   seg.count = 0;
+   }
+
+
+void Textindex::replayJournal (void)
+   {
+   QList<page_words> pages;
+   page_words page;
+   QByteArray words;
+   QString path;
+   qint64 size, mtime, good = 0;
+   quint32 count, i;
+   quint8 type;
+
+   _journal.setFileName (indexFile ("journal", _gen));
+   if (_journal.open (QIODevice::ReadOnly))
+      {
+      QDataStream stream (&_journal);
+
+      stream.setVersion (QDataStream::Qt_5_0);
+      while (!stream.atEnd ())
+         {
+         stream >> type >> path;
+         if (type == JOURNAL_add)
+            {
+            stream >> size >> mtime >> count;
+            pages.clear ();
+            for (i = 0; i < count && stream.status () == QDataStream::Ok; i++)
+               {
+               stream >> page.pagenum >> words;
+
+               // a page with no words must not give us an empty word
+               page.words.clear ();
+               foreach (const QByteArray &word, words.split (' '))
+                  if (!word.isEmpty ())
+                     page.words << word;
+               pages << page;
+               }
+            }
+         if (stream.status () != QDataStream::Ok
+             || (type != JOURNAL_add && type != JOURNAL_remove))
+            break;
+         if (type == JOURNAL_add)
+            addDoc (path, size, mtime, pages, false);
+         else
+            killDoc (path, false);
+         good = _journal.pos ();
+         }
+      _journal.close ();
+      }
+
+   /* drop anything after the last complete record, which we might have been
+      writing when we crashed, so that new records can be read back */
+   if (_journal.exists () && _journal.size () != good)
+      _journal.resize (good);
+   QDir ().mkpath (_dir);
+   if (!_journal.open (QIODevice::WriteOnly | QIODevice::Append))
+      qDebug () << "Textindex: cannot write" << _journal.fileName ();
+   }
+
+
+void Textindex::addDoc (const QString &path, qint64 size, qint64 mtime,
+      const QList<page_words> &pages, bool journal)
+   {
+   doc_info doc;
+   int id;
+
+   killDoc (path, false);
+   id = _docs.size ();
+   doc.path = path;
+   doc.size = size;
+   doc.mtime = mtime;
+   doc.live = true;
+   _docs << doc;
+   _docid.insert (path, id);
+   _dirdocs.insert (doc_dir (path), path);
+   foreach (const page_words &page, pages)
+      foreach (const QByteArray &word, page.words)
+         {
+         _delta [word] << id << page.pagenum;
+         _delta_count++;
+         }
+
+   if (journal)
+      {
+      QDataStream stream (&_journal);
+
+      stream.setVersion (QDataStream::Qt_5_0);
+      stream << quint8 (JOURNAL_add) << path << size << mtime
+             << quint32 (pages.size ());
+      foreach (const page_words &page, pages)
+         {
+         QByteArray words;
+
+         foreach (const QByteArray &word, page.words)
+            {
+            if (!words.isEmpty ())
+               words += ' ';
+            words += word;
+            }
+         stream << qint32 (page.pagenum) << words;
+         }
+      _journal.flush ();
+      }
+   }
+
+
+void Textindex::killDoc (const QString &path, bool journal)
+   {
+   int id = _docid.value (path, -1);
+
+   if (id == -1)
+      return;
+   _docid.remove (path);
+   _dirdocs.remove (doc_dir (path), path);
+   _docs [id].live = false;
+   _docs [id].path.clear ();
+   if (journal)
+      {
+      QDataStream stream (&_journal);
+
+      stream.setVersion (QDataStream::Qt_5_0);
+      stream << quint8 (JOURNAL_remove) << path;
+      _journal.flush ();
+      }
+   }
+
+
+QList<QByteArray> Textindex::splitWords (const QString &text)
+   {
+   QList<QByteArray> words;
+   QSet<QByteArray> seen;
+   QString lower = text.toLower ();
+   QByteArray word;
+   int i, start;
+
+   for (i = 0; i < lower.size (); )
+      {
+      while (i < lower.size () && !lower [i].isLetterOrNumber ())
+         i++;
+      for (start = i; i < lower.size () && lower [i].isLetterOrNumber (); )
+         i++;
+      if (i - start >= WORD_MIN && i - start <= WORD_MAX)
+         {
+         word = lower.mid (start, i - start).toUtf8 ();
+         if (!seen.contains (word))
+            {
+            seen.insert (word);
+            words << word;
+            }
+         }
+      }
+   return words;
+   }
+
+
+QMap<QString, QList<int> > Textindex::find (const QString &str)
+   {
+   QList<QByteArray> words = splitWords (str);
+   QMap<QString, QList<int> > result;
+   QSet<quint64> hits, found;
+   int i, doc;
+
+   if (words.isEmpty ())
+      return result;
+
+   QMutexLocker locker (&_mutex);
+   for (i = 0; i < words.size (); i++)
+      {
+      found.clear ();
+      lookup (words [i], i == words.size () - 1
+            && words [i].size () >= PREFIX_MIN, found);
+      if (!i)
+         hits = found;
+      else
+         hits.intersect (found);
+      if (hits.isEmpty ())
+         return result;
+      }
+
+   // stacks which have been reindexed or removed will not be live
+   foreach (quint64 hit, hits)
+      {
+      doc = hit >> PAGE_BITS;
+      if (_docs [doc].live)
+         result [_root + _docs [doc].path] << int (hit
+               & ((1 << PAGE_BITS) - 1));
+      }
+   for (QMap<QString, QList<int> >::iterator it = result.begin ();
+         it != result.end (); it++)
+      std::sort (it->begin (), it->end ());
+   return result;
+   }
+
+
+void Textindex::lookup (const QByteArray &word, bool prefix,
+      QSet<quint64> &found)
+   {
+   QVector<quint32> post;
+   const term_entry *ent;
+   quint32 lo, hi, mid;
+   int i;
+
+   // find the first word in the segment which is not less than 'word'
+   for (lo = 0, hi = _seg.count; lo < hi; )
+      {
+      mid = (lo + hi) / 2;
+      ent = term_at (_seg.table, mid);
+      if (compare_term (term_word (_seg.table, ent), ent->str_len, word) < 0)
+         lo = mid + 1;
+      else
+         hi = mid;
+      }
+   for (; lo < _seg.count; lo++)
+      {
+      ent = term_at (_seg.table, lo);
+      if (prefix ? ent->str_len < uint (word.size ())
+               || memcmp (term_word (_seg.table, ent), word.constData (),
+                     word.size ())
+            : compare_term (term_word (_seg.table, ent), ent->str_len, word))
+         break;
+      decode_postings (_seg.data + ent->post_off, ent->post_count, post);
+      }
+
+   // then the words held in memory
+   foreach (const postings_hash *hash, QList<const postings_hash *> ()
+         << &_merging << &_delta)
+      if (prefix)
+         {
+         for (postings_hash::const_iterator it = hash->begin ();
+               it != hash->end (); it++)
+            if (it.key ().startsWith (word))
+               post += it.value ();
+         }
+      else
+         post += hash->value (word);
+
+   for (i = 0; i < post.size (); i += 2)
+      found.insert (quint64 (post [i]) << PAGE_BITS | post [i + 1]);
+   }
+
+
+void Textindex::update (const QString &dir, bool subdirs)
+   {
+   QMutexLocker locker (&_mutex);
+   request_info req;
+
+   req.dir = QDir (dir).absolutePath () + "/";
+   req.subdirs = subdirs;
+   if (!req.dir.startsWith (_root))
+      return;
+   foreach (const request_info &old, _queue)
+      if (old.dir == req.dir && old.subdirs >= subdirs)
+         return;
+   _queue << req;
+   if (!_working)
+      {
+      _working = true;
+      _pool.start (new Textindexjob (this));
+      }
+   }
+
+
+bool Textindex::takeNext (request_info &req)
+   {
+   QMutexLocker locker (&_mutex);
+
+   if (_queue.isEmpty () || _stop)
+      {
+      _working = false;
+      return false;
+      }
+   req = _queue.takeFirst ();
+   return true;
+   }
+
+
+bool Textindex::scan (const request_info &req)
+   {
+   QDir dir (req.dir);
+   QString reldir = req.dir.mid (_root.size ());
+   QSet<QString> present;
+   QString path;
+   bool changed;
+   int id;
+
+   foreach (const QFileInfo &fi, dir.entryInfoList (QDir::Files))
+      {
+      if (File::typeFromName (fi.fileName ()) == File::Type_other)
+         continue;
+      path = reldir + fi.fileName ();
+      present.insert (path);
+
+      _mutex.lock ();
+      if (_stop)
+         {
+         _mutex.unlock ();
+         return false;
+         }
+      id = _docid.value (path, -1);
+      changed = id == -1 || _docs [id].size != fi.size ()
+            || _docs [id].mtime != fi.lastModified ().toMSecsSinceEpoch ();
+      _mutex.unlock ();
+      if (changed)
+         indexStack (fi, path);
+      }
+
+   // drop any stacks in this directory which have gone
+   _mutex.lock ();
+   foreach (const QString &old, _dirdocs.values (reldir))
+      if (!present.contains (old))
+         killDoc (old, true);
+   _mutex.unlock ();
+
+   if (req.subdirs)
+      foreach (const QString &sub, dir.entryList (QDir::Dirs
+            | QDir::NoDotAndDotDot))
+         {
+         request_info subreq;
+
+         subreq.dir = req.dir + sub + "/";
+         subreq.subdirs = true;
+         if (!scan (subreq))
+            return false;
+         }
+
+   // note when the whole repository has been done, so we don't do it again
+   if (req.subdirs && req.dir == _root)
+      {
+      QFile file (_dir + SCANNED_FILE);
+
+      if (!file.open (QIODevice::WriteOnly))
+         qDebug () << "Textindex: cannot write" << file.fileName ();
+      }
+   return true;
+   }
+
+
+void Textindex::indexStack (const QFileInfo &fi, const QString &path)
+   {
+   QList<page_words> pages;
+   page_words page;
+   QString base, ext, text;
+   File::e_type type = File::typeFromName (fi.fileName ());
+   bool merge_now;
+   File *f;
+   int i, first = 0, last;
+
+   /* each page of a JPEG stack is a separate file, so it has only one page.
+      The pages before it are just placeholders */
+   if (type == File::Type_jpeg
+       && !File::decodePageNumber (fi.fileName (), base, first, ext))
+      first = 0;
+
+   // use our own File object, as with Thumbnailer
+   f = File::createFile (fi.path () + "/", fi.fileName (), 0, type);
+   if (!f->load ())
+      {
+      last = type == File::Type_jpeg ? qMin (first + 1, f->pagecount ())
+            : f->pagecount ();
+      for (i = first; i < last; i++)
+         if (!f->getPageText (i, text) && !text.isEmpty ())
+            {
+            page.pagenum = i;
+            page.words = splitWords (text);
+            pages << page;
+            }
+      }
+   delete f;
+
+   _mutex.lock ();
+   addDoc (path, fi.size (), fi.lastModified ().toMSecsSinceEpoch (), pages,
+         true);
+   merge_now = _delta_count >= MERGE_POSTINGS;
+   _mutex.unlock ();
+   if (merge_now)
+      merge ();
+   }
+
+
+void Textindex::merge (void)
+   {
+   QList<QByteArray> keys;
+   QVector<term_entry> table;
+   QVector<doc_info> docs, live;
+   QVector<int> renum;
+   QVector<quint32> post;
+   QByteArray strings, buf, word, journal;
+   segment_info old, seg;
+   term_header hdr;
+   term_entry entry;
+   quint64 post_off = 0;
+   quint32 si = 0, prev;
+   int di = 0, gen, cmp, i, id, dropped;
+   const term_entry *ent = 0;
+   const char *str = 0;
+   bool ok;
+
+   /* take the postings we have so far, and start a new journal for anything
+      indexed while we are busy. Searches still see everything, since they
+      look in _merging as well as _delta */
+   _mutex.lock ();
+   _merging.swap (_delta);
+   _delta_count = 0;
+   old = _seg;
+   gen = _gen + 1;
+   docs = _docs;
+   _journal.close ();
+   _journal.setFileName (indexFile ("journal", gen));
+   _journal.open (QIODevice::WriteOnly | QIODevice::Truncate);
+   _mutex.unlock ();
+
+   /* documents which have gone are dropped from the new generation, so give
+      the live ones new numbers. This keeps their order, so postings stay
+      sorted */
+   renum.resize (docs.size ());
+   for (i = 0; i < docs.size (); i++)
+      if (docs [i].live)
+         {
+         renum [i] = live.size ();
+         live << docs [i];
+         }
+      else
+         renum [i] = -1;
+   dropped = docs.size () - live.size ();
+
+   keys = _merging.keys ();
+   std::sort (keys.begin (), keys.end ());
+
+   QFile pfile (indexFile ("postings", gen));
+   ok = pfile.open (QIODevice::WriteOnly | QIODevice::Truncate);
+
+   // merge the old word table with the new words, both being sorted
+   while (ok && (si < old.count || di < keys.size ()))
+      {
+      if (si < old.count)
+         {
+         ent = term_at (old.table, si);
+         str = term_word (old.table, ent);
+         }
+      if (si == old.count)
+         cmp = 1;
+      else if (di == keys.size ())
+         cmp = -1;
+      else
+         cmp = compare_term (str, ent->str_len, keys [di]);
+
+      /* old documents all have lower numbers than new ones, so the postings
+         stay in order if we put the old ones first */
+      post.clear ();
+      if (cmp <= 0)
+         {
+         word = QByteArray (str, ent->str_len);
+         decode_postings (old.data + ent->post_off, ent->post_count, post);
+         si++;
+         }
+      if (cmp >= 0)
+         {
+         word = keys [di];
+         post += _merging.value (keys [di]);
+         di++;
+         }
+
+      // encode the postings which are still live
+      entry.post_off = post_off;
+      entry.post_count = 0;
+      for (i = 0, prev = 0; i < post.size (); i += 2)
+         if (renum [post [i]] != -1)
+            {
+            id = renum [post [i]];
+            put_varint (buf, id - prev);
+            put_varint (buf, post [i + 1]);
+            prev = id;
+            entry.post_count++;
+            }
+      if (!entry.post_count)
+         continue;
+      post_off += buf.size ();
+      ok = pfile.write (buf) == buf.size ();
+      buf.clear ();
+
+      entry.str_off = strings.size ();
+      entry.str_len = word.size ();
+      strings += word;
+      table << entry;
+      }
+   pfile.close ();
+
+   QFile tfile (indexFile ("terms", gen));
+   memcpy (hdr.magic, TERM_MAGIC, sizeof (TERM_MAGIC));
+   hdr.count = table.size ();
+   hdr.pad = 0;
+   if (ok && tfile.open (QIODevice::WriteOnly | QIODevice::Truncate))
+      {
+      ok = tfile.write ((const char *)&hdr, sizeof (hdr)) == sizeof (hdr)
+         && tfile.write ((const char *)table.constData (),
+                  table.size () * sizeof (term_entry))
+               == qint64 (table.size () * sizeof (term_entry))
+         && tfile.write (strings) == strings.size ();
+      tfile.close ();
+      }
+   else
+      ok = false;
+   ok = ok && mapSegment (seg, gen);
+
+   /* write the document table last, since that is what points to the new
+      generation. Documents changed since we started are in the new journal,
+      so we write the live part of the table as it was when we started */
+   _mutex.lock ();
+   if (ok)
+      {
+      QSaveFile file (_dir + "docs");
+
+      ok = file.open (QIODevice::WriteOnly);
+      if (ok)
+         {
+         QDataStream stream (&file);
+
+         stream.setVersion (QDataStream::Qt_5_0);
+         stream << QString (INDEX_HEADER) << quint32 (gen)
+                << quint32 (live.size ());
+         foreach (const doc_info &doc, live)
+            stream << doc.path << doc.size << doc.mtime << doc.live;
+         ok = file.commit ();
+         }
+      }
+   if (ok)
+      {
+      _seg = seg;
+      _gen = gen;
+      _merging.clear ();
+
+      /* switch to the new numbering. Documents added since we started come
+         after the old ones and are only in _delta, so they just move down.
+         Any old document which has gone since then is in the new journal */
+      for (i = 0; i < docs.size (); i++)
+         if (renum [i] != -1)
+            live [renum [i]] = _docs [i];
+      _docs = live + _docs.mid (docs.size ());
+      _docid.clear ();
+      for (i = 0; i < _docs.size (); i++)
+         if (_docs [i].live)
+            _docid.insert (_docs [i].path, i);
+      if (dropped)
+         for (postings_hash::iterator it = _delta.begin ();
+               it != _delta.end (); it++)
+            for (i = 0; i < it->size (); i += 2)
+               (*it) [i] -= dropped;
+      unmapSegment (old);
+      QFile::remove (indexFile ("terms", gen - 1));
+      QFile::remove (indexFile ("postings", gen - 1));
+      QFile::remove (indexFile ("journal", gen - 1));
+      }
+   else
+      {
+      /* keep using the old segment, putting back what we took out. The new
+         journal may already have records, so move them to the old one */
+      qDebug () << "Textindex: cannot write segment" << gen;
+      unmapSegment (seg);
+      foreach (const QByteArray &key, _delta.keys ())
+         _merging [key] += _delta.value (key);
+      _delta.swap (_merging);
+      _merging.clear ();
+      _delta_count = 0;
+      foreach (const QVector<quint32> &list, _delta)
+         _delta_count += list.size () / 2;
+
+      _journal.close ();
+      if (_journal.open (QIODevice::ReadOnly))
+         journal = _journal.readAll ();
+      _journal.close ();
+      _journal.remove ();
+      _journal.setFileName (indexFile ("journal", _gen));
+      if (_journal.open (QIODevice::WriteOnly | QIODevice::Append))
+         _journal.write (journal);
+      QFile::remove (indexFile ("terms", gen));
+      QFile::remove (indexFile ("postings", gen));
+      }
+   _mutex.unlock ();
+   }
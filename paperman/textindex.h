@@ -0,0 +1,234 @@
+/*
+License: GPL-2
+  An electronic filing cabinet: scan, print, stack, arrange
+ Copyright (C) 2009 Simon Glass, chch-kiwi@users.sourceforge.net
+ .
+ This program is free software; you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation; either version 2 of the License, or
+ (at your option) any later version.
+ .
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+ .
+ You should have received a copy of the GNU General Public License
+ along with this program; if not, write to the Free Software
+ Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301 USA
+
+X-Comment: On Debian GNU/Linux systems, the complete text of the GNU General
+ Public License can be found in the /usr/share/common-licenses/GPL file.
+*/
+/*
+   Project:    Maxview
+   File:       textindex.h
+
+   This file implements a full-text index of the page text in a repository,
+   so that the filter box can find stacks by their contents.
+
+   The index lives in the .maxview-index directory at the root of the
+   repository. It is an inverted index: for each word it holds the list of
+   pages (document and page number) containing that word. Most of it is in
+   a segment made up of two files: a sorted table of words, and the postings
+   for each word. These are mapped into memory, so a lookup is a binary
+   search followed by decoding a few postings.
+
+   Stacks indexed since the segment was written are held in memory, and
+   recorded in a journal so that they survive a restart. When there are
+   enough of these, a new segment is written in the background, merging the
+   old segment with the new stacks. A document table records each stack's
+   path, size and modification time. A stack which changes is simply indexed
+   again under a new document number, and the old one is marked as dead.
+
+   Indexing is done on a background thread. Each time a directory is
+   opened its stacks are checked, and any which are new or have changed are
+   read using our own File objects, as with Thumbnailer.
+*/
+
+#ifndef __textindex_h
+#define __textindex_h
+
+
+#include <QByteArray>
+#include <QFile>
+#include <QHash>
+#include <QList>
+#include <QMap>
+#include <QMutex>
+#include <QSet>
+#include <QString>
+#include <QThreadPool>
+#include <QVector>
+
+
+class QFileInfo;
+
+
+class Textindex
+   {
+   friend class Textindexjob;
+
+public:
+   /** get the index for a repository, reading it from disc if needed
+
+      \param root      root directory of the repository
+      \returns the index */
+   static Textindex *instance (const QString &root);
+
+   //! stop all background work and write out any changes
+   static void saveAll (void);
+
+   /** ask for the stacks in a directory to be indexed in the background.
+       Only stacks which are new or have changed since they were last
+       indexed are read. Stacks which have gone are dropped from the index
+
+      \param dir       directory to index (full path)
+      \param subdirs   true to include all subdirectories */
+   void update (const QString &dir, bool subdirs = false);
+
+   /** find the pages which contain all the words in a string. The last word
+       is taken as a prefix if it is at least 3 characters long, since the
+       user may still be typing it
+
+      \param str       words to search for
+      \returns list of page numbers for each matching stack (full path) */
+   QMap<QString, QList<int> > find (const QString &str);
+
+   /** split some text into the words we index. These are lower case, made
+       of letters and digits, and between 2 and 32 characters long
+
+      \param text      text to split
+      \returns list of unique words, in the order they first appear */
+   static QList<QByteArray> splitWords (const QString &text);
+
+private:
+   //! information about a document (i.e. a stack) in the index
+   struct doc_info
+      {
+      QString path;     //!< path relative to the root, empty if dead
+      qint64 size;      //!< file size when indexed
+      qint64 mtime;     //!< modification time when indexed (ms since epoch)
+      bool live;        //!< false if the stack has gone or been reindexed
+      };
+
+   //! the words on one page
+   struct page_words
+      {
+      int pagenum;               //!< page number
+      QList<QByteArray> words;   //!< words on the page
+      };
+
+   //! a segment on disc (see the top of this file)
+   struct segment_info
+      {
+      QFile *terms;     //!< word table file
+      QFile *postings;  //!< postings file
+      const uchar *table;   //!< mapped word table, or 0 if none
+      const uchar *data;    //!< mapped postings
+      quint32 count;    //!< number of words
+      };
+
+   //! a request for indexing
+   struct request_info
+      {
+      QString dir;      //!< directory to index (with trailing /)
+      bool subdirs;     //!< true to include subdirectories
+      };
+
+   typedef QHash<QByteArray, QVector<quint32> > postings_hash;
+
+   Textindex (const QString &root);
+   ~Textindex ();
+
+   //! \returns the full path of an index file for a given generation
+   QString indexFile (const char *name, int gen) const;
+
+   //! read the document table, segment and journal from disc
+   void load (void);
+
+   /** map a segment's files into memory
+
+      \param seg    segment to set up
+      \param gen    generation to map
+      \returns true if ok */
+   bool mapSegment (segment_info &seg, int gen);
+
+   //! unmap a segment and close its files
+   void unmapSegment (segment_info &seg);
+
+   //! replay the journal into memory, dropping any partial record at the end
+   void replayJournal (void);
+
+   /** add a document to the index, replacing any old one with the same
+       path. Must be called with _mutex held
+
+      \param path      path relative to the root
+      \param size      file size
+      \param mtime     modification time
+      \param pages     words on each page
+      \param journal   true to record it in the journal */
+   void addDoc (const QString &path, qint64 size, qint64 mtime,
+         const QList<page_words> &pages, bool journal);
+
+   /** mark a document as dead. Must be called with _mutex held
+
+      \param path      path relative to the root
+      \param journal   true to record it in the journal */
+   void killDoc (const QString &path, bool journal);
+
+   /** find all the pages containing a word. Must be called with _mutex held
+
+      \param word      word to find
+      \param prefix    true to find all words starting with 'word'
+      \param found     returns the pages, each as (doc << 20 | pagenum) */
+   void lookup (const QByteArray &word, bool prefix, QSet<quint64> &found);
+
+   /** index the stacks in a directory. This runs on the worker thread.
+       Once the whole repository has been done, this is recorded so that
+       it is not done again
+
+      \param req       directory to index
+      \returns false if we were asked to stop part way through */
+   bool scan (const request_info &req);
+
+   /** read the text of a stack and add it to the index. This runs on the
+       worker thread
+
+      \param fi        file to index
+      \param path      path relative to the root */
+   void indexStack (const QFileInfo &fi, const QString &path);
+
+   /** write a new segment holding everything in the old one and in
+       _merging. Documents which have gone are dropped and the rest are
+       renumbered, so the document table does not keep growing. This runs
+       on the worker thread */
+   void merge (void);
+
+   /** called by the worker to get the next request
+
+      \param req   returns the request
+      \returns true if there was one, false if the worker should exit */
+   bool takeNext (request_info &req);
+
+private:
+   QString _root;       //!< repository root (with trailing /)
+   QString _dir;        //!< our directory within the root (with trailing /)
+   QMutex _mutex;       //!< protects everything below
+   int _gen;            //!< generation of the current segment and journal
+   QVector<doc_info> _docs;     //!< all documents, by number
+   QHash<QString, int> _docid;  //!< number of each live document, by path
+   QMultiHash<QString, QString> _dirdocs;  //!< path of each live document, by directory
+   segment_info _seg;   //!< current segment
+   postings_hash _delta;      //!< postings not in any segment
+   postings_hash _merging;    //!< postings being merged into a new segment
+   int _delta_count;    //!< number of postings in _delta
+   QFile _journal;      //!< journal for the current generation
+   QThreadPool _pool;   //!< our worker thread
+   QList<request_info> _queue;   //!< requests not yet started
+   bool _working;       //!< true if the worker is running
+   bool _stop;          //!< true to stop the worker as soon as possible
+   };
+
+
+#endif
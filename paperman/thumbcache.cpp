@@ -0,0 +1,304 @@
+/*
+License: GPL-2
+  An electronic filing cabinet: scan, print, stack, arrange
+ Copyright (C) 2009 Simon Glass, chch-kiwi@users.sourceforge.net
+ .
+ This program is free software; you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation; either version 2 of the License, or
+ (at your option) any later version.
+ .
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+ .
+ You should have received a copy of the GNU General Public License
+ along with this program; if not, write to the Free Software
+ Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301 USA
+
+X-Comment: On Debian GNU/Linux systems, the complete text of the GNU General
+ Public License can be found in the /usr/share/common-licenses/GPL file.
+*/
+
+
+#include <QCryptographicHash>
+#include <QDateTime>
+#include <QDebug>
+#include <QDir>
+#include <QDirIterator>
+#include <QFile>
+#include <QFileInfo>
+#include <QMultiMap>
+#include <QSaveFile>
+#include <QStandardPaths>
+#include <QTextStream>
+
+#include "config.h"
+#include "thumbcache.h"
+
+
+//! first line of the index file, so we can change the format later
+#define INDEX_HEADER "maxview-thumbcache 1"
+
+
+Thumbcache *Thumbcache::instance (void)
+   {
+   static Thumbcache cache;
+
+   return &cache;
+   }
+
+
+Thumbcache::Thumbcache ()
+   {
+   _dir = QStandardPaths::writableLocation (QStandardPaths::CacheLocation)
+         + "/thumbnails/";
+   _loaded = false;
+   _changed = false;
+   _total = 0;
+   _limit = CONFIG_thumbcache_limit;
+   _clock = 0;
+   }
+
+
+Thumbcache::~Thumbcache ()
+   {
+   save ();
+   }
+
+
+QString Thumbcache::makeKey (const QString &path, int pagenum) const
+   {
+   QFileInfo fi (path);
+   QString str;
+
+   if (!fi.exists ())
+      return QString ();
+   str = QString ("%1\n%2\n%3\n%4").arg (fi.absoluteFilePath ())
+         .arg (fi.size ()).arg (fi.lastModified ().toMSecsSinceEpoch ())
+         .arg (pagenum);
+   return QCryptographicHash::hash (str.toUtf8 (),
+         QCryptographicHash::Sha1).toHex ();
+   }
+
+
+QString Thumbcache::entryFilename (const QString &key) const
+   {
+   // spread the entries over subdirectories to keep each one small
+   return _dir + key.left (2) + "/" + key + ".png";
+   }
+
+
+bool Thumbcache::find (const QString &path, int pagenum, QImage &image)
+   {
+   QString key = makeKey (path, pagenum);
+   bool found;
+
+   if (key.isEmpty ())
+      return false;
+
+   _mutex.lock ();
+   loadIndex ();
+   found = _entries.contains (key);
+   if (found)
+      {
+      _entries [key].used = ++_clock;
+      _changed = true;
+      }
+   _mutex.unlock ();
+
+   if (!found)
+      return false;
+   if (image.load (entryFilename (key), "PNG"))
+      return true;
+
+   // the entry has been deleted or damaged, so forget about it
+   _mutex.lock ();
+   removeEntry (key);
+   _mutex.unlock ();
+   return false;
+   }
+
+
+void Thumbcache::insert (const QString &path, int pagenum, const QImage &image)
+   {
+   QString key = makeKey (path, pagenum);
+   QString fname, fpath = QFileInfo (path).absoluteFilePath ();
+   entry_info entry;
+
+   if (key.isEmpty () || image.isNull ())
+      return;
+
+   // write the image first, so that no one can find a partial entry
+   fname = entryFilename (key);
+   QDir ().mkpath (QFileInfo (fname).path ());
+   QSaveFile file (fname);
+   if (!file.open (QIODevice::WriteOnly) || !image.save (&file, "PNG")
+       || !file.commit ())
+      return;
+   entry.path = fpath;
+   entry.pagenum = pagenum;
+   entry.bytes = QFileInfo (fname).size ();
+
+   _mutex.lock ();
+   loadIndex ();
+
+   // drop any entries for older versions of this page
+   foreach (const QString &old, _bypath.values (fpath))
+      if (old != key && _entries.value (old).pagenum == pagenum)
+         removeEntry (old);
+
+   if (_entries.contains (key))
+      _total -= _entries [key].bytes;
+   else
+      _bypath.insert (fpath, key);
+   entry.used = ++_clock;
+   _entries.insert (key, entry);
+   _total += entry.bytes;
+   _changed = true;
+   trim ();
+   _mutex.unlock ();
+   }
+
+
+void Thumbcache::remove (const QString &path)
+   {
+   QString fpath = QFileInfo (path).absoluteFilePath ();
+
+   _mutex.lock ();
+   loadIndex ();
+   foreach (const QString &key, _bypath.values (fpath))
+      removeEntry (key);
+   _mutex.unlock ();
+   }
+
+
+void Thumbcache::setLimit (qint64 limit)
+   {
+   _mutex.lock ();
+   _limit = limit;
+   if (_loaded)
+      trim ();
+   _mutex.unlock ();
+   }
+
+
+void Thumbcache::loadIndex (void)
+   {
+   QFile file (_dir + "index");
+   QString key, line;
+   entry_info entry;
+
+   if (_loaded)
+      return;
+   _loaded = true;
+
+   if (file.open (QIODevice::ReadOnly | QIODevice::Text))
+      {
+      QTextStream stream (&file);
+
+      // paths may hold any characters, so don't depend on the locale
+      stream.setCodec ("UTF-8");
+      if (stream.readLine () == INDEX_HEADER)
+         while (!stream.atEnd ())
+            {
+            // key, bytes, used, pagenum, path (which may contain tabs)
+            line = stream.readLine ();
+            key = line.section ('\t', 0, 0);
+            entry.bytes = line.section ('\t', 1, 1).toLongLong ();
+            entry.used = line.section ('\t', 2, 2).toULongLong ();
+            entry.pagenum = line.section ('\t', 3, 3).toInt ();
+            entry.path = line.section ('\t', 4);
+            if (key.isEmpty () || _entries.contains (key))
+               continue;
+            _entries.insert (key, entry);
+            _bypath.insert (entry.path, key);
+            _total += entry.bytes;
+            _clock = qMax (_clock, entry.used);
+            }
+      }
+   else
+      {
+      /* no index, so pick up whatever is on disc. We don't know which file
+         these came from, but since the key includes the modification time
+         they can't go stale, and will eventually be dropped as unused */
+      QDirIterator it (_dir, QStringList () << "*.png", QDir::Files,
+            QDirIterator::Subdirectories);
+
+      while (it.hasNext ())
+         {
+         it.next ();
+         entry.pagenum = -1;
+         entry.bytes = it.fileInfo ().size ();
+         entry.used = 0;
+         _entries.insert (it.fileInfo ().completeBaseName (), entry);
+         _total += entry.bytes;
+         }
+      _changed = !_entries.isEmpty ();
+      }
+   trim ();
+   }
+
+
+void Thumbcache::removeEntry (const QString &key)
+   {
+   QHash<QString, entry_info>::iterator it = _entries.find (key);
+
+   if (it == _entries.end ())
+      return;
+   _total -= it->bytes;
+   _bypath.remove (it->path, key);
+   _entries.erase (it);
+   QFile::remove (entryFilename (key));
+   _changed = true;
+   }
+
+
+void Thumbcache::trim (void)
+   {
+   QMultiMap<quint64, QString> order;
+   QMultiMap<quint64, QString>::iterator it;
+
+   if (_total <= _limit)
+      return;
+
+   // sort by last use
+   foreach (const QString &key, _entries.keys ())
+      order.insert (_entries [key].used, key);
+
+   // go a little under the limit, so that we don't do this on every insert
+   for (it = order.begin (); it != order.end () && _total > _limit / 10 * 9; it++)
+      removeEntry (it.value ());
+   }
+
+
+void Thumbcache::save (void)
+   {
+   QHash<QString, entry_info>::const_iterator it;
+
+   _mutex.lock ();
+   if (_changed)
+      {
+      QDir ().mkpath (_dir);
+      QSaveFile file (_dir + "index");
+
+      if (file.open (QIODevice::WriteOnly | QIODevice::Text))
+         {
+         QTextStream stream (&file);
+
+         // loadIndex() reads UTF-8
+         stream.setCodec ("UTF-8");
+         stream << INDEX_HEADER << "\n";
+         for (it = _entries.constBegin (); it != _entries.constEnd (); it++)
+            stream << it.key () << '\t' << it->bytes << '\t' << it->used
+                   << '\t' << it->pagenum << '\t' << it->path << "\n";
+         stream.flush ();
+         if (file.commit ())
+            _changed = false;
+         else
+            qDebug () << "Thumbcache: cannot write index" << file.errorString ();
+         }
+      }
+   _mutex.unlock ();
+   }
@@ -0,0 +1,136 @@
+/*
+License: GPL-2
+  An electronic filing cabinet: scan, print, stack, arrange
+ Copyright (C) 2009 Simon Glass, chch-kiwi@users.sourceforge.net
+ .
+ This program is free software; you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation; either version 2 of the License, or
+ (at your option) any later version.
+ .
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+ .
+ You should have received a copy of the GNU General Public License
+ along with this program; if not, write to the Free Software
+ Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301 USA
+
+X-Comment: On Debian GNU/Linux systems, the complete text of the GNU General
+ Public License can be found in the /usr/share/common-licenses/GPL file.
+*/
+/*
+   Project:    Maxview
+   File:       thumbcache.h
+
+   This file implements a persistent per-user cache of page preview images.
+
+   Each preview is stored as a PNG file in the user's cache directory. The
+   key is made from the pathname, size and modification time of the file
+   holding the page, together with the page number, so a file which changes
+   on disc simply stops matching its old entries.
+
+   An index records the size of each entry and when it was last used. Once
+   the cache exceeds its size limit, the least recently used entries are
+   removed.
+*/
+
+#ifndef __thumbcache_h
+#define __thumbcache_h
+
+
+#include <QHash>
+#include <QImage>
+#include <QMultiHash>
+#include <QMutex>
+#include <QString>
+
+
+class Thumbcache
+   {
+public:
+   //! \returns the cache (there is only one)
+   static Thumbcache *instance (void);
+
+   /** look up a preview image in the cache. This is thread-safe
+
+      \param path      full path of the file holding the page
+      \param pagenum   page number
+      \param image     returns the image, if found
+      \returns true if found, false if not */
+   bool find (const QString &path, int pagenum, QImage &image);
+
+   /** add a preview image to the cache, replacing any older entries for this
+       page. This is thread-safe
+
+      \param path      full path of the file holding the page
+      \param pagenum   page number
+      \param image     image to store */
+   void insert (const QString &path, int pagenum, const QImage &image);
+
+   /** remove all entries for a file. This is needed when a file is changed
+       by us, since its modification time might not change enough for us to
+       notice
+
+      \param path      full path of the file */
+   void remove (const QString &path);
+
+   /** set the maximum size of the cache
+
+      \param limit     maximum size in bytes */
+   void setLimit (qint64 limit);
+
+   //! write the index back to disc, if it has changed
+   void save (void);
+
+private:
+   //! an entry in the cache
+   struct entry_info
+      {
+      QString path;     //!< path of the file the page came from
+      int pagenum;      //!< page number
+      qint64 bytes;     //!< size of the entry on disc
+      quint64 used;     //!< value of _clock when last used
+      };
+
+   Thumbcache ();
+   ~Thumbcache ();
+
+   /** work out the key for a page. This includes the file's size and
+       modification time
+
+      \param path      full path of the file holding the page
+      \param pagenum   page number
+      \returns key, or empty string if the file does not exist */
+   QString makeKey (const QString &path, int pagenum) const;
+
+   //! \returns the filename used to hold a given entry
+   QString entryFilename (const QString &key) const;
+
+   /** read the index from disc. If there isn't one, we rebuild it from the
+       files in the cache directory. Must be called with _mutex held */
+   void loadIndex (void);
+
+   /** remove an entry from the index and from disc. Must be called with
+       _mutex held */
+   void removeEntry (const QString &key);
+
+   /** remove least recently used entries until we are within our limit.
+       Must be called with _mutex held */
+   void trim (void);
+
+private:
+   QMutex _mutex;       //!< protects everything below
+   QString _dir;        //!< cache directory (with trailing /)
+   bool _loaded;        //!< true if the index has been read
+   bool _changed;       //!< true if the index needs saving
+   QHash<QString, entry_info> _entries;   //!< all entries, by key
+   QMultiHash<QString, QString> _bypath;  //!< keys for each file path
+   qint64 _total;       //!< total bytes used by entries
+   qint64 _limit;       //!< maximum number of bytes to use
+   quint64 _clock;      //!< incremented on each use, for LRU
+   };
+
+
+#endif
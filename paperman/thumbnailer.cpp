@@ -0,0 +1,283 @@
+/*
+License: GPL-2
+  An electronic filing cabinet: scan, print, stack, arrange
+ Copyright (C) 2009 Simon Glass, chch-kiwi@users.sourceforge.net
+ .
+ This program is free software; you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation; either version 2 of the License, or
+ (at your option) any later version.
+ .
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+ .
+ You should have received a copy of the GNU General Public License
+ along with this program; if not, write to the Free Software
+ Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301 USA
+
+X-Comment: On Debian GNU/Linux systems, the complete text of the GNU General
+ Public License can be found in the /usr/share/common-licenses/GPL file.
+*/
+
+
+#include <QCoreApplication>
+#include <QDebug>
+#include <QFileInfo>
+#include <QMutexLocker>
+#include <QRunnable>
+#include <QThread>
+#include <QTimer>
+
+#include "file.h"
+#include "thumbcache.h"
+#include "thumbnailer.h"
+
+
+//! time to wait for more previews to arrive before telling the model, in ms
+#define FLUSH_DELAY 50
+
+
+/** a worker which keeps taking requests from the Thumbnailer until there are
+none left */
+
+class Thumbnailjob : public QRunnable
+   {
+public:
+   Thumbnailjob (Thumbnailer *owner) : _owner (owner) {}
+
+   void run (void);
+
+private:
+   Thumbnailer *_owner;
+   };
+
+
+void Thumbnailjob::run (void)
+   {
+   Thumbnailer::request_info req;
+   Thumbcache *cache = Thumbcache::instance ();
+   QString path;
+
+   while (_owner->takeNext (req))
+      {
+      Thumbnailer::result_info res;
+      err_info *err = NULL;
+      File *f, *pf;
+
+      res.key = req.key;
+      res.pagenum = req.pagenum;
+      res.file = 0;
+      res.cached = false;
+
+      /* if we have seen this page before, there is nothing to decode, and
+         no need to open the stack at all. The model loads it when it needs
+         to know about its pages */
+      path = req.dir + req.fname;
+      if (req.type != File::Type_other
+          && cache->find (path, req.pagenum, res.image))
+         {
+         res.cached = true;
+         res.failed = false;
+         _owner->finished (res);
+         continue;
+         }
+
+      /* use our own File object so that we don't need to worry about what
+         the GUI thread is doing with the real one. Once loaded, it is handed
+         to the model, which takes over its state. File::createFile()
+         complains about unknown types itself, which we must not do here */
+      switch (req.type)
+         {
+         case File::Type_max :
+         case File::Type_pdf :
+         case File::Type_jpeg :
+            f = File::createFile (req.dir, req.leaf, 0, req.type);
+            err = f->load ();
+            break;
+
+         case File::Type_other :
+            f = 0;   // nothing to preview
+            break;
+
+         default :
+            f = 0;
+            err = err_make (ERRFN, ERR_file_type_unsupported1,
+                            qPrintable (File::typeName (req.type)));
+            break;
+         }
+
+      if (f && !err)
+         {
+         /* a jpeg stack has a file for each page, which can be opened on
+            its own */
+         pf = req.fname == req.leaf ? f
+               : File::createFile (req.dir, req.fname, 0, req.type);
+         if (pf != f)
+            err = pf->load ();
+         if (!err)
+            err = pf->getPreviewImage (req.pagenum, res.image, false);
+         if (!err)
+            cache->insert (path, req.pagenum, res.image);
+         if (pf != f)
+            delete pf;
+         }
+
+      // errors are reported by the model, on the GUI thread
+      res.failed = err != NULL;
+      if (err)
+         res.err = *err;
+
+      if (f)
+         {
+         f->moveToThread (QCoreApplication::instance ()->thread ());
+         res.file = f;
+         }
+      _owner->finished (res);
+      }
+   }
+
+
+Thumbnailer::Thumbnailer (QObject *parent)
+      : QObject (parent)
+   {
+   _workers = 0;
+
+   // leave a core for the GUI thread
+   _pool.setMaxThreadCount (qMax (1, QThread::idealThreadCount () - 1));
+
+   _flushTimer = new QTimer (this);
+   _flushTimer->setSingleShot (true);
+   connect (_flushTimer, SIGNAL (timeout ()), this, SLOT (flush ()));
+   }
+
+
+Thumbnailer::~Thumbnailer ()
+   {
+   cancelQueued ();
+   _pool.waitForDone ();
+   foreach (const result_info &res, _results)
+      delete res.file;
+   }
+
+
+void Thumbnailer::request (File *f, bool urgent)
+   {
+   QMutexLocker locker (&_mutex);
+   request_info req;
+   int i;
+
+   req.key = f->pathname ();
+   if (_pending.contains (req.key))
+      {
+      // move it to the front if it hasn't started yet
+      if (urgent)
+         for (i = 0; i < _queue.size (); i++)
+            if (_queue [i].key == req.key)
+               {
+               _queue.move (i, 0);
+               break;
+               }
+      return;
+      }
+
+   req.dir = QFileInfo (req.key).path () + "/";
+   req.leaf = f->filename ();
+   req.pagenum = f->pagenum ();
+   req.fname = f->pageFilename (req.pagenum);
+   req.type = f->type ();
+   if (urgent)
+      _queue.prepend (req);
+   else
+      _queue.append (req);
+   _pending.insert (req.key, true);
+
+   if (_workers < _pool.maxThreadCount ())
+      {
+      _workers++;
+      _pool.start (new Thumbnailjob (this));
+      }
+   }
+
+
+QStringList Thumbnailer::cancelQueued (void)
+   {
+   QMutexLocker locker (&_mutex);
+   QStringList keys;
+
+   foreach (const request_info &req, _queue)
+      {
+      keys << req.key;
+      _pending.remove (req.key);
+      }
+   _queue.clear ();
+   return keys;
+   }
+
+
+bool Thumbnailer::isPending (const QString &key) const
+   {
+   QMutexLocker locker (&_mutex);
+
+   return _pending.contains (key);
+   }
+
+
+bool Thumbnailer::takeNext (request_info &req)
+   {
+   QMutexLocker locker (&_mutex);
+
+   if (_queue.isEmpty ())
+      {
+      _workers--;
+      return false;
+      }
+   req = _queue.takeFirst ();
+   return true;
+   }
+
+
+void Thumbnailer::finished (const result_info &res)
+   {
+   bool first;
+
+   _mutex.lock ();
+   _pending.remove (res.key);
+   first = _results.isEmpty ();
+   _results << res;
+   _mutex.unlock ();
+
+   // we are on a worker thread, so get the GUI thread to start the timer
+   if (first)
+      QMetaObject::invokeMethod (this, "scheduleFlush", Qt::QueuedConnection);
+   }
+
+
+void Thumbnailer::scheduleFlush (void)
+   {
+   if (!_flushTimer->isActive ())
+      _flushTimer->start (FLUSH_DELAY);
+   }
+
+
+void Thumbnailer::flush (void)
+   {
+   QList<result_info> results;
+   bool done;
+
+   _mutex.lock ();
+   results = _results;
+   _results.clear ();
+   done = _pending.isEmpty ();
+   _mutex.unlock ();
+
+   if (!results.isEmpty ())
+      emit ready (results);
+   if (done)
+      {
+      // a good time to record what is in the cache
+      Thumbcache::instance ()->save ();
+      emit idle ();
+      }
+   }
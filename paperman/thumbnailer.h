@@ -0,0 +1,143 @@
+/*
+License: GPL-2
+  An electronic filing cabinet: scan, print, stack, arrange
+ Copyright (C) 2009 Simon Glass, chch-kiwi@users.sourceforge.net
+ .
+ This program is free software; you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation; either version 2 of the License, or
+ (at your option) any later version.
+ .
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+ .
+ You should have received a copy of the GNU General Public License
+ along with this program; if not, write to the Free Software
+ Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301 USA
+
+X-Comment: On Debian GNU/Linux systems, the complete text of the GNU General
+ Public License can be found in the /usr/share/common-licenses/GPL file.
+*/
+/*
+   Project:    Maxview
+   File:       thumbnailer.h
+
+   This file implements a service which generates stack previews on a pool
+   of worker threads, so that opening a large directory does not hold up
+   the GUI.
+
+   Requests are queued with the most recently requested (i.e. visible)
+   stacks first. Each worker opens its own File object for the stack, so
+   nothing is shared with the GUI thread. Finished images are collected
+   and handed back to the GUI thread in batches, along with the loaded File
+   object, whose state the model adopts so that it need not load the stack
+   again, and any error, which the model reports. A preview which is already
+   in the thumbnail cache is handed back without opening the stack at all.
+*/
+
+#ifndef __thumbnailer_h
+#define __thumbnailer_h
+
+
+#include <QHash>
+#include <QImage>
+#include <QList>
+#include <QMutex>
+#include <QObject>
+#include <QThreadPool>
+
+#include "err.h"
+#include "file.h"
+
+
+class QTimer;
+
+
+class Thumbnailer : public QObject
+   {
+   Q_OBJECT
+
+   friend class Thumbnailjob;
+
+public:
+   //! a request for a preview
+   struct request_info
+      {
+      QString key;         //!< key for this request (the stack's pathname)
+      QString dir;         //!< directory containing the file (with trailing /)
+      QString leaf;        //!< filename of the stack
+      QString fname;       //!< filename holding the page
+      File::e_type type;   //!< file type
+      int pagenum;         //!< page number to preview
+      };
+
+   //! a finished preview
+   struct result_info
+      {
+      QString key;         //!< key from the request
+      int pagenum;         //!< page number that was previewed
+      QImage image;        //!< preview image, null if we could not make one
+      File *file;          //!< the stack, loaded, or 0. The receiver owns this
+      bool cached;         //!< true if the image came from the thumbnail cache (file is 0)
+      bool failed;         //!< true if something went wrong
+      err_info err;        //!< the error, if failed
+      };
+
+   Thumbnailer (QObject *parent = 0);
+   ~Thumbnailer ();
+
+   /** request a preview of the current page of a file. Nothing happens if
+       there is already a request for this file
+
+      \param f        file to preview
+      \param urgent   true to put this ahead of other requests (e.g. because
+                      it is visible) */
+   void request (File *f, bool urgent = true);
+
+   /** drop all requests which have not been started yet
+
+      \returns list of keys for the dropped requests */
+   QStringList cancelQueued (void);
+
+   //! \returns true if there is a request outstanding for the given key
+   bool isPending (const QString &key) const;
+
+signals:
+   /** emitted (on the GUI thread) with a batch of finished previews. The
+       receiver must delete each result's file */
+   void ready (const QList<Thumbnailer::result_info> &results);
+
+   /** emitted when all requests have been dealt with */
+   void idle (void);
+
+private slots:
+   //! start the batch timer, if not already running
+   void scheduleFlush (void);
+
+   //! send out all finished previews
+   void flush (void);
+
+private:
+   /** called by a worker to get the next request
+
+      \param req   returns the request
+      \returns true if there was one, false if the worker should exit */
+   bool takeNext (request_info &req);
+
+   //! called by a worker when a request is complete
+   void finished (const result_info &res);
+
+private:
+   QThreadPool _pool;         //!< our worker threads
+   mutable QMutex _mutex;     //!< protects everything below
+   QList<request_info> _queue;   //!< requests not yet started, most urgent first
+   QHash<QString, bool> _pending;   //!< keys queued or being worked on
+   QList<result_info> _results;   //!< finished previews waiting to go out
+   int _workers;              //!< number of workers started
+   QTimer *_flushTimer;       //!< batches up finished previews
+   };
+
+
+#endif
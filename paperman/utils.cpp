@@ -509,6 +509,23 @@ err_info *util_buildZip (QString &zip, const QStringList &fnamelist)
    }
 
 
+err_info *util_replaceFile (const QString &src, const QString &dest)
+   {
+#ifdef Q_OS_WIN
+   // rename() will not replace an existing file on Windows
+   if (!MoveFileExW ((LPCWSTR)QDir::toNativeSeparators (src).utf16 (),
+                     (LPCWSTR)QDir::toNativeSeparators (dest).utf16 (),
+                     MOVEFILE_REPLACE_EXISTING))
+#else
+   if (::rename (QFile::encodeName (src).constData (),
+                 QFile::encodeName (dest).constData ()))
+#endif
+      return err_make (ERRFN, ERR_could_not_rename_file2, qPrintable (src),
+                       qPrintable (dest));
+   return NULL;
+   }
+
+
 QString util_findNextFilename (QString fname, QString dir, QString ext)
    {
    QString orig = fname;
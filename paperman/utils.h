@@ -118,6 +118,13 @@ struct err_info *util_get_tmp (char *tmp);
    \param fnamelist list of filenames to add to the zip (without their path) */
 err_info *util_buildZip (QString &zip, const QStringList &fnamelist);
 
+/** rename a file, replacing any existing file with the new name
+
+   \param src     current pathname
+   \param dest    new pathname
+   \returns error, or NULL if ok */
+err_info *util_replaceFile (const QString &src, const QString &dest);
+
 #define UTIL_PAGE_PREFIX "_p"
 
 /** given a filename, try to make it unique by adding numbers, etc.
@@ -39,6 +39,10 @@
 #include <QFile>
 #include <QDateTime>
 #include <QCoreApplication>
+#include <QRunnable>
+#include <QSemaphore>
+#include <QThread>
+#include <QThreadPool>
 
 // You can remove this #include if you replace the qDebug() statements.
 #include <QtDebug>
@@ -104,6 +108,16 @@
 //! Do not store very small files as the compression headers overhead would be to big
 #define ZIP_COMPRESSION_THRESHOLD 60
 
+//! Files at least twice this size are deflated in blocks of this size on several threads
+#define ZIP_PARALLEL_BLOCK (1024*1024)
+//! Size of the deflate window, which is carried over from one block to the next
+#define ZIP_DICT_SIZE 32768
+
+//! Amount of a file to test-compress when deciding whether to store it
+#define ZIP_PROBE_SIZE (64*1024)
+//! Store files whose sample does not deflate to less than this percentage
+#define ZIP_PROBE_PERCENT 97
+
 //! This macro updates a one-char-only CRC; it's the Info-Zip macro re-adapted
 #define CRC32(c, b) crcTable[((int)c^b) & 0xff] ^ (c >> 8)
 
@@ -289,9 +303,12 @@ Zip::ErrorCode Zip::createArchive(const QString& filename, bool overwrite)
 
 /*!
 	Attempts to create a new Zip archive. If there is another open archive this will be closed.
-	\warning The class takes ownership of the device!
+	The device may be sequential (a pipe or socket, say), in which case each
+	entry's crc and sizes are written after its data instead of being
+	filled in afterwards.
+	\warning The class takes ownership of the device, unless \p takeOwnership is false!
  */
-Zip::ErrorCode Zip::createArchive(QIODevice* device)
+Zip::ErrorCode Zip::createArchive(QIODevice* device, bool takeOwnership)
 {
 	if (device == 0)
 	{
@@ -299,7 +316,7 @@ Zip::ErrorCode Zip::createArchive(QIODevice* device)
 		return Zip::OpenFailed;
 	}
 
-	return d->createArchive(device);
+	return d->createArchive(device, takeOwnership);
 }
 
 /*!
@@ -560,6 +577,8 @@ ZipPrivate::ZipPrivate()
 {
 	headers = 0;
 	device = 0;
+	devOffset = 0;
+	ownsDevice = true;
 
 	// keep an unsigned pointer so we avoid to over bloat the code with casts
 	uBuffer = (unsigned char*) buffer1;
@@ -573,7 +592,7 @@ ZipPrivate::~ZipPrivate()
 }
 
 //! \internal
-Zip::ErrorCode ZipPrivate::createArchive(QIODevice* dev)
+Zip::ErrorCode ZipPrivate::createArchive(QIODevice* dev, bool takeOwnership)
 {
 	Q_ASSERT(dev != 0);
 
@@ -581,17 +600,20 @@ Zip::ErrorCode ZipPrivate::createArchive(QIODevice* dev)
 		closeArchive();
 
 	device = dev;
+	ownsDevice = takeOwnership;
 
 	if (!device->isOpen())
 	{
-		if (!device->open(QIODevice::ReadOnly)) {
-			delete device;
+		if (!device->open(QIODevice::WriteOnly)) {
+			if (ownsDevice)
+				delete device;
 			device = 0;
 			qDebug() << "Unable to open device for writing.";
 			return Zip::OpenFailed;
 		}
 	}
 
+	devOffset = device->isSequential() ? 0 : device->pos();
 	headers = new QMap<QString,ZipEntryP*>;
 	return Zip::Ok;
 }
@@ -623,6 +645,9 @@ Zip::ErrorCode ZipPrivate::createEntry(const QFileInfo& file, const QString& roo
 		if (file.size() < ZIP_COMPRESSION_THRESHOLD)
 			level = Zip::Store;
 		else
+		{
+			bool probe = level == Zip::AutoMIME || level == Zip::AutoFull;
+
 			switch (level)
 			{
 			case Zip::AutoCPU:
@@ -632,11 +657,17 @@ Zip::ErrorCode ZipPrivate::createEntry(const QFileInfo& file, const QString& roo
 				level = detectCompressionByMime(ext);
 				break;
 			case Zip::AutoFull:
-				level = detectCompressionByMime(ext);
+				// level 9 is much slower than 6 for very little gain
+				level = qMin(detectCompressionByMime(ext), Zip::Deflate6);
 				break;
 			default:
 				;
 			}
+
+			// catch compressed data that the extension doesn't tell us about
+			if (probe && level != Zip::Store && !isCompressible(file))
+				level = Zip::Store;
+		}
 	}
 
 	// entryName contains the path as it should be written
@@ -648,6 +679,12 @@ Zip::ErrorCode ZipPrivate::createEntry(const QFileInfo& file, const QString& roo
 
 	h->compMethod = (level == Zip::Store) ? 0 : 0x0008;
 
+	// We can't go back to fill in the crc and sizes on a sequential device,
+	// so they go in a data descriptor after the data instead
+	bool sequential = device->isSequential();
+	if (sequential)
+		h->gpFlag[0] |= 8;
+
 	// Set encryption bit and set the data descriptor bit
 	// so we can use mod time instead of crc for password check
 	bool encrypt = !dirOnly && !password.isEmpty();
@@ -706,7 +743,7 @@ Zip::ErrorCode ZipPrivate::createEntry(const QFileInfo& file, const QString& roo
 	h->szComp = encrypt ? ZIP_LOCAL_ENC_HEADER_SIZE : 0;
 
 	// uncompressed size [22,23,24,25]
-	setULong(h->szUncomp, buffer1, ZIP_LH_OFF_USIZE);
+	setULong(sequential ? 0 : h->szUncomp, buffer1, ZIP_LH_OFF_USIZE);
 
 	// filename length
     QByteArray entryNameBytes = entryName.toLatin1();
@@ -719,17 +756,17 @@ Zip::ErrorCode ZipPrivate::createEntry(const QFileInfo& file, const QString& roo
 	buffer1[ZIP_LH_OFF_XLEN] = buffer1[ZIP_LH_OFF_XLEN + 1] = 0;
 
 	// Store offset to write crc and compressed size
-	h->lhOffset = device->pos();
+	h->lhOffset = devOffset;
 	quint32 crcOffset = h->lhOffset + ZIP_LH_OFF_CRC;
 
-	if (device->write(buffer1, ZIP_LOCAL_HEADER_SIZE) != ZIP_LOCAL_HEADER_SIZE)
+	if (writeData(buffer1, ZIP_LOCAL_HEADER_SIZE) != ZIP_LOCAL_HEADER_SIZE)
 	{
 		delete h;
 		return Zip::WriteFailed;
 	}
 
 	// Write out filename
-	if (device->write(entryNameBytes) != sz)
+	if (writeData(entryNameBytes.constData(), sz) != sz)
 	{
 		delete h;
 		return Zip::WriteFailed;
@@ -775,7 +812,7 @@ Zip::ErrorCode ZipPrivate::createEntry(const QFileInfo& file, const QString& roo
 		buffer1[11] ^= randByte;
 
 		// Write out encryption header
-		if (device->write(buffer1, ZIP_LOCAL_ENC_HEADER_SIZE) != ZIP_LOCAL_ENC_HEADER_SIZE)
+		if (writeData(buffer1, ZIP_LOCAL_ENC_HEADER_SIZE) != ZIP_LOCAL_ENC_HEADER_SIZE)
 		{
 			delete h;
 			return Zip::WriteFailed;
@@ -808,12 +845,26 @@ Zip::ErrorCode ZipPrivate::createEntry(const QFileInfo& file, const QString& roo
 				if (!password.isEmpty ())
 					encryptBytes(keys, buffer1, read);
 
-				if ( (written = device->write(buffer1, read)) != read )
+				if (writeData(buffer1, read) != read)
 				{
 					actualFile.close();
 					delete h;
 					return Zip::WriteFailed;
 				}
+				written += read;
+			}
+		}
+		else if (toRead >= 2 * ZIP_PARALLEL_BLOCK && QThread::idealThreadCount() > 1)
+		{
+			Zip::ErrorCode ec = deflateParallel(actualFile, level,
+				isPNGFile ? Z_RLE : Z_DEFAULT_STRATEGY, encrypt ? keys : 0, crc, written);
+
+			actualFile.close();
+			if (ec != Zip::Ok)
+			{
+				qDebug() << QString("Error while compressing %1").arg(file.absoluteFilePath());
+				delete h;
+				return ec;
 			}
 		}
 		else
@@ -891,7 +942,7 @@ Zip::ErrorCode ZipPrivate::createEntry(const QFileInfo& file, const QString& roo
 					if (!password.isEmpty ())
 						encryptBytes(keys, buffer2, compressed);
 
-					if (device->write(buffer2, compressed) != compressed)
+					if (writeData(buffer2, compressed) != compressed)
 					{
 						deflateEnd(&zstr);
 						actualFile.close();
@@ -919,32 +970,32 @@ Zip::ErrorCode ZipPrivate::createEntry(const QFileInfo& file, const QString& roo
 		actualFile.close();
 	}
 
-	// Store end of entry offset
-	quint32 current = device->pos();
-
-	// Update crc and compressed size in local header
-	if (!device->seek(crcOffset))
-	{
-		delete h;
-		return Zip::SeekFailed;
-	}
-
 	h->crc = dirOnly ? 0 : crc;
 	h->szComp += written;
 
-	setULong(h->crc, buffer1, 0);
-	setULong(h->szComp, buffer1, 4);
-	if ( device->write(buffer1, 8) != 8)
+	if (!sequential)
 	{
-		delete h;
-		return Zip::WriteFailed;
-	}
+		// Update crc and compressed size in local header
+		if (!device->seek(crcOffset))
+		{
+			delete h;
+			return Zip::SeekFailed;
+		}
 
-	// Seek to end of entry
-	if (!device->seek(current))
-	{
-		delete h;
-		return Zip::SeekFailed;
+		setULong(h->crc, buffer1, 0);
+		setULong(h->szComp, buffer1, 4);
+		if ( device->write(buffer1, 8) != 8)
+		{
+			delete h;
+			return Zip::WriteFailed;
+		}
+
+		// Seek to end of entry
+		if (!device->seek(devOffset))
+		{
+			delete h;
+			return Zip::SeekFailed;
+		}
 	}
 
 	if ((h->gpFlag[0] & 8) == 8)
@@ -966,7 +1017,7 @@ Zip::ErrorCode ZipPrivate::createEntry(const QFileInfo& file, const QString& roo
 		// Uncompressed size
 		setULong(h->szUncomp, buffer1, ZIP_DD_OFF_USIZE);
 
-		if (device->write(buffer1, ZIP_DD_SIZE_WS) != ZIP_DD_SIZE_WS)
+		if (writeData(buffer1, ZIP_DD_SIZE_WS) != ZIP_DD_SIZE_WS)
 		{
 			delete h;
 			return Zip::WriteFailed;
@@ -977,6 +1028,167 @@ Zip::ErrorCode ZipPrivate::createEntry(const QFileInfo& file, const QString& roo
 	return Zip::Ok;
 }
 
+//! \internal Writes to the device, keeping track of our position (which a sequential device can't tell us).
+qint64 ZipPrivate::writeData(const char* data, qint64 len)
+{
+	qint64 n = device->write(data, len);
+
+	if (n > 0)
+		devOffset += n;
+	return n;
+}
+
+//! \internal Returns false if a sample from the start of a file hardly deflates at all.
+bool ZipPrivate::isCompressible(const QFileInfo& file)
+{
+	QFile actualFile(file.absoluteFilePath());
+
+	// let the caller report any error
+	if (!actualFile.open(QIODevice::ReadOnly))
+		return true;
+
+	qint64 read = actualFile.read(buffer1, ZIP_PROBE_SIZE);
+	uLongf len = ZIP_READ_BUFFER;
+
+	actualFile.close();
+	if (read <= 0 || compress2((Bytef*) buffer2, &len, uBuffer, (uLong)read, 1) != Z_OK)
+		return true;
+	return len * 100 < (uLongf)read * ZIP_PROBE_PERCENT;
+}
+
+/*!
+	\internal Deflates one block of a file for deflateParallel().
+*/
+class ZipDeflateJob : public QRunnable
+{
+public:
+	ZipDeflateJob(int level, int strategy, QSemaphore* done)
+		: level(level), strategy(strategy), last(false), crc(0), ok(false), done(done)
+	{
+		setAutoDelete(false);
+	}
+
+	void run();
+
+	int level;
+	int strategy;
+	bool last;              // true for the last block, which ends the stream
+	QByteArray dict;        // end of the previous block, to prime the compressor
+	QByteArray input;
+	QByteArray output;
+	quint32 crc;            // crc of input
+	bool ok;
+
+private:
+	QSemaphore* done;       // released when we finish
+};
+
+void ZipDeflateJob::run()
+{
+	z_stream zstr;
+	int used = 0;
+	int zret;
+
+	zstr.zalloc = Z_NULL;
+	zstr.zfree = Z_NULL;
+	zstr.opaque = Z_NULL;
+
+	crc = crc32(crc32(0L, Z_NULL, 0), (const Bytef*) input.constData(), input.size());
+	if (deflateInit2(&zstr, level, Z_DEFLATED, -MAX_WBITS, 8, strategy) == Z_OK)
+	{
+		if (!dict.isEmpty())
+			deflateSetDictionary(&zstr, (const Bytef*) dict.constData(), dict.size());
+
+		zstr.next_in = (Bytef*) input.data();
+		zstr.avail_in = input.size();
+
+		// A sync flush leaves the output on a byte boundary, so the next
+		// block's output can simply follow it
+		do
+		{
+			output.resize(used + deflateBound(&zstr, input.size()) + 16);
+			zstr.next_out = (Bytef*) output.data() + used;
+			zstr.avail_out = output.size() - used;
+			zret = deflate(&zstr, last ? Z_FINISH : Z_SYNC_FLUSH);
+			used = output.size() - zstr.avail_out;
+		} while (zret == Z_OK && zstr.avail_out == 0);
+
+		output.resize(used);
+		ok = zstr.avail_in == 0 && (last ? zret == Z_STREAM_END
+			: zret == Z_OK || zret == Z_BUF_ERROR);
+		deflateEnd(&zstr);
+	}
+	done->release();
+}
+
+/*!
+	\internal Deflates a large file in blocks on the global thread pool.
+
+	Each block is primed with the end of the one before, so compression is
+	almost as good as for a single stream, and the blocks' output joins up
+	to make one deflate stream. Blocks are handled in batches of one per
+	thread, which keeps memory use bounded.
+*/
+Zip::ErrorCode ZipPrivate::deflateParallel(QFile& file, int level, int strategy,
+	quint32* keys, quint32& crc, qint64& written)
+{
+	QThreadPool* pool = QThreadPool::globalInstance();
+	int batch = qMax(2, pool->maxThreadCount());
+	QList<ZipDeflateJob*> jobs;
+	QSemaphore done;
+	QByteArray dict;
+	qint64 totRead = 0;
+	qint64 toRead = file.size();
+	bool last = false;
+	Zip::ErrorCode ec = Zip::Ok;
+
+	while (!last && ec == Zip::Ok)
+	{
+		for (int i = 0; i < batch && !last; ++i)
+		{
+			ZipDeflateJob* job = new ZipDeflateJob(level, strategy, &done);
+
+			job->input = file.read(ZIP_PARALLEL_BLOCK);
+			if (file.error() != QFile::NoError)
+			{
+				delete job;
+				ec = Zip::ReadFailed;
+				break;
+			}
+			totRead += job->input.size();
+			last = job->input.size() < ZIP_PARALLEL_BLOCK || totRead >= toRead;
+			job->last = last;
+			job->dict = dict;
+			if (!last)
+				dict = job->input.right(ZIP_DICT_SIZE);
+			jobs.append(job);
+			pool->start(job);
+		}
+		done.acquire(jobs.size());
+
+		// write out the results in order
+		foreach (ZipDeflateJob* job, jobs)
+		{
+			if (ec != Zip::Ok)
+				break;
+			if (!job->ok)
+			{
+				ec = Zip::ZlibError;
+				break;
+			}
+			crc = crc32_combine(crc, job->crc, job->input.size());
+			if (keys)
+				encryptBytes(keys, job->output.data(), job->output.size());
+			if (writeData(job->output.constData(), job->output.size()) != job->output.size())
+				ec = Zip::WriteFailed;
+			written += job->output.size();
+		}
+		qDeleteAll(jobs);
+		jobs.clear();
+	}
+	return ec;
+}
+
 //! \internal
 int ZipPrivate::decryptByte(quint32 key2) const
 {
@@ -1039,6 +1251,10 @@ Zip::CompressionLevel ZipPrivate::detectCompressionByMime(const QString& ext)
 	if ((ext == "png") ||
 		(ext == "jpg") ||
 		(ext == "jpeg") ||
+		(ext == "pdf") ||
+		(ext == "max") ||
+		(ext == "tif") ||
+		(ext == "tiff") ||
 		(ext == "mp3") ||
 		(ext == "ogg") ||
 		(ext == "ogm") ||
@@ -1083,7 +1299,7 @@ Zip::ErrorCode ZipPrivate::closeArchive()
 
 	unsigned int sz;
 	quint32 szCentralDir = 0;
-	quint32 offCentralDir = device->pos();
+	quint32 offCentralDir = devOffset;
 
 	for (QMap<QString,ZipEntryP*>::ConstIterator itr = headers->constBegin(); itr != headers->constEnd(); ++itr)
 	{
@@ -1154,7 +1370,7 @@ Zip::ErrorCode ZipPrivate::closeArchive()
 		// relative offset of local header [42->45]
 		setULong(h->lhOffset, buffer1, ZIP_CD_OFF_LHOFF);
 
-		if (device->write(buffer1, ZIP_CD_SIZE) != ZIP_CD_SIZE)
+		if (writeData(buffer1, ZIP_CD_SIZE) != ZIP_CD_SIZE)
 		{
 			//! \todo See if we can detect QFile objects using the Qt Meta Object System
 			/*
@@ -1165,7 +1381,7 @@ Zip::ErrorCode ZipPrivate::closeArchive()
 		}
 
 		// Write out filename
-		if ((unsigned int)device->write(fileNameBytes) != sz)
+		if ((unsigned int)writeData(fileNameBytes.constData(), sz) != sz)
 		{
 			//! \todo SAME AS ABOVE: See if we can detect QFile objects using the Qt Meta Object System
 			/*
@@ -1223,7 +1439,7 @@ Zip::ErrorCode ZipPrivate::closeArchive()
 		buffer1[ZIP_EOCD_OFF_COMMLEN + 1] = (commentLength >> 8) & 0xFF;
 	}
 
-	if (device->write(buffer1, ZIP_EOCD_SIZE) != ZIP_EOCD_SIZE)
+	if (writeData(buffer1, ZIP_EOCD_SIZE) != ZIP_EOCD_SIZE)
 	{
 		//! \todo SAME AS ABOVE: See if we can detect QFile objects using the Qt Meta Object System
 		/*
@@ -1235,7 +1451,7 @@ Zip::ErrorCode ZipPrivate::closeArchive()
 
 	if (commentLength != 0)
 	{
-		if ((unsigned int)device->write(commentBytes) != commentLength)
+		if ((unsigned int)writeData(commentBytes.constData(), commentLength) != commentLength)
 		{
 			//! \todo SAME AS ABOVE: See if we can detect QFile objects using the Qt Meta Object System
 			/*
@@ -1261,7 +1477,10 @@ void ZipPrivate::reset()
 		headers = 0;
 	}
 
-	delete device; device = 0;
+	if (ownsDevice)
+		delete device;
+	device = 0;
+	devOffset = 0;
 }
 
 //! \internal Returns the path of the parent directory
@@ -88,7 +88,7 @@ public:
 	QString password() const;
 
 	ErrorCode createArchive(const QString& file, bool overwrite = true);
-	ErrorCode createArchive(QIODevice* device);
+	ErrorCode createArchive(QIODevice* device, bool takeOwnership = true);
 
 	QString archiveComment() const;
 	void setArchiveComment(const QString& comment);
@@ -60,6 +60,8 @@ public:
 	QMap<QString,ZipEntryP*>* headers;
 
 	QIODevice* device;
+	qint64 devOffset;       // number of bytes written to device
+	bool ownsDevice;        // true to delete device when finished
 
 	char buffer1[ZIP_READ_BUFFER];
 	char buffer2[ZIP_READ_BUFFER];
@@ -71,7 +73,7 @@ public:
 	QString comment;
 	QString password;
 
-	Zip::ErrorCode createArchive(QIODevice* device);
+	Zip::ErrorCode createArchive(QIODevice* device, bool takeOwnership);
 	Zip::ErrorCode closeArchive();
 	void reset();
 
@@ -79,6 +81,11 @@ public:
 
 	Zip::ErrorCode createEntry(const QFileInfo& file, const QString& root, Zip::CompressionLevel level);
 	Zip::CompressionLevel detectCompressionByMime(const QString& ext);
+	bool isCompressible(const QFileInfo& file);
+	Zip::ErrorCode deflateParallel(QFile& file, int level, int strategy,
+		quint32* keys, quint32& crc, qint64& written);
+
+	qint64 writeData(const char* data, qint64 len);
 
 	inline void encryptBytes(quint32* keys, char* buffer, qint64 read);
 